@@ -78,34 +78,47 @@ ymax1 = max(maxRad,max(y1));
 x1=round(((x1/(xmax1-xmin1))*GRID_SCALE)+ceil(GRID_SCALE/2));
 y1=round(((y1/(ymax1-ymin1))*GRID_SCALE)+ceil(GRID_SCALE/2));
 
-fprintf('%60s\n',' ' );
-for iChan=1:length(x1)
-    for iFreq=1:size(sevenDdataIn,6)
-        for iFac=1:size(sevenDdataIn,5)
-            for iSub=1:size(sevenDdataIn,4)
-                for iCell=1:size(sevenDdataIn,3)
-                    if ft_hastoolbox('DISTCOMP') && (EPmain.preferences.advanced.parallel==1)
-                        ep_tictoc;if EPtictoc.stop;sevenDdataOut=[];return;end
-                        fprintf('%s%-60s',repmat(sprintf('\b'),1,60),sprintf('Remapping channel %4d of %4d', iChan, length(x1)))
-                        parfor iPoint=1:size(sevenDdataIn,2)
-                            [Xi,Yi,Zi] = griddata(x,y,sevenDdataIn(:,iPoint,iCell,iSub,iFac,iFreq),[1:GRID_SCALE]',[1:GRID_SCALE],'v4');
-                            %v4 interpolates to the edge of the box.  With other interpolation options, if a bad channel is at the edge of the montage then it
-                            %would just be NaN.
-                            sevenDdataOut(iChan,iPoint,iCell,iSub,iFac,iFreq)=Zi(y1(iChan),x1(iChan));
-                        end
-                    else
-                        for iPoint=1:size(sevenDdataIn,2)
-                            ep_tictoc;if EPtictoc.stop;sevenDdataOut=[];return;end
-                            fprintf('%s%-60s',repmat(sprintf('\b'),1,60),sprintf('Remapping point %d in channel %4d of %4d',iPoint, iChan, length(x1)))
-                            [Xi,Yi,Zi] = griddata(x,y,sevenDdataIn(:,iPoint,iCell,iSub,iFac,iFreq),[1:GRID_SCALE]',[1:GRID_SCALE],'v4');
-                            %v4 interpolates to the edge of the box.  With other interpolation options, if a bad channel is at the edge of the montage then it
-                            %would just be NaN.
-                            sevenDdataOut(iChan,iPoint,iCell,iSub,iFac,iFreq)=Zi(y1(iChan),x1(iChan));
-                        end
-                    end
-                end
-            end
-        end
+%The v4 surface of griddata is linear in the data, so its value at each new electrode is a fixed
+%weighting of the old electrodes.  The weights are made once per pair of montages and applied to
+%every point, cell, subject, factor and frequency in a single matrix product.
+interpOp=ep_interpOperator(x,y,x1,y1);
+ep_tictoc;if EPtictoc.stop;sevenDdataOut=[];return;end
+dataSize=[size(sevenDdataIn) ones(1,7)];
+sevenDdataOut=reshape(interpOp*reshape(double(sevenDdataIn),size(sevenDdataIn,1),[]),[length(x1) dataSize(2:6)]);
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function interpOp=ep_interpOperator(x,y,x1,y1)
+%Weights of the old electrodes (x,y) giving griddata(x,y,v,...,'v4') at the new electrodes (x1,y1).
+%The last few operators are kept, as the same montages come back for every dataset of a study.
+
+persistent cachedKeys cachedOps
+
+key=[x(:);y(:);NaN;x1(:);y1(:)];
+for iCache=1:length(cachedKeys)
+    if isequal(cachedKeys{iCache},key)
+        interpOp=cachedOps{iCache};
+        return
     end
 end
-fprintf('%60s\n',' ' );
+
+%electrodes on the same grid point are averaged, as griddata does
+[xy,~,whichPoint]=unique([x(:) y(:)],'rows');
+mergeOp=full(sparse(whichPoint,1:length(x),1,size(xy,1),length(x)));
+mergeOp=bsxfun(@rdivide,mergeOp,sum(mergeOp,2));
+
+%biharmonic spline of Sandwell (1987), the Green's function being zero at distance zero
+xy=xy(:,1)+1i*xy(:,2);
+d=abs(bsxfun(@minus,xy,xy.'));
+g=(d.^2).*(log(d)-1);
+g(1:size(d,1)+1:end)=0;
+d1=abs(bsxfun(@minus,x1(:)+1i*y1(:),xy.'));
+g1=(d1.^2).*(log(d1)-1);
+g1(d1==0)=0;
+interpOp=(g1/g)*mergeOp;
+
+cachedKeys{end+1}=key;
+cachedOps{end+1}=interpOp;
+if length(cachedKeys) > 10
+    cachedKeys(1)=[];
+    cachedOps(1)=[];
+end
@@ -55,11 +55,18 @@ maxIterations = lineNoiseOut.maximumIterations;
 %% Perform the calculation for each channel separately
 data = double(signal.data);
 chans = sort(lineNoiseOut.lineNoiseChannels);
-parfor ch = chans
-    data(ch, :) = blasst(squeeze(data(ch, :)), lineFrequencies, ...
-                         frequencyRanges, sRate, ...
-                         'MaximumIterations', maxIterations, ...
-                         'Verbose', 0);
+if exist('blasstMex', 'file') == 3
+    % Native engine: all line frequencies of a channel in one pass, the
+    % channels spread over threads
+    data(chans, :) = blasstMex(data(chans, :), lineFrequencies, fRange, ...
+                               sRate, maxIterations);
+else
+    parfor ch = chans
+        data(ch, :) = blasst(squeeze(data(ch, :)), lineFrequencies, ...
+                             frequencyRanges, sRate, ...
+                             'MaxIterations', maxIterations, ...
+                             'Verbose', 0);
+    end
 end
 signal.data = data;
 clear data;
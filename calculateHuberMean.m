@@ -1,14 +1,21 @@
-function X = calculateHuberMean(Y, rho, iters)
+function [X, iterations] = calculateHuberMean(Y, rho, iters, tol)
 % Perform a robust mean under the Huber loss function.
 % x = calculateRobust(Y, rho, iters)
+% [x, iterations] = calculateRobust(Y, rho, iters, tol)
 %
 % Input:
 %   Y : MxN matrix over which to average (columnwise)
 %   rho : augmented Lagrangian variable (default: 1)
-%   iters : number of iterations to perform (default: 1000)
+%   iters : maximum number of iterations to perform (default: 1000)
+%   tol : a column stops once its primal and dual residuals are below
+%         tol*sqrt(M), 0 always runs iters iterations (default: 1e-6)
 %
 % Output:
 %   x : 1xN vector that is the roust mean of Y
+%   iterations : 1xN number of iterations run per column
+%
+% Uses mex/huberMeanMex.cc when it is compiled, which runs the columns in
+% place on all cores.
 %
 % Based on the ADMM Matlab codes also found at:
 %   http://www.stanford.edu/~boyd/papers/distr_opt_stat_learning_admm.html
@@ -22,17 +29,39 @@ end
 if ~exist('iters', 'var') || isempty(iters)
     iters = 1000; 
 end
+if ~exist('tol', 'var') || isempty(tol)
+    tol = 1e-6;
+end
+
+if exist('huberMeanMex', 'file') == 3
+    [X, iterations] = huberMeanMex(Y, rho, iters, tol);
+    return
+end
 
 m = size(Y,1);
+iterations = zeros(1, size(Y,2));
 if m==1
     X = Y;
 else
     mu = sum(Y)/m;
+    X = mu;
     Z = zeros(size(Y)); U = Z;
+    active = true(1, size(Y,2));
     for k = 1:iters
         X = mu + sum(Z - U)/m;
         D = bsxfun(@minus, X, Y - U);
-        Z = (rho/(1+rho) + (1/(1+rho))*max(0,(1-(1+1/rho)./abs(D)))).*D;
-        U = D - Z;
+        Znew = (rho/(1+rho) + (1/(1+rho))*max(0,(1-(1+1/rho)./abs(D)))).*D;
+        Unew = D - Znew;
+        % converged columns keep their X, Z and U
+        iterations(active) = k;
+        if tol > 0
+            active = active & (sum((Unew - U).^2) > tol^2*m | ...
+                               rho^2*sum((Znew - Z).^2) > tol^2*m);
+        end
+        Z(:, active) = Znew(:, active);
+        U(:, active) = Unew(:, active);
+        if ~any(active)
+            break
+        end
     end
 end
\ No newline at end of file
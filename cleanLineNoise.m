@@ -54,9 +54,17 @@ lineNoiseOut.tapers = checkTapers(lineNoiseOut.taperTemplate, Nwin, lineNoiseOut
 %% Perform the calculation for each channel separately
 data = double(signal.data);
 chans = sort(lineNoiseOut.lineNoiseChannels);
-% parfor ch = chans
-for ch = chans
-    data(ch, :) = removeLinesMovingWindow(squeeze(data(ch, :)), lineNoiseOut);
+if exist('lineNoiseMex', 'file') == 3
+    % all channels at once on the native engine (mex/lineNoiseMex.cc)
+    K = size(lineNoiseOut.tapers, 2);
+    sig = finv(1 - lineNoiseOut.p, 2, 2*K - 2);
+    data(chans, :) = lineNoiseMex(data(chans, :), lineNoiseOut.tapers, ...
+                                  lineNoiseOut, sig);
+else
+    % parfor ch = chans
+    for ch = chans
+        data(ch, :) = removeLinesMovingWindow(squeeze(data(ch, :)), lineNoiseOut);
+    end
 end
 signal.data = data;
 clear data;
@@ -64,9 +64,10 @@ for nSubj = 1:numSubj
     intv = false;
     Sac = rmSac(sacData, tw, thr, vthr, dur, intv);
 
-    % Extract feature of microsaccads and epoch
+    % Store the microsaccades as events, the time x trial matrices are
+    % made from them when needed (sacEventMatrix.m, sacQueryMex)
     tw   = [-1000 4000];
-    [RateMatx, AmpMatx, VelMatx, AngMatx] = getSacMTX(Sac,tw);
+    SacEvents = getSacEvents(Sac,tw);
 %%
     save([subjDir subjFileName 'beh.mat'],        "behData")
     save([subjDir subjFileName 'info.mat'],       "subInfo")
@@ -75,10 +76,7 @@ for nSubj = 1:numSubj
     save([subjDir subjFileName 'l_epbcData.mat'], "l_epbcData")
     save([subjDir subjFileName 'r_epbcData.mat'], "r_epbcData")
     save([subjDir subjFileName 'Sac.mat'],        "Sac")
-    save([subjDir subjFileName 'RateMatx.mat'],   "RateMatx")
-    save([subjDir subjFileName 'AmpMatx.mat'],    "AmpMatx")
-    save([subjDir subjFileName 'VelMatx.mat'],    "VelMatx")
-    save([subjDir subjFileName 'AngMatx.mat'],    "AngMatx")
+    save([subjDir subjFileName 'SacEvents.mat'],  "SacEvents")
     save([subjDir subjFileName 'rmFlag.mat'],     "rmFlag")
 end
 
@@ -194,17 +194,23 @@ channelCorrelations = ones(WCorrelation, numberChannels);
 noiseLevels = zeros(WCorrelation, numberChannels);
 channelDeviations = zeros(WCorrelation, numberChannels);
 n = length(correlationWindow);
-xWin = reshape(X(1:n*WCorrelation, :)', numberChannels, n, WCorrelation);
-dataWin = reshape(data(1:n*WCorrelation, :)', numberChannels, n, WCorrelation);
-parfor k = 1:WCorrelation 
-    eegPortion = squeeze(xWin(:, :, k))';
-    dataPortion = squeeze(dataWin(:, :, k))';
-    windowCorrelation = corrcoef(eegPortion);
-    abs_corr = abs(windowCorrelation - diag(diag(windowCorrelation)));
-    channelCorrelations(k, :)  = quantile(abs_corr, 0.98);
-    noiseLevels(k, :) = mad(dataPortion - eegPortion, 1)./mad(eegPortion, 1);
-    channelDeviations(k, :) =  0.7413 *iqr(dataPortion);
-end;
+if exist('noisyChannelsMex', 'file') == 3
+    % Native engine: each window standardised once, windows spread over threads
+    [channelCorrelations, noiseLevels, channelDeviations] = ...
+        noisyChannelsMex('correlation', X, data, n, WCorrelation);
+else
+    xWin = reshape(X(1:n*WCorrelation, :)', numberChannels, n, WCorrelation);
+    dataWin = reshape(data(1:n*WCorrelation, :)', numberChannels, n, WCorrelation);
+    parfor k = 1:WCorrelation 
+        eegPortion = squeeze(xWin(:, :, k))';
+        dataPortion = squeeze(dataWin(:, :, k))';
+        windowCorrelation = corrcoef(eegPortion);
+        abs_corr = abs(windowCorrelation - diag(diag(windowCorrelation)));
+        channelCorrelations(k, :)  = quantile(abs_corr, 0.98);
+        noiseLevels(k, :) = mad(dataPortion - eegPortion, 1)./mad(eegPortion, 1);
+        channelDeviations(k, :) =  0.7413 *iqr(dataPortion);
+    end;
+end
 dropOuts = isnan(channelCorrelations) | isnan(noiseLevels);
 channelCorrelations(dropOuts) = 0.0;
 noiseLevels(dropOuts) = 0.0;
@@ -290,12 +296,17 @@ if noisyOut.ransacPerformed
     n = length(ransacWindow);
     m = length(ransacChannels);
     p = noisyOut.ransacSampleSize;
-    Xwin = reshape(X(1:n*WRansac, :)', m, n, WRansac);
-    parfor k = 1:WRansac
-        ransacCorrelationsT(:, k) = ...
-            calculateRansacWindow(squeeze(Xwin(:, :, k))', P, n, m, p);
+    if exist('noisyChannelsMex', 'file') == 3
+        % Native engine: the subsets of P compacted once, windows spread over threads
+        ransacCorrelationsT = noisyChannelsMex('ransac', X, P, n, WRansac, p);
+    else
+        Xwin = reshape(X(1:n*WRansac, :)', m, n, WRansac);
+        parfor k = 1:WRansac
+            ransacCorrelationsT(:, k) = ...
+                calculateRansacWindow(squeeze(Xwin(:, :, k))', P, n, m, p);
+        end
+        clear Xwin;
     end
-    clear Xwin;
     noisyOut.ransacCorrelations(ransacChannels, :) = ransacCorrelationsT;
     flagged = noisyOut.ransacCorrelations < noisyOut.ransacCorrelationThreshold;
     badChannelsFromRansac = find(sum(flagged, 2)*ransacFrames > ransacUnbrokenFrames)';
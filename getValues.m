@@ -4,17 +4,27 @@ precDir = dir([projectDir '\derivatives\prec\sub*']);
 numSubj = length(precDir);
 op_sub = cell(numSubj, 1); % Preallocate cell array for efficiency
 
+% project cache of buildProjectCache.m, [] if there is none for dv
+cache = openProjectCache(projectDir,dv);
+
 for nSubj = 1:numSubj
     subIdx = sprintf('\\sub-%02d',nSubj);
     subjDir = [precDir(nSubj).folder subIdx '\\'];
 
-    subFile = dir([subjDir '\*info.mat']);
-    load([subFile.folder '\\' subFile.name])
+    if ~isempty(cache)
+        if cache.meta.subjects(nSubj).olFlag
+            continue
+        end
+        op = getValues_sj(subjDir,dv,tw,iv,ivVal,cache,nSubj);
+    else
+        subFile = dir([subjDir '\*info.mat']);
+        load([subFile.folder '\\' subFile.name])
 
-    if subInfo.olFlag
-        continue
+        if subInfo.olFlag
+            continue
+        end
+        op = getValues_sj(subjDir,dv,tw,iv,ivVal);
     end
-    op = getValues_sj(subjDir,dv,tw,iv,ivVal);
 
     % if isnan(mean(op.(dv),'all'))
     %     continue
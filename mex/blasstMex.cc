@@ -0,0 +1,537 @@
+/*==========================================================
+ * blasstMex.cc - [DATA]=blasstMex(DATA, LINEFREQUENCIES, FREQUENCYRANGES, SRATE, MAXITERATIONS, NTHREADS);
+ %function [DATA]=blasstMex(DATA, LINEFREQUENCIES, FREQUENCYRANGES, SRATE, MAXITERATIONS, NTHREADS);
+ %BLASST line noise removal of blasst/blasst.m (blasst_internal.m passes
+ %accepted by the blasst_test.m convergence test), for every row of DATA, with
+ %the channels spread over a pool of threads.
+ %This is a MEX-file for MATLAB.
+ % compiled on OS X: mex CXXFLAGS='$CXXFLAGS -std=c++11 -O3' blasstMex.cc
+ % compiled on Windows: mex COMPFLAGS='$COMPFLAGS /O2' blasstMex.cc
+ % compiled on Linux: mex CXXFLAGS='$CXXFLAGS -std=c++11 -O3 -pthread' LDFLAGS='$LDFLAGS -pthread' blasstMex.cc
+ %
+ %A thread takes a channel and runs all line frequencies on it before taking
+ %the next one.  The Gabor atoms of a line frequency and their spectra are
+ %made once per call and shared by the threads.  The convolutions of the power
+ %modulator and of the test are overlap save FFT convolutions over blocks, so
+ %only their summaries are kept: the prefix sums of the modulator at the ends
+ %of the windows of the atoms, and the histograms of the test.  The projections
+ %on the atoms are sums over the window of the padded channel around each
+ %centre, which is read in place instead of being copied into the windows x
+ %atoms matrix X.  The memory of a channel is a few copies of it, instead of
+ %the X and realWavelets matrices of blasst_internal.m.
+ %
+ %Inputs
+ %  DATA            : Channels x samples, real double.
+ %  LINEFREQUENCIES : Line frequencies, removed one after the other.
+ %  FREQUENCYRANGES : Range around each line frequency, a scalar for all.
+ %  SRATE           : Sampling rate.  The scale is 2^(log2(SRATE)+2) as in
+ %                    blasst.m, rounded to whole samples, the resolution 2.
+ %  MAXITERATIONS   : Maximal passes per line frequency, a scalar for all.
+ %  NTHREADS        : Number of threads, 0 for one per core.  Optional.
+ %
+ %Outputs
+ %  DATA            : Cleaned channels, same size.  Channels that are too
+ %                    short for the atoms of blasst_internal.m, or are zero,
+ %                    are returned as they are.
+ %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#include "mex.h"
+#include <vector>
+#include <deque>
+#include <complex>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+typedef std::complex<double> cplx;
+
+static const double PI = 3.14159265358979323846;
+static const double RESOLUTION = 2;
+
+/* the atoms of one line frequency: the target frequencies fs and the test frequencies tfs */
+struct Bank {
+    size_t maxIter;
+    size_t nfs, ntfs;
+    std::vector<double> W;          // nfs x ntfs modulator and test weights, rows sum to 1
+    std::vector<double> wMean;      // mean of the rows of W
+    std::vector<double> re, im;     // nfs x n target atoms
+    std::vector<cplx> spectra;      // (nfs + ntfs) x M atom spectra, targets first
+};
+
+struct Plan {
+    double scale, timeJump, scalingFactor, offset;
+    size_t n2, n, M, L;
+    std::vector<cplx> twiddle;
+    std::vector<Bank> banks;
+};
+
+/* per thread buffers */
+struct Work {
+    std::vector<cplx> u, v;         // M
+    std::vector<double> acc;        // nfs x L
+    std::vector<double> lg;         // L
+    std::vector<double> x, xTemp, xp;
+};
+
+/* in place radix 2 FFT */
+static void fft(std::vector<cplx>& a, const std::vector<cplx>& twiddle)
+{
+    size_t N = a.size();
+    for (size_t i = 1, j = 0; i < N; i++) {
+        size_t bit = N >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+            std::swap(a[i], a[j]);
+    }
+    for (size_t len = 2; len <= N; len <<= 1) {
+        size_t step = N/len;
+        for (size_t i = 0; i < N; i += len)
+            for (size_t k = 0; k < len/2; k++) {
+                cplx u = a[i + k], v = a[i + k + len/2]*twiddle[k*step];
+                a[i + k] = u + v;
+                a[i + k + len/2] = u - v;
+            }
+    }
+}
+
+/* complexGabor of blasst_internal.m at time t */
+static cplx gabor(double f, double scale, double t)
+{
+    return std::pow(2.0, 0.25)/std::sqrt(scale)*std::exp(-PI/(scale*scale)*t*t)*std::polar(1.0, 2*PI*f*t);
+}
+
+/* sR*(0:(1/(2*scale)):.5) within [lo, hi], the colon computed from both ends like MATLAB */
+static std::vector<double> gridBetween(double sR, double scale, double lo, double hi)
+{
+    double d = 1/(2*scale);
+    size_t count = (size_t)std::floor(0.5/d + 1e-10);
+    std::vector<double> f;
+    for (size_t k = 0; k <= count; k++) {
+        double v = sR*(2*k <= count ? k*d : 0.5 - (count - k)*d);
+        if (v >= lo && v <= hi)
+            f.push_back(v);
+    }
+    return f;
+}
+
+/* eps(x) of MATLAB */
+static double epsOf(double x)
+{
+    x = std::fabs(x);
+    return std::nextafter(x, std::numeric_limits<double>::infinity()) - x;
+}
+
+/* out[j] = sum_t g(t) x[j - t] (the centred convolution of multiConvolveFFT) for j in [begin, end)
+   and the atoms in rows [from, to) of the spectra, x being zero outside [0, len).  Calls
+   use(row, j0, count, r) with |r[q]| = |out[j0 + q]| for q < count. */
+template <typename F>
+static void convolve(const Plan& p, const Bank& b, const double* x, size_t len, size_t begin, size_t end,
+                     size_t from, size_t to, Work& w, F use)
+{
+    const long n2 = (long)p.n2;
+    for (size_t j0 = begin; j0 < end; j0 += p.L) {
+        size_t count = std::min(p.L, end - j0);
+        for (size_t i = 0; i < p.M; i++) {
+            long s = (long)j0 - n2 + (long)i;
+            w.u[i] = s >= 0 && s < (long)len ? x[s] : 0;
+        }
+        fft(w.u, p.twiddle);
+        for (size_t row = from; row < to; row++) {
+            // the conjugate of the inverse transform, the magnitudes are all that is used
+            const cplx* h = &b.spectra[row*p.M];
+            for (size_t i = 0; i < p.M; i++)
+                w.v[i] = std::conj(w.u[i]*h[i]);
+            fft(w.v, p.twiddle);
+            use(row, j0, count, &w.v[p.n - 1]);
+        }
+    }
+}
+
+/* the atom centres and weights of blasst_internal.m, 1 based in x, false if x is too short */
+static bool atomCenters(const Plan& p, size_t N, double offset, std::vector<long>& centers, std::vector<double>& weights)
+{
+    const double step = p.timeJump, first = 1 + offset, n2 = (double)p.n2;
+    std::deque<double> left, mid, right;
+    if (N >= first) {
+        size_t count = (size_t)std::floor((N - first)/step + 1e-10) + 1;
+        for (size_t k = 0; k < count; k++)
+            mid.push_back(first + k*step);
+    }
+    if (mid.empty())
+        return false;
+    left.push_back(mid.front());
+    mid.pop_front();
+    while (std::round(left.front()) > -n2 + 1)
+        left.push_front(left.front() - step);
+    while (std::round(left.back()) < n2) {
+        left.push_back(left.back() + step);
+        if (!mid.empty())
+            mid.pop_front();
+    }
+    if (mid.empty())
+        return false;
+    right.push_back(mid.back());
+    mid.pop_back();
+    while (std::round(right.back()) < N + n2)
+        right.push_back(right.back() + step);
+    while (std::round(right.front()) > N - n2) {
+        right.push_front(right.front() - step);
+        if (!mid.empty())
+            mid.pop_back();
+    }
+
+    std::vector<double> all(left.begin(), left.end());
+    all.insert(all.end(), mid.begin(), mid.end());
+    all.insert(all.end(), right.begin(), right.end());
+    centers.clear();
+    weights.clear();
+    const double s = p.scale, rootPi = std::sqrt(PI);
+    for (size_t j = 1; j + 1 < all.size(); j++) {
+        double c = std::round(all[j]);
+        centers.push_back((long)c);
+        weights.push_back(s/2*(std::erf(rootPi*(N - c)/s) - std::erf(rootPi*(1 - c)/s))/s);
+    }
+    return !centers.empty();
+}
+
+/* one pass of blasst_internal.m, the cleaned channel in xOut, false if nothing was done */
+static bool blasstInternal(const Plan& p, const Bank& b, const std::vector<double>& x, double offset,
+                           Work& w, std::vector<double>& xOut)
+{
+    const size_t N = x.size(), n = p.n, pad = 2*n, Np = N + 2*pad;
+    std::vector<long> centers;
+    std::vector<double> weights;
+    if (!atomCenters(p, N, offset, centers, weights))
+        return false;
+    const size_t nc = centers.size(), nfs = b.nfs, ntfs = b.ntfs;
+
+    std::vector<double>& xp = w.xp;
+    xp.assign(Np, 0);
+    std::copy(x.begin(), x.end(), xp.begin() + pad);
+
+    // mean of the modulator over round((-scale/(2*rez)):(scale/(2*rez))) around each centre
+    const double half = p.scale/(2*RESOLUTION);
+    const long lo = (long)std::round(-half);
+    const long hi = (long)std::round(-half + std::floor(2*half + 1e-10));
+    std::vector<size_t> start(nc), marks;
+    for (size_t j = 0; j < nc; j++) {
+        start[j] = (size_t)(centers[j] + (long)pad - 1 + lo);
+        marks.push_back(start[j]);
+        marks.push_back(start[j] + (size_t)(hi - lo + 1));
+    }
+    std::sort(marks.begin(), marks.end());
+    marks.erase(std::unique(marks.begin(), marks.end()), marks.end());
+    std::vector<double> prefix(marks.size()*nfs, 0);
+    {
+        // modulator = sqrt(exp(W*log(abs(C).^2))), C of the test atoms on the padded channel
+        std::vector<double> cum(nfs, 0);
+        size_t next = 0;
+        double* acc = w.acc.data();
+        const size_t L = p.L;
+        std::fill(w.acc.begin(), w.acc.end(), 0);
+        convolve(p, b, xp.data(), Np, marks.front(), marks.back(), nfs, nfs + ntfs, w,
+                 [&](size_t row, size_t j0, size_t count, const cplx* r) {
+            const double* wr = &b.W[row - nfs];
+            double* lg = w.lg.data();
+            for (size_t q = 0; q < count; q++)
+                lg[q] = std::log(std::norm(r[q])/((double)p.M*p.M));
+            for (size_t k = 0; k < nfs; k++) {
+                double wk = wr[k*ntfs];
+                for (size_t q = 0; q < count; q++)
+                    acc[k*L + q] += wk*lg[q];
+            }
+            if (row + 1 < nfs + ntfs)
+                return;
+            for (size_t q = 0; q < count; q++) {
+                for (; next < marks.size() && marks[next] == j0 + q; next++)
+                    std::copy(cum.begin(), cum.end(), prefix.begin() + next*nfs);
+                for (size_t k = 0; k < nfs; k++) {
+                    cum[k] += std::exp(0.5*acc[k*L + q]);
+                    acc[k*L + q] = 0;
+                }
+            }
+        });
+        for (; next < marks.size(); next++)
+            std::copy(cum.begin(), cum.end(), prefix.begin() + next*nfs);
+    }
+
+    // projections of each window on the target atoms, the best atom per window
+    std::vector<double> amps(nc), cr(nc), ci(nc);
+    std::vector<size_t> which(nc);
+    const double count = (double)(hi - lo + 1);
+    for (size_t j = 0; j < nc; j++) {
+        const double* xw = &xp[centers[j] + pad - 1 - p.n2];
+        size_t m0 = std::lower_bound(marks.begin(), marks.end(), start[j]) - marks.begin();
+        size_t m1 = std::lower_bound(marks.begin(), marks.end(), start[j] + (size_t)count) - marks.begin();
+        amps[j] = 0;
+        which[j] = 0;
+        cr[j] = ci[j] = 0;
+        bool first = true;
+        for (size_t k = 0; k < nfs; k++) {
+            const double* gr = &b.re[k*n];
+            const double* gi = &b.im[k*n];
+            double sr = 0, si = 0;
+            for (size_t i = 0; i < n; i++) {
+                sr += xw[i]*gr[i];
+                si += xw[i]*gi[i];
+            }
+            double pM = (prefix[m1*nfs + k] - prefix[m0*nfs + k])/count;
+            double a = std::sqrt(sr*sr + si*si) - pM;
+            a = a > 0 ? a : 0;
+            if (first || a > amps[j]) {
+                amps[j] = a;
+                which[j] = k;
+                cr[j] = sr;
+                ci[j] = si;
+                first = false;
+            }
+        }
+    }
+
+    // subtract real(exp(-1i*angle(P))*atom), scaled by the amplitude
+    for (size_t j = 0; j < nc; j++) {
+        double mag = std::sqrt(cr[j]*cr[j] + ci[j]*ci[j]);
+        if (amps[j] == 0 || mag == 0)
+            continue;
+        double scale = p.scalingFactor*amps[j]/weights[j]*std::sqrt(2.0)/mag;
+        double a = scale*cr[j], c = scale*ci[j];
+        const double* gr = &b.re[which[j]*n];
+        const double* gi = &b.im[which[j]*n];
+        double* xw = &xp[centers[j] + pad - 1 - p.n2];
+        for (size_t i = 0; i < n; i++)
+            xw[i] -= a*gr[i] + c*gi[i];
+    }
+    xOut.assign(xp.begin() + pad, xp.begin() + pad + N);
+    return true;
+}
+
+/* the bins of hist for the interior edges, (] intervals like MATLAB */
+static size_t histBin(const std::vector<double>& edges, double v)
+{
+    return std::upper_bound(edges.begin(), edges.end(), v) - edges.begin();
+}
+
+/* blasst_test.m: Bhattacharyya distance between the target and test histograms, false if undefined */
+static bool blasstTest(const Plan& p, const Bank& b, const std::vector<double>& x, Work& w, double& dist, bool& maxFlag)
+{
+    const size_t N = x.size(), nfs = b.nfs, ntfs = b.ntfs;
+    const double scale2 = (double)p.M*p.M;
+    const size_t bins = (size_t)std::ceil(2*std::pow((double)N, 1.0/3));
+
+    // range of log(abs(D).^2) over all test atoms
+    double lo = std::numeric_limits<double>::infinity(), hi = -lo;
+    convolve(p, b, x.data(), N, 0, N, nfs, nfs + ntfs, w,
+             [&](size_t, size_t, size_t count, const cplx* r) {
+        for (size_t q = 0; q < count; q++) {
+            double v = std::log(std::norm(r[q])/scale2);
+            lo = std::min(lo, v);
+            hi = std::max(hi, v);
+        }
+    });
+    if (!std::isfinite(lo) || !std::isfinite(hi))
+        return false;
+    if (lo == hi) {
+        lo = lo - std::floor(bins/2.0) - 0.5;
+        hi = hi + std::ceil(bins/2.0) - 0.5;
+    }
+
+    // hist(log(abs(D).^2)', bins), then hist(log(abs(C).^2)', centers)
+    double width = (hi - lo)/bins;
+    std::vector<double> xx(bins + 1), centers(bins), dEdges, cEdges;
+    for (size_t i = 0; i <= bins; i++)
+        xx[i] = lo + width*i;
+    xx[bins] = hi;
+    for (size_t i = 0; i < bins; i++)
+        centers[i] = xx[i] + width/2;
+    for (size_t i = 1; i < bins; i++) {
+        dEdges.push_back(xx[i] + epsOf(xx[i]));
+        double mid = centers[i-1] + (centers[i] - centers[i-1])/2;
+        cEdges.push_back(mid + epsOf(mid));
+    }
+    std::vector<double> dHist(bins, 0), cHist(bins, 0);
+    convolve(p, b, x.data(), N, 0, N, 0, nfs + ntfs, w,
+             [&](size_t row, size_t, size_t count, const cplx* r) {
+        bool target = row < nfs;
+        const std::vector<double>& edges = target ? cEdges : dEdges;
+        double weight = target ? 1.0/nfs : b.wMean[row - nfs];
+        std::vector<double>& hist = target ? cHist : dHist;
+        for (size_t q = 0; q < count; q++) {
+            double v = std::log(std::norm(r[q])/scale2);
+            if (!std::isnan(v))
+                hist[histBin(edges, v)] += weight;
+        }
+    });
+
+    double sum = 0;
+    size_t best = 0;
+    for (size_t i = 0; i < bins; i++) {
+        sum += std::sqrt(dHist[i]/N*cHist[i]/N);
+        if (cHist[i] > cHist[best])
+            best = i;
+    }
+    maxFlag = best == bins - 1;
+    dist = -std::log(sum + 1e-8);
+    return true;
+}
+
+/* blasst.m for one channel and all line frequencies */
+static void cleanChannel(const Plan& p, Work& w)
+{
+    for (size_t f = 0; f < p.banks.size(); f++) {
+        const Bank& b = p.banks[f];
+        if (b.nfs == 0 || b.ntfs == 0)
+            continue;
+        double dist, dist1;
+        bool maxFlag;
+        if (!blasstTest(p, b, w.x, w, dist, maxFlag))
+            continue;
+        for (size_t m = 0; m < b.maxIter; m++) {
+            if (!blasstInternal(p, b, w.x, m*p.offset, w, w.xTemp))
+                break;
+            if (!blasstTest(p, b, w.xTemp, w, dist1, maxFlag))
+                break;
+            if (dist1 >= dist && !maxFlag)
+                break;
+            dist = dist1;
+            w.x.swap(w.xTemp);
+        }
+    }
+}
+
+static Bank makeBank(const Plan& p, double sR, double f, double r, size_t maxIter)
+{
+    Bank b;
+    b.maxIter = maxIter;
+    std::vector<double> fs = gridBetween(sR, p.scale, f - r, f + r);
+    std::vector<double> tfs = gridBetween(sR, p.scale, f - 3*r, f - 2*r);
+    std::vector<double> tfsr = gridBetween(sR, p.scale, f + 2*r, f + 3*r);
+    tfs.insert(tfs.end(), tfsr.begin(), tfsr.end());
+    b.nfs = fs.size();
+    b.ntfs = tfs.size();
+
+    b.W.assign(b.nfs*b.ntfs, 0);
+    b.wMean.assign(b.ntfs, 0);
+    for (size_t k = 0; k < b.nfs; k++) {
+        double sum = 0;
+        for (size_t m = 0; m < b.ntfs; m++)
+            sum += b.W[k*b.ntfs + m] = std::fabs(1/(fs[k] - tfs[m]));
+        for (size_t m = 0; m < b.ntfs; m++) {
+            b.W[k*b.ntfs + m] /= sum;
+            b.wMean[m] += b.W[k*b.ntfs + m]/b.nfs;
+        }
+    }
+
+    const size_t n = p.n;
+    b.re.resize(b.nfs*n);
+    b.im.resize(b.nfs*n);
+    b.spectra.resize((b.nfs + b.ntfs)*p.M);
+    std::vector<cplx> a(p.M);
+    for (size_t row = 0; row < b.nfs + b.ntfs; row++) {
+        double fr = (row < b.nfs ? fs[row] : tfs[row - b.nfs])/sR;
+        std::fill(a.begin(), a.end(), 0);
+        for (size_t i = 0; i < n; i++) {
+            a[i] = gabor(fr, p.scale, (double)i - (double)p.n2);
+            if (row < b.nfs) {
+                b.re[row*n + i] = a[i].real();
+                b.im[row*n + i] = a[i].imag();
+            }
+        }
+        fft(a, p.twiddle);
+        std::copy(a.begin(), a.end(), b.spectra.begin() + row*p.M);
+    }
+    return b;
+}
+
+/* The gateway function */
+void mexFunction( int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[])
+{
+    /* check for proper number of arguments */
+    if(nrhs < 5 || nrhs > 6) {
+        mexErrMsgIdAndTxt("MyToolbox:blasstMex:nrhs","Five or six inputs required.");
+    }
+    if(nlhs > 1) {
+        mexErrMsgIdAndTxt("MyToolbox:blasstMex:nlhs","One output required.");
+    }
+    for (int i = 0; i < nrhs; i++) {
+        if( !mxIsDouble(prhs[i]) || mxIsComplex(prhs[i])) {
+            mexErrMsgIdAndTxt("MyToolbox:blasstMex:notDouble","All inputs must be real doubles.");
+        }
+    }
+
+    size_t nChan = mxGetM(prhs[0]);
+    size_t N = mxGetN(prhs[0]);
+    size_t nLines = mxGetNumberOfElements(prhs[1]);
+    const double* lines = mxGetPr(prhs[1]);
+    const double* ranges = mxGetPr(prhs[2]);
+    const double* iters = mxGetPr(prhs[4]);
+    size_t nRanges = mxGetNumberOfElements(prhs[2]), nIters = mxGetNumberOfElements(prhs[4]);
+    if ((nRanges != 1 && nRanges != nLines) || (nIters != 1 && nIters != nLines)) {
+        mexErrMsgIdAndTxt("MyToolbox:blasstMex:size","FREQUENCYRANGES and MAXITERATIONS must be scalars or have an element per line frequency.");
+    }
+    double sR = mxGetScalar(prhs[3]);
+    if (!(sR > 0)) {
+        mexErrMsgIdAndTxt("MyToolbox:blasstMex:srate","SRATE must be positive.");
+    }
+
+    Plan p;
+    p.scale = std::round(std::pow(2.0, std::log2(sR) + 2));
+    p.n2 = (size_t)(2*p.scale);
+    p.n = 2*p.n2 + 1;
+    p.timeJump = p.scale/RESOLUTION/std::sqrt(PI);
+    p.offset = std::log2(p.scale) + 1;
+    double sum = 0;
+    for (double t = -RESOLUTION*10; t <= RESOLUTION*10; t++)
+        sum += std::exp(-t*t/(RESOLUTION*RESOLUTION));
+    p.scalingFactor = 1/sum;
+    // blocks of about 3n outputs per transform
+    p.M = 1;
+    while (p.M < 4*p.n)
+        p.M <<= 1;
+    p.L = p.M - p.n + 1;
+    p.twiddle.resize(p.M/2);
+    for (size_t k = 0; k < p.M/2; k++)
+        p.twiddle[k] = std::polar(1.0, -2*PI*k/p.M);
+    for (size_t f = 0; f < nLines; f++) {
+        double r = ranges[nRanges == 1 ? 0 : f];
+        double maxIter = iters[nIters == 1 ? 0 : f];
+        p.banks.push_back(makeBank(p, sR, lines[f], r, maxIter > 0 ? (size_t)maxIter : 0));
+    }
+
+    size_t nThreads = nrhs > 5 ? (size_t)mxGetScalar(prhs[5]) : 0;
+    if (nThreads == 0)
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+    nThreads = std::min(nThreads, std::max((size_t)1, nChan));
+
+    plhs[0] = mxDuplicateArray(prhs[0]);
+    double* data = mxGetPr(plhs[0]);
+    size_t maxFs = 0;
+    for (size_t f = 0; f < nLines; f++)
+        maxFs = std::max(maxFs, p.banks[f].nfs);
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        Work w;
+        w.u.resize(p.M);
+        w.v.resize(p.M);
+        w.acc.resize(maxFs*p.L);
+        w.lg.resize(p.L);
+        for (size_t ch = next++; ch < nChan; ch = next++) {
+            w.x.resize(N);
+            for (size_t i = 0; i < N; i++)
+                w.x[i] = data[ch + i*nChan];
+            cleanChannel(p, w);
+            for (size_t i = 0; i < N; i++)
+                data[ch + i*nChan] = w.x[i];
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < nThreads; i++)
+        workers.push_back(std::thread(work));
+    work();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
@@ -0,0 +1,410 @@
+/*==========================================================
+ * detectSacMex.cc - [SAC, RMFLAG]=detectSacMex(D, OFFSETS, EVT, VFAC, MINDUR, FS, NTHREADS);
+ %function [SAC, RMFLAG]=detectSacMex(D, OFFSETS, EVT, VFAC, MINDUR, FS, NTHREADS);
+ %Engbert & Kliegl microsaccade detection for all trials of a subject in one call.
+ %Does the work of detectSac.m (getMsac, microsacc.m and binsacc.m) trial by trial,
+ %with the trials spread over a pool of threads.
+ %This is a MEX-file for MATLAB.
+ % compiled on OS X: mex CXXFLAGS='$CXXFLAGS -std=c++11' detectSacMex.cc
+ % compiled on Windows: mex detectSacMex.cc
+ % compiled on Linux: mex CXXFLAGS='$CXXFLAGS -std=c++11 -pthread' LDFLAGS='$LDFLAGS -pthread' detectSacMex.cc
+ %
+ %Per trial and eye the velocity is the central difference of the position
+ %(0 at the first and last sample).  The robust velocity SD is
+ %sqrt(median(v.^2)-median(v)^2) with NaNs omitted, found by selection rather
+ %than sorting, with the mean based SD as fallback like microsacc.m.  Samples
+ %outside the VFAC ellipse are scanned once for runs of at least MINDUR
+ %samples.  The binocular pairing merges the onset-ordered saccades of both eyes
+ %and walks them in one pass instead of building a 0/1 time series per trial.
+ %
+ %Engbert, R., & Kliegl, R. (2003). Microsaccades uncover the orientation of
+ %covert attention. Vision Research, 43(9), 1035-1045.
+ %
+ %Engbert, R., & Mergenthaler, K. (2006). Microsaccades are triggered by low
+ %retinal image slip. PNAS, 103(18), 7192-7197.
+
+ %Inputs
+ %  D        : Samples of all trials stacked (rows=samples), columns are
+ %             time, left x, left y, right x, right y (the columns 1, 2, 3, 7
+ %             and 8 of the trial data used by detectSac.m).
+ %  OFFSETS  : Row vector of length numTrial+1, trial t is rows
+ %             OFFSETS(t)+1 to OFFSETS(t+1) of D.
+ %  EVT      : Event time per trial.  Saccade onsets and offsets are returned
+ %             relative to the first sample at that time (or one ms later).
+ %  VFAC     : Relative velocity threshold (detectSac.m uses 6).
+ %  MINDUR   : Minimal saccade duration in samples (detectSac.m uses 6).
+ %  FS       : Sampling rate in Hz (detectSac.m uses 1000).
+ %  NTHREADS : Number of threads, 0 for one per core.  Optional.
+
+ %Outputs
+ %  SAC      : numTrial x 1 cell array with the 14 column binocular saccade
+ %             matrix of binsacc.m per trial (columns 1-7 right eye, 8-14
+ %             left eye: onset, offset, peak velocity, dx, dy, dX, dY).
+ %             Empty for trials without binocular saccades.
+ %  RMFLAG   : numTrial x 1 logical, true for trials detectSac.m would drop
+ %             (the detection fails on them) and for trials without a
+ %             sample at the event time.
+ %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#include "mex.h"
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <cfloat>
+#include <limits>
+
+struct Saccade {
+    double v[7];    // onset, offset (1 based samples), vpeak, dx, dy, dX, dY
+};
+
+struct TrialResult {
+    std::vector<double> sac;    // row major, 14 columns
+    bool rmFlag;
+};
+
+/* median of the non-NaN values (NaN if there are none), by selection */
+static double nanMedian(std::vector<double>& values)
+{
+    values.erase(std::remove_if(values.begin(), values.end(), [](double x) { return std::isnan(x); }), values.end());
+    size_t n = values.size();
+    if (n == 0)
+        return std::numeric_limits<double>::quiet_NaN();
+
+    std::nth_element(values.begin(), values.begin() + n/2, values.end());
+    double upper = values[n/2];
+    if (n % 2)
+        return upper;
+    double lower = *std::max_element(values.begin(), values.begin() + n/2);
+    return (lower + upper)/2;
+}
+
+/* microsacc.m's threshold: sqrt(median(v.^2)-median(v)^2), else the mean based SD.
+   Returns false where microsacc.m errors out (both are below realmin). */
+static bool robustSD(const std::vector<double>& vel, std::vector<double>& scratch, double& msd)
+{
+    scratch.assign(vel.begin(), vel.end());
+    double med = nanMedian(scratch);
+    scratch.resize(vel.size());
+    for (size_t i = 0; i < vel.size(); i++)
+        scratch[i] = vel[i]*vel[i];
+    double med2 = nanMedian(scratch);
+
+    // a negative difference has a zero real part in matlab
+    double var = med2 - med*med;
+    msd = var > 0 ? std::sqrt(var) : (std::isnan(var) ? var : 0);
+    if (msd < DBL_MIN) {
+        double sum = 0, sum2 = 0;
+        size_t n = 0;
+        for (size_t i = 0; i < vel.size(); i++) {
+            if (std::isnan(vel[i]))
+                continue;
+            sum += vel[i];
+            sum2 += vel[i]*vel[i];
+            n++;
+        }
+        double mean = sum/n;
+        var = sum2/n - mean*mean;
+        msd = var > 0 ? std::sqrt(var) : (std::isnan(var) ? var : 0);
+        if (msd < DBL_MIN)
+            return false;
+    }
+    return true;
+}
+
+/* position of the first minimum/maximum, ignoring NaNs (the first element if all are NaN) */
+static void nanMinMax(const double* x, size_t n, double& minVal, size_t& minIdx, double& maxVal, size_t& maxIdx)
+{
+    minVal = maxVal = x[0];
+    minIdx = maxIdx = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (std::isnan(x[i]))
+            continue;
+        if (std::isnan(minVal) || x[i] < minVal) {
+            minVal = x[i];
+            minIdx = i;
+        }
+        if (std::isnan(maxVal) || x[i] > maxVal) {
+            maxVal = x[i];
+            maxIdx = i;
+        }
+    }
+}
+
+static double sign(double x)
+{
+    return (x > 0) - (x < 0);
+}
+
+/* getMsac + microsacc.m for one eye.  Returns false where microsacc.m errors out. */
+static bool microsacc(const double* x, const double* y, size_t n, double VFAC, size_t MINDUR, double fs,
+                      std::vector<double>& vx, std::vector<double>& vy, std::vector<double>& scratch,
+                      std::vector<Saccade>& sac)
+{
+    sac.clear();
+    vx.assign(n, 0);
+    vy.assign(n, 0);
+    for (size_t i = 1; i + 1 < n; i++) {
+        vx[i] = (x[i+1] - x[i-1])*fs/2;
+        vy[i] = (y[i+1] - y[i-1])*fs/2;
+    }
+
+    double msdx, msdy;
+    if (!robustSD(vx, scratch, msdx) || !robustSD(vy, scratch, msdy))
+        return false;
+    double radiusx = VFAC*msdx;
+    double radiusy = VFAC*msdy;
+
+    // runs of consecutive samples outside the ellipse
+    size_t nAbove = 0;
+    size_t runStart = 0, runLength = 0;
+    for (size_t i = 0; i <= n; i++) {
+        bool above = false;
+        if (i < n) {
+            double tx = vx[i]/radiusx, ty = vy[i]/radiusy;
+            above = tx*tx + ty*ty > 1;
+        }
+        if (above) {
+            if (runLength == 0)
+                runStart = i;
+            runLength++;
+            nAbove++;
+            continue;
+        }
+        if (runLength >= MINDUR && runLength > 0) {
+            Saccade s;
+            size_t a = runStart, b = runStart + runLength - 1;
+            s.v[0] = a + 1;
+            s.v[1] = b + 1;
+
+            double vpeak = -std::numeric_limits<double>::infinity();
+            bool anyPeak = false;
+            for (size_t k = a; k <= b; k++) {
+                double v = std::sqrt(vx[k]*vx[k] + vy[k]*vy[k]);
+                if (!std::isnan(v) && v > vpeak) {
+                    vpeak = v;
+                    anyPeak = true;
+                }
+            }
+            s.v[2] = anyPeak ? vpeak : std::numeric_limits<double>::quiet_NaN();
+            s.v[3] = x[b] - x[a];
+            s.v[4] = y[b] - y[a];
+
+            double minx, maxx, miny, maxy;
+            size_t ix1, ix2, iy1, iy2;
+            nanMinMax(x + a, b - a + 1, minx, ix1, maxx, ix2);
+            nanMinMax(y + a, b - a + 1, miny, iy1, maxy, iy2);
+            s.v[5] = sign((double)ix2 - (double)ix1)*(maxx - minx);
+            s.v[6] = sign((double)iy2 - (double)iy1)*(maxy - miny);
+            sac.push_back(s);
+        }
+        runLength = 0;
+    }
+
+    // with no sample above threshold microsacc.m indexes an empty list when MINDUR <= 1
+    if (nAbove == 0 && MINDUR <= 1)
+        return false;
+    return true;
+}
+
+static double amplitude(const Saccade& s)
+{
+    return std::sqrt(s.v[5]*s.v[5] + s.v[6]*s.v[6]);
+}
+
+/* binsacc.m: saccades of either eye whose samples (onset+1 to offset) touch or
+   overlap form one cluster.  A cluster with saccades of both eyes gives one
+   binocular saccade, the largest amplitude one of each eye.  Returns false where
+   binsacc.m errors out (several saccades of one eye in a monocular cluster). */
+static bool binsacc(const std::vector<Saccade>& sacl, const std::vector<Saccade>& sacr, std::vector<double>& sac)
+{
+    sac.clear();
+    if (sacl.empty() || sacr.empty())
+        return true;
+
+    // saccades with onset == offset (only found with MINDUR <= 1) cover no samples and are left out
+    struct Span { double from, to; int eye; size_t idx; };
+    std::vector<Span> spans;
+    for (size_t i = 0; i < sacl.size(); i++)
+        if (sacl[i].v[1] > sacl[i].v[0])
+            spans.push_back({sacl[i].v[0] + 1, sacl[i].v[1], 0, i});
+    size_t nl = spans.size();
+    for (size_t i = 0; i < sacr.size(); i++)
+        if (sacr[i].v[1] > sacr[i].v[0])
+            spans.push_back({sacr[i].v[0] + 1, sacr[i].v[1], 1, i});
+    // both lists come out of microsacc in onset order
+    std::inplace_merge(spans.begin(), spans.begin() + nl, spans.end(), [](const Span& a, const Span& b) { return a.from < b.from; });
+
+    size_t i = 0;
+    while (i < spans.size()) {
+        // samples from..to are set, spans that start right after the end join the cluster
+        double to = spans[i].to;
+        size_t j = i + 1;
+        while (j < spans.size() && spans[j].from <= to + 1) {
+            to = std::max(to, spans[j].to);
+            j++;
+        }
+
+        int nLeft = 0, nRight = 0;
+        long bestl = -1, bestr = -1;
+        double ampl = 0, ampr = 0;
+        for (size_t k = i; k < j; k++) {
+            const Saccade& s = spans[k].eye ? sacr[spans[k].idx] : sacl[spans[k].idx];
+            double amp = amplitude(s);
+            // max() ignores NaN and keeps the first of equal values
+            if (spans[k].eye) {
+                nRight++;
+                if (bestr < 0 || (!std::isnan(amp) && (std::isnan(ampr) || amp > ampr))) {
+                    bestr = spans[k].idx;
+                    ampr = amp;
+                }
+            } else {
+                nLeft++;
+                if (bestl < 0 || (!std::isnan(amp) && (std::isnan(ampl) || amp > ampl))) {
+                    bestl = spans[k].idx;
+                    ampl = amp;
+                }
+            }
+        }
+
+        if (nLeft > 0 && nRight > 0) {
+            sac.insert(sac.end(), sacr[bestr].v, sacr[bestr].v + 7);
+            sac.insert(sac.end(), sacl[bestl].v, sacl[bestl].v + 7);
+        } else if (nLeft > 1 || nRight > 1) {
+            return false;
+        }
+        i = j;
+    }
+    return true;
+}
+
+static void detectTrial(const double* D, size_t nRows, size_t from, size_t to, double evt,
+                        double VFAC, size_t MINDUR, double fs, TrialResult& result)
+{
+    result.sac.clear();
+    result.rmFlag = false;
+    size_t n = to - from;
+    if (n == 0)
+        return;
+
+    const double* t = D + from;
+    const double* lx = D + nRows + from;
+    const double* ly = D + 2*nRows + from;
+    const double* rx = D + 3*nRows + from;
+    const double* ry = D + 4*nRows + from;
+
+    std::vector<double> vx, vy, scratch, sac;
+    std::vector<Saccade> sacl, sacr;
+    if (!microsacc(lx, ly, n, VFAC, MINDUR, fs, vx, vy, scratch, sacl) ||
+        !microsacc(rx, ry, n, VFAC, MINDUR, fs, vx, vy, scratch, sacr) ||
+        !binsacc(sacl, sacr, sac)) {
+        result.rmFlag = true;
+        return;
+    }
+    if (sac.empty())
+        return;
+
+    size_t onset = n;
+    for (size_t i = 0; i < n && onset == n; i++)
+        if (t[i] == evt)
+            onset = i;
+    for (size_t i = 0; i < n && onset == n; i++)
+        if (t[i] == evt + 1)
+            onset = i;
+    if (onset == n) {
+        result.rmFlag = true;
+        return;
+    }
+
+    double onsetTP = onset + 1;
+    for (size_t k = 0; k < sac.size(); k += 14) {
+        sac[k] -= onsetTP;
+        sac[k+1] -= onsetTP;
+        sac[k+7] -= onsetTP;
+        sac[k+8] -= onsetTP;
+    }
+    result.sac.swap(sac);
+}
+
+/* The gateway function */
+void mexFunction( int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[])
+{
+    /* check for proper number of arguments */
+    if(nrhs < 6 || nrhs > 7) {
+        mexErrMsgIdAndTxt("MyToolbox:detectSacMex:nrhs","Six or seven inputs required.");
+    }
+    if(nlhs > 2) {
+        mexErrMsgIdAndTxt("MyToolbox:detectSacMex:nlhs","At most two outputs.");
+    }
+    for (int i = 0; i < nrhs; i++) {
+        if( !mxIsDouble(prhs[i]) || mxIsComplex(prhs[i])) {
+            mexErrMsgIdAndTxt("MyToolbox:detectSacMex:notDouble","All inputs must be real doubles.");
+        }
+    }
+    if(mxGetN(prhs[0]) != 5) {
+        mexErrMsgIdAndTxt("MyToolbox:detectSacMex:badD","D must have 5 columns: time, left x, left y, right x, right y.");
+    }
+
+    const double* D = mxGetPr(prhs[0]);
+    size_t nRows = mxGetM(prhs[0]);
+    const double* offsets = mxGetPr(prhs[1]);
+    size_t numTrial = mxGetNumberOfElements(prhs[1]);
+    if (numTrial == 0) {
+        mexErrMsgIdAndTxt("MyToolbox:detectSacMex:badOffsets","OFFSETS must have numTrial+1 elements.");
+    }
+    numTrial--;
+    for (size_t i = 0; i < numTrial; i++) {
+        if (offsets[i] < 0 || offsets[i] > offsets[i+1] || offsets[i+1] > nRows) {
+            mexErrMsgIdAndTxt("MyToolbox:detectSacMex:badOffsets","OFFSETS must be increasing and within the rows of D.");
+        }
+    }
+    if (mxGetNumberOfElements(prhs[2]) != numTrial) {
+        mexErrMsgIdAndTxt("MyToolbox:detectSacMex:badEvt","EVT must have one element per trial.");
+    }
+    const double* evt = mxGetPr(prhs[2]);
+    double VFAC = mxGetScalar(prhs[3]);
+    double MINDUR = mxGetScalar(prhs[4]);
+    double fs = mxGetScalar(prhs[5]);
+    if (MINDUR < 0) {
+        mexErrMsgIdAndTxt("MyToolbox:detectSacMex:badMINDUR","MINDUR must not be negative.");
+    }
+    size_t nThreads = nrhs > 6 ? (size_t)mxGetScalar(prhs[6]) : 0;
+    if (nThreads == 0)
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+    nThreads = std::min(nThreads, std::max((size_t)1, numTrial));
+
+    // trials are handed out one at a time, so long and short trials even out
+    std::vector<TrialResult> results(numTrial);
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        for (size_t t = next++; t < numTrial; t = next++)
+            detectTrial(D, nRows, (size_t)offsets[t], (size_t)offsets[t+1], evt[t], VFAC, (size_t)MINDUR, fs, results[t]);
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < nThreads; i++)
+        workers.push_back(std::thread(work));
+    work();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    plhs[0] = mxCreateCellMatrix(numTrial, 1);
+    if (nlhs > 1)
+        plhs[1] = mxCreateLogicalMatrix(numTrial, 1);
+    for (size_t t = 0; t < numTrial; t++) {
+        if (nlhs > 1)
+            mxGetLogicals(plhs[1])[t] = results[t].rmFlag;
+
+        const std::vector<double>& sac = results[t].sac;
+        size_t nSac = sac.size()/14;
+        if (nSac == 0)
+            continue;
+        mxArray* out = mxCreateDoubleMatrix(nSac, 14, mxREAL);
+        double* o = mxGetPr(out);
+        for (size_t s = 0; s < nSac; s++)
+            for (size_t c = 0; c < 14; c++)
+                o[s + c*nSac] = sac[s*14 + c];
+        mxSetCell(plhs[0], t, out);
+    }
+}
@@ -0,0 +1,521 @@
+/*==========================================================
+ * filtfiltMex.cc - [Y]=filtfiltMex(X, DIM, LANES, SEGMENTS, SOS, B, DEMEAN, NTHREADS);
+ %function [Y]=filtfiltMex(X, DIM, LANES, SEGMENTS, SOS, B, DEMEAN, NTHREADS);
+ %Zero-phase filtering of many channels at once along one dimension of an N-D
+ %array, for ep_filterData.m (the EP data array, filtered along time) and
+ %filtfilt_fast.m (time x channels).
+ %This is a MEX-file for MATLAB.
+ % compiled on OS X: mex CXXFLAGS='$CXXFLAGS -std=c++11 -O3' filtfiltMex.cc
+ % compiled on Windows: mex COMPFLAGS='$COMPFLAGS /O2' filtfiltMex.cc
+ % compiled on Linux: mex CXXFLAGS='$CXXFLAGS -std=c++11 -O3 -pthread' LDFLAGS='$LDFLAGS -pthread' filtfiltMex.cc
+ %
+ %X is seen as pre x len x post around DIM.  A lane is one pre index in one
+ %post slab, i.e. one channel of one trial/subject/factor for EP data, and is
+ %read in place with a stride of pre: the channels of EP data lie next to each
+ %other, so a block of lanes is an interleaved time x channel layout as is.
+ %
+ %IIR (SOS): every stage is a filtfilt of its own, as MATLAB's filtfilt does it:
+ %the ends reflected about the first and last sample (3 x filter order
+ %samples) and every section started from its steady state for that sample.
+ %Blocks of 8 lanes run through all sections sample by sample, with the loop
+ %over the lanes innermost, and are filtered in place in Y: only the reflected
+ %tail and the output of the forward pass over it are kept aside.
+ %
+ %FIR (B): the forward and backward pass of filtfilt_fast.m (ends extrapolated
+ %by length(B) samples) are one centred convolution with conv(B, flip(B)).  It
+ %is done by overlap-save FFT convolution for long filters, two lanes per
+ %complex FFT, and directly for short ones.  Every block of output samples is
+ %independent, so blocks of one lane are spread over the threads as well.
+
+ %Inputs
+ %  X        : Real double or single array.
+ %  DIM      : Dimension to filter along.
+ %  LANES    : Indices into the dimensions before DIM combined (the channels
+ %             for EP data, filtered along time), [] for all.
+ %  SEGMENTS : K x 2 [first last] indices along DIM, each filtered on its own
+ %             (the parts of continuous data between boundary events), [] for
+ %             the whole dimension.
+ %  SOS      : L x 6 second order sections [b0 b1 b2 a0 a1 a2], or a cell
+ %             array of those applied one after the other, or [].
+ %  B        : FIR coefficients, or [].  Either SOS or B.
+ %  DEMEAN   : true to take out the mean of every lane and segment before
+ %             filtering and add it back after (ep_filterData.m does this
+ %             against edge artifacts).
+ %  NTHREADS : Number of threads, 0 for one per core.  Optional.
+
+ %Outputs
+ %  Y        : X with the lanes and segments filtered, of the class of X.
+ %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#include "mex.h"
+#include <vector>
+#include <complex>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <cmath>
+
+typedef std::complex<double> cplx;
+
+static const size_t BLOCK = 8;     // lanes run through the IIR sections together
+static const double PI = 3.14159265358979323846;
+
+struct Section {
+    double b0, b1, b2, a1, a2;     // normalized, a0 = 1
+    double zi1, zi2;               // steady state for a unit input to the cascade
+};
+
+struct Stage {
+    std::vector<Section> sections;
+    long pad;                      // reflected samples at each end
+};
+
+struct Segment {
+    size_t from, n;
+};
+
+/* a run of samples of up to BLOCK lanes, sample k of lane j at y[off[j] + k*stride] */
+template <typename T>
+struct LaneBlock {
+    T* y;
+    size_t off[BLOCK];
+    size_t count;
+    size_t stride;
+};
+
+/* sample k of x[0..n) extended by point reflection about its ends, wrapping like filtfilt_fast.m for short x */
+template <typename F>
+static inline double reflected(F x, long k, long n)
+{
+    if (k < 0)
+        return 2*x(0) - x(((-k) % n + n) % n);
+    if (k >= n)
+        return 2*x(n-1) - x(((n - 2 - (k - n)) % n + n) % n);
+    return x(k);
+}
+
+static Stage makeStage(const double* sos, size_t L)
+{
+    Stage stage;
+    long order = 0;
+    double gain = 1;
+    for (size_t s = 0; s < L; s++) {
+        double a0 = sos[s + 3*L];
+        Section sec;
+        sec.b0 = sos[s]/a0;
+        sec.b1 = sos[s + L]/a0;
+        sec.b2 = sos[s + 2*L]/a0;
+        sec.a1 = sos[s + 4*L]/a0;
+        sec.a2 = sos[s + 5*L]/a0;
+        order += (sec.b2 != 0 || sec.a2 != 0) ? 2 : (sec.b1 != 0 || sec.a1 != 0) ? 1 : 0;
+
+        // direct form II transposed at rest for a constant input gain
+        double den = 1 + sec.a1 + sec.a2;
+        if (den != 0) {
+            double g = (sec.b0 + sec.b1 + sec.b2)/den;
+            sec.zi1 = (g - sec.b0)*gain;
+            sec.zi2 = (sec.b2 - sec.a2*g)*gain;
+            gain *= g;
+        } else {
+            sec.zi1 = sec.zi2 = 0;
+        }
+        stage.sections.push_back(sec);
+    }
+    stage.pad = std::max(1L, 3*order);
+    return stage;
+}
+
+/* one sample of BLOCK lanes through all sections */
+static inline void runSections(const std::vector<Section>& sections, double* v, double (*z1)[BLOCK], double (*z2)[BLOCK])
+{
+    for (size_t s = 0; s < sections.size(); s++) {
+        const Section& c = sections[s];
+        double* p = z1[s];
+        double* q = z2[s];
+        for (size_t j = 0; j < BLOCK; j++) {
+            double x = v[j];
+            double y = c.b0*x + p[j];
+            p[j] = c.b1*x - c.a1*y + q[j];
+            q[j] = c.b2*x - c.a2*y;
+            v[j] = y;
+        }
+    }
+}
+
+static inline void startSections(const std::vector<Section>& sections, const double* v, double (*z1)[BLOCK], double (*z2)[BLOCK])
+{
+    for (size_t s = 0; s < sections.size(); s++)
+        for (size_t j = 0; j < BLOCK; j++) {
+            z1[s][j] = sections[s].zi1*v[j];
+            z2[s][j] = sections[s].zi2*v[j];
+        }
+}
+
+/* filtfilt of one stage over n samples of a lane block, in place */
+template <typename T>
+static void filtfiltBlock(const Stage& stage, LaneBlock<T>& lb, long n, std::vector<double>& tail)
+{
+    const std::vector<Section>& sections = stage.sections;
+    size_t L = sections.size();
+    long pad = stage.pad;
+    std::vector<double> state(2*L*BLOCK);
+    double (*z1)[BLOCK] = (double (*)[BLOCK])&state[0];
+    double (*z2)[BLOCK] = (double (*)[BLOCK])&state[L*BLOCK];
+    double v[BLOCK];
+
+    T* y = lb.y;
+    size_t st = lb.stride;
+    // the reflected tail is read before the forward pass overwrites the samples
+    tail.assign(pad*BLOCK, 0);
+    for (size_t j = 0; j < lb.count; j++) {
+        const T* base = y + lb.off[j];
+        auto x = [&](long k) { return (double)base[k*st]; };
+        for (long k = 0; k < pad; k++)
+            tail[k*BLOCK + j] = reflected(x, n + k, n);
+    }
+
+    // forward: reflected head, the samples, the tail
+    for (long k = -pad; k < n + pad; k++) {
+        for (size_t j = 0; j < BLOCK; j++) {
+            if (j >= lb.count)
+                v[j] = 0;
+            else if (k < 0) {
+                const T* base = y + lb.off[j];
+                v[j] = reflected([&](long i) { return (double)base[i*st]; }, k, n);
+            } else if (k < n)
+                v[j] = y[lb.off[j] + k*st];
+            else
+                v[j] = tail[(k - n)*BLOCK + j];
+        }
+        if (k == -pad)
+            startSections(sections, v, z1, z2);
+        runSections(sections, v, z1, z2);
+        if (k >= n)
+            std::copy(v, v + BLOCK, &tail[(k - n)*BLOCK]);
+        else if (k >= 0)
+            for (size_t j = 0; j < lb.count; j++)
+                y[lb.off[j] + k*st] = (T)v[j];
+    }
+
+    // backward: the tail reversed, then the samples; the head is not needed
+    for (long k = n + pad - 1; k >= 0; k--) {
+        for (size_t j = 0; j < BLOCK; j++)
+            v[j] = j >= lb.count ? 0 : k >= n ? tail[(k - n)*BLOCK + j] : (double)y[lb.off[j] + k*st];
+        if (k == n + pad - 1)
+            startSections(sections, v, z1, z2);
+        runSections(sections, v, z1, z2);
+        if (k < n)
+            for (size_t j = 0; j < lb.count; j++)
+                y[lb.off[j] + k*st] = (T)v[j];
+    }
+}
+
+/* in place radix 2 FFT, inverse unscaled */
+static void fft(std::vector<cplx>& a, const std::vector<cplx>& twiddle, bool inverse)
+{
+    size_t N = a.size();
+    for (size_t i = 1, j = 0; i < N; i++) {
+        size_t bit = N >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+            std::swap(a[i], a[j]);
+    }
+    for (size_t len = 2; len <= N; len <<= 1) {
+        size_t step = N/len;
+        for (size_t i = 0; i < N; i += len)
+            for (size_t k = 0; k < len/2; k++) {
+                cplx w = inverse ? std::conj(twiddle[k*step]) : twiddle[k*step];
+                cplx u = a[i + k], v = a[i + k + len/2]*w;
+                a[i + k] = u + v;
+                a[i + k + len/2] = u - v;
+            }
+    }
+}
+
+struct FirPlan {
+    std::vector<double> c;         // conv(B, flip(B)), symmetric
+    long half;                     // length(B) - 1, c is centred on c[half]
+    size_t N, L;                   // FFT size and output samples per block, 0 for direct
+    std::vector<cplx> twiddle, C;
+};
+
+static FirPlan makeFirPlan(const double* b, size_t w)
+{
+    FirPlan plan;
+    plan.c.assign(2*w - 1, 0);
+    for (size_t i = 0; i < w; i++)
+        for (size_t k = 0; k < w; k++)
+            plan.c[i + (w - 1 - k)] += b[i]*b[k];
+    plan.half = (long)w - 1;
+
+    size_t Lc = plan.c.size();
+    plan.N = plan.L = 0;
+    if (Lc < 64)
+        return plan;
+    plan.N = 4096;
+    while (plan.N < 4*Lc)
+        plan.N <<= 1;
+    plan.L = plan.N - Lc + 1;
+    plan.twiddle.resize(plan.N/2);
+    for (size_t k = 0; k < plan.N/2; k++)
+        plan.twiddle[k] = std::polar(1.0, -2*PI*k/plan.N);
+    plan.C.assign(plan.N, 0);
+    for (size_t i = 0; i < Lc; i++)
+        plan.C[i] = plan.c[i];
+    fft(plan.C, plan.twiddle, false);
+    return plan;
+}
+
+/* output samples [k0, k0+count) of up to two lanes of a segment */
+template <typename T>
+static void firBlock(const FirPlan& plan, const T* const* base, const double* mean, size_t nLanes,
+                     size_t stride, long n, long k0, long count, T* const* out, std::vector<cplx>& buf)
+{
+    auto x = [&](size_t j, long k) {
+        return reflected([&](long i) { return (double)base[j][i*stride] - mean[j]; }, k, n);
+    };
+    long half = plan.half;
+    if (plan.N == 0) {
+        for (size_t j = 0; j < nLanes; j++)
+            for (long k = k0; k < k0 + count; k++) {
+                double acc = 0;
+                for (long m = -half; m <= half; m++)
+                    acc += plan.c[half + m]*x(j, k + m);
+                out[j][k*stride] = (T)(acc + mean[j]);
+            }
+        return;
+    }
+
+    // overlap-save: N inputs from k0 - half give the outputs from k0 once the
+    // first 2*half circular ones are dropped; the second lane rides in the
+    // imaginary part
+    buf.assign(plan.N, 0);
+    long inputs = std::min((long)plan.N, count + 2*half);
+    for (long i = 0; i < inputs; i++)
+        buf[i] = cplx(x(0, k0 - half + i), nLanes > 1 ? x(1, k0 - half + i) : 0);
+    fft(buf, plan.twiddle, false);
+    for (size_t i = 0; i < plan.N; i++)
+        buf[i] *= plan.C[i];
+    fft(buf, plan.twiddle, true);
+    double scale = 1.0/plan.N;
+    for (long t = 0; t < count; t++) {
+        cplx r = buf[t + 2*half]*scale;
+        out[0][(k0 + t)*stride] = (T)(r.real() + mean[0]);
+        if (nLanes > 1)
+            out[1][(k0 + t)*stride] = (T)(r.imag() + mean[1]);
+    }
+}
+
+template <typename T>
+static double laneMean(const T* base, size_t stride, size_t n)
+{
+    double sum = 0;
+    for (size_t k = 0; k < n; k++)
+        sum += base[k*stride];
+    return sum/n;
+}
+
+template <typename T>
+static void run(const T* X, T* Y, size_t pre, size_t len, size_t post, const std::vector<size_t>& lanes,
+                const std::vector<Segment>& segments, const std::vector<Stage>& stages,
+                const double* b, size_t w, bool demean, size_t nThreads)
+{
+    // every lane of every post slab, by start offset
+    std::vector<size_t> offsets;
+    for (size_t s = 0; s < post; s++)
+        for (size_t i = 0; i < lanes.size(); i++)
+            offsets.push_back(lanes[i] + s*pre*len);
+    size_t nLanes = offsets.size();
+    auto pool = [&](size_t nItems, const std::function<void(size_t)>& item) {
+        std::atomic<size_t> next(0);
+        auto work = [&]() {
+            for (size_t i = next++; i < nItems; i = next++)
+                item(i);
+        };
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < std::min(nThreads, nItems); i++)
+            workers.push_back(std::thread(work));
+        work();
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+    };
+
+    if (w == 0) {
+        size_t nBlocks = (nLanes + BLOCK - 1)/BLOCK;
+        pool(nBlocks*segments.size(), [&](size_t item) {
+            const Segment& seg = segments[item % segments.size()];
+            size_t first = (item/segments.size())*BLOCK;
+            LaneBlock<T> lb;
+            lb.y = Y;
+            lb.count = std::min(BLOCK, nLanes - first);
+            lb.stride = pre;
+            double mean[BLOCK];
+            for (size_t j = 0; j < lb.count; j++) {
+                lb.off[j] = offsets[first + j] + seg.from*pre;
+                mean[j] = demean ? laneMean(Y + lb.off[j], pre, seg.n) : 0;
+                if (demean)
+                    for (size_t k = 0; k < seg.n; k++)
+                        Y[lb.off[j] + k*pre] -= (T)mean[j];
+            }
+            std::vector<double> tail;
+            for (size_t s = 0; s < stages.size(); s++)
+                filtfiltBlock(stages[s], lb, (long)seg.n, tail);
+            if (demean)
+                for (size_t j = 0; j < lb.count; j++)
+                    for (size_t k = 0; k < seg.n; k++)
+                        Y[lb.off[j] + k*pre] += (T)mean[j];
+        });
+        return;
+    }
+
+    FirPlan plan = makeFirPlan(b, w);
+    size_t nPairs = (nLanes + 1)/2;
+    std::vector<double> means(nLanes*segments.size(), 0);
+    if (demean)
+        pool(nLanes*segments.size(), [&](size_t i) {
+            const Segment& seg = segments[i % segments.size()];
+            means[i] = laneMean(X + offsets[i/segments.size()] + seg.from*pre, pre, seg.n);
+        });
+
+    // items are (segment, pair of lanes, block of output samples)
+    size_t blockLen = plan.N ? plan.L : 4096;
+    std::vector<size_t> firstItem(segments.size() + 1, 0);
+    for (size_t g = 0; g < segments.size(); g++)
+        firstItem[g+1] = firstItem[g] + nPairs*((segments[g].n + blockLen - 1)/blockLen);
+    pool(firstItem.back(), [&](size_t item) {
+        size_t g = std::upper_bound(firstItem.begin(), firstItem.end(), item) - firstItem.begin() - 1;
+        const Segment& seg = segments[g];
+        size_t nSegBlocks = (seg.n + blockLen - 1)/blockLen;
+        size_t pair = (item - firstItem[g])/nSegBlocks;
+        long k0 = (long)(((item - firstItem[g]) % nSegBlocks)*blockLen);
+        long count = std::min((long)blockLen, (long)seg.n - k0);
+
+        size_t count2 = std::min((size_t)2, nLanes - 2*pair);
+        const T* base[2];
+        T* out[2];
+        double mean[2] = {0, 0};
+        for (size_t j = 0; j < count2; j++) {
+            size_t lane = 2*pair + j;
+            base[j] = X + offsets[lane] + seg.from*pre;
+            out[j] = Y + offsets[lane] + seg.from*pre;
+            mean[j] = means[lane*segments.size() + g];
+        }
+        std::vector<cplx> buf;
+        firBlock(plan, base, mean, count2, pre, (long)seg.n, k0, count, out, buf);
+    });
+}
+
+/* The gateway function */
+void mexFunction( int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[])
+{
+    /* check for proper number of arguments */
+    if(nrhs < 7 || nrhs > 8) {
+        mexErrMsgIdAndTxt("MyToolbox:filtfiltMex:nrhs","Seven or eight inputs required.");
+    }
+    if(nlhs > 1) {
+        mexErrMsgIdAndTxt("MyToolbox:filtfiltMex:nlhs","One output required.");
+    }
+    if( !(mxIsDouble(prhs[0]) || mxIsSingle(prhs[0])) || mxIsComplex(prhs[0])) {
+        mexErrMsgIdAndTxt("MyToolbox:filtfiltMex:notReal","X must be a real double or single array.");
+    }
+    for (int i = 1; i < nrhs; i++) {
+        if (i == 4 && mxIsCell(prhs[i]))
+            continue;
+        if (i == 6 && mxIsLogical(prhs[i]))
+            continue;
+        if( !mxIsDouble(prhs[i]) || mxIsComplex(prhs[i])) {
+            mexErrMsgIdAndTxt("MyToolbox:filtfiltMex:notDouble","DIM, LANES, SEGMENTS, SOS, B, DEMEAN and NTHREADS must be real doubles.");
+        }
+    }
+
+    size_t nDims = mxGetNumberOfDimensions(prhs[0]);
+    const mwSize* dims = mxGetDimensions(prhs[0]);
+    double dimArg = mxGetScalar(prhs[1]);
+    if (!(dimArg >= 1) || dimArg != std::floor(dimArg)) {
+        mexErrMsgIdAndTxt("MyToolbox:filtfiltMex:badDim","DIM must be a positive integer.");
+    }
+    size_t dim = (size_t)dimArg - 1;
+    size_t pre = 1, len = dim < nDims ? dims[dim] : 1, post = 1;
+    for (size_t d = 0; d < nDims; d++) {
+        if (d < dim)
+            pre *= dims[d];
+        else if (d > dim)
+            post *= dims[d];
+    }
+
+    std::vector<size_t> lanes;
+    if (mxIsEmpty(prhs[2])) {
+        for (size_t i = 0; i < pre; i++)
+            lanes.push_back(i);
+    } else {
+        const double* l = mxGetPr(prhs[2]);
+        for (size_t i = 0; i < mxGetNumberOfElements(prhs[2]); i++) {
+            if (!(l[i] >= 1 && l[i] <= pre)) {
+                mexErrMsgIdAndTxt("MyToolbox:filtfiltMex:badLanes","LANES must index the dimensions before DIM.");
+            }
+            lanes.push_back((size_t)l[i] - 1);
+        }
+    }
+
+    std::vector<Segment> segments;
+    if (mxIsEmpty(prhs[3])) {
+        segments.push_back(Segment{0, len});
+    } else {
+        if (mxGetN(prhs[3]) != 2) {
+            mexErrMsgIdAndTxt("MyToolbox:filtfiltMex:badSegments","SEGMENTS must be K x 2 [first last].");
+        }
+        const double* g = mxGetPr(prhs[3]);
+        size_t K = mxGetM(prhs[3]);
+        for (size_t k = 0; k < K; k++) {
+            if (!(g[k] >= 1 && g[k] <= g[k+K] && g[k+K] <= len)) {
+                mexErrMsgIdAndTxt("MyToolbox:filtfiltMex:badSegments","SEGMENTS must lie within DIM with first <= last.");
+            }
+            segments.push_back(Segment{(size_t)g[k] - 1, (size_t)(g[k+K] - g[k]) + 1});
+        }
+    }
+
+    std::vector<Stage> stages;
+    std::vector<const mxArray*> sosArrays;
+    if (mxIsCell(prhs[4])) {
+        for (size_t i = 0; i < mxGetNumberOfElements(prhs[4]); i++)
+            sosArrays.push_back(mxGetCell(prhs[4], i));
+    } else if (!mxIsEmpty(prhs[4])) {
+        sosArrays.push_back(prhs[4]);
+    }
+    for (size_t i = 0; i < sosArrays.size(); i++) {
+        const mxArray* sos = sosArrays[i];
+        if (!sos || !mxIsDouble(sos) || mxGetN(sos) != 6 || mxGetM(sos) == 0) {
+            mexErrMsgIdAndTxt("MyToolbox:filtfiltMex:badSOS","SOS must be L x 6 [b0 b1 b2 a0 a1 a2], or a cell array of those.");
+        }
+        const double* s = mxGetPr(sos);
+        for (size_t k = 0; k < mxGetM(sos); k++) {
+            if (s[k + 3*mxGetM(sos)] == 0) {
+                mexErrMsgIdAndTxt("MyToolbox:filtfiltMex:badSOS","The a0 of every section must be nonzero.");
+            }
+        }
+        stages.push_back(makeStage(s, mxGetM(sos)));
+    }
+    size_t w = mxGetNumberOfElements(prhs[5]);
+    if ((w == 0) == stages.empty()) {
+        mexErrMsgIdAndTxt("MyToolbox:filtfiltMex:filter","Either SOS or B must be given.");
+    }
+    bool demean = mxGetScalar(prhs[6]) != 0;
+
+    size_t nThreads = nrhs > 7 ? (size_t)mxGetScalar(prhs[7]) : 0;
+    if (nThreads == 0)
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    plhs[0] = mxDuplicateArray(prhs[0]);
+    if (len == 0 || lanes.empty())
+        return;
+    if (mxIsDouble(prhs[0]))
+        run((const double*)mxGetData(prhs[0]), (double*)mxGetData(plhs[0]), pre, len, post, lanes,
+            segments, stages, w ? mxGetPr(prhs[5]) : 0, w, demean, nThreads);
+    else
+        run((const float*)mxGetData(prhs[0]), (float*)mxGetData(plhs[0]), pre, len, post, lanes,
+            segments, stages, w ? mxGetPr(prhs[5]) : 0, w, demean, nThreads);
+}
@@ -0,0 +1,164 @@
+/*==========================================================
+ * huberMeanMex.cc - [X, ITERS]=huberMeanMex(Y, RHO, MAXITER, TOL, NTHREADS);
+ %function [X, ITERS]=huberMeanMex(Y, RHO, MAXITER, TOL, NTHREADS);
+ %Columnwise robust mean under the Huber loss, the ADMM of calculateHuberMean.m
+ %run column by column in place, with the columns spread over a pool of threads.
+ %This is a MEX-file for MATLAB.
+ % compiled on OS X: mex CXXFLAGS='$CXXFLAGS -std=c++11 -O3' huberMeanMex.cc
+ % compiled on Windows: mex COMPFLAGS='$COMPFLAGS /O2' huberMeanMex.cc
+ % compiled on Linux: mex CXXFLAGS='$CXXFLAGS -std=c++11 -O3 -pthread' LDFLAGS='$LDFLAGS -pthread' huberMeanMex.cc
+ %
+ %A column only needs its own Z and U (M values each), kept in two buffers per
+ %thread instead of three M x N matrices per iteration.  One branch free pass
+ %over the column per iteration does the D, Z and U updates, the residuals and
+ %the sum(Z - U) of the next X, so the compiler can vectorize it.  A column
+ %stops once the primal residual ||U - Uold|| and the dual residual
+ %RHO*||Z - Zold|| are both below TOL*sqrt(M).
+ %
+ %Boyd, S., Parikh, N., Chu, E., Peleato, B., & Eckstein, J. (2011).
+ %Distributed optimization and statistical learning via the alternating
+ %direction method of multipliers. Foundations and Trends in Machine Learning,
+ %3(1), 1-122.
+
+ %Inputs
+ %  Y        : M x N matrix (double or single) averaged columnwise.
+ %  RHO      : Augmented Lagrangian parameter (calculateHuberMean.m uses 1).
+ %  MAXITER  : Maximal number of iterations per column.
+ %  TOL      : Convergence tolerance, 0 runs every column for MAXITER
+ %             iterations like calculateHuberMean.m.
+ %  NTHREADS : Number of threads, 0 for one per core.  Optional.
+
+ %Outputs
+ %  X        : 1 x N robust mean, of the class of Y.
+ %  ITERS    : 1 x N iterations run per column.
+ %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#include "mex.h"
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cmath>
+
+/* ADMM for one column, returns the iterations run and the mean in x */
+template <typename T>
+static size_t huberColumn(const T* y, size_t m, double rho, size_t maxIter, double tol,
+                          std::vector<double>& z, std::vector<double>& u, double& x)
+{
+    double mu = 0;
+    for (size_t i = 0; i < m; i++)
+        mu += y[i];
+    mu /= m;
+    x = mu;
+    if (m == 1)
+        return 0;
+
+    std::fill(z.begin(), z.end(), 0);
+    std::fill(u.begin(), u.end(), 0);
+    double* zp = z.data();
+    double* up = u.data();
+    const double a = rho/(1 + rho), b = 1/(1 + rho), c = 1 + 1/rho;
+    const double tol2 = tol*tol*m;
+    double zu = 0;
+    for (size_t k = 0; k < maxIter; k++) {
+        x = mu + zu/m;
+        double r2 = 0, s2 = 0;
+        zu = 0;
+        for (size_t i = 0; i < m; i++) {
+            double d = x - (y[i] - up[i]);
+            // max(0, NaN) is 0 in MATLAB, and so is this
+            double shrink = 1 - c/std::fabs(d);
+            shrink = shrink > 0 ? shrink : 0;
+            double zi = (a + b*shrink)*d;
+            double ui = d - zi;
+            r2 += (ui - up[i])*(ui - up[i]);
+            s2 += (zi - zp[i])*(zi - zp[i]);
+            zp[i] = zi;
+            up[i] = ui;
+            zu += zi - ui;
+        }
+        if (tol > 0 && r2 <= tol2 && rho*rho*s2 <= tol2)
+            return k + 1;
+    }
+    return maxIter;
+}
+
+template <typename T>
+static void huberMean(const T* Y, size_t m, size_t n, double rho, size_t maxIter, double tol,
+                      size_t nThreads, T* X, double* iters)
+{
+    // columns are handed out in blocks, one column is too little work
+    const size_t block = 64;
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        std::vector<double> z(m), u(m);
+        for (size_t from = next.fetch_add(block); from < n; from = next.fetch_add(block)) {
+            size_t to = std::min(n, from + block);
+            for (size_t j = from; j < to; j++) {
+                double x;
+                iters[j] = (double)huberColumn(Y + j*m, m, rho, maxIter, tol, z, u, x);
+                X[j] = (T)x;
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < nThreads; i++)
+        workers.push_back(std::thread(work));
+    work();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+/* The gateway function */
+void mexFunction( int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[])
+{
+    /* check for proper number of arguments */
+    if(nrhs < 4 || nrhs > 5) {
+        mexErrMsgIdAndTxt("MyToolbox:huberMeanMex:nrhs","Four or five inputs required.");
+    }
+    if(nlhs > 2) {
+        mexErrMsgIdAndTxt("MyToolbox:huberMeanMex:nlhs","At most two outputs.");
+    }
+    if( !(mxIsDouble(prhs[0]) || mxIsSingle(prhs[0])) || mxIsComplex(prhs[0])) {
+        mexErrMsgIdAndTxt("MyToolbox:huberMeanMex:notReal","Y must be a real double or single matrix.");
+    }
+    for (int i = 1; i < nrhs; i++) {
+        if( !mxIsDouble(prhs[i]) || mxIsComplex(prhs[i]) || mxGetNumberOfElements(prhs[i]) != 1) {
+            mexErrMsgIdAndTxt("MyToolbox:huberMeanMex:notScalar","RHO, MAXITER, TOL and NTHREADS must be real double scalars.");
+        }
+    }
+
+    size_t m = mxGetM(prhs[0]);
+    size_t n = mxGetN(prhs[0]);
+    double rho = mxGetScalar(prhs[1]);
+    double maxIter = mxGetScalar(prhs[2]);
+    double tol = mxGetScalar(prhs[3]);
+    if (!(rho > 0)) {
+        mexErrMsgIdAndTxt("MyToolbox:huberMeanMex:badRho","RHO must be positive.");
+    }
+    if (!(maxIter >= 0)) {
+        mexErrMsgIdAndTxt("MyToolbox:huberMeanMex:badMaxIter","MAXITER must not be negative.");
+    }
+    if (m == 0) {
+        mexErrMsgIdAndTxt("MyToolbox:huberMeanMex:empty","Y must have at least one row.");
+    }
+    size_t nThreads = nrhs > 4 ? (size_t)mxGetScalar(prhs[4]) : 0;
+    if (nThreads == 0)
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+    nThreads = std::min(nThreads, std::max((size_t)1, n));
+
+    plhs[0] = mxCreateNumericMatrix(1, n, mxGetClassID(prhs[0]), mxREAL);
+    mxArray* iters = mxCreateDoubleMatrix(1, n, mxREAL);
+    if (mxIsDouble(prhs[0]))
+        huberMean((const double*)mxGetData(prhs[0]), m, n, rho, (size_t)maxIter, tol, nThreads,
+                  (double*)mxGetData(plhs[0]), mxGetPr(iters));
+    else
+        huberMean((const float*)mxGetData(prhs[0]), m, n, rho, (size_t)maxIter, tol, nThreads,
+                  (float*)mxGetData(plhs[0]), mxGetPr(iters));
+
+    if (nlhs > 1)
+        plhs[1] = iters;
+    else
+        mxDestroyArray(iters);
+}
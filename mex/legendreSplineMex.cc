@@ -0,0 +1,133 @@
+/*==========================================================
+ * legendreSplineMex.cc - [G, H]=legendreSplineMex(COSEE, ORDER, TOL, NTHREADS);
+ %function [G, H]=legendreSplineMex(COSEE, ORDER, TOL, NTHREADS);
+ %Legendre series of the spherical spline (G) and surface Laplacian (H) of
+ %interpMx in private/spherical_interpolate.m, with the elements spread over
+ %a pool of threads.
+ %This is a MEX-file for MATLAB.
+ % compiled on OS X: mex CXXFLAGS='$CXXFLAGS -std=c++11 -O3' legendreSplineMex.cc
+ % compiled on Windows: mex COMPFLAGS='$COMPFLAGS /O2' legendreSplineMex.cc
+ % compiled on Linux: mex CXXFLAGS='$CXXFLAGS -std=c++11 -O3 -pthread' LDFLAGS='$LDFLAGS -pthread' legendreSplineMex.cc
+ %
+ %Every element runs the recurrence and the moving average stopping rule of
+ %interpMx for at most 500 terms.  The factors (2n+1)/(n^2+n)^ORDER are made
+ %once per call, and a symmetric COSEE (the source x source matrix) is only
+ %summed over one triangle.
+ %
+ %Perrin, F., Pernier, J., Bertrand, O., & Echallier, J. F. (1989). Spherical
+ %splines for scalp potential and current density mapping.
+ %Electroencephalography and Clinical Neurophysiology, 72(2), 184-187.
+ %
+ %Inputs
+ %  COSEE    : Matrix of cosines of the angles between electrode pairs.
+ %  ORDER    : Order of the spline (spherical_interpolate.m uses 4).
+ %  TOL      : Tolerance of the series (spherical_interpolate.m uses eps).
+ %  NTHREADS : Number of threads, 0 for one per core.  Optional.
+ %
+ %Outputs
+ %  G        : Spline matrix, size of COSEE.
+ %  H        : Surface Laplacian matrix, size of COSEE.
+ %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#include "mex.h"
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cmath>
+
+static const double PI = 3.14159265358979323846;
+static const size_t TERMS = 500;
+
+/* the series of interpMx for one cosine */
+static void legendreSeries(double x, const std::vector<double>& a, const std::vector<double>& b,
+                           double tol, double& G, double& H)
+{
+    double Pns1 = 1, Pn = x;
+    G = a[1]*Pn;
+    H = b[1]*Pn;
+    double dG = std::fabs(G), dH = std::fabs(H);
+    for (size_t n = 2; n <= TERMS; n++) {
+        double Pns2 = Pns1;
+        Pns1 = Pn;
+        Pn = ((2.0*n - 1)*x*Pns1 - (n - 1.0)*Pns2)/n;
+        double oG = G, oH = H;
+        G += a[n]*Pn;
+        H += b[n]*Pn;
+        dG = (std::fabs(oG - G) + dG)/2;
+        dH = (std::fabs(oH - H) + dH)/2;
+        if (dG < tol && dH < tol)
+            break;
+    }
+    G /= 4*PI;
+    H /= 4*PI;
+}
+
+/* The gateway function */
+void mexFunction( int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[])
+{
+    /* check for proper number of arguments */
+    if(nrhs < 3 || nrhs > 4) {
+        mexErrMsgIdAndTxt("MyToolbox:legendreSplineMex:nrhs","Three or four inputs required.");
+    }
+    if(nlhs > 2) {
+        mexErrMsgIdAndTxt("MyToolbox:legendreSplineMex:nlhs","At most two outputs.");
+    }
+    for (int i = 0; i < nrhs; i++) {
+        if( !mxIsDouble(prhs[i]) || mxIsComplex(prhs[i])) {
+            mexErrMsgIdAndTxt("MyToolbox:legendreSplineMex:notDouble","All inputs must be real doubles.");
+        }
+    }
+
+    size_t m = mxGetM(prhs[0]);
+    size_t n = mxGetN(prhs[0]);
+    const double* cosEE = mxGetPr(prhs[0]);
+    double order = mxGetScalar(prhs[1]);
+    double tol = mxGetScalar(prhs[2]);
+    size_t nThreads = nrhs > 3 ? (size_t)mxGetScalar(prhs[3]) : 0;
+    if (nThreads == 0)
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+    nThreads = std::min(nThreads, std::max((size_t)1, m*n/64));
+
+    // (2n+1)/(n^2+n)^order of the G sum and (n^2+n) times it of the H sum
+    std::vector<double> a(TERMS + 1), b(TERMS + 1);
+    for (size_t k = 1; k <= TERMS; k++) {
+        double nn = (double)k*k + k;
+        a[k] = (2.0*k + 1)/std::pow(nn, order);
+        b[k] = nn*a[k];
+    }
+
+    plhs[0] = mxCreateDoubleMatrix(m, n, mxREAL);
+    mxArray* hOut = mxCreateDoubleMatrix(m, n, mxREAL);
+    double* G = mxGetPr(plhs[0]);
+    double* H = mxGetPr(hOut);
+    bool symmetric = m == n;
+    for (size_t j = 0; j < n && symmetric; j++)
+        for (size_t i = j + 1; i < m && symmetric; i++)
+            symmetric = cosEE[i + j*m] == cosEE[j + i*m];
+
+    // columns are handed out one at a time, the lower triangle only when symmetric
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        for (size_t j = next++; j < n; j = next++)
+            for (size_t i = symmetric ? j : 0; i < m; i++) {
+                legendreSeries(cosEE[i + j*m], a, b, tol, G[i + j*m], H[i + j*m]);
+                if (symmetric) {
+                    G[j + i*m] = G[i + j*m];
+                    H[j + i*m] = H[i + j*m];
+                }
+            }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < nThreads; i++)
+        workers.push_back(std::thread(work));
+    work();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    if (nlhs > 1)
+        plhs[1] = hOut;
+    else
+        mxDestroyArray(hOut);
+}
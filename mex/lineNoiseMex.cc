@@ -0,0 +1,439 @@
+/*==========================================================
+ * lineNoiseMex.cc - [DATA]=lineNoiseMex(DATA, TAPERS, LINENOISE, SIG, NTHREADS);
+ %function [DATA]=lineNoiseMex(DATA, TAPERS, LINENOISE, SIG, NTHREADS);
+ %removeLinesMovingWindow.m for all the channels of cleanLineNoise.m in one
+ %call, with the channels spread over a pool of threads.
+ %This is a MEX-file for MATLAB.
+ % compiled on OS X: mex CXXFLAGS='$CXXFLAGS -std=c++11 -O3' lineNoiseMex.cc
+ % compiled on Windows: mex COMPFLAGS='$COMPFLAGS /O2' lineNoiseMex.cc
+ % compiled on Linux: mex CXXFLAGS='$CXXFLAGS -std=c++11 -O3 -pthread' LDFLAGS='$LDFLAGS -pthread' lineNoiseMex.cc
+ %
+ %Everything that only depends on the window and the tapers is set up once per
+ %call: the frequency grid, the sums of the odd tapers, the bins each line
+ %scans, and a table of complex exponentials for those bins only.  Per window
+ %the tapered data goes through real FFTs, two tapers per complex FFT, and
+ %the F-statistic of testSignificantFrequencies.m is evaluated only in the
+ %scan bands of the lines still being removed.  Between iterations the
+ %spectrum of calculateSegmentSpectrum.m is only needed at the bins of those
+ %lines, so only those bins are computed (one DFT sum per bin, taper and
+ %segment) instead of the full segment spectrum.  A pass that finds no
+ %significant line ends the iterations, as the next passes would repeat it.
+ %
+ %Mitra, P. P., & Bokil, H. (2008). Observed Brain Dynamics. Oxford
+ %University Press.
+
+ %Inputs
+ %  DATA      : Channels x samples, the rows of the channels to clean.
+ %  TAPERS    : Samples per window x K tapers (lineNoise.tapers of
+ %              cleanLineNoise.m, scaled by sqrt(Fs) like checkTapers.m).
+ %  LINENOISE : The lineNoise structure of removeLinesMovingWindow.m (Fs,
+ %              lineFrequencies, fScanBandWidth, fPassBand, pad,
+ %              taperWindowStep, tau, maximumIterations).
+ %  SIG       : F-statistic threshold, finv(1 - p, 2, 2*K - 2).
+ %  NTHREADS  : Number of threads, 0 for one per core.  Optional.
+
+ %Outputs
+ %  DATA      : Cleaned channels, same size.
+ %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#include "mex.h"
+#include <vector>
+#include <complex>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+typedef std::complex<double> cplx;
+
+static const double PI = 3.14159265358979323846;
+static const size_t NONE = (size_t)-1;
+
+struct Line {
+    size_t from, to;    // scan bins (ridx)
+    size_t bin;         // nearest bin (fidx, itemp)
+};
+
+struct Plan {
+    double Fs, sig, tau, win;
+    bool scan;                      // fScanBandWidth given
+    size_t nwin, K, nfft, nstep, maxIter;
+    bool pow2;
+    std::vector<double> tapers;     // nwin x K
+    std::vector<double> H0;         // sums of the odd (1 based) tapers
+    double H0sq;
+    std::vector<Line> lines;
+    std::vector<size_t> row;        // bin -> row of table, NONE if not needed
+    std::vector<cplx> table;        // exp(2i*pi*f*t/Fs), row x nwin
+    std::vector<double> smooth;     // overlap weights
+    std::vector<cplx> twiddle;
+};
+
+static double field(const mxArray* s, const char* name, double fallback)
+{
+    mxArray* f = mxGetField(s, 0, name);
+    return f && !mxIsEmpty(f) ? mxGetScalar(f) : fallback;
+}
+
+/* in place radix 2 FFT */
+static void fft(std::vector<cplx>& a, const std::vector<cplx>& twiddle)
+{
+    size_t N = a.size();
+    for (size_t i = 1, j = 0; i < N; i++) {
+        size_t bit = N >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+            std::swap(a[i], a[j]);
+    }
+    for (size_t len = 2; len <= N; len <<= 1) {
+        size_t step = N/len;
+        for (size_t i = 0; i < N; i += len)
+            for (size_t k = 0; k < len/2; k++) {
+                cplx u = a[i + k], v = a[i + k + len/2]*twiddle[k*step];
+                a[i + k] = u + v;
+                a[i + k + len/2] = u - v;
+            }
+    }
+}
+
+/* first bin of [lo, hi] nearest to target, like [~, i] = min(abs(f - target)) */
+static size_t nearestBin(double target, size_t lo, size_t hi, double df)
+{
+    size_t best = lo;
+    for (size_t b = lo; b <= hi; b++)
+        if (std::fabs(b*df - target) < std::fabs(best*df - target))
+            best = b;
+    return best;
+}
+
+/* tapered Fourier transforms J (K x bins, row major by taper) of one window at the needed bins */
+static void windowTransforms(const Plan& p, const double* x, std::vector<cplx>& buf, std::vector<cplx>& J)
+{
+    size_t nBins = p.table.size()/p.nwin;
+    J.assign(p.K*nBins, 0);
+    if (!p.pow2) {
+        for (size_t k = 0; k < p.K; k++) {
+            const double* h = &p.tapers[k*p.nwin];
+            for (size_t b = 0; b < p.row.size(); b++) {
+                size_t r = p.row[b];
+                if (r == NONE)
+                    continue;
+                const cplx* e = &p.table[r*p.nwin];
+                cplx acc = 0;
+                for (size_t t = 0; t < p.nwin; t++)
+                    acc += x[t]*h[t]*std::conj(e[t]);
+                J[k*nBins + r] = acc/p.Fs;
+            }
+        }
+        return;
+    }
+
+    // two real tapered windows per complex FFT
+    for (size_t k = 0; k < p.K; k += 2) {
+        bool two = k + 1 < p.K;
+        const double* ha = &p.tapers[k*p.nwin];
+        const double* hb = two ? &p.tapers[(k+1)*p.nwin] : 0;
+        buf.assign(p.nfft, 0);
+        for (size_t t = 0; t < p.nwin; t++)
+            buf[t] = cplx(x[t]*ha[t], two ? x[t]*hb[t] : 0);
+        fft(buf, p.twiddle);
+        for (size_t b = 0; b < p.row.size(); b++) {
+            size_t r = p.row[b];
+            if (r == NONE)
+                continue;
+            cplx z = buf[b], zc = std::conj(buf[(p.nfft - b) % p.nfft]);
+            J[k*nBins + r] = (z + zc)*0.5/p.Fs;
+            if (two)
+                J[(k+1)*nBins + r] = (z - zc)*cplx(0, -0.5)/p.Fs;
+        }
+    }
+}
+
+/* F-statistic and amplitude (times Fs) at one bin, as testSignificantFrequencies.m */
+static void fTest(const Plan& p, const std::vector<cplx>& J, size_t r, double& F, cplx& A)
+{
+    size_t nBins = p.table.size()/p.nwin;
+    cplx a = 0;
+    for (size_t k = 0; k < p.K; k += 2)
+        a += J[k*nBins + r]*p.H0[k/2];
+    a /= p.H0sq;
+    double den = 0;
+    for (size_t k = 0; k < p.K; k++) {
+        cplx d = k % 2 ? J[k*nBins + r] : J[k*nBins + r] - a*p.H0[k/2];
+        den += std::norm(d);
+    }
+    F = (p.K - 1)*std::norm(a)*p.H0sq/den;
+    A = a*p.Fs;
+}
+
+/* 10*log10 of the calculateSegmentSpectrum.m spectrum at the bins of the given lines */
+static void lineSpectrum(const Plan& p, const double* x, size_t n, const std::vector<size_t>& active, std::vector<double>& S)
+{
+    // segments start at E = 0:win:(T - win) seconds like createdatamatc.m
+    double win = p.win, T = n/p.Fs;
+    size_t nSeg = T >= win ? (size_t)std::floor((T - win)/win + 1e-10) + 1 : 0;
+    S.assign(active.size(), 0);
+    size_t used = 0;
+    for (size_t s = 0; s < nSeg; s++) {
+        size_t start = (size_t)std::floor(s*win*p.Fs);
+        if (start + p.nwin > n)
+            break;
+        used++;
+        for (size_t l = 0; l < active.size(); l++) {
+            const cplx* e = &p.table[p.row[p.lines[active[l]].bin]*p.nwin];
+            for (size_t k = 0; k < p.K; k++) {
+                const double* h = &p.tapers[k*p.nwin];
+                cplx acc = 0;
+                for (size_t t = 0; t < p.nwin; t++)
+                    acc += x[start + t]*h[t]*std::conj(e[t]);
+                S[l] += std::norm(acc/p.Fs);
+            }
+        }
+    }
+    for (size_t l = 0; l < active.size(); l++)
+        S[l] = 10*std::log10(S[l]/(p.K*used));
+}
+
+static void cleanChannel(const Plan& p, std::vector<double>& x)
+{
+    size_t n = x.size();
+    if (n < p.nwin || p.lines.empty())
+        return;
+    size_t nw = (n - p.nwin)/p.nstep + 1;
+    size_t overlap = p.smooth.size();
+    size_t fitLen = (nw - 1)*p.nstep + p.nwin;
+    size_t nBins = p.table.size()/p.nwin;
+
+    std::vector<size_t> active(p.lines.size());
+    for (size_t l = 0; l < active.size(); l++)
+        active[l] = l;
+    std::vector<double> spectrum, cleaned;
+    lineSpectrum(p, &x[0], n, active, spectrum);
+
+    std::vector<double> fit(fitLen), fitWin(p.nwin), fitPrev(p.nwin);
+    std::vector<cplx> buf, J;
+    std::vector<double> F(nBins);
+    std::vector<cplx> A(nBins);
+    std::vector<char> tested(nBins), freqMask(nBins);
+    for (size_t iteration = 0; iteration < p.maxIter; iteration++) {
+        std::vector<char> f0Mask(active.size(), 0);
+        std::fill(fit.begin(), fit.end(), 0);
+        for (size_t w = 0; w < nw; w++) {
+            size_t start = w*p.nstep;
+            windowTransforms(p, &x[start], buf, J);
+            std::fill(tested.begin(), tested.end(), 0);
+            std::fill(freqMask.begin(), freqMask.end(), 0);
+            auto Fval = [&](size_t bin) {
+                size_t r = p.row[bin];
+                if (!tested[r]) {
+                    fTest(p, J, r, F[r], A[r]);
+                    tested[r] = 1;
+                }
+                return F[r];
+            };
+
+            for (size_t l = 0; l < active.size(); l++) {
+                const Line& line = p.lines[active[l]];
+                if (p.scan) {
+                    // largest significant peak in the scan band
+                    size_t best = NONE;
+                    double bestF = 0;
+                    for (size_t b = line.from; b <= line.to; b++) {
+                        double f = Fval(b);
+                        if (f >= p.sig && f > bestF) {
+                            best = b;
+                            bestF = f;
+                        }
+                    }
+                    if (best != NONE) {
+                        freqMask[p.row[best]] = 1;
+                        f0Mask[l] = 1;
+                    }
+                } else {
+                    freqMask[p.row[line.bin]] = Fval(line.bin) >= p.sig;
+                    f0Mask[l] |= freqMask[p.row[line.bin]];
+                }
+            }
+
+            std::fill(fitWin.begin(), fitWin.end(), 0);
+            for (size_t r = 0; r < nBins; r++) {
+                if (!freqMask[r])
+                    continue;
+                const cplx* e = &p.table[r*p.nwin];
+                for (size_t t = 0; t < p.nwin; t++)
+                    fitWin[t] += 2*(A[r]*e[t]).real();
+            }
+            if (w > 0)
+                for (size_t t = 0; t < overlap; t++)
+                    fitWin[t] = p.smooth[t]*fitWin[t] + (1 - p.smooth[t])*fitPrev[p.nwin - overlap + t];
+            std::copy(fitWin.begin(), fitWin.end(), fit.begin() + start);
+            fitPrev.swap(fitWin);
+        }
+
+        bool any = false;
+        for (size_t l = 0; l < active.size(); l++)
+            any = any || f0Mask[l];
+        if (!any)
+            break;
+        for (size_t i = 0; i < fitLen; i++)
+            x[i] -= fit[i];
+
+        // keep the lines that were significant and got smaller
+        lineSpectrum(p, &x[0], n, active, cleaned);
+        std::vector<size_t> keep;
+        std::vector<double> keepSpectrum;
+        for (size_t l = 0; l < active.size(); l++) {
+            if (f0Mask[l] && !(spectrum[l] - cleaned[l] < 0)) {
+                keep.push_back(active[l]);
+                keepSpectrum.push_back(cleaned[l]);
+            }
+        }
+        active.swap(keep);
+        spectrum.swap(keepSpectrum);
+        if (active.empty())
+            break;
+    }
+}
+
+/* The gateway function */
+void mexFunction( int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[])
+{
+    /* check for proper number of arguments */
+    if(nrhs < 4 || nrhs > 5) {
+        mexErrMsgIdAndTxt("MyToolbox:lineNoiseMex:nrhs","Four or five inputs required.");
+    }
+    if(nlhs > 1) {
+        mexErrMsgIdAndTxt("MyToolbox:lineNoiseMex:nlhs","One output required.");
+    }
+    if( !mxIsDouble(prhs[0]) || mxIsComplex(prhs[0]) || !mxIsDouble(prhs[1]) || mxIsComplex(prhs[1])) {
+        mexErrMsgIdAndTxt("MyToolbox:lineNoiseMex:notDouble","DATA and TAPERS must be real doubles.");
+    }
+    if(!mxIsStruct(prhs[2])) {
+        mexErrMsgIdAndTxt("MyToolbox:lineNoiseMex:notStruct","LINENOISE must be the lineNoise structure.");
+    }
+
+    Plan p;
+    const mxArray* ln = prhs[2];
+    p.Fs = field(ln, "Fs", 1);
+    p.sig = mxGetScalar(prhs[3]);
+    p.tau = field(ln, "tau", 100);
+    p.win = field(ln, "taperWindowSize", 4);
+    p.nwin = mxGetM(prhs[1]);
+    p.K = mxGetN(prhs[1]);
+    p.maxIter = (size_t)field(ln, "maximumIterations", 10);
+    double step = field(ln, "taperWindowStep", 1);
+    p.nstep = (size_t)std::round(step*p.Fs);
+    if (p.nwin == 0 || p.K == 0 || p.nstep == 0) {
+        mexErrMsgIdAndTxt("MyToolbox:lineNoiseMex:badWindow","TAPERS and the window step must not be empty.");
+    }
+    p.tapers.assign(mxGetPr(prhs[1]), mxGetPr(prhs[1]) + p.nwin*p.K);
+
+    // H0 of the odd tapers
+    p.H0sq = 0;
+    for (size_t k = 0; k < p.K; k += 2) {
+        double s = 0;
+        for (size_t t = 0; t < p.nwin; t++)
+            s += p.tapers[k*p.nwin + t];
+        p.H0.push_back(s);
+        p.H0sq += s*s;
+    }
+
+    // nfft = max(2^(nextpow2(N) + pad), N)
+    int e = 0;
+    while (((size_t)1 << e) < p.nwin)
+        e++;
+    int pad = (int)field(ln, "pad", 0);
+    size_t padded = e + pad >= 0 ? (size_t)1 << (e + pad) : 1;
+    p.nfft = std::max(padded, p.nwin);
+    p.pow2 = (p.nfft & (p.nfft - 1)) == 0;
+    double df = p.Fs/p.nfft;
+
+    // frequency grid of getfgrid.m
+    double fLo = 0, fHi = p.Fs/2;
+    mxArray* fp = mxGetField(ln, 0, "fPassBand");
+    size_t binLo, binHi;
+    if (fp && mxGetNumberOfElements(fp) == 1) {
+        binLo = binHi = nearestBin(mxGetScalar(fp), 0, p.nfft - 1, df);
+    } else {
+        if (fp && mxGetNumberOfElements(fp) >= 2) {
+            fLo = mxGetPr(fp)[0];
+            fHi = mxGetPr(fp)[mxGetNumberOfElements(fp) - 1];
+        }
+        binLo = p.nfft;
+        binHi = 0;
+        for (size_t b = 0; b < p.nfft; b++)
+            if (b*df >= fLo && b*df <= fHi) {
+                binLo = std::min(binLo, b);
+                binHi = std::max(binHi, b);
+            }
+    }
+
+    mxArray* lf = mxGetField(ln, 0, "lineFrequencies");
+    mxArray* bw = mxGetField(ln, 0, "fScanBandWidth");
+    p.scan = bw && !mxIsEmpty(bw);
+    double fscanbw = p.scan ? mxGetScalar(bw) : 0;
+    p.row.assign(p.nfft, NONE);
+    size_t nRows = 0;
+    if (binLo <= binHi && lf) {
+        for (size_t i = 0; i < mxGetNumberOfElements(lf); i++) {
+            double f0 = mxGetPr(lf)[i];
+            Line line;
+            line.bin = nearestBin(f0, binLo, binHi, df);
+            line.from = p.scan ? nearestBin(f0 - fscanbw/2, binLo, binHi, df) : line.bin;
+            line.to = p.scan ? nearestBin(f0 + fscanbw/2, binLo, binHi, df) : line.bin;
+            for (size_t b = std::min(line.from, line.bin); b <= std::max(line.to, line.bin); b++)
+                if (p.row[b] == NONE)
+                    p.row[b] = nRows++;
+            p.lines.push_back(line);
+        }
+    }
+    p.table.resize(nRows*p.nwin);
+    for (size_t b = 0; b < p.nfft; b++) {
+        if (p.row[b] == NONE)
+            continue;
+        for (size_t t = 0; t < p.nwin; t++)
+            p.table[p.row[b]*p.nwin + t] = std::polar(1.0, 2*PI*(b*df)*t/p.Fs);
+    }
+    if (p.pow2) {
+        p.twiddle.resize(p.nfft/2);
+        for (size_t k = 0; k < p.nfft/2; k++)
+            p.twiddle[k] = std::polar(1.0, -2*PI*k/p.nfft);
+    }
+
+    size_t overlap = p.nwin > p.nstep ? p.nwin - p.nstep : 0;
+    for (size_t i = 1; i <= overlap; i++)
+        p.smooth.push_back(1/(1 + std::exp(-p.tau*(i - overlap/2.0)/overlap)));
+
+    size_t nChans = mxGetM(prhs[0]);
+    size_t n = mxGetN(prhs[0]);
+    plhs[0] = mxDuplicateArray(prhs[0]);
+    double* data = mxGetPr(plhs[0]);
+
+    size_t nThreads = nrhs > 4 ? (size_t)mxGetScalar(prhs[4]) : 0;
+    if (nThreads == 0)
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+    nThreads = std::min(nThreads, std::max((size_t)1, nChans));
+
+    // a channel is a row, copied out and back so the windows are contiguous
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        std::vector<double> x(n);
+        for (size_t c = next++; c < nChans; c = next++) {
+            for (size_t i = 0; i < n; i++)
+                x[i] = data[c + i*nChans];
+            cleanChannel(p, x);
+            for (size_t i = 0; i < n; i++)
+                data[c + i*nChans] = x[i];
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < nThreads; i++)
+        workers.push_back(std::thread(work));
+    work();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
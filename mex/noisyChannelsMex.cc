@@ -0,0 +1,321 @@
+/*==========================================================
+ * noisyChannelsMex.cc - [CORR, NOISE, DEV]=noisyChannelsMex('correlation', X, DATA, N, W, NTHREADS);
+ *                       [R]=noisyChannelsMex('ransac', X, P, N, W, SAMPLES, NTHREADS);
+ %function [CORR, NOISE, DEV]=noisyChannelsMex('correlation', X, DATA, N, W, NTHREADS);
+ %function [R]=noisyChannelsMex('ransac', X, P, N, W, SAMPLES, NTHREADS);
+ %The windowed correlation (method 3) and RANSAC (method 4) stages of
+ %findNoisyChannels.m, with the windows spread over a pool of threads.
+ %This is a MEX-file for MATLAB.
+ % compiled on OS X: mex CXXFLAGS='$CXXFLAGS -std=c++11 -O3' noisyChannelsMex.cc
+ % compiled on Windows: mex COMPFLAGS='$COMPFLAGS /O2' noisyChannelsMex.cc
+ % compiled on Linux: mex CXXFLAGS='$CXXFLAGS -std=c++11 -O3 -pthread' LDFLAGS='$LDFLAGS -pthread' noisyChannelsMex.cc
+ %
+ %'correlation': every channel of a window is standardised once (centred and
+ %scaled to unit norm), so corrcoef is the product of the standardised window
+ %with itself, computed in 4 x 4 channel tiles.  The 0.98 quantile of the
+ %absolute correlations, the ratio of the mads of DATA - X and X and the
+ %0.7413*iqr of DATA follow quantile, mad and iqr of MATLAB.
+ %
+ %'ransac': the columns of P of one random sample are zero outside the rows
+ %of its channel subset.  The nonzero rows of each sample are taken out of P
+ %once per call and reused for every window, so a prediction costs the subset
+ %size instead of the channel count per channel.  The median over the samples
+ %(the round(SAMPLES/2)-th smallest, as calculateRansacWindow) is taken over a
+ %block of time points at a time instead of the time x channel x sample array.
+ %
+ %Inputs
+ %  X        : Samples x channels, the filtered data (the X of
+ %             findNoisyChannels.m, its ransac channels for 'ransac').
+ %  DATA     : Samples x channels, the unfiltered data.
+ %  P        : Channels x channels*SAMPLES reconstruction matrices of
+ %             calc_projector, side by side.
+ %  N        : Window length in samples.
+ %  W        : Number of windows, window k is samples (k-1)*N+1 to k*N.
+ %  SAMPLES  : Number of random samples in P.
+ %  NTHREADS : Number of threads, 0 for one per core.  Optional.
+ %
+ %Outputs
+ %  CORR     : W x channels 0.98 quantile of the absolute correlation of each
+ %             channel with the others.
+ %  NOISE    : W x channels mad(DATA - X, 1)./mad(X, 1).
+ %  DEV      : W x channels 0.7413*iqr(DATA).
+ %  R        : Channels x W correlation of each channel with its RANSAC
+ %             prediction.
+ %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#include "mex.h"
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+static const double NaN = std::numeric_limits<double>::quiet_NaN();
+
+/* prctile of MATLAB on n sorted values without NaNs, p in percent */
+static double prctileSorted(const double* x, size_t n, double p)
+{
+    if (n == 0)
+        return NaN;
+    double r = p/100*n;
+    double k = std::floor(r + 0.5);
+    r -= k;
+    size_t lo = k < 1 ? 1 : (size_t)k;
+    size_t hi = std::min((size_t)k + 1, n);
+    return (0.5 + r)*x[hi - 1] + (0.5 - r)*x[lo - 1];
+}
+
+/* median of MATLAB, reorders x */
+static double median(std::vector<double>& x)
+{
+    size_t n = x.size(), h = n/2;
+    std::nth_element(x.begin(), x.begin() + h, x.end());
+    double m = x[h];
+    if (n % 2 == 0)
+        m = (*std::max_element(x.begin(), x.begin() + h) + m)/2;
+    return m;
+}
+
+/* mad(x, 1), reorders x */
+static double mad(std::vector<double>& x)
+{
+    double m = median(x);
+    for (size_t i = 0; i < x.size(); i++)
+        x[i] = std::fabs(x[i] - m);
+    return median(x);
+}
+
+/* upper triangle (4 x 4 tiles) of Z*Z' for c rows of length n, c a multiple of 4 */
+static void gram(const double* Z, size_t c, size_t n, double* G)
+{
+    for (size_t i = 0; i < c; i += 4)
+        for (size_t j = i; j < c; j += 4) {
+            double s[4][4] = {{0}};
+            const double* a[4] = {Z + i*n, Z + (i+1)*n, Z + (i+2)*n, Z + (i+3)*n};
+            const double* b[4] = {Z + j*n, Z + (j+1)*n, Z + (j+2)*n, Z + (j+3)*n};
+            for (size_t t = 0; t < n; t++)
+                for (int u = 0; u < 4; u++)
+                    for (int v = 0; v < 4; v++)
+                        s[u][v] += a[u][t]*b[v][t];
+            for (int u = 0; u < 4; u++)
+                for (int v = 0; v < 4; v++) {
+                    G[(i+u)*c + j+v] = s[u][v];
+                    G[(j+v)*c + i+u] = s[u][v];
+                }
+        }
+}
+
+/* method 3 for one window of c channels, columns of X and DATA start at x and d with stride S */
+static void correlationWindow(const double* x, const double* d, size_t S, size_t c, size_t n,
+                              std::vector<double>& Z, std::vector<double>& G, std::vector<double>& buf,
+                              double* corr, double* noise, double* dev, size_t ldo)
+{
+    size_t c4 = (c + 3)/4*4;
+    Z.assign(c4*n, 0);
+    for (size_t j = 0; j < c; j++) {
+        const double* xj = x + j*S;
+        double mean = 0, ss = 0;
+        for (size_t t = 0; t < n; t++)
+            mean += xj[t];
+        mean /= n;
+        for (size_t t = 0; t < n; t++)
+            ss += (xj[t] - mean)*(xj[t] - mean);
+        // constant channels correlate as NaN, like corrcoef
+        double scale = ss > 0 ? 1/std::sqrt(ss) : NaN;
+        for (size_t t = 0; t < n; t++)
+            Z[j*n + t] = (xj[t] - mean)*scale;
+    }
+    G.resize(c4*c4);
+    gram(Z.data(), c4, n, G.data());
+
+    for (size_t j = 0; j < c; j++) {
+        buf.clear();
+        for (size_t i = 0; i < c; i++) {
+            double r = G[j*c4 + i];
+            if (i == j)
+                r = std::isnan(r) ? NaN : 0;
+            r = std::fabs(r);
+            r = r > 1 ? 1 : r;
+            if (!std::isnan(r))
+                buf.push_back(r);
+        }
+        std::sort(buf.begin(), buf.end());
+        corr[j*ldo] = prctileSorted(buf.data(), buf.size(), 98);
+
+        const double* xj = x + j*S;
+        const double* dj = d + j*S;
+        buf.resize(n);
+        for (size_t t = 0; t < n; t++)
+            buf[t] = dj[t] - xj[t];
+        double num = mad(buf);
+        buf.assign(xj, xj + n);
+        noise[j*ldo] = num/mad(buf);
+
+        buf.assign(dj, dj + n);
+        std::sort(buf.begin(), buf.end());
+        dev[j*ldo] = 0.7413*(prctileSorted(buf.data(), n, 75) - prctileSorted(buf.data(), n, 25));
+    }
+}
+
+/* the nonzero rows of one random sample of P and their weights, rows x channels */
+struct Sample {
+    std::vector<size_t> rows;
+    std::vector<double> weights;
+};
+
+static std::vector<Sample> compactSamples(const double* P, size_t m, size_t samples)
+{
+    std::vector<Sample> out(samples);
+    for (size_t k = 0; k < samples; k++) {
+        const double* Pk = P + k*m*m;
+        for (size_t a = 0; a < m; a++) {
+            bool used = false;
+            for (size_t j = 0; j < m && !used; j++)
+                used = Pk[a + j*m] != 0;
+            if (!used)
+                continue;
+            out[k].rows.push_back(a);
+            for (size_t j = 0; j < m; j++)
+                out[k].weights.push_back(Pk[a + j*m]);
+        }
+    }
+    return out;
+}
+
+/* method 4 for one window of m channels starting at x with stride S, as calculateRansacWindow */
+static void ransacWindow(const double* x, size_t S, size_t m, size_t n, const std::vector<Sample>& samples,
+                         std::vector<double>& pred, std::vector<double>& vals, double* r)
+{
+    const size_t p = samples.size(), T = 32;
+    const size_t pick = (size_t)std::round(p/2.0) - 1;
+    std::vector<double> sxy(m, 0), sxx(m, 0), syy(m, 0);
+    pred.resize(p*T*m);
+    vals.resize(p);
+    for (size_t t0 = 0; t0 < n; t0 += T) {
+        size_t nt = std::min(T, n - t0);
+        // pred(k, t, :) = X(t, rows of k)*weights of k
+        std::fill(pred.begin(), pred.end(), 0);
+        for (size_t k = 0; k < p; k++) {
+            const Sample& s = samples[k];
+            for (size_t t = 0; t < nt; t++) {
+                double* y = &pred[(k*T + t)*m];
+                for (size_t a = 0; a < s.rows.size(); a++) {
+                    double xa = x[s.rows[a]*S + t0 + t];
+                    const double* w = &s.weights[a*m];
+                    for (size_t j = 0; j < m; j++)
+                        y[j] += xa*w[j];
+                }
+            }
+        }
+        for (size_t t = 0; t < nt; t++)
+            for (size_t j = 0; j < m; j++) {
+                for (size_t k = 0; k < p; k++)
+                    vals[k] = pred[(k*T + t)*m + j];
+                std::nth_element(vals.begin(), vals.begin() + pick, vals.end());
+                double y = vals[pick], xj = x[j*S + t0 + t];
+                sxy[j] += xj*y;
+                sxx[j] += xj*xj;
+                syy[j] += y*y;
+            }
+    }
+    for (size_t j = 0; j < m; j++)
+        r[j] = sxy[j]/(std::sqrt(sxx[j])*std::sqrt(syy[j]));
+}
+
+/* runs job(k, thread buffers) for the windows k = 0..W-1 */
+template <typename Job>
+static void forWindows(size_t W, size_t nThreads, Job job)
+{
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        std::vector<double> a, b, c;
+        for (size_t k = next++; k < W; k = next++)
+            job(k, a, b, c);
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < nThreads; i++)
+        workers.push_back(std::thread(work));
+    work();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+/* The gateway function */
+void mexFunction( int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[])
+{
+    /* check for proper number of arguments */
+    if(nrhs < 1 || !mxIsChar(prhs[0])) {
+        mexErrMsgIdAndTxt("MyToolbox:noisyChannelsMex:mode","The first input must be 'correlation' or 'ransac'.");
+    }
+    char* buf = mxArrayToString(prhs[0]);
+    std::string mode = buf;
+    mxFree(buf);
+    bool ransac = mode == "ransac";
+    if (!ransac && mode != "correlation") {
+        mexErrMsgIdAndTxt("MyToolbox:noisyChannelsMex:mode","The first input must be 'correlation' or 'ransac'.");
+    }
+    int nIn = ransac ? 6 : 5;
+    if(nrhs < nIn || nrhs > nIn + 1) {
+        mexErrMsgIdAndTxt("MyToolbox:noisyChannelsMex:nrhs","%d or %d inputs required.", nIn, nIn + 1);
+    }
+    if(nlhs > (ransac ? 1 : 3)) {
+        mexErrMsgIdAndTxt("MyToolbox:noisyChannelsMex:nlhs","Too many outputs.");
+    }
+    for (int i = 1; i < nrhs; i++) {
+        if( !mxIsDouble(prhs[i]) || mxIsComplex(prhs[i])) {
+            mexErrMsgIdAndTxt("MyToolbox:noisyChannelsMex:notDouble","All inputs after the first must be real doubles.");
+        }
+    }
+
+    const double* X = mxGetPr(prhs[1]);
+    size_t S = mxGetM(prhs[1]);
+    size_t c = mxGetN(prhs[1]);
+    size_t n = (size_t)mxGetScalar(prhs[3]);
+    size_t W = (size_t)mxGetScalar(prhs[4]);
+    if (n*W > S) {
+        mexErrMsgIdAndTxt("MyToolbox:noisyChannelsMex:windows","N*W exceeds the number of samples.");
+    }
+    size_t nThreads = nrhs > nIn ? (size_t)mxGetScalar(prhs[nIn]) : 0;
+    if (nThreads == 0)
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+    nThreads = std::min(nThreads, std::max((size_t)1, W));
+
+    if (!ransac) {
+        if (mxGetM(prhs[2]) != S || mxGetN(prhs[2]) != c) {
+            mexErrMsgIdAndTxt("MyToolbox:noisyChannelsMex:size","X and DATA must have the same size.");
+        }
+        const double* D = mxGetPr(prhs[2]);
+        plhs[0] = mxCreateDoubleMatrix(W, c, mxREAL);
+        mxArray* noise = mxCreateDoubleMatrix(W, c, mxREAL);
+        mxArray* dev = mxCreateDoubleMatrix(W, c, mxREAL);
+        double* corrOut = mxGetPr(plhs[0]);
+        double* noiseOut = mxGetPr(noise);
+        double* devOut = mxGetPr(dev);
+        forWindows(W, nThreads, [&](size_t k, std::vector<double>& Z, std::vector<double>& G, std::vector<double>& b) {
+            correlationWindow(X + k*n, D + k*n, S, c, n, Z, G, b, corrOut + k, noiseOut + k, devOut + k, W);
+        });
+        if (nlhs > 1)
+            plhs[1] = noise;
+        else
+            mxDestroyArray(noise);
+        if (nlhs > 2)
+            plhs[2] = dev;
+        else
+            mxDestroyArray(dev);
+        return;
+    }
+
+    size_t samples = (size_t)mxGetScalar(prhs[5]);
+    if (samples == 0 || mxGetM(prhs[2]) != c || mxGetN(prhs[2]) != c*samples) {
+        mexErrMsgIdAndTxt("MyToolbox:noisyChannelsMex:size","P must be channels x channels*SAMPLES.");
+    }
+    std::vector<Sample> compact = compactSamples(mxGetPr(prhs[2]), c, samples);
+    plhs[0] = mxCreateDoubleMatrix(c, W, mxREAL);
+    double* R = mxGetPr(plhs[0]);
+    forWindows(W, nThreads, [&](size_t k, std::vector<double>& pred, std::vector<double>& vals, std::vector<double>&) {
+        ransacWindow(X + k*n, S, c, n, compact, pred, vals, R + k*c);
+    });
+}
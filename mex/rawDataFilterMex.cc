@@ -0,0 +1,483 @@
+/*==========================================================
+ * rawDataFilterMex.cc - [VALOUT]=rawDataFilterMex(T, DIA, OFFSETS, SETTINGS, NTHREADS);
+ %function [VALOUT]=rawDataFilterMex(T, DIA, OFFSETS, SETTINGS, NTHREADS);
+ %The pupil size filter chain of rawDataFilter.m (range filter, dilation speed
+ %filter, gap padding, island filter and the residuals filter passes) for all
+ %trials of a subject in one call, with the trials spread over a pool of threads.
+ %This is a MEX-file for MATLAB.
+ % compiled on OS X: mex CXXFLAGS='$CXXFLAGS -std=c++11' rawDataFilterMex.cc
+ % compiled on Windows: mex rawDataFilterMex.cc
+ % compiled on Linux: mex CXXFLAGS='$CXXFLAGS -std=c++11 -pthread' LDFLAGS='$LDFLAGS -pthread' rawDataFilterMex.cc
+ %
+ %Medians are found by selection (nth_element) instead of sorting, the island
+ %filter is one pass over the valid samples and the gap padding one sweep over
+ %the samples and the gaps together.  The residuals filter interpolates to the
+ %uniform grid, runs filtfilt with MATLAB's edge reflection and initial
+ %conditions and interpolates back like rawDataFilter.m.  Errors that
+ %rawDataFilter.m raises for a trial (time not strictly increasing, too few
+ %samples for interp1 or filtfilt) are raised here for the first such trial.
+ %
+ %Kret, M. E., & Sjak-Shie, E. E. (2019). Preprocessing pupil size data:
+ %Guidelines and code. Behavior Research Methods, 51(3), 1336-1342.
+
+ %Inputs
+ %  T        : Sample times in ms of all trials stacked (column vector).
+ %  DIA      : Pupil sizes, same size as T.
+ %  OFFSETS  : Row vector of length numTrial+1, trial t is elements
+ %             OFFSETS(t)+1 to OFFSETS(t+1).
+ %  SETTINGS : Settings struct as returned by rawDataFilter().
+ %  NTHREADS : Number of threads, 0 for one per core.  Optional.
+
+ %Outputs
+ %  VALOUT   : Logical column vector, the valOut of rawDataFilter.m per trial
+ %             stacked like T.
+ %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#include "mex.h"
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
+#include <cmath>
+#include <limits>
+
+static const double NaN = std::numeric_limits<double>::quiet_NaN();
+
+struct FilterSettings {
+    double minDiameter, maxDiameter;
+    double islandSeparation, minIslandWidth;
+    double speedMadMultiplier, speedMaxGap;
+    double gapMinWidth, gapMaxWidth, gapPaddingBackward, gapPaddingForward;
+    int residualsPasses;
+    double residualsMadMultiplier, residualsInterpFs;
+    std::vector<double> lowpassB, lowpassA;
+};
+
+/* nanmedian, by selection */
+static double nanMedian(std::vector<double>& values)
+{
+    values.erase(std::remove_if(values.begin(), values.end(), [](double x) { return std::isnan(x); }), values.end());
+    size_t n = values.size();
+    if (n == 0)
+        return NaN;
+
+    std::nth_element(values.begin(), values.begin() + n/2, values.end());
+    double upper = values[n/2];
+    if (n % 2)
+        return upper;
+    double lower = *std::max_element(values.begin(), values.begin() + n/2);
+    return (lower + upper)/2;
+}
+
+/* madCalc: median + n*MAD */
+static double madThreshold(const std::vector<double>& d, double n, std::vector<double>& scratch)
+{
+    scratch.assign(d.begin(), d.end());
+    double med = nanMedian(scratch);
+    scratch.resize(d.size());
+    for (size_t i = 0; i < d.size(); i++)
+        scratch[i] = std::fabs(d[i] - med);
+    double mad = nanMedian(scratch);
+    return med + n*mad;
+}
+
+/* removeLoners: clusters of valid samples separated by more than islandSeparation
+   from other samples and narrower than minIslandWidth are made invalid */
+static void removeLoners(const double* t, std::vector<char>& valid, const FilterSettings& s)
+{
+    size_t n = valid.size();
+    size_t nrValid = std::count(valid.begin(), valid.end(), 1);
+    if (nrValid < 3)
+        return;
+
+    size_t first = n;    // first sample of the current island
+    size_t last = n;     // last valid sample seen
+    for (size_t i = 0; i <= n; i++) {
+        if (i < n && !valid[i])
+            continue;
+        bool shore = i == n || (last < n && t[i] - t[last] > s.islandSeparation);
+        if (shore && first < n) {
+            // the same arithmetic as the histc bins of rawDataFilter.m
+            double width = (t[last] + 0.001) - (t[first] - 0.001);
+            if (width - 0.002 < s.minIslandWidth) {
+                for (size_t k = first; k <= last; k++)
+                    valid[k] = 0;
+            }
+        }
+        if (i == n)
+            break;
+        if (shore || first == n)
+            first = i;
+        last = i;
+    }
+}
+
+/* expandGaps: valid samples within the padding of a gap between minWidth and maxWidth are made invalid */
+static void expandGaps(const double* t, std::vector<char>& valid, const FilterSettings& s)
+{
+    if (std::isnan(s.gapMinWidth) && std::isnan(s.gapMaxWidth))
+        return;
+    if (!(s.gapPaddingBackward > 0 || s.gapPaddingForward > 0))
+        return;
+
+    std::vector<size_t> validIndx;
+    for (size_t i = 0; i < valid.size(); i++)
+        if (valid[i])
+            validIndx.push_back(i);
+
+    std::vector<double> gapStart, gapEnd;
+    for (size_t k = 0; k + 1 < validIndx.size(); k++) {
+        double gap = t[validIndx[k+1]] - t[validIndx[k]];
+        if (gap > s.gapMinWidth && gap < s.gapMaxWidth) {
+            gapStart.push_back(t[validIndx[k]]);
+            gapEnd.push_back(t[validIndx[k+1]]);
+        }
+    }
+
+    // starts and ends both increase, so the first gap that does not end before a
+    // sample is the only one that can start before it
+    size_t j = 0;
+    for (size_t k = 0; k < validIndx.size(); k++) {
+        double tk = t[validIndx[k]];
+        while (j < gapEnd.size() && !(tk < gapEnd[j] + s.gapPaddingForward))
+            j++;
+        if (j == gapEnd.size())
+            break;
+        if (tk > gapStart[j] - s.gapPaddingBackward)
+            valid[validIndx[k]] = 0;
+    }
+}
+
+/* interp1(x, y, xi, 'linear') for increasing x and xi, NaN outside x */
+static void interpLinear(const std::vector<double>& x, const std::vector<double>& y,
+                         const double* xi, size_t n, std::vector<double>& yi)
+{
+    yi.assign(n, NaN);
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (xi[i] < x.front() || xi[i] > x.back() || std::isnan(xi[i]))
+            continue;
+        while (k + 2 < x.size() && xi[i] > x[k+1])
+            k++;
+        if (xi[i] == x[k+1]) {
+            yi[i] = y[k+1];
+            continue;
+        }
+        double r = (xi[i] - x[k])/(x[k+1] - x[k]);
+        yi[i] = y[k] + r*(y[k+1] - y[k]);
+    }
+}
+
+/* filter(b, a, x, zi) in direct form II transposed, b and a normalized */
+static void filterDF2T(const std::vector<double>& b, const std::vector<double>& a,
+                       std::vector<double>& x, std::vector<double> z)
+{
+    size_t order = b.size() - 1;
+    for (size_t i = 0; i < x.size(); i++) {
+        double xi = x[i];
+        double yi = b[0]*xi + (order ? z[0] : 0);
+        for (size_t k = 0; k + 1 < order; k++)
+            z[k] = b[k+1]*xi + z[k+1] - a[k+1]*yi;
+        if (order)
+            z[order-1] = b[order]*xi - a[order]*yi;
+        x[i] = yi;
+    }
+}
+
+/* filtfilt(b, a, x) as in MATLAB: reflected edges of 3*order samples and the
+   steady state initial conditions scaled by the first sample */
+static void filtfilt(std::vector<double> b, std::vector<double> a, std::vector<double>& x)
+{
+    size_t nfilt = std::max(b.size(), a.size());
+    size_t nfact = std::max((size_t)1, 3*(nfilt - 1));
+    if (x.size() <= nfact)
+        throw std::runtime_error("filtfilt: data must have length more than 3 times filter order");
+    b.resize(nfilt, 0);
+    a.resize(nfilt, 0);
+    double a0 = a[0];
+    for (size_t k = 0; k < nfilt; k++) {
+        b[k] /= a0;
+        a[k] /= a0;
+    }
+
+    // (eye - companion) \ (b(2:end) - b(1)*a(2:end))
+    size_t m = nfilt - 1;
+    std::vector<double> zi(m);
+    if (m > 0) {
+        std::vector<double> M(m*m, 0), rhs(m);
+        for (size_t i = 0; i < m; i++) {
+            M[i*m] = a[i+1];
+            rhs[i] = b[i+1] - b[0]*a[i+1];
+        }
+        M[0] += 1;
+        for (size_t k = 1; k < m; k++) {
+            M[k*m + k] += 1;
+            M[(k-1)*m + k] -= 1;
+        }
+        for (size_t c = 0; c < m; c++) {
+            size_t p = c;
+            for (size_t r = c + 1; r < m; r++)
+                if (std::fabs(M[r*m + c]) > std::fabs(M[p*m + c]))
+                    p = r;
+            if (p != c) {
+                for (size_t k = 0; k < m; k++)
+                    std::swap(M[c*m + k], M[p*m + k]);
+                std::swap(rhs[c], rhs[p]);
+            }
+            for (size_t r = c + 1; r < m; r++) {
+                double f = M[r*m + c]/M[c*m + c];
+                for (size_t k = c; k < m; k++)
+                    M[r*m + k] -= f*M[c*m + k];
+                rhs[r] -= f*rhs[c];
+            }
+        }
+        for (size_t c = m; c-- > 0;) {
+            double v = rhs[c];
+            for (size_t k = c + 1; k < m; k++)
+                v -= M[c*m + k]*zi[k];
+            zi[c] = v/M[c*m + c];
+        }
+    }
+
+    size_t n = x.size();
+    std::vector<double> y(n + 2*nfact);
+    for (size_t i = 0; i < nfact; i++) {
+        y[i] = 2*x[0] - x[nfact - i];
+        y[nfact + n + i] = 2*x[n-1] - x[n - 2 - i];
+    }
+    std::copy(x.begin(), x.end(), y.begin() + nfact);
+
+    std::vector<double> z(m);
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t k = 0; k < m; k++)
+            z[k] = zi[k]*y[0];
+        filterDF2T(b, a, y, z);
+        std::reverse(y.begin(), y.end());
+    }
+    std::copy(y.begin() + nfact, y.begin() + nfact + n, x.begin());
+}
+
+/* deviationCalculator: |dia - smooth trendline of the valid samples| */
+static void deviation(const double* t, const std::vector<double>& dia, const std::vector<char>& valid,
+                      const std::vector<double>& tInterp, const FilterSettings& s, std::vector<double>& dev)
+{
+    size_t n = dia.size();
+    std::vector<double> tValid, diaValid;
+    for (size_t i = 0; i < n; i++) {
+        if (valid[i] && !std::isnan(dia[i])) {
+            tValid.push_back(t[i]);
+            diaValid.push_back(dia[i]);
+        }
+    }
+    if (tValid.size() < 2)
+        throw std::runtime_error("interp1: at least two valid samples are needed for the residuals filter");
+
+    // linear interpolation, nearest neighbour extrapolation
+    std::vector<double> uniform;
+    interpLinear(tValid, diaValid, &tInterp[0], tInterp.size(), uniform);
+    for (size_t i = 0; i < uniform.size(); i++)
+        if (std::isnan(uniform[i]))
+            uniform[i] = tInterp[i] < tValid.front() ? diaValid.front() : diaValid.back();
+
+    filtfilt(s.lowpassB, s.lowpassA, uniform);
+    if (tInterp.size() < 2)
+        throw std::runtime_error("interp1: the residuals filter grid has fewer than two points");
+    interpLinear(tInterp, uniform, t, n, dev);
+    for (size_t i = 0; i < n; i++)
+        dev[i] = std::fabs(dia[i] - dev[i]);
+}
+
+/* rawDataFilter.m for one trial */
+static void rawDataFilter(const double* t, const double* dia, size_t n, const FilterSettings& s, std::vector<char>& valid)
+{
+    std::vector<double> scratch;
+
+    // removeOutOfBounds
+    valid.assign(n, 0);
+    for (size_t i = 0; i < n; i++)
+        valid[i] = !std::isnan(dia[i]) && !(dia[i] > s.maxDiameter) && !(dia[i] < s.minDiameter);
+    double lastT = NaN;
+    for (size_t i = 0; i < n; i++) {
+        if (!valid[i])
+            continue;
+        if (t[i] == lastT)
+            throw std::runtime_error("Time vector not strictly increasing.");
+        lastT = t[i];
+    }
+    removeLoners(t, valid, s);
+
+    // madSpeedFilter
+    std::vector<double> maxSpeed(n, NaN);
+    size_t prev = n;
+    double backSpeed = NaN;
+    for (size_t i = 0; i <= n; i++) {
+        if (i < n && !valid[i])
+            continue;
+        double fwdSpeed = NaN;
+        if (i < n && prev < n) {
+            double dt = t[i] - t[prev];
+            fwdSpeed = dt > s.speedMaxGap ? NaN : (dia[i] - dia[prev])/dt;
+        }
+        if (prev < n) {
+            // max() ignores NaN
+            double b = std::fabs(backSpeed), f = std::fabs(fwdSpeed);
+            maxSpeed[prev] = std::isnan(b) ? f : (std::isnan(f) ? b : std::max(b, f));
+        }
+        backSpeed = fwdSpeed;
+        prev = i;
+    }
+    double thresh = madThreshold(maxSpeed, s.speedMadMultiplier, scratch);
+    for (size_t i = 0; i < n; i++)
+        valid[i] = valid[i] && maxSpeed[i] <= thresh;
+    removeLoners(t, valid, s);
+    expandGaps(t, valid, s);
+
+    // madDeviationFilter
+    if (std::count(valid.begin(), valid.end(), 1) < 3)
+        return;
+    std::vector<double> tInterp;
+    double step = 1000/s.residualsInterpFs;
+    if (n > 0 && t[n-1] >= t[0]) {
+        size_t nInterp = (size_t)std::floor((t[n-1] - t[0])/step*(1 + 1e-12)) + 1;
+        for (size_t k = 0; k < nInterp; k++)
+            tInterp.push_back(t[0] + k*step);
+    }
+
+    std::vector<char> validIn = valid, start;
+    std::vector<double> diaValid(dia, dia + n), residuals;
+    for (size_t i = 0; i < n; i++)
+        if (!validIn[i])
+            diaValid[i] = NaN;
+    for (int pass = 1; pass <= s.residualsPasses; pass++) {
+        start = valid;
+        deviation(t, diaValid, valid, tInterp, s, residuals);
+        thresh = madThreshold(residuals, s.residualsMadMultiplier, scratch);
+        for (size_t i = 0; i < n; i++)
+            valid[i] = residuals[i] <= thresh && validIn[i];
+        removeLoners(t, valid, s);
+        if (pass > 1 && valid == start)
+            break;
+    }
+}
+
+static double getScalarField(const mxArray* settings, const char* name)
+{
+    const mxArray* f = mxGetField(settings, 0, name);
+    if (!f || !mxIsDouble(f) || mxGetNumberOfElements(f) != 1) {
+        mexErrMsgIdAndTxt("MyToolbox:rawDataFilterMex:settings","SETTINGS.%s must be a scalar double.", name);
+    }
+    return mxGetScalar(f);
+}
+
+static std::vector<double> getVectorField(const mxArray* settings, const char* name)
+{
+    const mxArray* f = mxGetField(settings, 0, name);
+    if (!f || !mxIsDouble(f) || mxGetNumberOfElements(f) == 0) {
+        mexErrMsgIdAndTxt("MyToolbox:rawDataFilterMex:settings","SETTINGS.%s must be a double vector.", name);
+    }
+    const double* p = mxGetPr(f);
+    return std::vector<double>(p, p + mxGetNumberOfElements(f));
+}
+
+/* The gateway function */
+void mexFunction( int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[])
+{
+    /* check for proper number of arguments */
+    if(nrhs < 4 || nrhs > 5) {
+        mexErrMsgIdAndTxt("MyToolbox:rawDataFilterMex:nrhs","Four or five inputs required.");
+    }
+    if(nlhs > 1) {
+        mexErrMsgIdAndTxt("MyToolbox:rawDataFilterMex:nlhs","One output required.");
+    }
+    for (int i = 0; i < 3; i++) {
+        if( !mxIsDouble(prhs[i]) || mxIsComplex(prhs[i])) {
+            mexErrMsgIdAndTxt("MyToolbox:rawDataFilterMex:notDouble","T, DIA and OFFSETS must be real doubles.");
+        }
+    }
+    if(!mxIsStruct(prhs[3])) {
+        mexErrMsgIdAndTxt("MyToolbox:rawDataFilterMex:settings","SETTINGS must be the struct returned by rawDataFilter().");
+    }
+
+    const double* t = mxGetPr(prhs[0]);
+    const double* dia = mxGetPr(prhs[1]);
+    size_t nTotal = mxGetNumberOfElements(prhs[0]);
+    if (mxGetNumberOfElements(prhs[1]) != nTotal) {
+        mexErrMsgIdAndTxt("MyToolbox:rawDataFilterMex:size","T and DIA must have the same number of elements.");
+    }
+    const double* offsets = mxGetPr(prhs[2]);
+    size_t numTrial = mxGetNumberOfElements(prhs[2]);
+    if (numTrial == 0) {
+        mexErrMsgIdAndTxt("MyToolbox:rawDataFilterMex:badOffsets","OFFSETS must have numTrial+1 elements.");
+    }
+    numTrial--;
+    for (size_t i = 0; i < numTrial; i++) {
+        if (offsets[i] < 0 || offsets[i] > offsets[i+1] || offsets[i+1] > nTotal) {
+            mexErrMsgIdAndTxt("MyToolbox:rawDataFilterMex:badOffsets","OFFSETS must be increasing and within T.");
+        }
+    }
+
+    FilterSettings s;
+    const mxArray* settings = prhs[3];
+    s.minDiameter = getScalarField(settings, "PupilDiameter_Min");
+    s.maxDiameter = getScalarField(settings, "PupilDiameter_Max");
+    if (!(s.maxDiameter > s.minDiameter)) {
+        mexErrMsgIdAndTxt("MyToolbox:rawDataFilterMex:settings","The maximum must be larger than the minumum.");
+    }
+    s.islandSeparation = getScalarField(settings, "islandFilter_islandSeperation_ms");
+    s.minIslandWidth = getScalarField(settings, "islandFilter_minIslandWidth_ms");
+    s.speedMadMultiplier = getScalarField(settings, "dilationSpeedFilter_MadMultiplier");
+    s.speedMaxGap = getScalarField(settings, "dilationSpeedFilter_maxGap_ms");
+    s.gapMinWidth = getScalarField(settings, "gapDetect_minWidth");
+    s.gapMaxWidth = getScalarField(settings, "gapDetect_maxWidth");
+    s.gapPaddingBackward = getScalarField(settings, "gapPadding_backward");
+    s.gapPaddingForward = getScalarField(settings, "gapPadding_forward");
+    s.residualsPasses = (int)getScalarField(settings, "residualsFilter_passes");
+    s.residualsMadMultiplier = getScalarField(settings, "residualsFilter_MadMultiplier");
+    s.residualsInterpFs = getScalarField(settings, "residualsFilter_interpFs");
+    s.lowpassB = getVectorField(settings, "residualsFilter_lowpassB");
+    s.lowpassA = getVectorField(settings, "residualsFilter_lowpassA");
+    if (s.lowpassA[0] == 0) {
+        mexErrMsgIdAndTxt("MyToolbox:rawDataFilterMex:settings","The first coefficient of SETTINGS.residualsFilter_lowpassA must not be zero.");
+    }
+
+    size_t nThreads = nrhs > 4 ? (size_t)mxGetScalar(prhs[4]) : 0;
+    if (nThreads == 0)
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+    nThreads = std::min(nThreads, std::max((size_t)1, numTrial));
+
+    // trials are handed out one at a time, errors are kept per trial for the main thread
+    std::vector<std::vector<char> > valid(numTrial);
+    std::vector<std::string> errors(numTrial);
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        for (size_t i = next++; i < numTrial; i = next++) {
+            size_t from = (size_t)offsets[i];
+            try {
+                rawDataFilter(t + from, dia + from, (size_t)offsets[i+1] - from, s, valid[i]);
+            } catch (std::exception& e) {
+                errors[i] = e.what();
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < nThreads; i++)
+        workers.push_back(std::thread(work));
+    work();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    for (size_t i = 0; i < numTrial; i++) {
+        if (!errors[i].empty()) {
+            mexErrMsgIdAndTxt("MyToolbox:rawDataFilterMex:trial","Trial %d: %s", (int)i + 1, errors[i].c_str());
+        }
+    }
+
+    plhs[0] = mxCreateLogicalMatrix(nTotal, 1);
+    mxLogical* out = mxGetLogicals(plhs[0]);
+    for (size_t i = 0; i < numTrial; i++)
+        for (size_t k = 0; k < valid[i].size(); k++)
+            out[(size_t)offsets[i] + k] = valid[i][k] != 0;
+}
@@ -0,0 +1,348 @@
+/*==========================================================
+ * resampleEyeMex.cc - [OUT, NEWOFFSETS, T]=resampleEyeMex(D, OFFSETS, VALID, COLS, ONGRID, NTHREADS);
+ %function [OUT, NEWOFFSETS, T]=resampleEyeMex(D, OFFSETS, VALID, COLS, ONGRID, NTHREADS);
+ %Timestamp repair, blink interpolation and resampling to the 1 ms grid of
+ %upSample.m and rmBlink.m for all trials of a subject in one call, with the
+ %trials spread over a pool of threads.
+ %This is a MEX-file for MATLAB.
+ % compiled on OS X: mex CXXFLAGS='$CXXFLAGS -std=c++11' resampleEyeMex.cc
+ % compiled on Windows: mex resampleEyeMex.cc
+ % compiled on Linux: mex CXXFLAGS='$CXXFLAGS -std=c++11 -pthread' LDFLAGS='$LDFLAGS -pthread' resampleEyeMex.cc
+ %
+ %The timestamps of a trial get the passes of rmDupes.m until they are strictly
+ %increasing, as in the while loops of upSample.m and rmBlink.m.  The
+ %duplicates are found once per trial and each pass only looks again at the
+ %stamps it moved, instead of a series of find calls over the whole trial.
+ %Timestamps that go backwards, on which that loop never ends, are instead
+ %pushed forward to one ms after the previous sample.  A trial is then copied
+ %to a row per sample layout and every output row is interpolated from the two
+ %bracketing samples in one sweep over all columns, the columns in COLS from
+ %the two bracketing valid samples.
+ %
+ %Inputs
+ %  D        : Samples of all trials stacked (rows=samples), column 1 is the
+ %             time in ms.
+ %  OFFSETS  : Row vector of length numTrial+1, trial t is rows
+ %             OFFSETS(t)+1 to OFFSETS(t+1) of D.
+ %  VALID    : Logical vector with a row per row of D, or [].  Where false,
+ %             the columns in COLS are interpolated linearly from the valid
+ %             samples around them (NaN outside the first and last valid
+ %             sample), as rmBlink.m does for blinks.
+ %  COLS     : Columns masked by VALID, [] for none.
+ %  ONGRID   : true for the rows of upSample.m, t(1):1:t(end) with column 1
+ %             set to that grid; false to keep the rows and column 1 of D.
+ %  NTHREADS : Number of threads, 0 for one per core.  Optional.
+
+ %Outputs
+ %  OUT        : The stacked trials after interpolation.
+ %  NEWOFFSETS : The trial offsets in OUT.
+ %  T          : The repaired timestamps, stacked like D.
+ %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#include "mex.h"
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+static const double NaN = std::numeric_limits<double>::quiet_NaN();
+
+/* the positions i of sep and around the touched stamps with t[i+1] == t[i],
+ * the find(diff(t)==0) of rmDupes.m.  Only a touched stamp can start or end
+ * a duplicate, so the rest of the trial is not scanned again. */
+static void refreshSep(const std::vector<double>& t, std::vector<size_t>& sep, std::vector<size_t>& touched)
+{
+    size_t n = t.size();
+    for (size_t k = 0; k < touched.size(); k++) {
+        if (touched[k] > 0)
+            sep.push_back(touched[k] - 1);
+        sep.push_back(touched[k]);
+    }
+    touched.clear();
+    std::sort(sep.begin(), sep.end());
+    sep.erase(std::unique(sep.begin(), sep.end()), sep.end());
+    size_t m = 0;
+    for (size_t k = 0; k < sep.size(); k++)
+        if (sep[k] + 1 < n && t[sep[k]+1] - t[sep[k]] == 0)
+            sep[m++] = sep[k];
+    sep.resize(m);
+}
+
+/* one call of rmDupes.m (0 based), sep holds its duplicates on entry and exit */
+static void rmDupesPass(std::vector<double>& t, std::vector<size_t>& sep, std::vector<size_t>& touched)
+{
+    if (!sep.empty() && sep[0] == 0) {
+        t[0] = t[0] - 1;
+        touched.push_back(0);
+        refreshSep(t, sep, touched);
+    }
+    for (size_t k = 0; k < sep.size(); k++)
+        if (sep[k] > 0 && t[sep[k]] - t[sep[k]-1] >= 2) {
+            t[sep[k]] = t[sep[k]] - 1;
+            touched.push_back(sep[k]);
+        }
+
+    refreshSep(t, sep, touched);
+    for (size_t k = 0; k + 1 < sep.size(); k++)
+        if (t[sep[k]+2] - t[sep[k]+1] == 2) {
+            t[sep[k]+1] = t[sep[k]+1] + 1;
+            touched.push_back(sep[k]+1);
+        }
+
+    refreshSep(t, sep, touched);
+    for (size_t k = 0; k < sep.size(); k++) {
+        t[sep[k]+1] = t[sep[k]+1] + 1;
+        touched.push_back(sep[k]+1);
+    }
+    refreshSep(t, sep, touched);
+}
+
+/* while any(diff(t)<=0), t = rmDupes(t); end */
+static void repairTimes(std::vector<double>& t)
+{
+    std::vector<size_t> sep, touched;
+    for (size_t i = 0; i + 1 < t.size(); i++)
+        if (t[i+1] - t[i] == 0)
+            sep.push_back(i);
+    // every pass with duplicates left changes t, so this ends
+    while (!sep.empty())
+        rmDupesPass(t, sep, touched);
+
+    // only samples going back in time are left, rmDupes does not touch those
+    // and the MATLAB loop never ends on them; NaN times can't be repaired
+    for (size_t i = 1; i < t.size(); i++)
+        if (t[i] - t[i-1] <= 0)
+            t[i] = t[i-1] + 1;
+}
+
+/* interp1(t, x, q, 'linear') for every column of the row per sample buffer x (n rows, c columns) */
+static void interpolateAll(const std::vector<double>& t, const std::vector<double>& x, size_t c,
+                           const std::vector<double>& q, std::vector<double>& y)
+{
+    size_t n = t.size(), nq = q.size();
+    y.assign(nq*c, NaN);
+    if (n == 0)
+        return;
+
+    size_t k = 0;
+    for (size_t i = 0; i < nq; i++) {
+        if (!(q[i] >= t[0] && q[i] <= t[n-1]))
+            continue;
+        while (k + 2 < n && q[i] > t[k+1])
+            k++;
+        double* yi = &y[i*c];
+        if (n == 1 || q[i] == t[k]) {
+            std::copy(&x[k*c], &x[k*c] + c, yi);
+        } else if (q[i] == t[k+1]) {
+            std::copy(&x[(k+1)*c], &x[(k+1)*c] + c, yi);
+        } else {
+            double r = (q[i] - t[k])/(t[k+1] - t[k]);
+            const double* x0 = &x[k*c];
+            const double* x1 = &x[(k+1)*c];
+            for (size_t j = 0; j < c; j++)
+                yi[j] = x0[j] + r*(x1[j] - x0[j]);
+        }
+    }
+}
+
+/* interp1(t(valid), x(valid), q, 'linear') for the masked columns of x, into the rows y */
+static void interpolateMasked(const std::vector<double>& t, const std::vector<double>& x, size_t c,
+                              const std::vector<char>& masked, const std::vector<char>& valid,
+                              const std::vector<double>& q, std::vector<double>& y)
+{
+    size_t n = t.size(), nq = q.size();
+    std::vector<size_t> v;
+    for (size_t i = 0; i < n; i++)
+        if (valid[i])
+            v.push_back(i);
+    std::vector<size_t> cols;
+    for (size_t j = 0; j < c; j++)
+        if (masked[j])
+            cols.push_back(j);
+    size_t nv = v.size();
+    size_t k = 0;
+    for (size_t i = 0; i < nq; i++) {
+        double* yi = &y[i*c];
+        if (nv == 0 || !(q[i] >= t[v[0]] && q[i] <= t[v[nv-1]])) {
+            for (size_t j = 0; j < cols.size(); j++)
+                yi[cols[j]] = NaN;
+            continue;
+        }
+        while (k + 2 < nv && q[i] > t[v[k+1]])
+            k++;
+        size_t a = v[k], b = nv > 1 ? v[k+1] : v[k];
+        if (q[i] == t[a] || nv == 1) {
+            for (size_t j = 0; j < cols.size(); j++)
+                yi[cols[j]] = x[a*c + cols[j]];
+        } else if (q[i] == t[b]) {
+            for (size_t j = 0; j < cols.size(); j++)
+                yi[cols[j]] = x[b*c + cols[j]];
+        } else {
+            double r = (q[i] - t[a])/(t[b] - t[a]);
+            for (size_t j = 0; j < cols.size(); j++)
+                yi[cols[j]] = x[a*c + cols[j]] + r*(x[b*c + cols[j]] - x[a*c + cols[j]]);
+        }
+    }
+}
+
+struct TrialResult {
+    std::vector<double> times;  // repaired timestamps
+    std::vector<double> rows;   // output, a row per sample
+    size_t nrRows;
+};
+
+static void resampleTrial(const double* D, size_t nTotal, size_t c, size_t from, size_t to,
+                          const double* valid, const std::vector<char>& masked, bool onGrid, TrialResult& result)
+{
+    size_t n = to - from;
+    result.times.assign(D + from, D + to);
+    repairTimes(result.times);
+
+    // row per sample, so the interpolation reads and writes contiguous rows
+    std::vector<double> x(n*c);
+    for (size_t j = 0; j < c; j++)
+        for (size_t i = 0; i < n; i++)
+            x[i*c + j] = D[from + i + j*nTotal];
+    std::vector<char> v;
+    if (valid) {
+        v.resize(n);
+        for (size_t i = 0; i < n; i++)
+            v[i] = valid[from + i] != 0;
+    }
+
+    if (onGrid) {
+        // t(1):1:t(end)
+        std::vector<double> q;
+        if (n > 0 && result.times[n-1] >= result.times[0]) {
+            size_t nq = (size_t)std::floor(result.times[n-1] - result.times[0]) + 1;
+            for (size_t i = 0; i < nq; i++)
+                q.push_back(result.times[0] + i);
+        }
+        interpolateAll(result.times, x, c, q, result.rows);
+        if (!v.empty())
+            interpolateMasked(result.times, x, c, masked, v, q, result.rows);
+        for (size_t i = 0; i < q.size(); i++)
+            result.rows[i*c] = q[i];
+        result.nrRows = q.size();
+    } else {
+        // the rows and the columns that are not masked stay as they are
+        result.rows = x;
+        if (!v.empty())
+            interpolateMasked(result.times, x, c, masked, v, result.times, result.rows);
+        result.nrRows = n;
+    }
+}
+
+/* The gateway function */
+void mexFunction( int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[])
+{
+    /* check for proper number of arguments */
+    if(nrhs < 5 || nrhs > 6) {
+        mexErrMsgIdAndTxt("MyToolbox:resampleEyeMex:nrhs","Five or six inputs required.");
+    }
+    if(nlhs > 3) {
+        mexErrMsgIdAndTxt("MyToolbox:resampleEyeMex:nlhs","At most three outputs.");
+    }
+    if( !mxIsDouble(prhs[0]) || mxIsComplex(prhs[0]) || !mxIsDouble(prhs[1])) {
+        mexErrMsgIdAndTxt("MyToolbox:resampleEyeMex:notDouble","D and OFFSETS must be real doubles.");
+    }
+
+    const double* D = mxGetPr(prhs[0]);
+    size_t nTotal = mxGetM(prhs[0]);
+    size_t c = mxGetN(prhs[0]);
+    if (c < 1) {
+        mexErrMsgIdAndTxt("MyToolbox:resampleEyeMex:badD","D must have the time in its first column.");
+    }
+    const double* offsets = mxGetPr(prhs[1]);
+    size_t numTrial = mxGetNumberOfElements(prhs[1]);
+    if (numTrial == 0) {
+        mexErrMsgIdAndTxt("MyToolbox:resampleEyeMex:badOffsets","OFFSETS must have numTrial+1 elements.");
+    }
+    numTrial--;
+    for (size_t i = 0; i < numTrial; i++) {
+        if (offsets[i] < 0 || offsets[i] > offsets[i+1] || offsets[i+1] > nTotal) {
+            mexErrMsgIdAndTxt("MyToolbox:resampleEyeMex:badOffsets","OFFSETS must be increasing and within the rows of D.");
+        }
+    }
+
+    // VALID as doubles, so logical and double masks are read the same way
+    std::vector<double> validCopy;
+    const double* valid = NULL;
+    if (!mxIsEmpty(prhs[2])) {
+        if (mxGetNumberOfElements(prhs[2]) != nTotal || !(mxIsLogical(prhs[2]) || mxIsDouble(prhs[2]))) {
+            mexErrMsgIdAndTxt("MyToolbox:resampleEyeMex:badValid","VALID must be [] or a logical vector with a row per row of D.");
+        }
+        if (mxIsLogical(prhs[2])) {
+            const mxLogical* l = mxGetLogicals(prhs[2]);
+            validCopy.assign(l, l + nTotal);
+            valid = validCopy.data();
+        } else {
+            valid = mxGetPr(prhs[2]);
+        }
+    }
+
+    std::vector<char> masked(c, 0);
+    if (!mxIsEmpty(prhs[3])) {
+        if (!mxIsDouble(prhs[3])) {
+            mexErrMsgIdAndTxt("MyToolbox:resampleEyeMex:badCols","COLS must be a double vector.");
+        }
+        const double* cols = mxGetPr(prhs[3]);
+        for (size_t i = 0; i < mxGetNumberOfElements(prhs[3]); i++) {
+            if (cols[i] < 2 || cols[i] > c || cols[i] != std::floor(cols[i])) {
+                mexErrMsgIdAndTxt("MyToolbox:resampleEyeMex:badCols","COLS must be column numbers of D other than the time column.");
+            }
+            masked[(size_t)cols[i] - 1] = 1;
+        }
+    }
+    if (!valid)
+        std::fill(masked.begin(), masked.end(), 0);
+    bool onGrid = mxGetScalar(prhs[4]) != 0;
+
+    size_t nThreads = nrhs > 5 ? (size_t)mxGetScalar(prhs[5]) : 0;
+    if (nThreads == 0)
+        nThreads = std::max(1u, std::thread::hardware_concurrency());
+    nThreads = std::min(nThreads, std::max((size_t)1, numTrial));
+
+    // trials are handed out one at a time, so long and short trials even out
+    std::vector<TrialResult> results(numTrial);
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        for (size_t i = next++; i < numTrial; i = next++)
+            resampleTrial(D, nTotal, c, (size_t)offsets[i], (size_t)offsets[i+1], valid, masked, onGrid, results[i]);
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < nThreads; i++)
+        workers.push_back(std::thread(work));
+    work();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    size_t nOut = 0;
+    plhs[1] = mxCreateDoubleMatrix(1, numTrial + 1, mxREAL);
+    double* newOffsets = mxGetPr(plhs[1]);
+    for (size_t i = 0; i < numTrial; i++) {
+        newOffsets[i] = (double)nOut;
+        nOut += results[i].nrRows;
+    }
+    newOffsets[numTrial] = (double)nOut;
+
+    plhs[0] = mxCreateDoubleMatrix(nOut, c, mxREAL);
+    double* out = mxGetPr(plhs[0]);
+    for (size_t i = 0; i < numTrial; i++) {
+        const std::vector<double>& rows = results[i].rows;
+        size_t base = (size_t)newOffsets[i];
+        for (size_t r = 0; r < results[i].nrRows; r++)
+            for (size_t j = 0; j < c; j++)
+                out[base + r + j*nOut] = rows[r*c + j];
+    }
+
+    if (nlhs > 2) {
+        plhs[2] = mxCreateDoubleMatrix(nTotal, 1, mxREAL);
+        double* t = mxGetPr(plhs[2]);
+        for (size_t i = 0; i < numTrial; i++)
+            std::copy(results[i].times.begin(), results[i].times.end(), t + (size_t)offsets[i]);
+    }
+}
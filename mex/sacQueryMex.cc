@@ -0,0 +1,187 @@
+/*==========================================================
+ * sacQueryMex.cc - [VAL]=sacQueryMex(TRIAL, IDX, VALUE, NTIME, GROUPS, KIND, WINDOW);
+ %function [VAL]=sacQueryMex(TRIAL, IDX, VALUE, NTIME, GROUPS, KIND, WINDOW);
+ %Condition averaged, smoothed microsaccade rate and feature time courses of
+ %getValues_sj.m, straight from the events of getSacEvents.m instead of the
+ %time x trial matrices of getSacMTX.m.
+ %This is a MEX-file for MATLAB.
+ % compiled on OS X: mex CXXFLAGS='$CXXFLAGS -std=c++11' sacQueryMex.cc
+ % compiled on Windows: mex sacQueryMex.cc
+ % compiled on Linux: mex CXXFLAGS='$CXXFLAGS -std=c++11' sacQueryMex.cc
+ %
+ %Each condition costs one pass over the events and a few over the time axis.
+ %The per time point sums over the trials of a condition are scattered from the
+ %events, and the moving mean of smoothdata(...,'movmean',WINDOW) (a centred
+ %window that shrinks at the ends) is taken from prefix sums.
+ %
+ %Inputs
+ %  TRIAL    : Trial number of every event.
+ %  IDX      : Time point (row of the getSacMTX.m matrix, 1 to NTIME) of every
+ %             event.  Events outside 1 to NTIME are left out.
+ %  VALUE    : Feature of every event (amplitude, velocity or angle), not used
+ %             for 'rate'.
+ %  NTIME    : Number of time points.
+ %  GROUPS   : Logical matrix, trials x conditions, the trials averaged per
+ %             condition (the rmIdx of getIV.m side by side).
+ %  KIND     : 'rate'  mean number of events per trial, then smoothed;
+ %             'mean'  mean feature over the events, gaps interpolated
+ %                     linearly with both ends set to the mean, then smoothed;
+ %             'cos', 'sin'  as 'mean' for the cosine/sine of the mean angle.
+ %  WINDOW   : Length of the moving mean (getValues_sj.m uses 100 for rates
+ %             and 500 for features).
+
+ %Outputs
+ %  VAL      : Conditions x NTIME.  Rows of conditions without trials (rate)
+ %             or without events (features) are NaN.
+ %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#include "mex.h"
+#include <vector>
+#include <string>
+#include <cmath>
+#include <limits>
+
+static const double NaN = std::numeric_limits<double>::quiet_NaN();
+
+/* movmean(x, window) with shrinking ends, from prefix sums */
+static void movingMean(std::vector<double>& x, size_t window)
+{
+    size_t n = x.size();
+    std::vector<double> prefix(n + 1, 0);
+    for (size_t i = 0; i < n; i++)
+        prefix[i+1] = prefix[i] + x[i];
+
+    // even windows hold one more point before than after
+    size_t before = window/2, after = (window - 1)/2;
+    for (size_t i = 0; i < n; i++) {
+        size_t from = i > before ? i - before : 0;
+        size_t to = std::min(n, i + after + 1);
+        x[i] = (prefix[to] - prefix[from])/(to - from);
+    }
+}
+
+/* the feature branch of getValues_sj.m for one condition: d([1 end]) = mean, interp1 over the gaps, movmean.
+   Returns false where getValues_sj.m keeps the unsmoothed row (interp1 fails). */
+static bool fillAndSmooth(std::vector<double>& d, size_t window)
+{
+    size_t n = d.size();
+    double sum = 0;
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!std::isnan(d[i])) {
+            sum += d[i];
+            count++;
+        }
+    }
+    if (count == 0 || n < 2)
+        return false;
+    d[0] = d[n-1] = sum/count;
+
+    // both ends are set, so every gap lies between two points
+    size_t last = 0;
+    for (size_t i = 1; i < n; i++) {
+        if (std::isnan(d[i]))
+            continue;
+        for (size_t k = last + 1; k < i; k++)
+            d[k] = d[last] + (double)(k - last)/(i - last)*(d[i] - d[last]);
+        last = i;
+    }
+    movingMean(d, window);
+    return true;
+}
+
+/* The gateway function */
+void mexFunction( int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[])
+{
+    /* check for proper number of arguments */
+    if(nrhs != 7) {
+        mexErrMsgIdAndTxt("MyToolbox:sacQueryMex:nrhs","Seven inputs required.");
+    }
+    if(nlhs > 1) {
+        mexErrMsgIdAndTxt("MyToolbox:sacQueryMex:nlhs","One output required.");
+    }
+    for (int i = 0; i < 4; i++) {
+        if( !mxIsDouble(prhs[i]) || mxIsComplex(prhs[i])) {
+            mexErrMsgIdAndTxt("MyToolbox:sacQueryMex:notDouble","TRIAL, IDX, VALUE and NTIME must be real doubles.");
+        }
+    }
+    if(!mxIsLogical(prhs[4])) {
+        mexErrMsgIdAndTxt("MyToolbox:sacQueryMex:groups","GROUPS must be a logical matrix, trials x conditions.");
+    }
+    if(!mxIsChar(prhs[5])) {
+        mexErrMsgIdAndTxt("MyToolbox:sacQueryMex:kind","KIND must be 'rate', 'mean', 'cos' or 'sin'.");
+    }
+
+    const double* trial = mxGetPr(prhs[0]);
+    const double* idx = mxGetPr(prhs[1]);
+    const double* value = mxGetPr(prhs[2]);
+    size_t nEvents = mxGetNumberOfElements(prhs[0]);
+    if (mxGetNumberOfElements(prhs[1]) != nEvents) {
+        mexErrMsgIdAndTxt("MyToolbox:sacQueryMex:size","TRIAL and IDX must have the same number of elements.");
+    }
+    size_t nTime = (size_t)mxGetScalar(prhs[3]);
+    const mxLogical* groups = mxGetLogicals(prhs[4]);
+    size_t numTrial = mxGetM(prhs[4]);
+    size_t nGroups = mxGetN(prhs[4]);
+    char* buf = mxArrayToString(prhs[5]);
+    std::string kind = buf;
+    mxFree(buf);
+    bool rate = kind == "rate";
+    if (!rate && kind != "mean" && kind != "cos" && kind != "sin") {
+        mexErrMsgIdAndTxt("MyToolbox:sacQueryMex:kind","KIND must be 'rate', 'mean', 'cos' or 'sin'.");
+    }
+    if (!rate && mxGetNumberOfElements(prhs[2]) != nEvents) {
+        mexErrMsgIdAndTxt("MyToolbox:sacQueryMex:size","VALUE must have an element per event.");
+    }
+    double window = mxGetScalar(prhs[6]);
+    if (!(window >= 1)) {
+        mexErrMsgIdAndTxt("MyToolbox:sacQueryMex:window","WINDOW must be at least 1.");
+    }
+
+    plhs[0] = mxCreateDoubleMatrix(nGroups, nTime, mxREAL);
+    double* out = mxGetPr(plhs[0]);
+    std::vector<double> sum(nTime), count(nTime);
+    for (size_t g = 0; g < nGroups; g++) {
+        const mxLogical* member = groups + g*numTrial;
+        size_t nMembers = 0;
+        for (size_t t = 0; t < numTrial; t++)
+            nMembers += member[t] != 0;
+
+        std::fill(sum.begin(), sum.end(), 0);
+        std::fill(count.begin(), count.end(), 0);
+        for (size_t e = 0; e < nEvents; e++) {
+            double tr = trial[e], i = idx[e];
+            if (!(tr >= 1 && tr <= numTrial && i >= 1 && i <= nTime) || !member[(size_t)tr - 1])
+                continue;
+            if (rate) {
+                sum[(size_t)i - 1] += 1;
+            } else if (!std::isnan(value[e])) {
+                sum[(size_t)i - 1] += value[e];
+                count[(size_t)i - 1] += 1;
+            }
+        }
+
+        std::vector<double> row(nTime, NaN);
+        if (rate) {
+            if (nMembers > 0) {
+                for (size_t i = 0; i < nTime; i++)
+                    row[i] = sum[i]/nMembers;
+                movingMean(row, (size_t)window);
+            }
+        } else {
+            for (size_t i = 0; i < nTime; i++)
+                if (count[i] > 0)
+                    row[i] = sum[i]/count[i];
+            std::vector<double> raw = row;
+            if (kind == "cos" || kind == "sin")
+                for (size_t i = 0; i < nTime; i++)
+                    row[i] = kind == "cos" ? std::cos(row[i]) : std::sin(row[i]);
+            // where interp1 fails getValues_sj.m keeps the mean before cos/sin
+            if (!fillAndSmooth(row, (size_t)window))
+                row.swap(raw);
+        }
+        for (size_t i = 0; i < nTime; i++)
+            out[g + i*nGroups] = row[i];
+    }
+}
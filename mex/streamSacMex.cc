@@ -0,0 +1,423 @@
+/*==========================================================
+ * streamSacMex.cc - [OUT]=streamSacMex(COMMAND, ...);
+ %function [OUT]=streamSacMex(COMMAND, ...);
+ %Online Engbert & Kliegl microsaccade detection on eye tracker samples as they
+ %are recorded, for gaze-contingent experiments.
+ %This is a MEX-file for MATLAB.
+ % compiled on OS X: mex CXXFLAGS='$CXXFLAGS -std=c++11' streamSacMex.cc
+ % compiled on Windows: mex streamSacMex.cc
+ % compiled on Linux: mex CXXFLAGS='$CXXFLAGS -std=c++11' streamSacMex.cc
+ %
+ %microsacc.m takes the velocity SD of a whole trial, so it can only run once the
+ %trial is over.  Here the robust SD sqrt(median(v.^2)-median(v)^2) is taken over
+ %a sliding window of the last WINDOW velocity samples instead, kept in a ring
+ %buffer with two balanced search trees per median.  Each sample costs
+ %O(log WINDOW) and the memory stays fixed however long the recording runs.  A
+ %sample counts as above threshold with the threshold of the window that ends
+ %at that sample.  VFAC and MINDUR mean the same as in microsacc.m.
+ %
+ %The velocity of a sample is the central difference, so it is known when the
+ %next sample comes in.  A saccade onset is reported as soon as MINDUR samples
+ %are above threshold and the saccade itself on its first sample below threshold,
+ %so the latency is MINDUR+1 samples for the onset and 2 samples for the end.
+ %
+ %Usage
+ %  H = streamSacMex('create', VFAC, MINDUR, FS, WINDOW, NEYES);
+ %      new detector.  WINDOW is the length of the sliding window in samples
+ %      (e.g. 2*FS), NEYES is 1 (columns x y) or 2 (columns left x, left y,
+ %      right x, right y).  Detection starts once the window holds
+ %      min(WINDOW,FS/10) samples.
+ %  EVENTS = streamSacMex('push', H, SAMPLES);
+ %      adds SAMPLES (rows=samples, 2*NEYES columns) and returns the events
+ %      they complete, one row per event:
+ %        eye (1 or 2), type (1 onset, 2 saccade), onset, offset, vpeak, dx, dy, dX, dY
+ %      onset and offset are sample numbers counted from 1 at the first pushed
+ %      sample, the other columns are those of microsacc.m.  Onset events have
+ %      the offset and amplitudes as far as the saccade has got.
+ %  EVENTS = streamSacMex('flush', H);
+ %      end of the recording: the last sample gets velocity 0 like in
+ %      detectSac.m and a saccade still running is closed.  The detector then
+ %      starts over as after reset.
+ %  RADIUS = streamSacMex('threshold', H);
+ %      current VFAC*SD per eye, rows are eyes, columns x and y (NaN while
+ %      warming up).
+ %  streamSacMex('reset', H);
+ %      forget all samples, e.g. at the start of a new trial.
+ %  streamSacMex('delete', H);
+ %
+ %Engbert, R., & Kliegl, R. (2003). Microsaccades uncover the orientation of
+ %covert attention. Vision Research, 43(9), 1035-1045.
+ %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
+
+#include "mex.h"
+#include <vector>
+#include <set>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <limits>
+
+static const double NaN = std::numeric_limits<double>::quiet_NaN();
+
+/* median, mean and mean square of the last n values, NaNs are kept in the window but not counted */
+class SlidingMedian
+{
+public:
+    explicit SlidingMedian(size_t n) : ring(n, NaN), pos(0), sum(0), sum2(0), nrValid(0) {}
+
+    void reset()
+    {
+        std::fill(ring.begin(), ring.end(), NaN);
+        pos = 0;
+        lo.clear();
+        hi.clear();
+        sum = sum2 = 0;
+        nrValid = 0;
+    }
+
+    void add(double x)
+    {
+        remove(ring[pos]);
+        ring[pos] = x;
+        pos = (pos + 1) % ring.size();
+        if (std::isnan(x))
+            return;
+
+        if (lo.empty() || x <= *lo.rbegin())
+            lo.insert(x);
+        else
+            hi.insert(x);
+        sum += x;
+        sum2 += x*x;
+        nrValid++;
+        balance();
+    }
+
+    size_t count() const { return nrValid; }
+
+    double median() const
+    {
+        if (lo.empty())
+            return NaN;
+        if (lo.size() > hi.size())
+            return *lo.rbegin();
+        return (*lo.rbegin() + *hi.begin())/2;
+    }
+
+    double mean() const { return sum/nrValid; }
+    double meanSquare() const { return sum2/nrValid; }
+
+private:
+    void remove(double x)
+    {
+        if (std::isnan(x))
+            return;
+        std::multiset<double>::iterator it;
+        if (!lo.empty() && x <= *lo.rbegin() && (it = lo.find(x)) != lo.end())
+            lo.erase(it);
+        else
+            hi.erase(hi.find(x));
+        sum -= x;
+        sum2 -= x*x;
+        nrValid--;
+        if (nrValid == 0)
+            sum = sum2 = 0;
+        balance();
+    }
+
+    // lo holds the lower half and one more for an odd count
+    void balance()
+    {
+        while (lo.size() > hi.size() + 1) {
+            std::multiset<double>::iterator it = --lo.end();
+            hi.insert(*it);
+            lo.erase(it);
+        }
+        while (hi.size() > lo.size()) {
+            lo.insert(*hi.begin());
+            hi.erase(hi.begin());
+        }
+    }
+
+    std::vector<double> ring;
+    size_t pos;
+    std::multiset<double> lo, hi;
+    double sum, sum2;
+    size_t nrValid;
+};
+
+/* the robust SD of microsacc.m over the window, NaN where microsacc.m has none */
+static double robustSD(const SlidingMedian& v, const SlidingMedian& v2)
+{
+    double med = v.median();
+    double var = v2.median() - med*med;
+    double msd = var > 0 ? std::sqrt(var) : (std::isnan(var) ? var : 0);
+    if (msd < DBL_MIN) {
+        double mean = v.mean();
+        var = v.meanSquare() - mean*mean;
+        msd = var > 0 ? std::sqrt(var) : (std::isnan(var) ? var : 0);
+        if (msd < DBL_MIN)
+            return NaN;
+    }
+    return msd;
+}
+
+/* one eye */
+class EyeDetector
+{
+public:
+    EyeDetector(double VFAC, size_t MINDUR, double fs, size_t window, size_t warmup)
+        : VFAC(VFAC), MINDUR(MINDUR), fs(fs), warmup(warmup),
+          medx(window), medy(window), medx2(window), medy2(window)
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        medx.reset();
+        medy.reset();
+        medx2.reset();
+        medy2.reset();
+        nrSamples = 0;
+        radiusx = radiusy = NaN;
+        runLength = 0;
+    }
+
+    // event rows are appended to events, eye is the first column
+    void push(double x, double y, double eye, std::vector<double>& events)
+    {
+        nrSamples++;
+        if (nrSamples == 1) {
+            // like getMsac, the first sample has velocity 0
+        } else if (nrSamples == 2) {
+            process(1, prevx, prevy, 0, 0, eye, events);
+        } else {
+            process(nrSamples - 1, prevx, prevy, (x - prev2x)*fs/2, (y - prev2y)*fs/2, eye, events);
+        }
+        prev2x = prevx;
+        prev2y = prevy;
+        prevx = x;
+        prevy = y;
+    }
+
+    void flush(double eye, std::vector<double>& events)
+    {
+        if (nrSamples > 0)
+            process(nrSamples, prevx, prevy, 0, 0, eye, events);
+        endRun(eye, events);
+        reset();
+    }
+
+    double radiusx, radiusy;
+
+private:
+    // sample number n (1 based) with its velocity
+    void process(double n, double x, double y, double vx, double vy, double eye, std::vector<double>& events)
+    {
+        medx.add(vx);
+        medy.add(vy);
+        medx2.add(std::isnan(vx) ? NaN : vx*vx);
+        medy2.add(std::isnan(vy) ? NaN : vy*vy);
+
+        radiusx = radiusy = NaN;
+        if (medx.count() >= warmup && medy.count() >= warmup) {
+            radiusx = VFAC*robustSD(medx, medx2);
+            radiusy = VFAC*robustSD(medy, medy2);
+        }
+
+        // NaN velocities or thresholds are never above
+        double tx = vx/radiusx, ty = vy/radiusy;
+        if (!(tx*tx + ty*ty > 1)) {
+            endRun(eye, events);
+            return;
+        }
+
+        double v = std::sqrt(vx*vx + vy*vy);
+        if (runLength == 0) {
+            onset = n;
+            vpeak = NaN;
+            startx = x;
+            starty = y;
+            minx = maxx = x;
+            miny = maxy = y;
+            minxAt = maxxAt = minyAt = maxyAt = n;
+        }
+        runLength++;
+        offset = n;
+        endx = x;
+        endy = y;
+        if (!std::isnan(v) && (std::isnan(vpeak) || v > vpeak))
+            vpeak = v;
+        // first occurrence of the extremes, NaNs ignored, as min/max in microsacc.m
+        track(x, n, minx, minxAt, maxx, maxxAt);
+        track(y, n, miny, minyAt, maxy, maxyAt);
+
+        if (runLength == MINDUR)
+            emit(eye, 1, events);
+    }
+
+    static void track(double x, double n, double& minVal, double& minAt, double& maxVal, double& maxAt)
+    {
+        if (std::isnan(x))
+            return;
+        if (std::isnan(minVal) || x < minVal) {
+            minVal = x;
+            minAt = n;
+        }
+        if (std::isnan(maxVal) || x > maxVal) {
+            maxVal = x;
+            maxAt = n;
+        }
+    }
+
+    static double sign(double x)
+    {
+        return (x > 0) - (x < 0);
+    }
+
+    void emit(double eye, double type, std::vector<double>& events)
+    {
+        double row[9] = { eye, type, onset, offset, vpeak, endx - startx, endy - starty,
+                          sign(maxxAt - minxAt)*(maxx - minx), sign(maxyAt - minyAt)*(maxy - miny) };
+        events.insert(events.end(), row, row + 9);
+    }
+
+    void endRun(double eye, std::vector<double>& events)
+    {
+        if (runLength >= MINDUR && runLength > 0)
+            emit(eye, 2, events);
+        runLength = 0;
+    }
+
+    double VFAC;
+    size_t MINDUR;
+    double fs;
+    size_t warmup;
+    SlidingMedian medx, medy, medx2, medy2;
+    size_t nrSamples;
+    double prevx, prevy, prev2x, prev2y;
+
+    // the saccade being followed
+    size_t runLength;
+    double onset, offset, vpeak, startx, starty, endx, endy;
+    double minx, maxx, miny, maxy, minxAt, maxxAt, minyAt, maxyAt;
+};
+
+typedef std::vector<EyeDetector> Detector;
+
+// detectors by handle
+static std::map<unsigned int, Detector*> instances;
+static unsigned int nextHandle = 1;
+
+static void freeInstances()
+{
+    for (std::map<unsigned int, Detector*>::iterator it = instances.begin(); it != instances.end(); ++it)
+        delete it->second;
+    instances.clear();
+}
+
+static Detector* getInstance(int nrhs, const mxArray *prhs[])
+{
+    if (nrhs < 2 || !mxIsNumeric(prhs[1]) || mxGetNumberOfElements(prhs[1]) != 1) {
+        mexErrMsgIdAndTxt("MyToolbox:streamSacMex:handle","The second input must be the handle returned by create.");
+    }
+    unsigned int handle = (unsigned int)mxGetScalar(prhs[1]);
+    if (!instances.count(handle)) {
+        mexErrMsgIdAndTxt("MyToolbox:streamSacMex:handle","Invalid streamSacMex handle.");
+    }
+    return instances[handle];
+}
+
+static mxArray* eventMatrix(const std::vector<double>& events)
+{
+    size_t n = events.size()/9;
+    mxArray* out = mxCreateDoubleMatrix(n, 9, mxREAL);
+    double* o = mxGetPr(out);
+    for (size_t i = 0; i < n; i++)
+        for (size_t c = 0; c < 9; c++)
+            o[i + c*n] = events[i*9 + c];
+    return out;
+}
+
+/* The gateway function */
+void mexFunction( int nlhs, mxArray *plhs[],
+                 int nrhs, const mxArray *prhs[])
+{
+    mexAtExit(freeInstances);
+
+    if(nrhs < 1 || !mxIsChar(prhs[0])) {
+        mexErrMsgIdAndTxt("MyToolbox:streamSacMex:command","The first input must be the command.");
+    }
+    if(nlhs > 1) {
+        mexErrMsgIdAndTxt("MyToolbox:streamSacMex:nlhs","At most one output.");
+    }
+    char* buf = mxArrayToString(prhs[0]);
+    std::string command = buf;
+    mxFree(buf);
+
+    try {
+        if (command == "create") {
+            if(nrhs != 6) {
+                mexErrMsgIdAndTxt("MyToolbox:streamSacMex:nrhs","create: VFAC, MINDUR, FS, WINDOW and NEYES required.");
+            }
+            double VFAC = mxGetScalar(prhs[1]);
+            double MINDUR = mxGetScalar(prhs[2]);
+            double fs = mxGetScalar(prhs[3]);
+            double window = mxGetScalar(prhs[4]);
+            double nrEyes = mxGetScalar(prhs[5]);
+            if (!(VFAC > 0) || !(MINDUR >= 1) || !(fs > 0) || !(window >= 3)) {
+                mexErrMsgIdAndTxt("MyToolbox:streamSacMex:badParameter","create: VFAC and FS must be positive, MINDUR at least 1 and WINDOW at least 3.");
+            }
+            if (nrEyes != 1 && nrEyes != 2) {
+                mexErrMsgIdAndTxt("MyToolbox:streamSacMex:badParameter","create: NEYES must be 1 or 2.");
+            }
+            size_t warmup = std::max((size_t)3, std::min((size_t)window, (size_t)(fs/10)));
+            Detector* detector = new Detector((size_t)nrEyes, EyeDetector(VFAC, (size_t)MINDUR, fs, (size_t)window, warmup));
+            unsigned int handle = nextHandle++;
+            instances[handle] = detector;
+            plhs[0] = mxCreateDoubleScalar(handle);
+        } else if (command == "push") {
+            Detector* detector = getInstance(nrhs, prhs);
+            if (nrhs != 3 || !mxIsDouble(prhs[2]) || mxIsComplex(prhs[2]) || mxGetN(prhs[2]) != 2*detector->size()) {
+                mexErrMsgIdAndTxt("MyToolbox:streamSacMex:badSamples","push: SAMPLES must be a real double matrix with two columns per eye.");
+            }
+            const double* s = mxGetPr(prhs[2]);
+            size_t n = mxGetM(prhs[2]);
+            std::vector<double> events;
+            for (size_t i = 0; i < n; i++)
+                for (size_t e = 0; e < detector->size(); e++)
+                    (*detector)[e].push(s[i + 2*e*n], s[i + (2*e + 1)*n], e + 1, events);
+            plhs[0] = eventMatrix(events);
+        } else if (command == "flush") {
+            Detector* detector = getInstance(nrhs, prhs);
+            std::vector<double> events;
+            for (size_t e = 0; e < detector->size(); e++)
+                (*detector)[e].flush(e + 1, events);
+            plhs[0] = eventMatrix(events);
+        } else if (command == "threshold") {
+            Detector* detector = getInstance(nrhs, prhs);
+            size_t nrEyes = detector->size();
+            plhs[0] = mxCreateDoubleMatrix(nrEyes, 2, mxREAL);
+            double* o = mxGetPr(plhs[0]);
+            for (size_t e = 0; e < nrEyes; e++) {
+                o[e] = (*detector)[e].radiusx;
+                o[e + nrEyes] = (*detector)[e].radiusy;
+            }
+        } else if (command == "reset") {
+            Detector* detector = getInstance(nrhs, prhs);
+            for (size_t e = 0; e < detector->size(); e++)
+                (*detector)[e].reset();
+        } else if (command == "delete") {
+            Detector* detector = getInstance(nrhs, prhs);
+            instances.erase((unsigned int)mxGetScalar(prhs[1]));
+            delete detector;
+        } else {
+            mexErrMsgIdAndTxt("MyToolbox:streamSacMex:command","Unknown command %s.", command.c_str());
+        }
+    } catch (std::bad_alloc&) {
+        mexErrMsgIdAndTxt("MyToolbox:streamSacMex:memory","Out of memory.");
+    }
+}
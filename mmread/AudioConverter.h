@@ -0,0 +1,257 @@
+/***************************************************
+Conversion of decoded audio to an analysis format while decoding.
+
+Packets are converted to float, optionally mixed down to mono and
+resampled to a target rate with a streaming polyphase resampler, then
+written as float32 or in the source sample format.  The resampler keeps
+only the last few input samples between packets, so a whole stream is
+converted in one pass without ever holding it at the source rate.
+
+The resampler is a windowed sinc (Blackman window) evaluated at
+outRate/gcd phases.  Output sample k lies exactly on input time
+k*inRate/outRate, so there is no delay to correct for; the filter looks
+ahead and the last samples come out when the stream is flushed.  When
+downsampling the cutoff is at the output Nyquist frequency.
+
+This file is part of mmread.
+**************************************************/
+
+#ifndef AUDIOCONVERTER_H
+#define AUDIOCONVERTER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+// input sample formats, in the order of AVbinSampleFormat
+enum { AC_U8=0, AC_S16, AC_S24, AC_S32, AC_FLOAT };
+
+class AudioResampler
+{
+public:
+	// zeroCrossings of the sinc on each side, at the input rate when upsampling
+	AudioResampler(int inRate, int outRate, int channels, int zeroCrossings = 16)
+	{
+		long g = gcd(inRate, outRate);
+		L = outRate/g;
+		M = inRate/g;
+		this->channels = channels;
+
+		double cutoff = std::min(1.0, (double)L/M);
+		halfTaps = (int)ceil(zeroCrossings/cutoff);
+		int taps = 2*halfTaps;
+
+		// M_PI is not defined by MSVC
+		const double pi = 3.14159265358979323846;
+
+		// phase p is the filter for an output that lies p/L input samples after an input sample
+		coefs.resize((size_t)L*taps);
+		for (long p=0; p<L; p++)
+		{
+			float* h = &coefs[p*taps];
+			double sum = 0;
+			for (int j=0; j<taps; j++)
+			{
+				double d = (j-halfTaps+1) - (double)p/L;
+				double x = cutoff*d;
+				double sinc = fabs(x) < 1e-12 ? 1 : sin(pi*x)/(pi*x);
+				double w = fabs(d) >= halfTaps ? 0 : 0.42+0.5*cos(pi*d/halfTaps)+0.08*cos(2*pi*d/halfTaps);
+				h[j] = sinc*w;
+				sum += h[j];
+			}
+			// unity gain at DC for every phase
+			for (int j=0; j<taps; j++) h[j] /= sum;
+		}
+
+		history.resize(channels);
+		reset();
+	}
+
+	void reset()
+	{
+		// the samples before the first one are taken as 0
+		for (int c=0; c<channels; c++) history[c].assign(halfTaps-1, 0.0f);
+		historyStart = -(halfTaps-1);
+		nextOut = 0;
+		nrIn = 0;
+	}
+
+	// append n interleaved input frames, the resampled frames (interleaved) are appended to out
+	void process(const float* in, size_t n, std::vector<float>* out)
+	{
+		for (int c=0; c<channels; c++)
+		{
+			std::vector<float>& h = history[c];
+			size_t old = h.size();
+			h.resize(old+n);
+			for (size_t i=0; i<n; i++) h[old+i] = in[i*channels+c];
+		}
+		nrIn += n;
+		produce(out, -1);
+	}
+
+	// the output that still depends on samples past the end of the input
+	void flush(std::vector<float>* out)
+	{
+		int64_t total = (nrIn*L + M-1)/M;
+		for (int c=0; c<channels; c++) history[c].resize(history[c].size()+halfTaps, 0.0f);
+		produce(out, total);
+	}
+
+private:
+	static long gcd(long a, long b) { while (b) { long t = a%b; a = b; b = t; } return a; }
+
+	// every output sample whose taps are all in the history (and before limit, if >= 0)
+	void produce(std::vector<float>* out, int64_t limit)
+	{
+		int taps = 2*halfTaps;
+		int64_t available = historyStart+(int64_t)history[0].size();
+		while (limit < 0 || nextOut < limit)
+		{
+			int64_t pos = nextOut*M;
+			int64_t base = pos/L;
+			long phase = pos%L;
+			// taps run from base-halfTaps+1 to base+halfTaps
+			if (base+halfTaps >= available) break;
+
+			const float* h = &coefs[phase*taps];
+			size_t first = base-halfTaps+1-historyStart;
+			for (int c=0; c<channels; c++)
+			{
+				const float* x = &history[c][first];
+				float acc = 0;
+				for (int j=0; j<taps; j++) acc += h[j]*x[j];
+				out->push_back(acc);
+			}
+			nextOut++;
+		}
+
+		// drop what no later output needs
+		int64_t keepFrom = (nextOut*M)/L-halfTaps+1;
+		if (keepFrom > historyStart)
+		{
+			size_t drop = (size_t)std::min<int64_t>(keepFrom-historyStart, history[0].size());
+			for (int c=0; c<channels; c++) history[c].erase(history[c].begin(), history[c].begin()+drop);
+			historyStart += drop;
+		}
+	}
+
+	long L, M;
+	int channels, halfTaps;
+	std::vector<float> coefs;
+	// input per channel, history[c][0] is input sample historyStart
+	std::vector<std::vector<float> > history;
+	int64_t historyStart, nextOut, nrIn;
+};
+
+class AudioConverter
+{
+public:
+	// outRate 0 keeps the source rate
+	AudioConverter(int sampleFormat, int bits, int channels, int rate, int outRate, bool mono, bool float32)
+	{
+		this->sampleFormat = sampleFormat;
+		this->bytesPerSample = std::max(1,bits/8);
+		this->channels = std::max(channels,1);
+		this->float32 = float32;
+		outChannels = mono ? 1 : this->channels;
+		this->outRate = outRate > 0 ? outRate : rate;
+		resampler = this->outRate != rate ? new AudioResampler(rate, this->outRate, outChannels) : NULL;
+	}
+
+	~AudioConverter()
+	{
+		delete resampler;
+	}
+
+	// converts nrBytes of interleaved source samples, the result is appended to out
+	void convert(const uint8_t* in, size_t nrBytes, std::vector<uint8_t>* out)
+	{
+		size_t n = nrBytes/bytesPerSample/channels;
+		frames.resize(n*outChannels);
+		for (size_t i=0; i<n; i++)
+		{
+			const uint8_t* s = in+i*channels*bytesPerSample;
+			if (outChannels == 1 && channels > 1)
+			{
+				float sum = 0;
+				for (int c=0; c<channels; c++) sum += toFloat(s+c*bytesPerSample);
+				frames[i] = sum/channels;
+			} else {
+				for (int c=0; c<channels; c++) frames[i*channels+c] = toFloat(s+c*bytesPerSample);
+			}
+		}
+
+		if (resampler)
+		{
+			resampled.clear();
+			resampler->process(frames.empty()?NULL:&frames[0], n, &resampled);
+			write(resampled, out);
+		} else write(frames, out);
+	}
+
+	// the last resampled samples at the end of the stream
+	void flush(std::vector<uint8_t>* out)
+	{
+		if (!resampler) return;
+		resampled.clear();
+		resampler->flush(&resampled);
+		write(resampled, out);
+		resampler->reset();
+	}
+
+	int outChannels, outRate;
+	// the delivered format: float32, or the source format
+	int outBits() { return float32 ? 32 : bytesPerSample*8; }
+	int outFormat() { return float32 ? AC_FLOAT : sampleFormat; }
+
+private:
+	float toFloat(const uint8_t* s)
+	{
+		switch (sampleFormat)
+		{
+			case AC_U8: return (s[0]-128)/128.0f;
+			case AC_S16: { int16_t v; memcpy(&v,s,2); return v/32768.0f; }
+			case AC_S24: return (int32_t)((uint32_t)s[0]<<8 | (uint32_t)s[1]<<16 | (uint32_t)s[2]<<24)/2147483648.0f;
+			case AC_S32: { int32_t v; memcpy(&v,s,4); return v/2147483648.0f; }
+			default: { float v; memcpy(&v,s,4); return v; }
+		}
+	}
+
+	static double clip(double v) { return v < -1 ? -1 : v > 1 ? 1 : v; }
+
+	void write(const std::vector<float>& in, std::vector<uint8_t>* out)
+	{
+		size_t n = in.size();
+		int size = float32 ? 4 : bytesPerSample;
+		size_t start = out->size();
+		out->resize(start+n*size);
+		uint8_t* d = out->data()+start;
+		if (float32 || sampleFormat == AC_FLOAT)
+		{
+			if (n) memcpy(d, &in[0], n*4);
+			return;
+		}
+
+		for (size_t i=0; i<n; i++, d+=size)
+		{
+			double v = clip(in[i]);
+			switch (sampleFormat)
+			{
+				case AC_U8: d[0] = (uint8_t)lrint(std::min(v*128+128, 255.0)); break;
+				case AC_S16: { int16_t s = (int16_t)lrint(std::min(v*32768, 32767.0)); memcpy(d,&s,2); break; }
+				case AC_S24: { int32_t s = (int32_t)lrint(std::min(v*8388608, 8388607.0)); d[0] = s; d[1] = s>>8; d[2] = s>>16; break; }
+				case AC_S32: { int32_t s = (int32_t)llrint(std::min(v*2147483648.0, 2147483647.0)); memcpy(d,&s,4); break; }
+			}
+		}
+	}
+
+	int sampleFormat, bytesPerSample, channels;
+	bool float32;
+	AudioResampler* resampler;
+	std::vector<float> frames, resampled;
+};
+
+#endif
@@ -14,301 +14,264 @@ Copyright 2008 Micah Richert
 This file is part of mmread.
 **************************************************/
 
-#ifdef MATLAB_MEX_FILE
-#include "mex.h"
-#define FFprintf(...) mexPrintf(__VA_ARGS__)
-#else
-#define FFprintf(...) printf(__VA_ARGS__)
-#endif
-
-//#ifndef mwSize
-//#define mwSize int
-//#endif
-
-#define DEBUG 0
-
-extern "C" {
-	#include <avbin.h>
-	#include <libavformat/avformat.h>
-
-	struct _AVbinFile {
-	    AVFormatContext *context;
-	    AVPacket *packet;
-	};
-
-	struct _AVbinStream {
-		int type;
-		AVFormatContext *format_context;
-		AVCodecContext *codec_context;
-		AVFrame *frame;
-	};
-}
-
-#include <stdlib.h>
-#include <string.h>
-#include <vector>
-#include <map>
-using namespace std;
-
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <unistd.h>
+#include "FFGrab.h"
 
-map<unsigned int,double> keyframes;
-unsigned int startDecodingAt;
+// ffmpeg's codec open/close is not thread safe, so grabbers on different
+// threads take turns building and cleaning up
+mutex avbinMutex;
 
-class Grabber
+#ifdef MATLAB_MEX_FILE
+// Double buffer for the batched matlab command.  The decoder thread copies
+// frames into one batch while matlab works on the other, it only waits when
+// both batches are full.  All mxArrays are created and destroyed on the
+// matlab thread, the decoder only writes into their data.  Every batch is
+// handed to matlab in arrays of its own.
+class FrameBatches
 {
 public:
-	Grabber(bool isAudio, AVbinStream* stream, bool trySeeking, double rate, int bytesPerWORD, AVbinStreamInfo info, AVbinTimestamp start_time)
+	FrameBatches(int width, int height, int channels, bool gray16, int batchSize)
 	{
-		this->stream = stream;
-		frameNr = 0;
-		packetNr = 0;
+		this->width = width;
+		this->height = height;
+		this->channels = channels;
+		this->gray16 = gray16;
+		this->batchSize = batchSize;
+
+		for (int i=0; i<2; i++)
+		{
+			allocate(i);
+			count[i] = 0;
+			ready[i] = false;
+		}
+		filling = 0;
+		nextOut = 0;
 		done = false;
-		this->bytesPerWORD = bytesPerWORD;
-		this->rate = rate;
-		startTime = 0;
-		stopTime = 0;
-		this->isAudio = isAudio;
-		this->info = info;
-		this->trySeeking = trySeeking;
-		this->start_time = start_time>0?start_time:0;
-	};
+		aborted = false;
+	}
 
-	~Grabber()
+	~FrameBatches()
 	{
-		// clean up any remaining memory...
-		if (DEBUG) FFprintf("freeing frame data...\n");
-		for (vector<uint8_t*>::iterator i=frames.begin();i != frames.end(); i++) free(*i);
+		for (int i=0; i<2; i++) destroy(i);
 	}
 
-	AVbinStream* stream;
-	AVbinStreamInfo info;
-	AVbinTimestamp start_time;
-
-	vector<uint8_t*> frames;
-	vector<unsigned int> frameBytes;
-	vector<double> frameTimes;
-
-	vector<unsigned int> frameNrs;
-
-	unsigned int frameNr;
-	unsigned int packetNr;
-	bool done;
-	bool isAudio;
-	bool trySeeking;
-
-	int bytesPerWORD;
-	double rate;
-	double startTime, stopTime;
-
-	int Grab(AVbinPacket* packet)
+	// decoder thread: copy a packed frame into the current batch as height x width x channels.
+	// Returns false if matlab gave up on the capture.
+	bool add(const uint8_t* frame, double frameNr, double time)
 	{
-		if (done) return 0;
-		if (!packet->data) return 1;
-
-		frameNr++;
-		packetNr++;
-		if (DEBUG) FFprintf("frameNr %d %d %d\n",frameNr,packetNr,packet->size);
-		int offset=0, len=0;
-		double timestamp = (packet->timestamp-start_time)/1000.0/1000.0;
-		if (DEBUG) FFprintf("time %lld %lld %lf\n",packet->timestamp,start_time,timestamp);
-
-		// either no frames are specified (capture all), or we have time specified
-		if (stopTime)
+		int slot;
 		{
-			if (isAudio)
-			{
-				// time is being used...
-				if (timestamp >= startTime)
-				{
-					// if we've reached the start...
-					offset = max(0,((int)((startTime-timestamp)*rate))*bytesPerWORD);
-					len = ((int)((stopTime-timestamp)*rate))*bytesPerWORD;
-					// if we have gone past our stop time...
-
-					done = len < 0;
-				}
-			} else {
-				done = stopTime <= timestamp;
-				len = (startTime <= timestamp)?0x7FFFFFFF:0;
-				if (DEBUG) FFprintf("startTime: %lf, stopTime: %lf, current: %lf, done: %d, len: %d\n",startTime,stopTime,timestamp,done,len);
-			}
-		} else {
-			// capture everything... video or audio
-			len = 0x7FFFFFFF;
+			unique_lock<mutex> lock(m);
+			changed.wait(lock, [this]{ return aborted || !ready[filling]; });
+			if (aborted) return false;
+			slot = filling;
 		}
 
-		if (isAudio)
-		{
-			if (trySeeking && (len<=0 || done)) return 0;
-
-			uint8_t audiobuf[1024*1024];
-			int uint8_tsleft = sizeof(audiobuf);
- 			int uint8_tsout = uint8_tsleft;
-			int uint8_tsread;
-			uint8_t* audiodata = audiobuf;
-			if (DEBUG) FFprintf("avbin_decode_audio\n");
-			while ((uint8_tsread = avbin_decode_audio(stream, packet->data, packet->size, audiodata, &uint8_tsout)) > 0)
-			{
-				packet->data += uint8_tsread;
-				packet->size -= uint8_tsread;
-				audiodata += uint8_tsout;
-				uint8_tsleft -= uint8_tsout;
-				uint8_tsout = uint8_tsleft;
-			}
+		int k = count[slot];
+		if (gray16) unpackFrame((const uint16_t*)frame, (uint16_t*)dataPtr[slot] + (size_t)k*width*height*channels, width, height, channels);
+		else unpackFrame(frame, dataPtr[slot] + (size_t)k*width*height*channels, width, height, channels);
+		frameNrsPtr[slot][k] = frameNr;
+		timesPtr[slot][k] = time;
 
-			int nrBytes = audiodata-audiobuf;
-			len = min(len,nrBytes);
-			offset = min(offset,nrBytes);
-
-			uint8_t* tmp = (uint8_t*)malloc(len);
-			if (!tmp) return 2;
+		if (++count[slot] == batchSize)
+		{
+			lock_guard<mutex> lock(m);
+			ready[slot] = true;
+			filling = 1-slot;
+			changed.notify_all();
+		}
+		return true;
+	}
 
-			memcpy(tmp,audiobuf+offset,len);
+	// decoder thread: no more frames, hand over what is left
+	void close()
+	{
+		lock_guard<mutex> lock(m);
+		if (count[filling] > 0) ready[filling] = true;
+		done = true;
+		changed.notify_all();
+	}
 
-			frames.push_back(tmp);
-			frameBytes.push_back(len);
-			frameTimes.push_back(timestamp);
+	// matlab thread: wait for the next batch, -1 when the decoder is done
+	int next()
+	{
+		unique_lock<mutex> lock(m);
+		changed.wait(lock, [this]{ return ready[nextOut] || done; });
+		if (!ready[nextOut]) return -1;
 
-		} else {
-			bool skip = false;
-			if (frameNrs.size() > 0)
-			{
-				//frames are being specified
-				// check to see if the frame is in our list
-				bool foundNr = false;
-				unsigned int lastFrameNr = 0;
-				for (int i=0;i<frameNrs.size();i++)
-				{
-					if (frameNrs.at(i) == frameNr) foundNr = true;
-					if (frameNrs.at(i) > lastFrameNr) lastFrameNr = frameNrs.at(i);
-				}
+		int slot = nextOut;
+		if (count[slot] < batchSize)
+		{
+			// the last batch may be short
+			mwSize dims[4] = {(mwSize)height, (mwSize)width, (mwSize)channels, (mwSize)count[slot]};
+			mxSetDimensions(data[slot], dims, 4);
+			mxSetM(frameNrs[slot], count[slot]);
+			mxSetM(times[slot], count[slot]);
+		}
+		return slot;
+	}
 
-				done = frameNr > lastFrameNr;
-				if (!foundNr) {
-					if (DEBUG) FFprintf("Skipping frame %d\n",frameNr);
-					skip = true;
-				}
-			}
-			if ((trySeeking && skip && packetNr < startDecodingAt && packetNr != 1) || done ) return 0;
+	// matlab thread: the batch may be refilled.  The command may have kept
+	// the arrays it was given, so the slot gets new ones.
+	void release(int slot)
+	{
+		destroy(slot);
+		allocate(slot);
+
+		lock_guard<mutex> lock(m);
+		count[slot] = 0;
+		ready[slot] = false;
+		nextOut = 1-slot;
+		changed.notify_all();
+	}
 
-			if (DEBUG) FFprintf("allocate frame %d\n",frames.size());
-			uint8_t* videobuf = (uint8_t*)malloc(bytesPerWORD);
-			if (!videobuf) return 2;
-			if (DEBUG) FFprintf("avbin_decode_video\n");
+	void abort()
+	{
+		lock_guard<mutex> lock(m);
+		aborted = true;
+		changed.notify_all();
+	}
 
-			if (avbin_decode_video(stream, packet->data, packet->size,videobuf)<=0)
-			{
-				if (DEBUG) FFprintf("avbin_decode_video FAILED!!!\n");
-				// silently ignore decode errors
-				frameNr--;
-				free(videobuf);
-				return 3;
-			}
+	bool isAborted()
+	{
+		lock_guard<mutex> lock(m);
+		return aborted;
+	}
 
-			if (stream->frame->key_frame)
-			{
-				keyframes[packetNr] = timestamp;
-			}
+	mxArray* data[2];
+	mxArray* frameNrs[2];
+	mxArray* times[2];
 
-			if (skip || len==0)
-			{
-				free(videobuf);
-				return 0;
-			}
-			frames.push_back(videobuf);
-			frameBytes.push_back(min(len,bytesPerWORD));
-			frameTimes.push_back(timestamp);
-		}
+private:
+	void allocate(int slot)
+	{
+		mwSize dims[4] = {(mwSize)height, (mwSize)width, (mwSize)channels, (mwSize)batchSize};
+		data[slot] = mxCreateNumericArray(4, dims, gray16?mxUINT16_CLASS:mxUINT8_CLASS, mxREAL);
+		frameNrs[slot] = mxCreateDoubleMatrix(batchSize,1,mxREAL);
+		times[slot] = mxCreateDoubleMatrix(batchSize,1,mxREAL);
+		dataPtr[slot] = (uint8_t*)mxGetData(data[slot]);
+		frameNrsPtr[slot] = mxGetPr(frameNrs[slot]);
+		timesPtr[slot] = mxGetPr(times[slot]);
+	}
 
-		return 0;
+	void destroy(int slot)
+	{
+		mxDestroyArray(data[slot]);
+		mxDestroyArray(frameNrs[slot]);
+		mxDestroyArray(times[slot]);
 	}
+
+	int width, height, channels, batchSize;
+	bool gray16;
+	uint8_t* dataPtr[2];
+	double* frameNrsPtr[2];
+	double* timesPtr[2];
+	int count[2];
+	bool ready[2];
+	int filling, nextOut;
+	bool done, aborted;
+	mutex m;
+	condition_variable changed;
 };
+#endif
+
 
-typedef map<int,Grabber*> streammap;
 
-class FFGrabber
+FFGrabber::FFGrabber(bool matlabThread)
 {
-public:
-	FFGrabber();
-
-	int build(char* filename, char* format, bool disableVideo, bool disableAudio, bool tryseeking);
-	int doCapture();
-
-	int getVideoInfo(unsigned int id, int* width, int* height, double* rate, int* nrFramesCaptured, int* nrFramesTotal, double* totalDuration);
-	int getAudioInfo(unsigned int id, int* nrChannels, double* rate, int* bits, int* nrFramesCaptured, int* nrFramesTotal, int* subtype, double* totalDuration);
-	void getCaptureInfo(int* nrVideo, int* nrAudio);
-	// data must be freed by caller
-	int getVideoFrame(unsigned int id, unsigned int frameNr, uint8_t** data, unsigned int* nrBytes, double* time);
-	// data must be freed by caller
-	int getAudioFrame(unsigned int id, unsigned int frameNr, uint8_t** data, unsigned int* nrBytes, double* time);
-	void setFrames(unsigned int* frameNrs, int nrFrames);
-	void setTime(double startTime, double stopTime);
-	void disableVideo();
-	void disableAudio();
-	void cleanUp(); // must be called at the end, in order to render anything afterward.
+	stopForced = false;
+	tryseeking = true;
+	file = NULL;
+	filename = NULL;
+	startDecodingAt = 0xFFFFFFFF;
+	this->matlabThread = matlabThread;
+	maxBytes = 0;
+	capturedBytes = 0;
+	budget = NULL;
+	truncated = false;
+	cancel = NULL;
+	epochStart = epochStop = 0;
+	epochFrames = 0;
+	epochData = NULL;
+	storeReader = NULL;
+	storeWriter = NULL;
+	sampleRate = sampleStart = sampleStop = 0;
+
+	// avbin only has to be initialised once, however many grabbers there are
+	static once_flag avbinInitialised;
+	call_once(avbinInitialised, []{
+		if (DEBUG) FFprintf("avbin_init\n");
+		if (avbin_init()) FFprintf("avbin_init init failed!!!\n");
+
+		av_log_set_level(AV_LOG_QUIET);
+	});
 
 #ifdef MATLAB_MEX_FILE
-	void setMatlabCommand(char * matlabCommand);
-	void setMatlabCommandHandle(mxArray * matlabCommandHandle);
-	void runMatlabCommand(Grabber* G);
+	matlabCommand = NULL;
+	matlabCommandHandle = NULL;
+	for (int i=0; i<6; i++) prhs[i] = NULL;
+	batchSize = 1;
+	batches = NULL;
 #endif
-private:
-	streammap streams;
-	vector<Grabber*> videos;
-	vector<Grabber*> audios;
-
-	AVbinFile* file;
-	AVbinFileInfo fileinfo;
-
-	bool stopForced;
-	bool tryseeking;
-	vector<unsigned int> frameNrs;
-	double startTime, stopTime;
-
-	char* filename;
-	struct stat filestat;
-
+}
 
+FFGrabber::~FFGrabber()
+{
+	cleanUp();
+	free(filename);
 #ifdef MATLAB_MEX_FILE
-	char* matlabCommand;
-	mxArray* matlabCommandHandle;
-	mxArray* prhs[6];
+	if (matlabCommandHandle) mxDestroyArray(matlabCommandHandle);
 #endif
-};
+}
 
+void FFGrabber::setMemoryLimit(size_t maxBytes, MemoryBudget* budget)
+{
+	this->maxBytes = maxBytes;
+	this->budget = budget;
+}
 
-FFGrabber::FFGrabber()
+void FFGrabber::setCancelFlag(const atomic<bool>* cancel)
 {
-	stopForced = false;
-	tryseeking = true;
-	file = NULL;
-	filename = NULL;
+	this->cancel = cancel;
+}
 
-	if (DEBUG) FFprintf("avbin_init\n");
- 	if (avbin_init()) FFprintf("avbin_init init failed!!!\n");
+// account for n more decoded bytes, false if that goes over a limit
+bool FFGrabber::reserveMemory(size_t n)
+{
+	if (maxBytes && capturedBytes+n > maxBytes) return false;
+	if (budget && !budget->take(n)) return false;
 
-	av_log_set_level(AV_LOG_QUIET);
+	capturedBytes += n;
+	return true;
 }
 
 void FFGrabber::cleanUp()
 {
 	if (!file) return; // nothing to cleanup.
 
-	for (streammap::iterator i = streams.begin(); i != streams.end(); i++)
 	{
-		avbin_close_stream(i->second->stream);
-		delete i->second;
+		lock_guard<mutex> lock(avbinMutex);
+		for (streammap::iterator i = streams.begin(); i != streams.end(); i++)
+		{
+			avbin_close_stream(i->second->stream);
+			delete i->second;
+		}
+
+		streams.clear();
+		videos.clear();
+		audios.clear();
+
+		avbin_close_file(file);
+		file = NULL;
 	}
 
- 	streams.clear();
- 	videos.clear();
- 	audios.clear();
+	free(epochData);
+	epochData = NULL;
+	epochTimes.clear();
+	frameStorePath.clear();
 
- 	avbin_close_file(file);
- 	file = NULL;
+	// the decoded data is gone (or handed over) now
+	if (budget) budget->give(capturedBytes);
+	capturedBytes = 0;
 
 #ifdef MATLAB_MEX_FILE
 	if (matlabCommand) free(matlabCommand);
@@ -316,7 +279,7 @@ void FFGrabber::cleanUp()
 #endif
 }
 
-int FFGrabber::getVideoInfo(unsigned int id, int* width, int* height, double* rate, int* nrFramesCaptured, int* nrFramesTotal, double* totalDuration)
+int FFGrabber::getVideoInfo(unsigned int id, int* width, int* height, double* rate, int* nrFramesCaptured, int* nrFramesTotal, double* totalDuration, int* pixelFormat)
 {
 	if (!width || !height || !nrFramesCaptured || !nrFramesTotal) return -1;
 
@@ -325,8 +288,9 @@ int FFGrabber::getVideoInfo(unsigned int id, int* width, int* height, double* ra
 
 	if (!CB) return -1;
 
-	*width  = CB->info.video.width;
-	*height = CB->info.video.height;
+	*width  = CB->outWidth;
+	*height = CB->outHeight;
+	if (pixelFormat) *pixelFormat = CB->output.pixelFormat;
 	*rate = CB->rate;
 	*nrFramesCaptured = CB->frames.size();
 	*nrFramesTotal = CB->frameNr;
@@ -355,7 +319,15 @@ int FFGrabber::getAudioInfo(unsigned int id, int* nrChannels, double* rate, int*
 	*rate = CB->info.audio.sample_rate;
 	*bits = CB->info.audio.sample_bits;
 	*subtype = CB->info.audio.sample_format;
-	*nrFramesCaptured = CB->frames.size();
+	if (CB->converter)
+	{
+		// what is delivered after the conversion
+		*nrChannels = CB->converter->outChannels;
+		*rate = CB->converter->outRate;
+		*bits = CB->converter->outBits();
+		*subtype = CB->converter->outFormat();
+	}
+	*nrFramesCaptured = CB->frameTimes.size();
 	*nrFramesTotal = CB->frameNr;
 
 	*totalDuration = fileinfo.duration/1000.0/1000.0;
@@ -392,6 +364,7 @@ int FFGrabber::getVideoFrame(unsigned int id, unsigned int frameNr, uint8_t** da
 
 	*data = tmp;
 	CB->frames[frameNr] = NULL;
+	stats.released(*nrBytes);
 
 	return 0;
 }
@@ -415,15 +388,40 @@ int FFGrabber::getAudioFrame(unsigned int id, unsigned int frameNr, uint8_t** da
 
 	*data = tmp;
 	CB->frames[frameNr] = NULL;
+	stats.released(*nrBytes);
 
 	return 0;
 }
 
+// data must be freed by caller
+int FFGrabber::getAudio(unsigned int id, uint8_t** data, size_t* nrBytes, bool* mxOwned, vector<double>* times)
+{
+	if (!data || !nrBytes || !mxOwned) return -1;
+
+	if (id >= audios.size()) return -2;
+	Grabber* CB = audios[id];
+	if (!CB || !CB->contiguousAudio) return -2;
+
+	*nrBytes = CB->audio.size;
+	*mxOwned = CB->audio.mxOwned;
+	stats.released(CB->audio.size);
+	*data = CB->audio.detach();
+	if (times) *times = CB->frameTimes;
+
+	return 0;
+}
+
+void FFGrabber::setContiguousAudio(bool contiguousAudio)
+{
+	for (size_t i=0; i < audios.size(); i++) audios.at(i)->contiguousAudio = contiguousAudio;
+}
+
 void FFGrabber::setFrames(unsigned int* frameNrs, int nrFrames)
 {
 	if (!frameNrs) return;
 
 	unsigned int minFrame=nrFrames>0?frameNrs[0]:0;
+	epochOnsets.clear();
 
 	this->frameNrs.clear();
 	for (int i=0; i<nrFrames; i++) this->frameNrs.push_back(frameNrs[i]);
@@ -453,6 +451,7 @@ void FFGrabber::setFrames(unsigned int* frameNrs, int nrFrames)
 			if (it->first <= minFrame && it->first > startDecodingAt) startDecodingAt = it->first;
 			if (DEBUG) FFprintf("%d %d\n",it->first,startDecodingAt);
 		}
+		stats.logSeek("startDecodingAt", keyframes.count(startDecodingAt)?keyframes[startDecodingAt]:0, startDecodingAt);
 	}
 
 
@@ -465,6 +464,7 @@ void FFGrabber::setTime(double startTime, double stopTime)
 	this->startTime = startTime;
 	this->stopTime = stopTime;
 	frameNrs.clear();
+	epochOnsets.clear();
 
 	for (int i=0; i < videos.size(); i++)
 	{
@@ -493,16 +493,122 @@ void FFGrabber::setTime(double startTime, double stopTime)
 	}
 }
 
+int FFGrabber::setClockAnchors(const vector<double>& videoTimes, const vector<double>& trackerTimes)
+{
+	if (!clock.set(videoTimes, trackerTimes)) return -1;
+	return 0;
+}
+
+int FFGrabber::setSampleLock(double rate, double startTime, double stopTime)
+{
+	if (rate < 0 || (stopTime && stopTime <= startTime)) return -1;
+
+	sampleRate = rate;
+	sampleStart = startTime;
+	sampleStop = stopTime;
+	for (size_t i=0; i < videos.size(); i++)
+	{
+		Grabber* CB = videos.at(i);
+		CB->sampleRate = rate;
+		CB->sampleStart = startTime;
+		CB->sampleStop = stopTime;
+	}
+
+	// only decode the part of the file that covers the samples (with a frame to spare on each side)
+	if (rate > 0 && stopTime && videos.size() > 0)
+	{
+		double frameTime = videos.at(0)->rate > 0 ? 1/videos.at(0)->rate : 0;
+		setTime(max(0.0,clock.toVideo(startTime)-frameTime), clock.toVideo(stopTime)+frameTime);
+	}
+
+	return 0;
+}
+
+int FFGrabber::getSampleFrames(unsigned int id, vector<int>* frameIndex)
+{
+	if (!frameIndex) return -1;
+	if (id >= videos.size()) return -2;
+	Grabber* CB = videos.at(id);
+	if (sampleRate <= 0) return -1;
+
+	// the samples run to the stop time, or to the end of the last captured frame
+	const vector<double>& times = CB->frameTimes;
+	double stop = sampleStop;
+	if (!stop) stop = times.empty() ? sampleStart : times.back()+(CB->rate > 0 ? 0.5/CB->rate : 0);
+	size_t nrSamples = (size_t)max(0.0,ceil((stop-sampleStart)*sampleRate-1e-9));
+
+	// both are in time order, so one pass finds the nearest frame of every sample
+	frameIndex->assign(nrSamples, -1);
+	size_t f = 0;
+	for (size_t k=0; k<nrSamples && !times.empty(); k++)
+	{
+		double t = sampleStart+k/sampleRate;
+		while (f+1 < times.size() && fabs(times[f+1]-t) < fabs(times[f]-t)) f++;
+		(*frameIndex)[k] = f;
+	}
+
+	return 0;
+}
+
+void FFGrabber::setEpochs(const vector<double>& onsets, double windowStart, double windowStop)
+{
+	epochOnsets = onsets;
+	epochStart = windowStart;
+	epochStop = windowStop;
+	frameNrs.clear();
+	startTime = stopTime = 0;
+}
+
+// data must be freed by caller
+int FFGrabber::getEpochs(uint8_t** data, int* nrTrials, int* nrFrames, int* frameBytes, vector<double>* times)
+{
+	if (!data || !nrTrials || !nrFrames || !frameBytes || !times) return -1;
+	if (!epochData || videos.size() == 0) return -2;
+
+	*nrTrials = epochOnsets.size();
+	*nrFrames = epochFrames;
+	*frameBytes = videos.at(0)->bytesPerWORD;
+	*times = epochTimes;
+	*data = epochData;
+	epochData = NULL;
+	stats.released((size_t)(*nrTrials)*epochFrames*(*frameBytes));
+
+	return 0;
+}
+
+int FFGrabber::setPupilTracking(const PupilSettings& settings)
+{
+	if (videos.size() == 0) return -2;
+
+	for (size_t i=0; i < videos.size(); i++) videos.at(i)->setPupilTracking(settings);
+
+	return 0;
+}
+
+int FFGrabber::getPupilData(unsigned int id, vector<PupilSample>** samples)
+{
+	if (!samples) return -1;
+
+	if (id >= videos.size()) return -2;
+	Grabber* CB = videos.at(id);
+	if (!CB || !CB->pupil) return -2;
+
+	*samples = &CB->pupil->samples;
+
+	return 0;
+}
+
 #ifdef MATLAB_MEX_FILE
-void FFGrabber::setMatlabCommand(char * matlabCommand)
+void FFGrabber::setMatlabCommand(char * matlabCommand, int batchSize)
 {
 	delete this->matlabCommand;
 	this->matlabCommand = matlabCommand;
 	mxDestroyArray(matlabCommandHandle);
 	matlabCommandHandle=NULL;
+	this->batchSize = batchSize;
 }
 
-void FFGrabber::setMatlabCommandHandle(mxArray* matlabCommandHandle)
+void FFGrabber::setMatlabCommandHandle(mxArray* matlabCommandHandle, int batchSize)
 {
 	mxDestroyArray(this->matlabCommandHandle);
 if (!mxIsClass(matlabCommandHandle,"function_handle")) mexErrMsgTxt("blah");
@@ -510,6 +616,86 @@ if (!mxIsClass(matlabCommandHandle,"function_handle")) mexErrMsgTxt("blah");
 	mexMakeArrayPersistent(matlabCommandHandle);
 	delete matlabCommand;
 	matlabCommand=NULL;
+	this->batchSize = batchSize;
+}
+
+// decoder thread: move the newest frame of the first video stream into the batch
+void FFGrabber::addToBatch(Grabber* G)
+{
+	if (G->frames.size() == 0) return;
+	vector<uint8_t*>::iterator lastframe = --(G->frames.end());
+	if (*lastframe == NULL) return;
+
+	if (G == videos.at(0))
+	{
+		double frameNr = G->frameNrs.size()==0?G->frameTimes.size():G->frameNrs[G->frameTimes.size()-1];
+		if (!batches->add(*lastframe, frameNr, G->frameTimes.back())) return;
+	}
+
+	// frames of other video streams are not passed on, the same as for a single frame command
+	free(*lastframe);
+	*lastframe = NULL;
+	stats.released(G->frameBytes.back());
+}
+
+// Decode on a separate thread and call the matlab command on batches of
+// frames (height x width x channels x batchSize) from this thread.
+int FFGrabber::doBatchedCapture()
+{
+	// audio is decoded on the decoder thread as well, which may not use mxMalloc
+	for (size_t i=0; i < audios.size(); i++)
+	{
+		if (!audios.at(i)->audio.data) audios.at(i)->audio.mxOwned = false;
+	}
+
+	Grabber* G = videos.at(0);
+	batches = new FrameBatches(G->outWidth, G->outHeight, G->bytesPerPixel()==3?3:1, G->output.pixelFormat==FF_GRAY16, batchSize);
+
+	thread decoder([this]{ readPackets(); batches->close(); });
+
+	mxArray* exception = NULL;
+	int slot;
+	while ((slot = batches->next()) >= 0)
+	{
+		mxArray* args[6];
+		mxArray* plhs[] = {NULL};
+		int n = 0;
+
+		if (matlabCommandHandle) args[n++] = matlabCommandHandle;
+		args[n++] = batches->data[slot];
+		args[n++] = mxCreateDoubleScalar(G->outWidth);
+		args[n++] = mxCreateDoubleScalar(G->outHeight);
+		args[n++] = batches->frameNrs[slot];
+		args[n++] = batches->times[slot];
+
+		double t = FFnow();
+		exception = mexCallMATLABWithTrap(0, plhs, n, args, matlabCommandHandle?"feval":matlabCommand);
+		stats.commandTime += FFnow()-t;
+
+		mxDestroyArray(args[n-4]);
+		mxDestroyArray(args[n-3]);
+
+		if (exception)
+		{
+			// stop the decoder before handing the error back to matlab
+			batches->abort();
+			break;
+		}
+		batches->release(slot);
+	}
+
+	decoder.join();
+	delete batches;
+	batches = NULL;
+
+	for (size_t i=0; i < videos.size(); i++)
+	{
+		if (videos.at(i)->pupil) videos.at(i)->pupil->finish();
+	}
+
+	if (exception) mexCallMATLAB(0, NULL, 1, &exception, "throw");
+
+	return 0;
 }
 
 void FFGrabber::runMatlabCommand(Grabber* G)
@@ -518,7 +704,7 @@ void FFGrabber::runMatlabCommand(Grabber* G)
 	{
 		mwSize dims[2];
 		dims[1]=1;
-		int width=G->info.video.width, height = G->info.video.height;
+		int width=G->outWidth, height = G->outHeight;
 		mxArray* plhs[] = {NULL};
 		int ExitCode;
 
@@ -529,12 +715,13 @@ void FFGrabber::runMatlabCommand(Grabber* G)
 
 		if (*lastframe == NULL) return;
 
-		dims[0] = G->frameBytes.back();
+		bool gray16 = G->output.pixelFormat == FF_GRAY16;
+		dims[0] = G->frameBytes.back()/(gray16?2:1);
 
 		if (prhs[0] == NULL)
 		{
 			//make matrices to pass to the matlab function
-			prhs[0] = mxCreateNumericArray(2, dims, mxUINT8_CLASS, mxREAL); // empty 2d matrix
+			prhs[0] = mxCreateNumericArray(2, dims, gray16?mxUINT16_CLASS:mxUINT8_CLASS, mxREAL); // empty 2d matrix
 			prhs[1] = mxCreateDoubleMatrix(1,1,mxREAL); mxGetPr(prhs[1])[0] = width;
 			prhs[2] = mxCreateDoubleMatrix(1,1,mxREAL); mxGetPr(prhs[2])[0] = height;
 			prhs[3] = mxCreateDoubleMatrix(1,1,mxREAL);
@@ -548,13 +735,15 @@ void FFGrabber::runMatlabCommand(Grabber* G)
 		mxGetPr(prhs[3])[0] = G->frameNrs.size()==0?G->frameTimes.size():G->frameNrs[G->frameTimes.size()-1];
 		mxGetPr(prhs[4])[0] = G->frameTimes.back();
 
-		memcpy(mxGetPr(prhs[0]),*lastframe,dims[0]);
+		memcpy(mxGetPr(prhs[0]),*lastframe,G->frameBytes.back());
 
 		//free the frame memory
 		free(*lastframe);
 		*lastframe = NULL;
+		stats.released(G->frameBytes.back());
 
 		//call Matlab
+		double t = FFnow();
 		if (matlabCommand) ExitCode = mexCallMATLAB(0,plhs,5,prhs,matlabCommand);
 		else {
 			for (int i=4;i>=0;i--) prhs[i+1]=prhs[i];
@@ -562,12 +751,16 @@ void FFGrabber::runMatlabCommand(Grabber* G)
 			ExitCode = mexCallMATLAB(0,plhs,6,prhs,"feval");
 			for (int i=0;i<=4;i++) prhs[i]=prhs[i+1];
 		}
+		stats.commandTime += FFnow()-t;
 	}
 }
 #endif
 
-int FFGrabber::build(char* filename, char* format, bool disableVideo, bool disableAudio, bool tryseeking)
+int FFGrabber::build(char* filename, char* format, bool disableVideo, bool disableAudio, bool tryseeking, const VideoOutput& videoOutput, const AudioOutput& audioOutput)
 {
+	lock_guard<mutex> lock(avbinMutex);
+	stats.reset();
+
 	if (DEBUG) FFprintf("avbin_open_filename\n");
  	if (format && strlen(format) > 0) file = avbin_open_filename_with_format(filename,format);
 	else file = avbin_open_filename(filename);
@@ -623,10 +816,14 @@ int FFGrabber::build(char* filename, char* format, bool disableVideo, bool disab
 				double rate = streaminfo.video.frame_rate_num/(0.00001+streaminfo.video.frame_rate_den);
 
 				if (DEBUG) FFprintf("Inserting video stream %d\n",stream_index);
-				streams[stream_index]=new Grabber(false,tmp,tryseeking,rate,streaminfo.video.height*streaminfo.video.width*3,streaminfo,fileinfo.start_time);
-				videos.push_back(streams[stream_index]);
+				Grabber* G = new Grabber(false,tmp,tryseeking,rate,0,streaminfo,fileinfo.start_time,&keyframes,&startDecodingAt,&stats);
+				G->bytesPerWORD = G->setVideoOutput(videoOutput);
+				G->clock = &clock;
+				streams[stream_index]=G;
+				videos.push_back(G);
 			} else {
-				FFprintf("Could not open video stream\n");
+				// mexPrintf is not safe from other threads
+				if (matlabThread) FFprintf("Could not open video stream\n");
 			}
 		}
 		if (streaminfo.type == AVBIN_STREAM_TYPE_AUDIO && !disableAudio)
@@ -635,15 +832,22 @@ int FFGrabber::build(char* filename, char* format, bool disableVideo, bool disab
 			if (tmp)
 			{
 				if (DEBUG) FFprintf("Inserting audio stream %d\n",stream_index);
-				streams[stream_index]=new Grabber(true,tmp,tryseeking,streaminfo.audio.sample_rate,streaminfo.audio.sample_bits*streaminfo.audio.channels,streaminfo,fileinfo.start_time);
-				audios.push_back(streams[stream_index]);
+				Grabber* G = new Grabber(true,tmp,tryseeking,streaminfo.audio.sample_rate,streaminfo.audio.sample_bits*streaminfo.audio.channels,streaminfo,fileinfo.start_time,&keyframes,&startDecodingAt,&stats);
+				// mxMalloc may only be used from matlab's thread
+				if (!matlabThread) G->audio.mxOwned = false;
+				G->setAudioOutput(audioOutput);
+				G->clock = &clock;
+				streams[stream_index]=G;
+				audios.push_back(G);
 			} else {
-				FFprintf("Could not open audio stream\n");
+				// mexPrintf is not safe from other threads
+				if (matlabThread) FFprintf("Could not open audio stream\n");
 			}
 		}
 	}
 	this->tryseeking = tryseeking;
 	stopForced = false;
+	truncated = false;
 
 	if (streams.size() == 0) return -10;
 
@@ -651,19 +855,74 @@ int FFGrabber::build(char* filename, char* format, bool disableVideo, bool disab
 }
 
 int FFGrabber::doCapture()
+{
+	if (epochOnsets.size() > 0) return doEpochCapture();
+
+#ifdef MATLAB_MEX_FILE
+	if (batchSize > 1 && (matlabCommand || matlabCommandHandle) && videos.size() > 0) return doBatchedCapture();
+#endif
+
+	readPackets();
+
+	// let the pupil trackers work through the frames still queued
+	for (size_t i=0; i < videos.size(); i++)
+	{
+		if (videos.at(i)->pupil) videos.at(i)->pupil->finish();
+	}
+
+#ifdef MATLAB_MEX_FILE
+	if (prhs[0])
+	{
+		mxDestroyArray(prhs[0]);
+		if (prhs[1]) mxDestroyArray(prhs[1]);
+		if (prhs[2]) mxDestroyArray(prhs[2]);
+		if (prhs[3]) mxDestroyArray(prhs[3]);
+		if (prhs[4]) mxDestroyArray(prhs[4]);
+	}
+	prhs[0] = NULL;
+#endif
+
+	return 0;
+}
+
+void FFGrabber::readPackets()
 {
 	AVbinPacket packet;
 	packet.structure_size = sizeof(packet);
 	streammap::iterator tmp;
 	int needseek=1;
 
+	if (openFrameStore())
+	{
+		// the first video stream comes from the store, only decode what is left
+		readFrameStore();
+		bool allDone = true;
+		for (streammap::iterator i = streams.begin(); i != streams.end(); i++) allDone = allDone && i->second->done;
+		if (allDone) return;
+	}
+
 	bool allDone = false;
+	bool reachedEnd = true;
+	double t = FFnow();
 	while (!avbin_read(file, &packet))
 	{
+		stats.readTime += FFnow()-t;
+		stats.packetsRead[packet.stream_index]++;
+
 		if ((tmp = streams.find(packet.stream_index)) != streams.end())
 		{
 			Grabber* G = tmp->second;
+			size_t held = G->bytesHeld;
 			G->Grab(&packet);
+			if (G->bytesHeld > held) stats.allocated(G->bytesHeld-held);
+
+			if (G->bytesHeld > held && !reserveMemory(G->bytesHeld-held))
+			{
+				if (DEBUG) FFprintf("memory limit reached\n");
+				truncated = true;
+				reachedEnd = false;
+				break;
+			}
 
 			if (G->done)
 			{
@@ -675,7 +934,11 @@ int FFGrabber::doCapture()
 			}
 
 #ifdef MATLAB_MEX_FILE
-			if (!G->isAudio) runMatlabCommand(G);
+			if (!G->isAudio)
+			{
+				if (batches) addToBatch(G);
+				else runMatlabCommand(G);
+			}
 #endif
 		} else
 			if (DEBUG) FFprintf("Unknown packet %d\n",packet.stream_index);
@@ -684,6 +947,7 @@ int FFGrabber::doCapture()
 		{
 			if (stopTime && startTime > 0) {
 				if (DEBUG) FFprintf("try seeking to %lf\n",startTime);
+				stats.logSeek("setTime", startTime);
 				av_seek_frame(file->context, -1, (AVbinTimestamp)(startTime*1000*1000), AVSEEK_FLAG_BACKWARD);
 			}
 			needseek = 0;
@@ -693,25 +957,385 @@ int FFGrabber::doCapture()
 		{
 			if (DEBUG) FFprintf("stopForced\n");
 			stopForced = true;
+			reachedEnd = false;
 			break;
 		}
-	}
 
 #ifdef MATLAB_MEX_FILE
-	if (prhs[0])
+		if (batches && batches->isAborted())
+		{
+			reachedEnd = false;
+			break;
+		}
+#endif
+		if (cancel && *cancel)
+		{
+			reachedEnd = false;
+			break;
+		}
+		t = FFnow();
+	}
+
+	for (size_t i=0; i < audios.size(); i++)
 	{
-		mxDestroyArray(prhs[0]);
-		if (prhs[1]) mxDestroyArray(prhs[1]);
-		if (prhs[2]) mxDestroyArray(prhs[2]);
-		if (prhs[3]) mxDestroyArray(prhs[3]);
-		if (prhs[4]) mxDestroyArray(prhs[4]);
+		Grabber* G = audios.at(i);
+		size_t held = G->bytesHeld;
+		G->finishAudio();
+		if (G->bytesHeld > held) stats.allocated(G->bytesHeld-held);
 	}
-	prhs[0] = NULL;
+
+	if (storeWriter)
+	{
+		// only a store with every frame of the file is of any use later on
+		if (reachedEnd) storeWriter->close();
+		else storeWriter->discard();
+		videos.at(0)->store = NULL;
+		delete storeWriter;
+		storeWriter = NULL;
+	}
+}
+
+int FFGrabber::makeProxy(const char* basePath, int* nrFrames, int* nrKeyframes)
+{
+	if (!basePath || !nrFrames || !nrKeyframes) return -1;
+	if (videos.size() == 0) return -2;
+
+	Grabber* G = videos.at(0);
+	int streamIndex = -1;
+	for (streammap::iterator i = streams.begin(); i != streams.end(); i++)
+	{
+		if (i->second == G) streamIndex = i->first;
+	}
+
+	struct ProxyLevel
+	{
+		const char* suffix;
+		int factor;
+		bool keyframesOnly;
+		int width, height;
+		struct SwsContext* sws;
+		uint8_t* buffer;
+		FrameStoreWriter store;
+	} levels[3] = {
+		{".q4.ffstore", 4, false, 0, 0, NULL, NULL, {}},
+		{".q16.ffstore", 16, false, 0, 0, NULL, NULL, {}},
+		{".key.ffstore", 4, true, 0, 0, NULL, NULL, {}}
+	};
+
+	bool ok = true;
+	for (int l=0; l<3; l++)
+	{
+		ProxyLevel& L = levels[l];
+		L.width = max(1,G->outWidth/L.factor);
+		L.height = max(1,G->outHeight/L.factor);
+		L.buffer = (uint8_t*)malloc(L.width*L.height*G->bytesPerPixel());
+
+		// the same header as a frame store read with factor times the downscale
+		FrameStoreHeader header = frameStoreHeader(G);
+		header.downscale *= L.factor;
+		header.outWidth = L.width;
+		header.outHeight = L.height;
+		header.frameBytes = L.width*L.height*G->bytesPerPixel();
+
+		string path = string(basePath)+L.suffix;
+		ok = ok && L.buffer && L.store.open(path.c_str(), header);
+	}
+
+	// from the start of the file, whatever was read before
+	stats.logSeek("proxy", 0);
+	av_seek_frame(file->context, -1, fileinfo.start_time>0?fileinfo.start_time:0, AVSEEK_FLAG_BACKWARD);
+	for (streammap::iterator i = streams.begin(); i != streams.end(); i++)
+		avcodec_flush_buffers(i->second->stream->codec_context);
+
+	*nrFrames = *nrKeyframes = 0;
+	AVbinPacket packet;
+	packet.structure_size = sizeof(packet);
+	double t = FFnow();
+	while (ok && !avbin_read(file, &packet))
+	{
+		stats.readTime += FFnow()-t;
+		stats.packetsRead[packet.stream_index]++;
+		t = FFnow();
+		if (packet.stream_index != streamIndex) continue;
+		if (G->decodeVideo(&packet, NULL) <= 0) continue;
+
+		double timestamp = (packet.timestamp-G->start_time)/1000.0/1000.0;
+		bool keyframe = G->stream->frame->key_frame;
+		for (int l=0; l<3 && ok; l++)
+		{
+			ProxyLevel& L = levels[l];
+			if (L.keyframesOnly && !keyframe) continue;
+			ok = G->convertPicture(L.buffer, &L.sws, L.width, L.height) && L.store.append(L.buffer, timestamp);
+		}
+		(*nrFrames)++;
+		if (keyframe) (*nrKeyframes)++;
+	}
+
+	for (int l=0; l<3; l++)
+	{
+		ProxyLevel& L = levels[l];
+		if (ok) ok = L.store.close();
+		else L.store.discard();
+		if (L.sws) sws_freeContext(L.sws);
+		free(L.buffer);
+	}
+	// a partial proxy is no use, remove what was already closed
+	if (!ok)
+	{
+		for (int l=0; l<3; l++) remove((string(basePath)+levels[l].suffix).c_str());
+		return -7;
+	}
+
+	return 0;
+}
+
+void FFGrabber::setFrameStore(const char* path)
+{
+	frameStorePath = path?path:"";
+}
+
+// what the store for the first video stream has to look like
+FrameStoreHeader FFGrabber::frameStoreHeader(Grabber* G)
+{
+	FrameStoreHeader header;
+	header.sourceSize = filestat.st_size;
+	header.sourceMtime = filestat.st_mtime;
+	header.x = G->output.x;
+	header.y = G->output.y;
+	header.width = G->output.width;
+	header.height = G->output.height;
+	header.pixelFormat = G->output.pixelFormat;
+	header.downscale = G->output.downscale;
+	header.outWidth = G->outWidth;
+	header.outHeight = G->outHeight;
+	header.bytesPerPixel = G->bytesPerPixel();
+	header.frameBytes = G->bytesPerWORD;
+	return header;
+}
+
+// open a valid store for reading, or start writing one when the whole file
+// is captured.  True if the frames can be read from the store.
+bool FFGrabber::openFrameStore()
+{
+	if (frameStorePath.empty() || videos.size() == 0) return false;
+
+	Grabber* G = videos.at(0);
+	FrameStoreHeader header = frameStoreHeader(G);
+
+	storeReader = new FrameStore();
+	if (storeReader->open(frameStorePath.c_str()) && storeReader->header.matches(header)) return true;
+	delete storeReader;
+	storeReader = NULL;
+
+	if (frameNrs.size() == 0 && !stopTime)
+	{
+		storeWriter = new FrameStoreWriter();
+		if (storeWriter->open(frameStorePath.c_str(), header)) G->store = storeWriter;
+		else
+		{
+			delete storeWriter;
+			storeWriter = NULL;
+		}
+	}
+	return false;
+}
+
+// deliver the frames of the first video stream from the store, selected
+// the same way as Grab does when decoding
+void FFGrabber::readFrameStore()
+{
+	Grabber* G = videos.at(0);
+	uint64_t nrFrames = storeReader->header.nrFrames;
+
+	unsigned int lastFrameNr = 0;
+	for (size_t i=0; i<G->frameNrs.size(); i++) lastFrameNr = max(lastFrameNr,G->frameNrs.at(i));
+
+	for (uint64_t i=0; i<nrFrames; i++)
+	{
+		unsigned int frameNr = i+1;
+		double timestamp = storeReader->time(i);
+
+		if (G->stopTime)
+		{
+			if (G->stopTime <= timestamp) break;
+			if (timestamp < G->startTime) continue;
+		} else if (G->frameNrs.size() > 0) {
+			if (frameNr > lastFrameNr) break;
+			if (find(G->frameNrs.begin(),G->frameNrs.end(),frameNr) == G->frameNrs.end()) continue;
+		}
+		if (!G->nearSample(timestamp)) continue;
+		timestamp = G->deliveredTime(timestamp);
+
+		uint8_t* videobuf = (uint8_t*)malloc(G->bytesPerWORD);
+		if (!videobuf) break;
+		memcpy(videobuf, storeReader->frame(i), G->bytesPerWORD);
+		G->frameNr = frameNr;
+
+		if (G->pupil)
+		{
+			G->pupil->push(videobuf, frameNr, timestamp);
+			continue;
+		}
+
+		if (!reserveMemory(G->bytesPerWORD))
+		{
+			free(videobuf);
+			truncated = true;
+			break;
+		}
+		G->frames.push_back(videobuf);
+		G->frameBytes.push_back(G->bytesPerWORD);
+		G->frameTimes.push_back(timestamp);
+		G->bytesHeld += G->bytesPerWORD;
+		stats.allocated(G->bytesPerWORD);
+
+#ifdef MATLAB_MEX_FILE
+		if (batches)
+		{
+			addToBatch(G);
+			if (batches->isAborted()) break;
+		}
+		else runMatlabCommand(G);
 #endif
+	}
+
+	// the whole file is known, so the total is exact
+	G->frameNr = nrFrames;
+	G->done = true;
+
+	storeReader->close();
+	delete storeReader;
+	storeReader = NULL;
+}
+
+// Decode the epochs of the first video stream.  The windows are sorted and
+// overlapping ones merged into clusters.  For each cluster we only seek if
+// the keyframe it starts from lies beyond what has been decoded already, so
+// clusters that share a GOP are decoded in one pass and no GOP is decoded
+// twice.  A frame goes into slot round((time-windowStart)*rate) of every
+// window it falls into.
+// copy a decoded frame into the windows of trials order[first..last] it falls in
+void FFGrabber::placeEpochFrame(const uint8_t* frame, double timestamp, int first, int last, const vector<pair<double,int> >& order, size_t frameBytes)
+{
+	int nrTrials = epochOnsets.size();
+	double rate = videos.at(0)->rate;
+	for (int i=first; i<=last; i++)
+	{
+		int trial = order[i].second;
+		int slot = (int)floor((timestamp-order[i].first)*rate+0.5);
+		if (slot < 0 || slot >= epochFrames) continue;
+
+		size_t n = trial + (size_t)nrTrials*slot;
+		if (!isnan(epochTimes[n])) continue;
+		memcpy(epochData+n*frameBytes, frame, frameBytes);
+		epochTimes[n] = timestamp;
+	}
+}
+
+int FFGrabber::doEpochCapture()
+{
+	if (videos.size() == 0) return -2;
+
+	Grabber* G = videos.at(0);
+	int streamIndex = -1;
+	for (streammap::iterator i = streams.begin(); i != streams.end(); i++)
+	{
+		if (i->second == G) streamIndex = i->first;
+	}
+
+	int nrTrials = epochOnsets.size();
+	double rate = G->rate;
+	epochFrames = max(1,(int)(((epochStop-epochStart)*rate)+0.5));
+	size_t frameBytes = G->bytesPerWORD;
+
+	free(epochData);
+	epochData = (uint8_t*)calloc((size_t)nrTrials*epochFrames, frameBytes);
+	if (!epochData) return -6;
+	stats.allocated((size_t)nrTrials*epochFrames*frameBytes);
+	epochTimes.assign((size_t)nrTrials*epochFrames, NAN);
+
+	uint8_t* frame = (uint8_t*)malloc(frameBytes);
+	if (!frame) return -6;
+
+	// trials sorted by window start
+	vector<pair<double,int> > order;
+	for (int i=0; i<nrTrials; i++) order.push_back(make_pair(epochOnsets[i]+epochStart,i));
+	sort(order.begin(),order.end());
+
+	// frames up to half a frame outside a window still round into it
+	double margin = 0.5/rate;
+	double decodedUpTo = -1e300;
+	// time of the frame left in the frame buffer, NAN if it holds none
+	double frameTime = NAN;
+	AVRational timeBase = {1, AV_TIME_BASE};
+	AVStream* st = file->context->streams[streamIndex];
+
+	AVbinPacket packet;
+	packet.structure_size = sizeof(packet);
+
+	for (int first=0; first < nrTrials;)
+	{
+		// merge overlapping windows into one cluster
+		int last = first;
+		double clusterStart = order[first].first-margin;
+		double clusterStop = order[first].first+(epochStop-epochStart)+margin;
+		while (last+1 < nrTrials && order[last+1].first-margin <= clusterStop)
+		{
+			last++;
+			clusterStop = max(clusterStop,order[last].first+(epochStop-epochStart)+margin);
+		}
+
+		// where would a seek land?  Without an index entry we have to seek.
+		AVbinTimestamp target = G->start_time + (AVbinTimestamp)(clusterStart*1000*1000);
+		double keyframeTime = clusterStart;
+		int entry = av_index_search_timestamp(st, av_rescale_q(target, timeBase, st->time_base), AVSEEK_FLAG_BACKWARD);
+		if (entry >= 0) keyframeTime = (av_rescale_q(avformat_index_get_entry(st, entry)->timestamp, st->time_base, timeBase)-G->start_time)/1000.0/1000.0;
+
+		// a seek only pays off when it lands past what is decoded already,
+		// otherwise the decoder keeps going forward from where it is
+		if (keyframeTime > decodedUpTo)
+		{
+			stats.logSeek("epoch", clusterStart);
+			av_seek_frame(file->context, -1, target, AVSEEK_FLAG_BACKWARD);
+			for (streammap::iterator i = streams.begin(); i != streams.end(); i++)
+				avcodec_flush_buffers(i->second->stream->codec_context);
+			frameTime = NAN;
+		}
+		else if (frameTime >= clusterStart && frameTime < clusterStop)
+		{
+			// the frame that ended the previous cluster already lies in this one
+			placeEpochFrame(frame, frameTime, first, last, order, frameBytes);
+		}
 
+		double t = FFnow();
+		while (!avbin_read(file, &packet))
+		{
+			stats.readTime += FFnow()-t;
+			stats.packetsRead[packet.stream_index]++;
+			t = FFnow();
+			if (packet.stream_index != streamIndex) continue;
+
+			double timestamp = (packet.timestamp-G->start_time)/1000.0/1000.0;
+
+			// frames before the cluster are decoded but not converted, the one
+			// past it is kept in case the next cluster starts before it
+			bool convert = timestamp >= clusterStart;
+			if (G->decodeVideo(&packet, convert?frame:NULL) <= 0) continue;
+			decodedUpTo = timestamp;
+			frameTime = convert ? timestamp : NAN;
+
+			if (timestamp >= clusterStop) break;
+			if (convert) placeEpochFrame(frame, timestamp, first, last, order, frameBytes);
+		}
+
+		first = last+1;
+	}
+
+	free(frame);
 	return 0;
 }
 
+
 #ifdef MATLAB_MEX_FILE
 FFGrabber FFG;
 
@@ -724,22 +1348,286 @@ char* message(int err)
 		case -2: return "Invalid interface";
 		case -4: return "Unable to open file";
 		case -5: return "AVbin version 8 or greater is required!";
+		case -6: return "Out of memory";
+		case -7: return "Unable to write file";
 		case -10: return "No input streams available.  Make sure you are not disabling audio or video.";
 		default: return "Unknown error";
 	}
 }
 
+// the contiguous audio of one stream as an mxArray, channels x samples or
+// (deinterleaved) samples x channels, 24 bit audio is widened to int32
+mxArray* audioToMatlab(FFGrabber* FF, unsigned int id, bool deinterleave, mxArray** timesOut)
+{
+	uint8_t* data;
+	size_t nrBytes;
+	bool mxOwned;
+	vector<double> times;
+	char* errmsg =  message(FF->getAudio(id, &data, &nrBytes, &mxOwned, &times));
+
+	if (strcmp("",errmsg)) mexErrMsgTxt(errmsg);
+
+	int nrChannels,bits,nrFramesCaptured,nrFramesTotal,subtype;
+	double rate, totalDuration;
+	FF->getAudioInfo(id, &nrChannels, &rate, &bits, &nrFramesCaptured, &nrFramesTotal, &subtype, &totalDuration);
+
+	mxClassID mxClass;
+	int bytesPerSample;
+	switch (bits)
+	{
+		case 16: mxClass = mxINT16_CLASS; bytesPerSample = 2; break;
+		case 24: mxClass = mxINT32_CLASS; bytesPerSample = 3; break;
+		case 32: mxClass = subtype==AVBIN_SAMPLE_FORMAT_S32?mxINT32_CLASS:subtype==AVBIN_SAMPLE_FORMAT_FLOAT?mxSINGLE_CLASS:mxUINT32_CLASS; bytesPerSample = 4; break;
+		default: mxClass = mxUINT8_CLASS; bytesPerSample = 1; break;
+	}
+	nrChannels = max(nrChannels,1);
+	size_t nrSamples = nrBytes/bytesPerSample/nrChannels;
+
+	if (bits == 24)
+	{
+		// widen to 32 bit in place, back to front so nothing is overwritten before it is read
+		size_t n = nrSamples*nrChannels;
+		data = (uint8_t*)(mxOwned?mxRealloc(data,n*4+1):realloc(data,n*4+1));
+		if (!data) mexErrMsgTxt("out of memory");
+		if (mxOwned) mexMakeMemoryPersistent(data);
+		int* widened = (int*)data;
+		for (size_t i=n; i-- > 0;)
+		{
+			uint8_t* in = data+i*3;
+			widened[i] = (((0x80&in[2])?-1:0)&0xFF000000) | ((in[2]<<16)+(in[1]<<8)+in[0]);
+		}
+		bytesPerSample = 4;
+	}
+
+	mwSize dims[2];
+	mxArray* out;
+	if (deinterleave)
+	{
+		// samples x channels needs one transposing copy
+		dims[0] = nrSamples; dims[1] = nrChannels;
+		out = mxCreateNumericArray(2, dims, mxClass, mxREAL);
+		uint8_t* dst = (uint8_t*)mxGetData(out);
+		for (size_t i=0; i<nrSamples; i++)
+			for (int c=0; c<nrChannels; c++)
+				memcpy(dst+(c*nrSamples+i)*bytesPerSample, data+(i*nrChannels+c)*bytesPerSample, bytesPerSample);
+		if (mxOwned) mxFree(data);
+		else free(data);
+	} else {
+		// channels x samples is exactly the decoded layout
+		dims[0] = nrChannels; dims[1] = nrSamples;
+		mwSize empty[2] = {0,0};
+		out = mxCreateNumericArray(2, empty, mxClass, mxREAL);
+		if (mxOwned && data)
+		{
+			mxSetData(out, data);
+		} else if (nrSamples > 0) {
+			// filled from a decoder thread, so it has to be copied once
+			mxSetData(out, mxMalloc(nrSamples*nrChannels*bytesPerSample));
+			memcpy(mxGetData(out), data, nrSamples*nrChannels*bytesPerSample);
+			free(data);
+		} else free(data);
+		if (nrSamples > 0) mxSetDimensions(out, dims, 2);
+	}
+
+	*timesOut = mxCreateDoubleMatrix(1,times.size(),mxREAL);
+	if (!times.empty()) memcpy(mxGetPr(*timesOut),&times[0],times.size()*sizeof(double));
+
+	return out;
+}
+
+// optional video output options: roi [x y width height] (0 based), pixel format, downscale
+VideoOutput parseVideoOutput(const char* cmd, const mxArray* roi, const mxArray* pixelFormat, const mxArray* downscale)
+{
+	VideoOutput videoOutput;
+	char msg[200];
+
+	if (roi && !mxIsEmpty(roi))
+	{
+		snprintf(msg, sizeof(msg), "%s: roi must be [x y width height] (as doubles)", cmd);
+		if (!mxIsDouble(roi) || mxGetNumberOfElements(roi) != 4) mexErrMsgTxt(msg);
+		double* r = mxGetPr(roi);
+		videoOutput.x = (int)r[0];
+		videoOutput.y = (int)r[1];
+		videoOutput.width = (int)r[2];
+		videoOutput.height = (int)r[3];
+	}
+	if (pixelFormat && !mxIsEmpty(pixelFormat))
+	{
+		char format[10];
+		snprintf(msg, sizeof(msg), "%s: pixel format must be 'rgb24', 'gray8' or 'gray16'", cmd);
+		if (!mxIsChar(pixelFormat)) mexErrMsgTxt(msg);
+		mxGetString(pixelFormat,format,10);
+		if (!strcmp("rgb24",format)) videoOutput.pixelFormat = FF_RGB24;
+		else if (!strcmp("gray8",format)) videoOutput.pixelFormat = FF_GRAY8;
+		else if (!strcmp("gray16",format)) videoOutput.pixelFormat = FF_GRAY16;
+		else mexErrMsgTxt(msg);
+	}
+	if (downscale && !mxIsEmpty(downscale))
+	{
+		snprintf(msg, sizeof(msg), "%s: downscale must be a positive integer", cmd);
+		if (!mxIsNumeric(downscale) || mxGetScalar(downscale) < 1) mexErrMsgTxt(msg);
+		videoOutput.downscale = (int)mxGetScalar(downscale);
+	}
+
+	return videoOutput;
+}
+
+AudioOutput parseAudioOutput(const char* cmd, const mxArray* rate, const mxArray* mono, const mxArray* float32)
+{
+	AudioOutput audioOutput;
+	char msg[200];
+
+	if (rate && !mxIsEmpty(rate))
+	{
+		snprintf(msg, sizeof(msg), "%s: audio rate must be a positive number (or [] for the source rate)", cmd);
+		if (!mxIsNumeric(rate) || mxGetScalar(rate) < 0) mexErrMsgTxt(msg);
+		audioOutput.rate = (int)(mxGetScalar(rate)+0.5);
+	}
+	if (mono && !mxIsEmpty(mono)) audioOutput.mono = mxGetScalar(mono) != 0;
+	if (float32 && !mxIsEmpty(float32)) audioOutput.float32 = mxGetScalar(float32) != 0;
+
+	return audioOutput;
+}
+
+// all captured frames of one video stream as a struct with the frames as height x width x channels x nrFrames
+mxArray* videoToMatlab(FFGrabber* FF, unsigned int id)
+{
+	int width,height,nrFramesCaptured,nrFramesTotal,pixelFormat;
+	double rate, totalDuration;
+	char* errmsg =  message(FF->getVideoInfo(id, &width, &height, &rate, &nrFramesCaptured, &nrFramesTotal, &totalDuration, &pixelFormat));
+	if (strcmp("",errmsg)) mexErrMsgTxt(errmsg);
+
+	int channels = pixelFormat==FF_RGB24?3:1;
+	bool gray16 = pixelFormat==FF_GRAY16;
+	size_t frameBytes = (size_t)width*height*channels*(gray16?2:1);
+
+	mwSize dims[4] = {(mwSize)height, (mwSize)width, (mwSize)channels, (mwSize)nrFramesCaptured};
+	mxArray* frames = mxCreateNumericArray(4, dims, gray16?mxUINT16_CLASS:mxUINT8_CLASS, mxREAL);
+	mxArray* times = mxCreateDoubleMatrix(1,nrFramesCaptured,mxREAL);
+	uint8_t* out = (uint8_t*)mxGetData(frames);
+	int nrFrames = 0;
+	for (int f=0; f<nrFramesCaptured; f++)
+	{
+		uint8_t* data;
+		unsigned int nrBytes;
+		if (FF->getVideoFrame(id, f, &data, &nrBytes, mxGetPr(times)+f)) continue;
+		if (nrBytes == frameBytes)
+		{
+			if (gray16) unpackFrame((const uint16_t*)data, (uint16_t*)(out+nrFrames*frameBytes), width, height, channels);
+			else unpackFrame(data, out+nrFrames*frameBytes, width, height, channels);
+			mxGetPr(times)[nrFrames++] = mxGetPr(times)[f];
+		}
+		free(data);
+	}
+	if (nrFrames < nrFramesCaptured)
+	{
+		dims[3] = nrFrames;
+		mxSetDimensions(frames, dims, 4);
+		mxSetN(times, nrFrames);
+	}
+
+	const char* fields[] = {"width","height","rate","nrFramesTotal","totalDuration","frames","times"};
+	mxArray* video = mxCreateStructMatrix(1,1,7,fields);
+	mxSetField(video,0,"width",mxCreateDoubleScalar(width));
+	mxSetField(video,0,"height",mxCreateDoubleScalar(height));
+	mxSetField(video,0,"rate",mxCreateDoubleScalar(rate));
+	mxSetField(video,0,"nrFramesTotal",mxCreateDoubleScalar(nrFramesTotal));
+	mxSetField(video,0,"totalDuration",mxCreateDoubleScalar(totalDuration));
+	mxSetField(video,0,"frames",frames);
+	mxSetField(video,0,"times",times);
+
+	return video;
+}
+
+// one finished file of a batch: index (1 based), filename, video and audio structs (one per stream), truncated, error
+mxArray* batchResultToMatlab(BatchDecoder::Result& result, const char* filename)
+{
+	const char* fields[] = {"index","filename","video","audio","truncated","error"};
+	mxArray* out = mxCreateStructMatrix(1,1,6,fields);
+	mxSetField(out,0,"index",mxCreateDoubleScalar(result.index+1));
+	mxSetField(out,0,"filename",mxCreateString(filename));
+	mxSetField(out,0,"error",mxCreateString(message(result.err)));
+
+	FFGrabber* FF = result.grabber;
+	mxSetField(out,0,"truncated",mxCreateLogicalScalar(FF->isTruncated()));
+	if (result.err) return out;
+
+	int nrVideo, nrAudio;
+	FF->getCaptureInfo(&nrVideo, &nrAudio);
+
+	mxArray* videos = mxCreateCellMatrix(1,nrVideo);
+	for (int i=0; i<nrVideo; i++) mxSetCell(videos,i,videoToMatlab(FF,i));
+	mxSetField(out,0,"video",videos);
+
+	const char* audioFields[] = {"nrChannels","rate","bits","subtype","totalDuration","data","times"};
+	mxArray* audios = mxCreateCellMatrix(1,nrAudio);
+	for (int i=0; i<nrAudio; i++)
+	{
+		int nrChannels,bits,nrFramesCaptured,nrFramesTotal,subtype;
+		double rate, totalDuration;
+		FF->getAudioInfo(i, &nrChannels, &rate, &bits, &nrFramesCaptured, &nrFramesTotal, &subtype, &totalDuration);
+
+		mxArray* audio = mxCreateStructMatrix(1,1,7,audioFields);
+		mxArray* times;
+		mxSetField(audio,0,"nrChannels",mxCreateDoubleScalar(nrChannels));
+		mxSetField(audio,0,"rate",mxCreateDoubleScalar(rate));
+		mxSetField(audio,0,"bits",mxCreateDoubleScalar(bits));
+		mxSetField(audio,0,"subtype",mxCreateDoubleScalar(subtype==AVBIN_SAMPLE_FORMAT_FLOAT?1:0));
+		mxSetField(audio,0,"totalDuration",mxCreateDoubleScalar(totalDuration));
+		mxSetField(audio,0,"data",audioToMatlab(FF,i,true,&times));
+		mxSetField(audio,0,"times",times);
+		mxSetCell(audios,i,audio);
+	}
+	mxSetField(out,0,"audio",audios);
+
+	return out;
+}
+
+// grabbers created by build with an output argument, by handle
+map<unsigned int,FFGrabber*> instances;
+unsigned int nextHandle = 1;
+
+// the running batch decode, if any
+BatchDecoder* batch = NULL;
+vector<string> batchFiles;
+
+void freeInstances()
+{
+	delete batch;
+	batch = NULL;
+	for (map<unsigned int,FFGrabber*>::iterator i=instances.begin(); i != instances.end(); i++) delete i->second;
+	instances.clear();
+}
+
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
-	if (nrhs < 1 || !mxIsChar(prhs[0])) mexErrMsgTxt("First parameter must be the command (a string)");
+	mexAtExit(freeInstances);
+
+	// a handle (from build) in front of the command selects the grabber, otherwise the default one is used
+	FFGrabber* FF = &FFG;
+	unsigned int handle = 0;
+	if (nrhs > 0 && mxIsNumeric(prhs[0]))
+	{
+		handle = (unsigned int)mxGetScalar(prhs[0]);
+		if (handle)
+		{
+			if (!instances.count(handle)) mexErrMsgTxt("Invalid FFGrab handle");
+			FF = instances[handle];
+		}
+		prhs++;
+		nrhs--;
+	}
+
+	if (nrhs < 1 || !mxIsChar(prhs[0])) mexErrMsgTxt("First parameter must be the command (a string), optionally preceded by a handle");
 
 	char cmd[100];
 	mxGetString(prhs[0],cmd,100);
+	double commandStart = FFnow();
 
 	if (!strcmp("build",cmd))
 	{
-		if (nrhs < 6 || !mxIsChar(prhs[1])) mexErrMsgTxt("build: parameters must be the filename (as a string), disableVideo, disableAudio, trySeeking");
-		if (nlhs > 0) mexErrMsgTxt("build: there are no outputs");
+		if (nrhs < 6 || !mxIsChar(prhs[1])) mexErrMsgTxt("build: parameters must be the filename (as a string), format, disableVideo, disableAudio, trySeeking and optionally roi, pixelFormat, downscale, audioRate, mono, float32");
+		if (nlhs > 1) mexErrMsgTxt("build: the only output is the handle");
 		int filenamelen = mxGetN(prhs[1])+1;
 		char* filename = new char[filenamelen];
 		if (!filename) mexErrMsgTxt("build: out of memory");
@@ -754,23 +1642,41 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 			format = NULL;
 		}
 
-		char* errmsg =  message(FFG.build(filename, format, mxGetScalar(prhs[3]), mxGetScalar(prhs[4]), mxGetScalar(prhs[5])));
+		VideoOutput videoOutput = parseVideoOutput("build", nrhs > 6?prhs[6]:NULL, nrhs > 7?prhs[7]:NULL, nrhs > 8?prhs[8]:NULL);
+		AudioOutput audioOutput = parseAudioOutput("build", nrhs > 9?prhs[9]:NULL, nrhs > 10?prhs[10]:NULL, nrhs > 11?prhs[11]:NULL);
+
+		// build with an output opens the file in a grabber of its own and returns its handle
+		bool newInstance = nlhs == 1 && !handle;
+		if (newInstance) FF = new FFGrabber();
+
+		char* errmsg =  message(FF->build(filename, format, mxGetScalar(prhs[3]), mxGetScalar(prhs[4]), mxGetScalar(prhs[5]), videoOutput, audioOutput));
 		delete[] format;
 		delete[] filename;
 
-		if (strcmp("",errmsg)) mexErrMsgTxt(errmsg);
+		if (strcmp("",errmsg))
+		{
+			if (newInstance) delete FF;
+			mexErrMsgTxt(errmsg);
+		}
+
+		if (newInstance)
+		{
+			handle = nextHandle++;
+			instances[handle] = FF;
+		}
+		if (nlhs == 1) plhs[0] = mxCreateDoubleScalar(handle);
 	} else if (!strcmp("doCapture",cmd)) {
 		if (nlhs > 0) mexErrMsgTxt("doCapture: there are no outputs");
-		char* errmsg =  message(FFG.doCapture());
+		char* errmsg =  message(FF->doCapture());
 		if (strcmp("",errmsg)) mexErrMsgTxt(errmsg);
 	} else if (!strcmp("getVideoInfo",cmd)) {
 		if (nrhs < 2 || !mxIsNumeric(prhs[1])) mexErrMsgTxt("getVideoInfo: second parameter must be the video stream id (as a number)");
-		if (nlhs > 6) mexErrMsgTxt("getVideoInfo: there are only 5 output values: width, height, rate, nrFramesCaptured, nrFramesTotal");
+		if (nlhs > 7) mexErrMsgTxt("getVideoInfo: there are only 7 output values: width, height, rate, nrFramesCaptured, nrFramesTotal, totalDuration, pixelFormat");
 
 		unsigned int id = (unsigned int)mxGetScalar(prhs[1]);
-		int width,height,nrFramesCaptured,nrFramesTotal;
+		int width,height,nrFramesCaptured,nrFramesTotal,pixelFormat;
 		double rate, totalDuration;
-		char* errmsg =  message(FFG.getVideoInfo(id, &width, &height,&rate, &nrFramesCaptured, &nrFramesTotal, &totalDuration));
+		char* errmsg =  message(FF->getVideoInfo(id, &width, &height,&rate, &nrFramesCaptured, &nrFramesTotal, &totalDuration, &pixelFormat));
 
 		if (strcmp("",errmsg)) mexErrMsgTxt(errmsg);
 
@@ -780,6 +1686,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		if (nlhs >= 4) {plhs[3] = mxCreateDoubleMatrix(1,1,mxREAL); mxGetPr(plhs[3])[0] = nrFramesCaptured; }
 		if (nlhs >= 5) {plhs[4] = mxCreateDoubleMatrix(1,1,mxREAL); mxGetPr(plhs[4])[0] = nrFramesTotal; }
 		if (nlhs >= 6) {plhs[5] = mxCreateDoubleMatrix(1,1,mxREAL); mxGetPr(plhs[5])[0] = totalDuration; }
+		if (nlhs >= 7) {plhs[6] = mxCreateDoubleMatrix(1,1,mxREAL); mxGetPr(plhs[6])[0] = pixelFormat; }
 	} else if (!strcmp("getAudioInfo",cmd)) {
 		if (nrhs < 2 || !mxIsNumeric(prhs[1])) mexErrMsgTxt("getAudioInfo: second parameter must be the audio stream id (as a number)");
 		if (nlhs > 7) mexErrMsgTxt("getAudioInfo: there are only 6 output values: nrChannels, rate, bits, nrFramesCaptured, nrFramesTotal, subtype");
@@ -787,7 +1694,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		unsigned int id = (unsigned int)mxGetScalar(prhs[1]);
 		int nrChannels,bits,nrFramesCaptured,nrFramesTotal,subtype;
 		double rate, totalDuration;
-		char* errmsg =  message(FFG.getAudioInfo(id, &nrChannels, &rate, &bits, &nrFramesCaptured, &nrFramesTotal, &subtype, &totalDuration));
+		char* errmsg =  message(FF->getAudioInfo(id, &nrChannels, &rate, &bits, &nrFramesCaptured, &nrFramesTotal, &subtype, &totalDuration));
 
 		if (strcmp("",errmsg)) mexErrMsgTxt(errmsg);
 
@@ -802,7 +1709,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		if (nlhs > 2) mexErrMsgTxt("getCaptureInfo: there are only 2 output values: nrVideo, nrAudio");
 
 		int nrVideo, nrAudio;
-		FFG.getCaptureInfo(&nrVideo, &nrAudio);
+		FF->getCaptureInfo(&nrVideo, &nrAudio);
 
 		if (nlhs >= 1) {plhs[0] = mxCreateDoubleMatrix(1,1,mxREAL); mxGetPr(plhs[0])[0] = nrVideo; }
 		if (nlhs >= 2) {plhs[1] = mxCreateDoubleMatrix(1,1,mxREAL); mxGetPr(plhs[1])[0] = nrAudio; }
@@ -817,12 +1724,16 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		double time;
 		mwSize dims[2];
 		dims[1]=1;
-		char* errmsg =  message(FFG.getVideoFrame(id, frameNr, &data, &nrBytes, &time));
+		char* errmsg =  message(FF->getVideoFrame(id, frameNr, &data, &nrBytes, &time));
 
 		if (strcmp("",errmsg)) mexErrMsgTxt(errmsg);
 
-		dims[0] = nrBytes;
-		plhs[0] = mxCreateNumericArray(2, dims, mxUINT8_CLASS, mxREAL); // empty 2d matrix
+		int width,height,nrFramesCaptured,nrFramesTotal,pixelFormat;
+		double rate, totalDuration;
+		FF->getVideoInfo(id, &width, &height,&rate, &nrFramesCaptured, &nrFramesTotal, &totalDuration, &pixelFormat);
+
+		dims[0] = pixelFormat==FF_GRAY16?nrBytes/2:nrBytes;
+		plhs[0] = mxCreateNumericArray(2, dims, pixelFormat==FF_GRAY16?mxUINT16_CLASS:mxUINT8_CLASS, mxREAL); // empty 2d matrix
 		memcpy(mxGetPr(plhs[0]),data,nrBytes);
 		free(data);
 		if (nlhs >= 2) {plhs[1] = mxCreateDoubleMatrix(1,1,mxREAL); mxGetPr(plhs[1])[0] = time; }
@@ -838,13 +1749,13 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		mwSize dims[2];
 		dims[1]=1;
 		mxClassID mxClass;
-		char* errmsg =  message(FFG.getAudioFrame(id, frameNr, &data, &nrBytes, &time));
+		char* errmsg =  message(FF->getAudioFrame(id, frameNr, &data, &nrBytes, &time));
 
 		if (strcmp("",errmsg)) mexErrMsgTxt(errmsg);
 
 		int nrChannels,bits,nrFramesCaptured,nrFramesTotal,subtype;
 		double rate, totalDuration;
-		FFG.getAudioInfo(id, &nrChannels, &rate, &bits, &nrFramesCaptured, &nrFramesTotal, &subtype, &totalDuration);
+		FF->getAudioInfo(id, &nrChannels, &rate, &bits, &nrFramesCaptured, &nrFramesTotal, &subtype, &totalDuration);
 
 		switch (bits)
 		{
@@ -897,6 +1808,22 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		memcpy(mxGetPr(plhs[0]),data,nrBytes);
 		free(data);
 		if (nlhs >= 2) {plhs[1] = mxCreateDoubleMatrix(1,1,mxREAL); mxGetPr(plhs[1])[0] = time; }
+	} else if (!strcmp("getAudio",cmd)) {
+		if (nrhs < 2 || !mxIsNumeric(prhs[1])) mexErrMsgTxt("getAudio: second parameter must be the audio stream id (as a number), optionally followed by deinterleave");
+		if (nlhs > 2) mexErrMsgTxt("getAudio: there are only 2 output values: data, times");
+
+		unsigned int id = (unsigned int)mxGetScalar(prhs[1]);
+		bool deinterleave = nrhs > 2 && mxGetScalar(prhs[2]);
+		mxArray* times;
+		plhs[0] = audioToMatlab(FF, id, deinterleave, &times);
+
+		if (nlhs >= 2) plhs[1] = times;
+		else mxDestroyArray(times);
+	} else if (!strcmp("setContiguousAudio",cmd)) {
+		if (nrhs < 2) mexErrMsgTxt("setContiguousAudio: second parameter must be true or false");
+		if (nlhs > 0) mexErrMsgTxt("setContiguousAudio: has no outputs");
+
+		FF->setContiguousAudio(mxGetScalar(prhs[1]) != 0);
 	} else if (!strcmp("setFrames",cmd)) {
 		if (nrhs < 2 || !mxIsDouble(prhs[1])) mexErrMsgTxt("setFrames: second parameter must be the frame numbers (as doubles)");
 		if (nlhs > 0) mexErrMsgTxt("setFrames: has no outputs");
@@ -906,18 +1833,166 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 		double* data = mxGetPr(prhs[1]);
 		for (int i=0; i<nrFrames; i++) frameNrs[i] = (unsigned int)data[i];
 
-		FFG.setFrames(frameNrs, nrFrames);
+		FF->setFrames(frameNrs, nrFrames);
 
 		delete[] frameNrs;
 	} else if (!strcmp("setTime",cmd)) {
 		if (nrhs < 3 || !mxIsDouble(prhs[1]) || !mxIsDouble(prhs[2])) mexErrMsgTxt("setTime: start and stop time are required (as doubles)");
 		if (nlhs > 0) mexErrMsgTxt("setTime: has no outputs");
 
-		FFG.setTime(mxGetScalar(prhs[1]), mxGetScalar(prhs[2]));
+		FF->setTime(mxGetScalar(prhs[1]), mxGetScalar(prhs[2]));
+	} else if (!strcmp("setFrameStore",cmd)) {
+		if (nrhs < 2 || !mxIsChar(prhs[1])) mexErrMsgTxt("setFrameStore: second parameter must be the path of the frame store (as a string, '' for none)");
+		if (nlhs > 0) mexErrMsgTxt("setFrameStore: has no outputs");
+
+		char* path = mxArrayToString(prhs[1]);
+		FF->setFrameStore(path);
+		mxFree(path);
+	} else if (!strcmp("readFrameStore",cmd)) {
+		if (nrhs < 2 || !mxIsChar(prhs[1])) mexErrMsgTxt("readFrameStore: parameters must be the path of the frame store (as a string) and optionally the frame range [first last] and the source file");
+		if (nlhs > 2) mexErrMsgTxt("readFrameStore: there are only 2 output values: frames, times");
+
+		// reads straight from the mapped store, no file has to be built
+		char* path = mxArrayToString(prhs[1]);
+		FrameStore store;
+		bool opened = store.open(path);
+		mxFree(path);
+		if (!opened) mexErrMsgTxt("readFrameStore: not a complete frame store");
+
+		if (nrhs > 3 && !mxIsEmpty(prhs[3]))
+		{
+			if (!mxIsChar(prhs[3])) mexErrMsgTxt("readFrameStore: the source file must be a string");
+			char* source = mxArrayToString(prhs[3]);
+			struct stat fstat;
+			bool missing = stat(source,&fstat) != 0;
+			mxFree(source);
+			if (missing || fstat.st_size != store.header.sourceSize || fstat.st_mtime != store.header.sourceMtime)
+				mexErrMsgTxt("readFrameStore: the frame store is out of date");
+		}
+
+		uint64_t first = 0, last = store.header.nrFrames;
+		if (nrhs > 2 && !mxIsEmpty(prhs[2]))
+		{
+			if (!mxIsDouble(prhs[2]) || mxGetNumberOfElements(prhs[2]) != 2) mexErrMsgTxt("readFrameStore: the frame range must be [first last] (1 based)");
+			double* range = mxGetPr(prhs[2]);
+			if (range[0] < 1 || range[1] < range[0]) mexErrMsgTxt("readFrameStore: invalid frame range");
+			first = (uint64_t)range[0]-1;
+			last = min((uint64_t)range[1],last);
+			first = min(first,last);
+		}
+
+		int width = store.header.outWidth, height = store.header.outHeight;
+		int channels = store.header.pixelFormat==FF_RGB24?3:1;
+		bool gray16 = store.header.pixelFormat==FF_GRAY16;
+		size_t frameBytes = store.header.frameBytes;
+
+		mwSize dims[4] = {(mwSize)height, (mwSize)width, (mwSize)channels, (mwSize)(last-first)};
+		plhs[0] = mxCreateNumericArray(4, dims, gray16?mxUINT16_CLASS:mxUINT8_CLASS, mxREAL);
+		uint8_t* out = (uint8_t*)mxGetData(plhs[0]);
+		for (uint64_t i=first; i<last; i++)
+		{
+			if (gray16) unpackFrame((const uint16_t*)store.frame(i), (uint16_t*)(out+(i-first)*frameBytes), width, height, channels);
+			else unpackFrame(store.frame(i), out+(i-first)*frameBytes, width, height, channels);
+		}
+
+		if (nlhs >= 2)
+		{
+			plhs[1] = mxCreateDoubleMatrix(1,last-first,mxREAL);
+			for (uint64_t i=first; i<last; i++) mxGetPr(plhs[1])[i-first] = store.time(i);
+		}
+	} else if (!strcmp("makeProxy",cmd)) {
+		if (nrhs < 2 || !mxIsChar(prhs[1])) mexErrMsgTxt("makeProxy: second parameter must be the base path of the proxy files (as a string)");
+		if (nlhs > 2) mexErrMsgTxt("makeProxy: there are only 2 output values: nrFrames, nrKeyframes");
+
+		char* basePath = mxArrayToString(prhs[1]);
+		int nrFrames, nrKeyframes;
+		char* errmsg =  message(FF->makeProxy(basePath, &nrFrames, &nrKeyframes));
+		mxFree(basePath);
+		if (strcmp("",errmsg)) mexErrMsgTxt(errmsg);
+
+		if (nlhs >= 1) plhs[0] = mxCreateDoubleScalar(nrFrames);
+		if (nlhs >= 2) plhs[1] = mxCreateDoubleScalar(nrKeyframes);
+	} else if (!strcmp("setClockAnchors",cmd)) {
+		if (nrhs < 3 || !mxIsDouble(prhs[1]) || !mxIsDouble(prhs[2]) || mxGetNumberOfElements(prhs[1]) != mxGetNumberOfElements(prhs[2])) mexErrMsgTxt("setClockAnchors: parameters must be the video times and the matching tracker times (in seconds, as doubles of the same length)");
+		if (nlhs > 0) mexErrMsgTxt("setClockAnchors: has no outputs");
+
+		double* videoTimes = mxGetPr(prhs[1]);
+		double* trackerTimes = mxGetPr(prhs[2]);
+		size_t n = mxGetNumberOfElements(prhs[1]);
+		if (FF->setClockAnchors(vector<double>(videoTimes,videoTimes+n), vector<double>(trackerTimes,trackerTimes+n)))
+			mexErrMsgTxt("setClockAnchors: the anchor times must be strictly increasing");
+	} else if (!strcmp("setSampleLock",cmd)) {
+		if (nrhs < 2 || !mxIsNumeric(prhs[1])) mexErrMsgTxt("setSampleLock: parameters must be the tracker sample rate and optionally the window [start stop] (tracker clock, in seconds)");
+		if (nrhs > 2 && !mxIsEmpty(prhs[2]) && (!mxIsDouble(prhs[2]) || mxGetNumberOfElements(prhs[2]) != 2)) mexErrMsgTxt("setSampleLock: the window must be [start stop] (as doubles)");
+		if (nlhs > 0) mexErrMsgTxt("setSampleLock: has no outputs");
+
+		double window[2] = {0,0};
+		if (nrhs > 2 && !mxIsEmpty(prhs[2])) memcpy(window, mxGetPr(prhs[2]), sizeof(window));
+		if (FF->setSampleLock(mxGetScalar(prhs[1]), window[0], window[1]))
+			mexErrMsgTxt("setSampleLock: the rate must be positive and the window must end after it starts");
+	} else if (!strcmp("getSampleFrames",cmd)) {
+		if (nrhs < 2 || !mxIsNumeric(prhs[1])) mexErrMsgTxt("getSampleFrames: second parameter must be the video stream id (as a number)");
+		if (nlhs > 1) mexErrMsgTxt("getSampleFrames: there is only 1 output value: the frame of every sample");
+
+		vector<int> frameIndex;
+		char* errmsg =  message(FF->getSampleFrames((unsigned int)mxGetScalar(prhs[1]), &frameIndex));
+		if (strcmp("",errmsg)) mexErrMsgTxt(errmsg);
+
+		// 1 based, 0 for samples without a frame
+		plhs[0] = mxCreateDoubleMatrix(1,frameIndex.size(),mxREAL);
+		double* out = mxGetPr(plhs[0]);
+		for (size_t i=0; i<frameIndex.size(); i++) out[i] = frameIndex[i]+1;
+	} else if (!strcmp("setEpochs",cmd)) {
+		if (nrhs < 3 || !mxIsDouble(prhs[1]) || !mxIsDouble(prhs[2]) || mxGetNumberOfElements(prhs[2]) != 2) mexErrMsgTxt("setEpochs: parameters must be the onset times and the window [start stop] relative to them (in seconds, as doubles)");
+		if (nlhs > 0) mexErrMsgTxt("setEpochs: has no outputs");
+
+		double* onsets = mxGetPr(prhs[1]);
+		double* window = mxGetPr(prhs[2]);
+		if (window[1] <= window[0]) mexErrMsgTxt("setEpochs: the window must end after it starts");
+
+		FF->setEpochs(vector<double>(onsets,onsets+mxGetNumberOfElements(prhs[1])), window[0], window[1]);
+	} else if (!strcmp("getEpochs",cmd)) {
+		if (nlhs > 2) mexErrMsgTxt("getEpochs: there are only 2 output values: frames, times");
+
+		uint8_t* data;
+		int nrTrials, nrFrames, frameBytes;
+		vector<double> times;
+		char* errmsg =  message(FF->getEpochs(&data, &nrTrials, &nrFrames, &frameBytes, &times));
+		if (strcmp("",errmsg)) mexErrMsgTxt(errmsg);
+
+		int width,height,nrFramesCaptured,nrFramesTotal,pixelFormat;
+		double rate, totalDuration;
+		FF->getVideoInfo(0, &width, &height, &rate, &nrFramesCaptured, &nrFramesTotal, &totalDuration, &pixelFormat);
+		int channels = pixelFormat==FF_RGB24?3:1;
+		bool gray16 = pixelFormat==FF_GRAY16;
+
+		// height x width x channels x trials x frames
+		mwSize dims[5] = {(mwSize)height, (mwSize)width, (mwSize)channels, (mwSize)nrTrials, (mwSize)nrFrames};
+		plhs[0] = mxCreateNumericArray(5, dims, gray16?mxUINT16_CLASS:mxUINT8_CLASS, mxREAL);
+		uint8_t* out = (uint8_t*)mxGetData(plhs[0]);
+		for (size_t n=0; n<(size_t)nrTrials*nrFrames; n++)
+		{
+			if (gray16) unpackFrame((const uint16_t*)(data+n*frameBytes), (uint16_t*)(out+n*frameBytes), width, height, channels);
+			else unpackFrame(data+n*frameBytes, out+n*frameBytes, width, height, channels);
+		}
+		free(data);
+
+		if (nlhs >= 2)
+		{
+			plhs[1] = mxCreateDoubleMatrix(nrTrials,nrFrames,mxREAL);
+			if (!times.empty()) memcpy(mxGetPr(plhs[1]),&times[0],times.size()*sizeof(double));
+		}
 	} else if (!strcmp("setMatlabCommand",cmd)) {
-		if (nrhs < 2 || !(mxIsChar(prhs[1]) || mxIsClass(prhs[1],"function_handle"))) mexErrMsgTxt("setMatlabCommand: the command must be passed as a string or function handle");
+		if (nrhs < 2 || !(mxIsChar(prhs[1]) || mxIsClass(prhs[1],"function_handle"))) mexErrMsgTxt("setMatlabCommand: the command must be passed as a string or function handle, optionally followed by the batch size");
 		if (nlhs > 0) mexErrMsgTxt("setMatlabCommand: has no outputs");
 
+		int batchSize = 1;
+		if (nrhs > 2 && !mxIsEmpty(prhs[2]))
+		{
+			if (!mxIsNumeric(prhs[2]) || mxGetScalar(prhs[2]) < 1) mexErrMsgTxt("setMatlabCommand: the batch size must be a positive number");
+			batchSize = (int)mxGetScalar(prhs[2]);
+		}
+
 		if (mxIsChar(prhs[1])) {
 			int len = mxGetN(prhs[1])+1;
 			char * matlabCommand = new char[len];;
@@ -925,30 +2000,175 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 
 			if (strlen(matlabCommand)==0)
 			{
-				FFG.setMatlabCommand(NULL);
+				FF->setMatlabCommand(NULL);
 				free(matlabCommand);
-			} else FFG.setMatlabCommand(matlabCommand);
+			} else FF->setMatlabCommand(matlabCommand, batchSize);
 		} else {
-			FFG.setMatlabCommandHandle(mxDuplicateArray(prhs[1]));
+			FF->setMatlabCommandHandle(mxDuplicateArray(prhs[1]), batchSize);
+		}
+
+	} else if (!strcmp("setPupilTracking",cmd)) {
+		if (nrhs < 2 || !mxIsDouble(prhs[1])) mexErrMsgTxt("setPupilTracking: parameters must be the roi [x y width height] (0 based, [] for the full frame) and optionally threshold, minArea, maxArea, nrThreads");
+		if (nlhs > 0) mexErrMsgTxt("setPupilTracking: has no outputs");
+
+		PupilSettings settings;
+		if (!mxIsEmpty(prhs[1]))
+		{
+			if (mxGetNumberOfElements(prhs[1]) != 4) mexErrMsgTxt("setPupilTracking: roi must be [x y width height]");
+			double* roi = mxGetPr(prhs[1]);
+			settings.x = (int)roi[0];
+			settings.y = (int)roi[1];
+			settings.width = (int)roi[2];
+			settings.height = (int)roi[3];
 		}
+		if (nrhs > 2 && !mxIsEmpty(prhs[2])) settings.threshold = (int)mxGetScalar(prhs[2]);
+		if (nrhs > 3 && !mxIsEmpty(prhs[3])) settings.minArea = (int)mxGetScalar(prhs[3]);
+		if (nrhs > 4 && !mxIsEmpty(prhs[4])) settings.maxArea = (int)mxGetScalar(prhs[4]);
+		if (nrhs > 5 && !mxIsEmpty(prhs[5])) settings.nrThreads = (int)mxGetScalar(prhs[5]);
+
+		char* errmsg =  message(FF->setPupilTracking(settings));
+		if (strcmp("",errmsg)) mexErrMsgTxt(errmsg);
+	} else if (!strcmp("getPupilData",cmd)) {
+		if (nrhs < 2 || !mxIsNumeric(prhs[1])) mexErrMsgTxt("getPupilData: second parameter must be the video stream id (as a number)");
+		if (nlhs > 2) mexErrMsgTxt("getPupilData: there are only 2 output values: data, frameNrs");
+
+		vector<PupilSample>* samples;
+		char* errmsg =  message(FF->getPupilData((unsigned int)mxGetScalar(prhs[1]), &samples));
+		if (strcmp("",errmsg)) mexErrMsgTxt(errmsg);
 
+		// one row per frame: time x y major minor confidence
+		int n = samples->size();
+		plhs[0] = mxCreateDoubleMatrix(n,6,mxREAL);
+		double* data = mxGetPr(plhs[0]);
+		for (int i=0; i<n; i++)
+		{
+			PupilSample& S = samples->at(i);
+			data[i] = S.time;
+			data[i+n] = S.x;
+			data[i+2*n] = S.y;
+			data[i+3*n] = S.major;
+			data[i+4*n] = S.minor;
+			data[i+5*n] = S.confidence;
+		}
+		if (nlhs >= 2)
+		{
+			plhs[1] = mxCreateDoubleMatrix(n,1,mxREAL);
+			for (int i=0; i<n; i++) mxGetPr(plhs[1])[i] = samples->at(i).frameNr;
+		}
 	} else if (!strcmp("cleanUp",cmd)) {
 		if (nlhs > 0) mexErrMsgTxt("cleanUp: there are no outputs");
-		FFG.cleanUp();
-	}
-}
-#endif
+		FF->cleanUp();
+	} else if (!strcmp("delete",cmd)) {
+		if (!handle) mexErrMsgTxt("delete: must be preceded by the handle returned by build");
+		if (nlhs > 0) mexErrMsgTxt("delete: there are no outputs");
+		delete FF;
+		instances.erase(handle);
+	} else if (!strcmp("batchStart",cmd)) {
+		if (nrhs < 2 || !mxIsCell(prhs[1])) mexErrMsgTxt("batchStart: second parameter must be the filenames (as a cell array of strings), optionally followed by an options struct");
+		if (nrhs > 2 && !mxIsEmpty(prhs[2]) && !mxIsStruct(prhs[2])) mexErrMsgTxt("batchStart: options must be a struct");
+		if (nlhs > 0) mexErrMsgTxt("batchStart: there are no outputs");
+
+		vector<string> filenames;
+		for (size_t i=0; i<mxGetNumberOfElements(prhs[1]); i++)
+		{
+			const mxArray* name = mxGetCell(prhs[1],i);
+			if (!name || !mxIsChar(name)) mexErrMsgTxt("batchStart: filenames must be strings");
+			char* tmp = mxArrayToString(name);
+			filenames.push_back(tmp);
+			mxFree(tmp);
+		}
 
-#ifdef TEST_FFGRAB
-int main(int argc, char** argv)
-{
-	FFGrabber FFG;
-printf("%s\n",argv[1]);
-	FFG.build(argv[1],NULL,false,false,true);
-	FFG.doCapture();
-	int nrVideo, nrAudio;
-	FFG.getCaptureInfo(&nrVideo, &nrAudio);
+		// options: format, disableVideo, disableAudio, roi, pixelFormat, downscale, time, nrThreads, maxBytesPerFile, maxBytes
+		BatchOptions options;
+		const mxArray* opts = nrhs > 2 && mxIsStruct(prhs[2])?prhs[2]:NULL;
+		const mxArray* field;
+		if (opts && (field = mxGetField(opts,0,"format")) && mxIsChar(field))
+		{
+			char* tmp = mxArrayToString(field);
+			options.format = tmp;
+			mxFree(tmp);
+		}
+		if (opts && (field = mxGetField(opts,0,"disableVideo")) && !mxIsEmpty(field)) options.disableVideo = mxGetScalar(field) != 0;
+		if (opts && (field = mxGetField(opts,0,"disableAudio")) && !mxIsEmpty(field)) options.disableAudio = mxGetScalar(field) != 0;
+		options.videoOutput = parseVideoOutput("batchStart", opts?mxGetField(opts,0,"roi"):NULL, opts?mxGetField(opts,0,"pixelFormat"):NULL, opts?mxGetField(opts,0,"downscale"):NULL);
+		options.audioOutput = parseAudioOutput("batchStart", opts?mxGetField(opts,0,"audioRate"):NULL, opts?mxGetField(opts,0,"mono"):NULL, opts?mxGetField(opts,0,"float32"):NULL);
+		if (opts && (field = mxGetField(opts,0,"time")) && !mxIsEmpty(field))
+		{
+			if (!mxIsDouble(field) || mxGetNumberOfElements(field) != 2) mexErrMsgTxt("batchStart: time must be [startTime stopTime]");
+			options.startTime = mxGetPr(field)[0];
+			options.stopTime = mxGetPr(field)[1];
+		}
+		if (opts && (field = mxGetField(opts,0,"nrThreads")) && !mxIsEmpty(field)) options.nrThreads = (int)mxGetScalar(field);
+		if (opts && (field = mxGetField(opts,0,"maxBytesPerFile")) && !mxIsEmpty(field)) options.maxBytesPerFile = (size_t)mxGetScalar(field);
+		if (opts && (field = mxGetField(opts,0,"maxBytes")) && !mxIsEmpty(field)) options.maxBytes = (size_t)mxGetScalar(field);
+
+		delete batch;
+		batchFiles = filenames;
+		batch = new BatchDecoder(filenames, options);
+	} else if (!strcmp("batchNext",cmd)) {
+		if (nlhs > 1) mexErrMsgTxt("batchNext: there is only 1 output value: result");
+		if (!batch) mexErrMsgTxt("batchNext: no batch was started");
+
+		// waits for the next file to finish, [] once all files are returned
+		BatchDecoder::Result result;
+		if (!batch->next(&result))
+		{
+			delete batch;
+			batch = NULL;
+			plhs[0] = mxCreateDoubleMatrix(0,0,mxREAL);
+			return;
+		}
+		plhs[0] = batchResultToMatlab(result, batchFiles[result.index].c_str());
+		batch->release(&result);
+	} else if (!strcmp("batchStop",cmd)) {
+		if (nlhs > 0) mexErrMsgTxt("batchStop: there are no outputs");
+		delete batch;
+		batch = NULL;
+	} else if (!strcmp("getStats",cmd)) {
+		if (nlhs > 1) mexErrMsgTxt("getStats: there is only 1 output value: stats");
+
+		FFStats& stats = FF->getStats();
+		const char* fields[] = {"packetsRead","framesDecoded","framesSkipped","framesDiscarded","framesFailed","noPicture","audioPacketsDecoded",
+			"bytesAllocated","residentBytes","peakResidentBytes","readTime","decodeTime","convertTime","commandTime","copyOutTime","seeks"};
+		plhs[0] = mxCreateStructMatrix(1,1,16,fields);
+
+		// [stream index, packets] per stream
+		mxArray* packets = mxCreateDoubleMatrix(stats.packetsRead.size(),2,mxREAL);
+		int n = 0;
+		for (map<int,unsigned int>::iterator i=stats.packetsRead.begin(); i != stats.packetsRead.end(); i++, n++)
+		{
+			mxGetPr(packets)[n] = i->first;
+			mxGetPr(packets)[n+stats.packetsRead.size()] = i->second;
+		}
+		mxSetField(plhs[0],0,"packetsRead",packets);
+		mxSetField(plhs[0],0,"framesDecoded",mxCreateDoubleScalar(stats.framesDecoded));
+		mxSetField(plhs[0],0,"framesSkipped",mxCreateDoubleScalar(stats.framesSkipped));
+		mxSetField(plhs[0],0,"framesDiscarded",mxCreateDoubleScalar(stats.framesDiscarded));
+		mxSetField(plhs[0],0,"framesFailed",mxCreateDoubleScalar(stats.framesFailed));
+		mxSetField(plhs[0],0,"noPicture",mxCreateDoubleScalar(stats.noPicture));
+		mxSetField(plhs[0],0,"audioPacketsDecoded",mxCreateDoubleScalar(stats.audioPacketsDecoded));
+		mxSetField(plhs[0],0,"bytesAllocated",mxCreateDoubleScalar(stats.bytesAllocated));
+		mxSetField(plhs[0],0,"residentBytes",mxCreateDoubleScalar(stats.residentBytes));
+		mxSetField(plhs[0],0,"peakResidentBytes",mxCreateDoubleScalar(stats.peakResidentBytes));
+		mxSetField(plhs[0],0,"readTime",mxCreateDoubleScalar(stats.readTime));
+		mxSetField(plhs[0],0,"decodeTime",mxCreateDoubleScalar(stats.decodeTime));
+		mxSetField(plhs[0],0,"convertTime",mxCreateDoubleScalar(stats.convertTime));
+		mxSetField(plhs[0],0,"commandTime",mxCreateDoubleScalar(stats.commandTime));
+		mxSetField(plhs[0],0,"copyOutTime",mxCreateDoubleScalar(stats.copyOutTime));
+
+		const char* seekFields[] = {"reason","time","packetNr"};
+		mxArray* seeks = mxCreateStructMatrix(stats.seeks.size(),1,3,seekFields);
+		for (size_t i=0; i<stats.seeks.size(); i++)
+		{
+			mxSetField(seeks,i,"reason",mxCreateString(stats.seeks[i].reason.c_str()));
+			mxSetField(seeks,i,"time",mxCreateDoubleScalar(stats.seeks[i].time));
+			mxSetField(seeks,i,"packetNr",mxCreateDoubleScalar(stats.seeks[i].packetNr));
+		}
+		mxSetField(plhs[0],0,"seeks",seeks);
+	}
 
-	printf("there are %d video streams, and %d audio.\n",nrVideo,nrAudio);
+	// time spent handing decoded data over to matlab
+	if (!strcmp("getVideoFrame",cmd) || !strcmp("getAudioFrame",cmd) || !strcmp("getAudio",cmd) || !strcmp("getEpochs",cmd))
+		FF->getStats().copyOutTime += FFnow()-commandStart;
 }
 #endif
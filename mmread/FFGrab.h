@@ -0,0 +1,1089 @@
+/***************************************************
+This is the main Grabber code.  It uses AVbin and ffmpeg
+to capture video and audio from video and audio files.
+
+The code supports any number of audio or video streams and
+is a cross platform solution to replace DDGrab.cpp.
+
+This code was intended to be used inside of a matlab interface,
+but can be used as a generic grabber class for anyone who needs
+one.  Without MATLAB_MEX_FILE it builds as a plain library (see
+the Makefile and ffgrab.cpp).
+
+Copyright 2008 Micah Richert
+
+This file is part of mmread.
+**************************************************/
+
+#ifndef FFGRAB_H
+#define FFGRAB_H
+
+#ifdef MATLAB_MEX_FILE
+#include "mex.h"
+#define FFprintf(...) mexPrintf(__VA_ARGS__)
+#else
+#define FFprintf(...) printf(__VA_ARGS__)
+#endif
+
+//#ifndef mwSize
+//#define mwSize int
+//#endif
+
+#define DEBUG 0
+
+extern "C" {
+	#include <avbin.h>
+	#include <libavformat/avformat.h>
+	#include <libswscale/swscale.h>
+	#include <libavutil/imgutils.h>
+	#include <libavutil/pixdesc.h>
+
+	struct _AVbinFile {
+	    AVFormatContext *context;
+	    AVPacket *packet;
+	};
+
+	struct _AVbinStream {
+		int type;
+		AVFormatContext *format_context;
+		AVCodecContext *codec_context;
+		AVFrame *frame;
+	};
+}
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
+using namespace std;
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "PupilTracker.h"
+#include "FrameStore.h"
+#include "AudioConverter.h"
+
+// older libavutil (as bundled with AVbin) still uses the PIX_FMT_ names
+#if LIBAVUTIL_VERSION_INT < AV_VERSION_INT(51,42,0)
+#define AVPixelFormat PixelFormat
+#define AV_PIX_FMT_RGB24 PIX_FMT_RGB24
+#define AV_PIX_FMT_GRAY8 PIX_FMT_GRAY8
+#define AV_PIX_FMT_GRAY16LE PIX_FMT_GRAY16LE
+#endif
+#if LIBAVUTIL_VERSION_INT < AV_VERSION_INT(52,3,0)
+#define av_pix_fmt_desc_get(fmt) (&av_pix_fmt_descriptors[fmt])
+#endif
+// newer libavformat only gives access to the index through avformat_index_get_entry
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58,78,100)
+#define avformat_index_get_entry(st,idx) (&(st)->index_entries[idx])
+#endif
+
+// pixel formats that decoded video frames can be converted to
+enum { FF_RGB24=0, FF_GRAY8=1, FF_GRAY16=2 };
+
+// how decoded video frames are delivered.  The region of interest is given
+// in pixels of the source frame (0 based); a width or height of 0 means the
+// full frame.  The ROI is cropped and downscaled by an integer factor in the
+// same sws_scale call that does the colour conversion.
+struct VideoOutput
+{
+	int x, y, width, height;
+	int pixelFormat;
+	int downscale;
+
+	VideoOutput()
+	{
+		x = y = width = height = 0;
+		pixelFormat = FF_RGB24;
+		downscale = 1;
+	}
+};
+
+// how decoded audio is delivered.  With any of these set every packet is
+// converted while decoding (see AudioConverter.h): mixed down to one
+// channel, resampled to rate (0 keeps the source rate) and written as
+// float32 (-1 to 1) instead of the source sample format.
+struct AudioOutput
+{
+	int rate;
+	bool mono;
+	bool float32;
+
+	AudioOutput()
+	{
+		rate = 0;
+		mono = float32 = false;
+	}
+
+	bool converts() const { return rate > 0 || mono || float32; }
+};
+
+// Piecewise-linear map from video time to the eye tracker's clock through
+// anchor pairs (the video and tracker time of the same sync events), which
+// corrects both the offset and the drift between the clocks.  Outside the
+// anchors the first or last segment is extended, a single anchor is a plain
+// offset and no anchors leave the time as it is.
+class ClockMap
+{
+public:
+	// false unless both have the same length and are strictly increasing
+	bool set(const vector<double>& videoTimes, const vector<double>& trackerTimes)
+	{
+		if (videoTimes.size() != trackerTimes.size()) return false;
+		for (size_t i=1; i<videoTimes.size(); i++)
+			if (videoTimes[i] <= videoTimes[i-1] || trackerTimes[i] <= trackerTimes[i-1]) return false;
+
+		video = videoTimes;
+		tracker = trackerTimes;
+		return true;
+	}
+
+	double toTracker(double t) const { return interpolate(video, tracker, t); }
+	double toVideo(double t) const { return interpolate(tracker, video, t); }
+
+private:
+	static double interpolate(const vector<double>& x, const vector<double>& y, double t)
+	{
+		if (x.empty()) return t;
+		if (x.size() == 1) return t-x[0]+y[0];
+
+		size_t i = upper_bound(x.begin(), x.end(), t)-x.begin();
+		i = min(max(i,(size_t)1),x.size()-1);
+		return y[i-1] + (t-x[i-1])*(y[i]-y[i-1])/(x[i]-x[i-1]);
+	}
+
+	vector<double> video, tracker;
+};
+
+// seconds on a monotonic clock, for the stage timings
+static inline double FFnow()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Counters and timings of the current capture, reset by build.  Reading
+// covers disk and demuxing (both happen in avbin_read).
+struct FFStats
+{
+	map<int,unsigned int> packetsRead; // by stream index
+	unsigned int framesDecoded;   // video pictures decoded
+	unsigned int framesSkipped;   // video packets not decoded (seeking or past the last frame)
+	unsigned int framesDiscarded; // decoded only to keep the decoder going
+	unsigned int framesFailed;    // decoder errors
+	unsigned int noPicture;       // packets that did not complete a picture (yet)
+	unsigned int audioPacketsDecoded;
+	size_t bytesAllocated, residentBytes, peakResidentBytes;
+	double readTime, decodeTime, convertTime, commandTime, copyOutTime;
+
+	// every seek decision: "startDecodingAt" (packetNr), "setTime", "epoch" or "proxy" (time in seconds)
+	struct Seek
+	{
+		string reason;
+		double time;
+		unsigned int packetNr;
+	};
+	vector<Seek> seeks;
+
+	FFStats()
+	{
+		reset();
+	}
+
+	void reset()
+	{
+		packetsRead.clear();
+		framesDecoded = framesSkipped = framesDiscarded = framesFailed = noPicture = audioPacketsDecoded = 0;
+		bytesAllocated = residentBytes = peakResidentBytes = 0;
+		readTime = decodeTime = convertTime = commandTime = copyOutTime = 0;
+		seeks.clear();
+	}
+
+	void logSeek(const char* reason, double time, unsigned int packetNr = 0)
+	{
+		Seek seek = {reason, time, packetNr};
+		seeks.push_back(seek);
+		if (DEBUG) FFprintf("seek (%s): %lf %u\n",reason,time,packetNr);
+	}
+
+	void allocated(size_t n)
+	{
+		bytesAllocated += n;
+		residentBytes += n;
+		peakResidentBytes = max(peakResidentBytes,residentBytes);
+	}
+
+	void released(size_t n)
+	{
+		residentBytes -= min(n,residentBytes);
+	}
+};
+
+// avbin_decode_audio wants at least this much room for every call
+#ifdef AVCODEC_MAX_AUDIO_FRAME_SIZE
+#define AUDIO_DECODE_RESERVE AVCODEC_MAX_AUDIO_FRAME_SIZE
+#else
+#define AUDIO_DECODE_RESERVE 192000
+#endif
+
+// Growable contiguous buffer for decoded audio.  Under matlab the memory
+// comes from mxMalloc so it can be handed to an mxArray without a copy; that
+// is switched off when the buffer is filled from a thread other than matlab's.
+struct AudioBuffer
+{
+	uint8_t* data;
+	size_t size, capacity;
+	bool mxOwned;
+
+	AudioBuffer()
+	{
+		data = NULL;
+		size = capacity = 0;
+#ifdef MATLAB_MEX_FILE
+		mxOwned = true;
+#else
+		mxOwned = false;
+#endif
+	}
+
+	~AudioBuffer()
+	{
+		release();
+	}
+
+	// make room for n more bytes, growing in chunks of at least 1 MB
+	bool reserve(size_t n)
+	{
+		if (size+n <= capacity) return true;
+
+		size_t newCapacity = max(size+n, capacity+max((size_t)1<<20, capacity/2));
+		uint8_t* tmp;
+#ifdef MATLAB_MEX_FILE
+		if (mxOwned)
+		{
+			tmp = (uint8_t*)mxRealloc(data,newCapacity);
+			mexMakeMemoryPersistent(tmp);
+		} else
+#endif
+		tmp = (uint8_t*)realloc(data,newCapacity);
+		if (!tmp) return false;
+
+		data = tmp;
+		capacity = newCapacity;
+		return true;
+	}
+
+	// hand the data over to the caller, who has to free it (mxFree if mxOwned)
+	uint8_t* detach()
+	{
+		uint8_t* tmp = data;
+		data = NULL;
+		size = capacity = 0;
+		return tmp;
+	}
+
+	void release()
+	{
+#ifdef MATLAB_MEX_FILE
+		if (mxOwned) mxFree(data);
+		else
+#endif
+		free(data);
+		data = NULL;
+		size = capacity = 0;
+	}
+};
+
+class Grabber
+{
+public:
+	Grabber(bool isAudio, AVbinStream* stream, bool trySeeking, double rate, int bytesPerWORD, AVbinStreamInfo info, AVbinTimestamp start_time, map<unsigned int,double>* keyframes, unsigned int* startDecodingAt, FFStats* stats)
+	{
+		this->stream = stream;
+		frameNr = 0;
+		packetNr = 0;
+		done = false;
+		this->bytesPerWORD = bytesPerWORD;
+		this->rate = rate;
+		startTime = 0;
+		stopTime = 0;
+		this->isAudio = isAudio;
+		this->info = info;
+		this->trySeeking = trySeeking;
+		this->start_time = start_time>0?start_time:0;
+		this->keyframes = keyframes;
+		this->startDecodingAt = startDecodingAt;
+		this->stats = stats;
+		bytesHeld = 0;
+		store = NULL;
+		sws = NULL;
+		pupil = NULL;
+		converter = NULL;
+		clock = NULL;
+		sampleRate = sampleStart = sampleStop = 0;
+		contiguousAudio = false;
+		scratch.mxOwned = false;
+		outWidth = info.video.width;
+		outHeight = info.video.height;
+	};
+
+	~Grabber()
+	{
+		// clean up any remaining memory...
+		if (DEBUG) FFprintf("freeing frame data...\n");
+		for (vector<uint8_t*>::iterator i=frames.begin();i != frames.end(); i++) free(*i);
+		if (sws) sws_freeContext(sws);
+		delete pupil;
+		delete converter;
+	}
+
+	// convert the decoded audio while decoding, see AudioOutput
+	void setAudioOutput(const AudioOutput& ao)
+	{
+		delete converter;
+		converter = NULL;
+		if (ao.converts() && info.audio.sample_rate > 0)
+			converter = new AudioConverter(info.audio.sample_format, info.audio.sample_bits, info.audio.channels, info.audio.sample_rate, ao.rate, ao.mono, ao.float32);
+	}
+
+	// the resampler holds back the last few samples until the stream ends
+	int finishAudio()
+	{
+		if (!converter) return 0;
+
+		converted.clear();
+		converter->flush(&converted);
+		return keepAudio(converted.empty()?NULL:&converted[0], converted.size(), false);
+	}
+
+	// time stamps are delivered in this clock, if set
+	double deliveredTime(double timestamp)
+	{
+		return clock ? clock->toTracker(timestamp) : timestamp;
+	}
+
+	// With a sample rate set only the frame nearest to each tracker sample is
+	// kept.  A frame is taken to cover its time +- half a frame interval (in
+	// the tracker clock), so every sample falls in exactly one frame.
+	bool nearSample(double timestamp)
+	{
+		if (sampleRate <= 0 || rate <= 0) return true;
+
+		// the interval is shifted by a fraction of a frame, so that a sample
+		// right on the boundary of two frames (common with rates like 250
+		// and 60 Hz) is not lost or counted twice through rounding
+		double shift = 0.001/rate;
+		double from = deliveredTime(timestamp-0.5/rate+shift), to = deliveredTime(timestamp+0.5/rate+shift);
+		double first = max(0.0, ceil((from-sampleStart)*sampleRate));
+		double next = ceil((to-sampleStart)*sampleRate);
+		if (sampleStop > 0) next = min(next, ceil((sampleStop-sampleStart)*sampleRate));
+		return next > first;
+	}
+
+	// analyse frames with the pupil tracker instead of keeping them
+	void setPupilTracking(const PupilSettings& settings)
+	{
+		delete pupil;
+		pupil = new PupilTracker(settings, outWidth, outHeight, bytesPerPixel(), output.x, output.y, output.downscale);
+	}
+
+	// clip the requested ROI to the frame and work out the size of the
+	// delivered frames.  Returns the number of bytes per output frame.
+	int setVideoOutput(const VideoOutput& vo)
+	{
+		output = vo;
+		int w = info.video.width, h = info.video.height;
+
+		output.x = max(0,min(output.x,w-1));
+		output.y = max(0,min(output.y,h-1));
+		if (output.width <= 0 || output.x+output.width > w) output.width = w-output.x;
+		if (output.height <= 0 || output.y+output.height > h) output.height = h-output.y;
+		if (output.downscale < 1) output.downscale = 1;
+
+		outWidth = max(1,output.width/output.downscale);
+		outHeight = max(1,output.height/output.downscale);
+
+		return outWidth*outHeight*bytesPerPixel();
+	}
+
+	int bytesPerPixel()
+	{
+		switch (output.pixelFormat)
+		{
+			case FF_GRAY8: return 1;
+			case FF_GRAY16: return 2;
+			default: return 3;
+		}
+	}
+
+	AVPixelFormat outPixelFormat()
+	{
+		switch (output.pixelFormat)
+		{
+			case FF_GRAY8: return AV_PIX_FMT_GRAY8;
+			case FF_GRAY16: return AV_PIX_FMT_GRAY16LE;
+			default: return AV_PIX_FMT_RGB24;
+		}
+	}
+
+	// Equivalent of avbin_decode_video, but crops, downscales and converts
+	// straight from the decoder's planes into out, so the full resolution
+	// RGB frame is never built.  out may be NULL to decode without
+	// converting.  Returns the number of bytes used, 0 if the packet did
+	// not complete a picture, or -1 on errors (counted in stats).
+	int decodeVideo(AVbinPacket* packet, uint8_t* out)
+	{
+		AVCodecContext* codec = stream->codec_context;
+		AVFrame* frame = stream->frame;
+		AVPacket avpacket;
+		int got_picture = 0;
+
+		av_init_packet(&avpacket);
+		avpacket.data = packet->data;
+		avpacket.size = packet->size;
+
+		double t = FFnow();
+		int used = avcodec_decode_video2(codec, frame, &got_picture, &avpacket);
+		stats->decodeTime += FFnow()-t;
+		if (used < 0)
+		{
+			stats->framesFailed++;
+			return -1;
+		}
+		if (!got_picture)
+		{
+			stats->noPicture++;
+			return 0;
+		}
+		stats->framesDecoded++;
+		// only keeping the decoder going (e.g. up to the start of an epoch)
+		if (!out) return used;
+
+		t = FFnow();
+		bool converted = convertPicture(out, &sws, outWidth, outHeight);
+		stats->convertTime += FFnow()-t;
+		if (!converted)
+		{
+			stats->framesFailed++;
+			return -1;
+		}
+
+		return used;
+	}
+
+	// crop, scale and convert the last decoded picture into out (width x
+	// height in the output pixel format), using (and caching) ctx.
+	bool convertPicture(uint8_t* out, struct SwsContext** ctx, int width, int height)
+	{
+		AVCodecContext* codec = stream->codec_context;
+		AVFrame* frame = stream->frame;
+
+		// the ROI origin has to sit on the chroma grid, otherwise the luma and
+		// chroma planes would be offset against each other
+		const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(codec->pix_fmt);
+		int x = (output.x >> desc->log2_chroma_w) << desc->log2_chroma_w;
+		int y = (output.y >> desc->log2_chroma_h) << desc->log2_chroma_h;
+
+		int steps[4];
+		if (av_image_fill_linesizes(steps, codec->pix_fmt, 1) < 0) return false;
+
+		const uint8_t* src[4];
+		for (int p=0; p<4; p++)
+		{
+			bool chroma = p==1 || p==2;
+			src[p] = frame->data[p];
+			// planes without a pixel step (e.g. palettes) are not cropped
+			if (src[p] && steps[p] > 0)
+			{
+				src[p] += (chroma?y>>desc->log2_chroma_h:y)*frame->linesize[p];
+				src[p] += (chroma?x>>desc->log2_chroma_w:x)*steps[p];
+			}
+		}
+
+		bool shrink = width < output.width || height < output.height;
+		*ctx = sws_getCachedContext(*ctx, output.width, output.height, codec->pix_fmt, width, height, outPixelFormat(),
+			shrink?SWS_AREA:SWS_FAST_BILINEAR, NULL, NULL, NULL);
+		if (!*ctx) return false;
+
+		uint8_t* dst[4] = {out, NULL, NULL, NULL};
+		int dstStride[4] = {width*bytesPerPixel(), 0, 0, 0};
+		sws_scale(*ctx, src, frame->linesize, 0, output.height, dst, dstStride);
+
+		return true;
+	}
+
+	AVbinStream* stream;
+	AVbinStreamInfo info;
+	AVbinTimestamp start_time;
+
+	vector<uint8_t*> frames;
+	vector<unsigned int> frameBytes;
+	vector<double> frameTimes;
+
+	vector<unsigned int> frameNrs;
+
+	// keyframes seen so far in this file, shared by the streams of one FFGrabber
+	map<unsigned int,double>* keyframes;
+	unsigned int* startDecodingAt;
+
+	// bytes of decoded data kept so far
+	size_t bytesHeld;
+
+	FFStats* stats;
+
+	unsigned int frameNr;
+	unsigned int packetNr;
+	bool done;
+	bool isAudio;
+	bool trySeeking;
+
+	int bytesPerWORD;
+	double rate;
+	double startTime, stopTime;
+
+	VideoOutput output;
+	int outWidth, outHeight;
+	struct SwsContext* sws;
+
+	PupilTracker* pupil;
+
+	// every decoded frame is also written here, if set
+	FrameStoreWriter* store;
+
+	// the tracker clock and the tracker samples (rate 0 for every frame), see FFGrabber::setSampleLock
+	const ClockMap* clock;
+	double sampleRate, sampleStart, sampleStop;
+
+	// audio is either kept per packet in frames, or appended to one contiguous
+	// buffer (with frameBytes/frameTimes still per packet)
+	bool contiguousAudio;
+	AudioBuffer audio;
+	AudioBuffer scratch;
+
+	// converts the decoded audio, if set (converted is its output for one packet)
+	AudioConverter* converter;
+	vector<uint8_t> converted;
+
+	// keep len bytes of converted audio, in the contiguous buffer or as a
+	// packet of its own.  Without newPacket they belong to the last packet.
+	int keepAudio(const uint8_t* data, size_t len, bool newPacket = true)
+	{
+		if (!newPacket && (!len || frameBytes.empty())) return 0;
+
+		if (contiguousAudio)
+		{
+			if (!audio.reserve(len)) return 2;
+			if (len) memcpy(audio.data+audio.size,data,len);
+			audio.size += len;
+		} else if (newPacket) {
+			uint8_t* tmp = (uint8_t*)malloc(len);
+			if (!tmp && len) return 2;
+			if (len) memcpy(tmp,data,len);
+			frames.push_back(tmp);
+		} else {
+			uint8_t* tmp = (uint8_t*)realloc(frames.back(),frameBytes.back()+len);
+			if (!tmp) return 2;
+			memcpy(tmp+frameBytes.back(),data,len);
+			frames.back() = tmp;
+		}
+
+		if (newPacket) frameBytes.push_back(len);
+		else frameBytes.back() += len;
+		bytesHeld += len;
+		return 0;
+	}
+
+	int Grab(AVbinPacket* packet)
+	{
+		if (done) return 0;
+		if (!packet->data) return 1;
+
+		frameNr++;
+		packetNr++;
+		if (DEBUG) FFprintf("frameNr %d %d %d\n",frameNr,packetNr,packet->size);
+		int offset=0, len=0;
+		double timestamp = (packet->timestamp-start_time)/1000.0/1000.0;
+		if (DEBUG) FFprintf("time %lld %lld %lf\n",packet->timestamp,start_time,timestamp);
+
+		// either no frames are specified (capture all), or we have time specified
+		if (stopTime)
+		{
+			if (isAudio)
+			{
+				// time is being used...
+				if (timestamp >= startTime)
+				{
+					// if we've reached the start...
+					offset = max(0,((int)((startTime-timestamp)*rate))*bytesPerWORD);
+					len = ((int)((stopTime-timestamp)*rate))*bytesPerWORD;
+					// if we have gone past our stop time...
+
+					done = len < 0;
+				}
+			} else {
+				done = stopTime <= timestamp;
+				len = (startTime <= timestamp)?0x7FFFFFFF:0;
+				if (DEBUG) FFprintf("startTime: %lf, stopTime: %lf, current: %lf, done: %d, len: %d\n",startTime,stopTime,timestamp,done,len);
+			}
+		} else {
+			// capture everything... video or audio
+			len = 0x7FFFFFFF;
+		}
+
+		if (isAudio)
+		{
+			if (trySeeking && (len<=0 || done)) return 0;
+
+			// decode straight onto the end of the contiguous buffer, or into the
+			// scratch buffer when keeping packets or converting.  Both grow as
+			// needed, so a packet can decode to any size.
+			bool direct = contiguousAudio && !converter;
+			AudioBuffer& buf = direct?audio:scratch;
+			if (!direct) scratch.size = 0;
+			size_t start = buf.size;
+
+			if (DEBUG) FFprintf("avbin_decode_audio\n");
+			double t = FFnow();
+			stats->audioPacketsDecoded++;
+			while (packet->size > 0)
+			{
+				if (!buf.reserve(AUDIO_DECODE_RESERVE)) return 2;
+				int uint8_tsout = (int)min(buf.capacity-buf.size,(size_t)0x7FFFFFFF);
+				int uint8_tsread = avbin_decode_audio(stream, packet->data, packet->size, buf.data+buf.size, &uint8_tsout);
+				if (uint8_tsread <= 0) break;
+
+				packet->data += uint8_tsread;
+				packet->size -= uint8_tsread;
+				buf.size += uint8_tsout;
+			}
+			stats->decodeTime += FFnow()-t;
+
+			int nrBytes = buf.size-start;
+			len = min(len,nrBytes);
+			offset = min(offset,nrBytes);
+
+			if (converter)
+			{
+				t = FFnow();
+				converted.clear();
+				converter->convert(scratch.data+offset, len, &converted);
+				stats->convertTime += FFnow()-t;
+				if (keepAudio(converted.empty()?NULL:&converted[0], converted.size())) return 2;
+			} else if (direct) {
+				// only keep the requested part of what was just decoded
+				if (offset > 0) memmove(audio.data+start,audio.data+start+offset,len);
+				audio.size = start+len;
+				frameBytes.push_back(len);
+				bytesHeld += len;
+			} else if (keepAudio(scratch.data+offset, len)) return 2;
+
+			frameTimes.push_back(deliveredTime(timestamp));
+
+		} else {
+			bool skip = false;
+			if (frameNrs.size() > 0)
+			{
+				//frames are being specified
+				// check to see if the frame is in our list
+				bool foundNr = false;
+				unsigned int lastFrameNr = 0;
+				for (int i=0;i<frameNrs.size();i++)
+				{
+					if (frameNrs.at(i) == frameNr) foundNr = true;
+					if (frameNrs.at(i) > lastFrameNr) lastFrameNr = frameNrs.at(i);
+				}
+
+				done = frameNr > lastFrameNr;
+				if (!foundNr) {
+					if (DEBUG) FFprintf("Skipping frame %d\n",frameNr);
+					skip = true;
+				}
+			}
+			if ((trySeeking && skip && packetNr < *startDecodingAt && packetNr != 1) || done )
+			{
+				stats->framesSkipped++;
+				return 0;
+			}
+
+			// frames that are not kept are only decoded to keep the decoder
+			// going, they are not converted (unless the store needs them)
+			bool keep = !skip && len != 0 && nearSample(timestamp);
+			uint8_t* videobuf = NULL;
+			if (keep || store)
+			{
+				if (DEBUG) FFprintf("allocate frame %d\n",frames.size());
+				videobuf = (uint8_t*)malloc(bytesPerWORD);
+				if (!videobuf) return 2;
+			}
+			if (DEBUG) FFprintf("decodeVideo\n");
+
+			if (decodeVideo(packet,videobuf)<=0)
+			{
+				if (DEBUG) FFprintf("decodeVideo FAILED!!!\n");
+				// no picture: decode errors and delays are counted in stats, the frame number is not used up
+				frameNr--;
+				free(videobuf);
+				return 3;
+			}
+
+			if (stream->frame->key_frame)
+			{
+				(*keyframes)[packetNr] = timestamp;
+			}
+
+			if (store) store->append(videobuf, timestamp);
+
+			if (!keep)
+			{
+				stats->framesDiscarded++;
+				free(videobuf);
+				return 0;
+			}
+			if (pupil)
+			{
+				// the tracker owns (and frees) the frame from here on
+				pupil->push(videobuf, frameNr, deliveredTime(timestamp));
+				return 0;
+			}
+			frames.push_back(videobuf);
+			frameBytes.push_back(min(len,bytesPerWORD));
+			frameTimes.push_back(deliveredTime(timestamp));
+			bytesHeld += bytesPerWORD;
+		}
+
+		return 0;
+	}
+};
+
+typedef map<int,Grabber*> streammap;
+
+// packed (row major, interleaved) pixels to matlab's height x width x channels order
+template <typename T> void unpackFrame(const T* in, T* out, int width, int height, int channels)
+{
+	for (int y=0; y<height; y++)
+		for (int x=0; x<width; x++)
+			for (int c=0; c<channels; c++)
+				out[y + height*(x + width*c)] = in[(y*width + x)*channels + c];
+}
+
+// Memory shared by several grabbers decoding at the same time.  A grabber
+// that would go over the limit waits as long as finished results are still
+// waiting to be collected (collecting them gives memory back), otherwise it
+// has to stop.
+class MemoryBudget
+{
+public:
+	MemoryBudget(size_t limit)
+	{
+		this->limit = limit;
+		used = 0;
+		collectable = 0;
+		aborted = false;
+	}
+
+	bool take(size_t n)
+	{
+		unique_lock<mutex> lock(m);
+		changed.wait(lock, [this,n]{ return aborted || !limit || used+n <= limit || collectable == 0; });
+		if (aborted || (limit && used+n > limit)) return false;
+		used += n;
+		return true;
+	}
+
+	void give(size_t n)
+	{
+		lock_guard<mutex> lock(m);
+		used -= min(n,used);
+		changed.notify_all();
+	}
+
+	void addCollectable(int n)
+	{
+		lock_guard<mutex> lock(m);
+		collectable += n;
+		changed.notify_all();
+	}
+
+	void abort()
+	{
+		lock_guard<mutex> lock(m);
+		aborted = true;
+		changed.notify_all();
+	}
+
+private:
+	size_t limit, used;
+	int collectable;
+	bool aborted;
+	mutex m;
+	condition_variable changed;
+};
+
+#ifdef MATLAB_MEX_FILE
+class FrameBatches;
+#endif
+
+class FFGrabber
+{
+public:
+	// matlabThread is false for grabbers that capture on a thread of their own
+	FFGrabber(bool matlabThread = true);
+	~FFGrabber();
+
+	int build(char* filename, char* format, bool disableVideo, bool disableAudio, bool tryseeking, const VideoOutput& videoOutput = VideoOutput(), const AudioOutput& audioOutput = AudioOutput());
+	int doCapture();
+
+	int getVideoInfo(unsigned int id, int* width, int* height, double* rate, int* nrFramesCaptured, int* nrFramesTotal, double* totalDuration, int* pixelFormat = NULL);
+	int getAudioInfo(unsigned int id, int* nrChannels, double* rate, int* bits, int* nrFramesCaptured, int* nrFramesTotal, int* subtype, double* totalDuration);
+	void getCaptureInfo(int* nrVideo, int* nrAudio);
+	// data must be freed by caller
+	int getVideoFrame(unsigned int id, unsigned int frameNr, uint8_t** data, unsigned int* nrBytes, double* time);
+	// data must be freed by caller
+	int getAudioFrame(unsigned int id, unsigned int frameNr, uint8_t** data, unsigned int* nrBytes, double* time);
+	// data must be freed by caller (with mxFree if mxOwned), times gets the time of every packet
+	int getAudio(unsigned int id, uint8_t** data, size_t* nrBytes, bool* mxOwned, vector<double>* times = NULL);
+	void setContiguousAudio(bool contiguousAudio);
+	void setFrames(unsigned int* frameNrs, int nrFrames);
+	void setTime(double startTime, double stopTime);
+	// deliver all time stamps in the eye tracker's clock, mapped through these anchor pairs (in seconds)
+	int setClockAnchors(const vector<double>& videoTimes, const vector<double>& trackerTimes);
+	// keep only the video frames nearest to tracker samples at rate, from startTime to stopTime
+	// (tracker clock, 0 stopTime for the whole file).  Set the clock anchors first.
+	int setSampleLock(double rate, double startTime, double stopTime);
+	// for every tracker sample the index of the captured frame nearest to it, -1 if none
+	int getSampleFrames(unsigned int id, vector<int>* frameIndex);
+	// keep the decoded frames of the first video stream in a frame store at path ("" for none):
+	// a valid store is read instead of decoding, otherwise a full capture writes it
+	void setFrameStore(const char* path);
+	// one pass writing a scrubbing proxy of the first video stream: basePath.q4.ffstore and
+	// basePath.q16.ffstore hold every frame at 1/4 and 1/16 size, basePath.key.ffstore the keyframes at 1/4
+	int makeProxy(const char* basePath, int* nrFrames, int* nrKeyframes);
+	// capture the first video stream in windows [onset+windowStart, onset+windowStop) around each onset (in seconds)
+	void setEpochs(const vector<double>& onsets, double windowStart, double windowStop);
+	// data (nrTrials*nrFrames packed frames, trial changing fastest) must be freed by caller, times is NaN for empty slots
+	int getEpochs(uint8_t** data, int* nrTrials, int* nrFrames, int* frameBytes, vector<double>* times);
+	int setPupilTracking(const PupilSettings& settings);
+	int getPupilData(unsigned int id, vector<PupilSample>** samples);
+	void disableVideo();
+	void disableAudio();
+	// stop capturing once maxBytes (0 for no limit) are decoded, or when the shared budget runs out
+	void setMemoryLimit(size_t maxBytes, MemoryBudget* budget = NULL);
+	// give up on the capture between packets once *cancel is set
+	void setCancelFlag(const atomic<bool>* cancel);
+	size_t getCapturedBytes() { return capturedBytes; }
+	// counters, timings and seek log of the current capture
+	FFStats& getStats() { return stats; }
+	bool isTruncated() { return truncated; }
+	void cleanUp(); // must be called at the end, in order to render anything afterward.
+
+#ifdef MATLAB_MEX_FILE
+	void setMatlabCommand(char * matlabCommand, int batchSize = 1);
+	void setMatlabCommandHandle(mxArray * matlabCommandHandle, int batchSize = 1);
+	void runMatlabCommand(Grabber* G);
+	void addToBatch(Grabber* G);
+	int doBatchedCapture();
+#endif
+private:
+	void readPackets();
+	bool reserveMemory(size_t n);
+	int doEpochCapture();
+	void placeEpochFrame(const uint8_t* frame, double timestamp, int first, int last, const vector<pair<double,int> >& order, size_t frameBytes);
+	FrameStoreHeader frameStoreHeader(Grabber* G);
+	bool openFrameStore();
+	void readFrameStore();
+
+	streammap streams;
+	vector<Grabber*> videos;
+	vector<Grabber*> audios;
+
+	AVbinFile* file;
+	AVbinFileInfo fileinfo;
+
+	bool stopForced;
+	bool tryseeking;
+	vector<unsigned int> frameNrs;
+	double startTime, stopTime;
+
+	char* filename;
+	struct stat filestat;
+
+	map<unsigned int,double> keyframes;
+	unsigned int startDecodingAt;
+
+	ClockMap clock;
+	double sampleRate, sampleStart, sampleStop;
+
+	FFStats stats;
+
+	string frameStorePath;
+	FrameStore* storeReader;
+	FrameStoreWriter* storeWriter;
+
+	vector<double> epochOnsets;
+	double epochStart, epochStop;
+	int epochFrames;
+	uint8_t* epochData;
+	vector<double> epochTimes;
+
+	bool matlabThread;
+	size_t maxBytes, capturedBytes;
+	MemoryBudget* budget;
+	bool truncated;
+	const atomic<bool>* cancel;
+
+
+#ifdef MATLAB_MEX_FILE
+	char* matlabCommand;
+	mxArray* matlabCommandHandle;
+	mxArray* prhs[6];
+
+	// > 1 calls the matlab command with that many frames at once
+	int batchSize;
+	FrameBatches* batches;
+#endif
+};
+
+struct BatchOptions
+{
+	string format;
+	bool disableVideo, disableAudio;
+	VideoOutput videoOutput;
+	AudioOutput audioOutput;
+	// 0 stop time captures the whole file
+	double startTime, stopTime;
+	// 0 uses one thread per core
+	int nrThreads;
+	// 0 means no limit
+	size_t maxBytesPerFile, maxBytes;
+
+	BatchOptions()
+	{
+		disableVideo = disableAudio = false;
+		startTime = stopTime = 0;
+		nrThreads = 0;
+		maxBytesPerFile = maxBytes = 0;
+	}
+};
+
+// Decodes a list of files on a pool of threads, one FFGrabber per file.
+// Finished files are handed out by next() in the order they finish, so
+// they can be used (and their memory freed) while the others are decoding.
+class BatchDecoder
+{
+public:
+	struct Result
+	{
+		int index;
+		FFGrabber* grabber; // owned by the caller after next()
+		int err;
+	};
+
+	BatchDecoder(const vector<string>& filenames, const BatchOptions& options) : budget(options.maxBytes)
+	{
+		this->filenames = filenames;
+		this->options = options;
+		nextFile = 0;
+		collected = 0;
+		stopping = false;
+
+		int nrThreads = options.nrThreads;
+		if (nrThreads <= 0) nrThreads = max(1u,thread::hardware_concurrency());
+		nrThreads = min(nrThreads,(int)filenames.size());
+		for (int i=0; i<nrThreads; i++) workers.push_back(thread(&BatchDecoder::work,this));
+	}
+
+	~BatchDecoder()
+	{
+		{
+			// files not started yet are dropped, the ones being decoded stop at their next packet
+			lock_guard<mutex> lock(m);
+			stopping = true;
+			nextFile = filenames.size();
+		}
+		budget.abort();
+		for (size_t i=0; i<workers.size(); i++) workers[i].join();
+		for (size_t i=0; i<finished.size(); i++) delete finished[i].grabber;
+	}
+
+	// waits for the next finished file, false when all files have been handed out
+	bool next(Result* result)
+	{
+		unique_lock<mutex> lock(m);
+		changed.wait(lock, [this]{ return !finished.empty() || collected == filenames.size(); });
+		if (finished.empty()) return false;
+
+		*result = finished.front();
+		finished.pop_front();
+		collected++;
+		return true;
+	}
+
+	// the caller is done with a result (every result has to be released),
+	// gives its memory back to the budget
+	void release(Result* result)
+	{
+		delete result->grabber;
+		result->grabber = NULL;
+		budget.addCollectable(-1);
+	}
+
+private:
+	void work()
+	{
+		while (true)
+		{
+			Result result;
+			{
+				lock_guard<mutex> lock(m);
+				if (stopping || nextFile == filenames.size()) return;
+				result.index = nextFile++;
+			}
+
+			FFGrabber* FF = new FFGrabber(false);
+			FF->setMemoryLimit(options.maxBytesPerFile, &budget);
+			FF->setCancelFlag(&stopping);
+			result.grabber = FF;
+			result.err = FF->build((char*)filenames[result.index].c_str(), options.format.empty()?NULL:(char*)options.format.c_str(),
+				options.disableVideo, options.disableAudio, true, options.videoOutput, options.audioOutput);
+			if (!result.err)
+			{
+				if (options.stopTime) FF->setTime(options.startTime, options.stopTime);
+				else
+				{
+					unsigned int noFrames;
+					FF->setFrames(&noFrames, 0);
+				}
+				FF->setContiguousAudio(true);
+				result.err = FF->doCapture();
+			}
+
+			lock_guard<mutex> lock(m);
+			finished.push_back(result);
+			budget.addCollectable(1);
+			changed.notify_all();
+		}
+	}
+
+	vector<string> filenames;
+	BatchOptions options;
+	MemoryBudget budget;
+
+	vector<thread> workers;
+	size_t nextFile, collected;
+	deque<Result> finished;
+	atomic<bool> stopping;
+	mutex m;
+	condition_variable changed;
+};
+
+#endif
@@ -0,0 +1,259 @@
+/***************************************************
+Raw store of decoded video frames.
+
+The file starts with a fixed size header, followed by the frames (all the
+same size, so frame i is at framesOffset + i*frameBytes) and a table with
+the time stamp of every frame.  Frames are stored the way FFGrab delivers
+them (after cropping, downscaling and pixel format conversion), so reading
+them back needs neither decoding nor conversion.
+
+The header records the size and modification time of the source file and
+the output settings, a store that does not match them is out of date.  It
+is only marked complete once all frames and the time table are written.
+
+Stores are read through a memory mapping.
+
+This file is part of mmread.
+**************************************************/
+
+#ifndef FRAMESTORE_H
+#define FRAMESTORE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+// keep windows.h from defining min and max over std::min and std::max
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#define fseeko _fseeki64
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define FRAMESTORE_MAGIC "FFSTORE"
+#define FRAMESTORE_VERSION 1
+// frames start on a page boundary
+#define FRAMESTORE_HEADER_SIZE 4096
+
+struct FrameStoreHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t complete;
+	// source file
+	int64_t sourceSize, sourceMtime;
+	// output settings: roi in source pixels, pixel format and downscale as used by FFGrab
+	int32_t x, y, width, height, pixelFormat, downscale;
+	// delivered frames
+	int32_t outWidth, outHeight, bytesPerPixel, reserved;
+	uint64_t nrFrames, frameBytes, framesOffset, timesOffset;
+
+	FrameStoreHeader()
+	{
+		memset(this, 0, sizeof(*this));
+		memcpy(magic, FRAMESTORE_MAGIC, 8);
+		version = FRAMESTORE_VERSION;
+		framesOffset = FRAMESTORE_HEADER_SIZE;
+	}
+
+	// same source and output settings (the frame count is not compared)
+	bool matches(const FrameStoreHeader& other) const
+	{
+		return !memcmp(magic, other.magic, 8) && version == other.version &&
+			sourceSize == other.sourceSize && sourceMtime == other.sourceMtime &&
+			x == other.x && y == other.y && width == other.width && height == other.height &&
+			pixelFormat == other.pixelFormat && downscale == other.downscale &&
+			outWidth == other.outWidth && outHeight == other.outHeight &&
+			bytesPerPixel == other.bytesPerPixel && frameBytes == other.frameBytes;
+	}
+};
+
+class FrameStoreWriter
+{
+public:
+	FrameStoreWriter()
+	{
+		file = NULL;
+	}
+
+	~FrameStoreWriter()
+	{
+		discard();
+	}
+
+	bool open(const char* path, const FrameStoreHeader& header)
+	{
+		discard();
+		this->path = path;
+		this->header = header;
+		this->header.complete = 0;
+		this->header.nrFrames = 0;
+		times.clear();
+
+		file = fopen(path, "wb");
+		if (!file) return false;
+
+		// the header is written again with the final counts by close()
+		std::vector<uint8_t> block(FRAMESTORE_HEADER_SIZE, 0);
+		memcpy(&block[0], &this->header, sizeof(this->header));
+		if (fwrite(&block[0], 1, block.size(), file) != block.size())
+		{
+			discard();
+			return false;
+		}
+		return true;
+	}
+
+	// frames have to come in order, starting with the first frame of the file
+	bool append(const uint8_t* frame, double time)
+	{
+		if (!file) return false;
+		if (fwrite(frame, 1, header.frameBytes, file) != header.frameBytes)
+		{
+			discard();
+			return false;
+		}
+		times.push_back(time);
+		header.nrFrames++;
+		return true;
+	}
+
+	// write the time table and mark the store complete
+	bool close()
+	{
+		if (!file) return false;
+
+		header.timesOffset = header.framesOffset + header.nrFrames*header.frameBytes;
+		header.complete = 1;
+		bool ok = (times.empty() || fwrite(&times[0], sizeof(double), times.size(), file) == times.size()) &&
+			!fseeko(file, 0, SEEK_SET) &&
+			fwrite(&header, sizeof(header), 1, file) == 1;
+		ok = !fclose(file) && ok;
+		file = NULL;
+
+		if (!ok) remove(path.c_str());
+		return ok;
+	}
+
+	// give up on an unfinished store
+	void discard()
+	{
+		if (!file) return;
+		fclose(file);
+		file = NULL;
+		remove(path.c_str());
+	}
+
+private:
+	std::string path;
+	FILE* file;
+	FrameStoreHeader header;
+	std::vector<double> times;
+};
+
+class FrameStore
+{
+public:
+	FrameStore()
+	{
+		data = NULL;
+		size = 0;
+#ifdef _WIN32
+		fileHandle = mapping = NULL;
+#endif
+	}
+
+	~FrameStore()
+	{
+		close();
+	}
+
+	// map a complete store, false if it can't be read or isn't complete
+	bool open(const char* path)
+	{
+		close();
+#ifdef _WIN32
+		fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (fileHandle == INVALID_HANDLE_VALUE) { fileHandle = NULL; return false; }
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart < FRAMESTORE_HEADER_SIZE) { close(); return false; }
+		size = fileSize.QuadPart;
+		mapping = CreateFileMapping(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!mapping) { close(); return false; }
+		data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!data) { close(); return false; }
+#else
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) || st.st_size < FRAMESTORE_HEADER_SIZE)
+		{
+			::close(fd);
+			return false;
+		}
+		size = st.st_size;
+		void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (map == MAP_FAILED) return false;
+		data = (const uint8_t*)map;
+#endif
+
+		memcpy(&header, data, sizeof(header));
+		if (memcmp(header.magic, FRAMESTORE_MAGIC, 8) || header.version != FRAMESTORE_VERSION || !header.complete ||
+			header.timesOffset + header.nrFrames*sizeof(double) > size ||
+			header.framesOffset + header.nrFrames*header.frameBytes > header.timesOffset)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (data) UnmapViewOfFile(data);
+		if (mapping) CloseHandle(mapping);
+		if (fileHandle) CloseHandle(fileHandle);
+		fileHandle = mapping = NULL;
+#else
+		if (data) munmap((void*)data, size);
+#endif
+		data = NULL;
+		size = 0;
+	}
+
+	bool isOpen() { return data != NULL; }
+
+	const uint8_t* frame(uint64_t i) { return data + header.framesOffset + i*header.frameBytes; }
+
+	double time(uint64_t i)
+	{
+		double t;
+		memcpy(&t, data + header.timesOffset + i*sizeof(double), sizeof(t));
+		return t;
+	}
+
+	FrameStoreHeader header;
+
+private:
+	const uint8_t* data;
+	uint64_t size;
+#ifdef _WIN32
+	HANDLE fileHandle, mapping;
+#endif
+};
+
+#endif
@@ -0,0 +1,312 @@
+/***************************************************
+Dark-pupil tracker for eye camera video.
+
+Decoded frames are handed to a small pool of worker threads while the
+decoder keeps going.  Each frame is thresholded inside a region of
+interest, the dark blobs are labelled (4-connected) and the largest blob
+within the allowed area range is taken as the pupil.  The ellipse comes
+from the second order moments of the blob.
+
+Only a per-frame sample (time, centre, axes, confidence) is kept, the
+frame itself is freed as soon as it has been analysed.
+
+This file is part of mmread.
+**************************************************/
+
+#ifndef PUPILTRACKER_H
+#define PUPILTRACKER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+struct PupilSettings
+{
+	// region of interest in pixels of the delivered frame, 0 width/height means the full frame
+	int x, y, width, height;
+	// luminance below which a pixel counts as pupil, 0 picks one per frame
+	int threshold;
+	// accepted blob size in pixels of the delivered frame
+	int minArea, maxArea;
+	// 0 uses one thread per core
+	int nrThreads;
+
+	PupilSettings()
+	{
+		x = y = width = height = 0;
+		threshold = 0;
+		minArea = 10;
+		maxArea = 0x7FFFFFFF;
+		nrThreads = 0;
+	}
+};
+
+struct PupilSample
+{
+	unsigned int frameNr;
+	double time;
+	// centre and full axis lengths, in pixels of the source video
+	double x, y, major, minor;
+	// 0 when no pupil was found, otherwise blob fill of the ellipse times its roundness
+	double confidence;
+
+	bool operator<(const PupilSample& other) const { return frameNr < other.frameNr; }
+};
+
+class PupilTracker
+{
+public:
+	// frames are width x height pixels of bytesPerPixel (1 gray8, 2 gray16, 3 rgb24).
+	// offsetX/Y and scale map delivered pixels back to source video pixels.
+	PupilTracker(const PupilSettings& settings, int width, int height, int bytesPerPixel, int offsetX, int offsetY, int scale)
+	{
+		this->settings = settings;
+		this->width = width;
+		this->height = height;
+		this->bytesPerPixel = bytesPerPixel;
+		this->offsetX = offsetX;
+		this->offsetY = offsetY;
+		this->scale = scale;
+
+		roiX = std::max(0,std::min(settings.x,width-1));
+		roiY = std::max(0,std::min(settings.y,height-1));
+		roiWidth = settings.width <= 0 || roiX+settings.width > width ? width-roiX : settings.width;
+		roiHeight = settings.height <= 0 || roiY+settings.height > height ? height-roiY : settings.height;
+
+		nrThreads = settings.nrThreads;
+		if (nrThreads <= 0) nrThreads = std::max(1u,std::thread::hardware_concurrency());
+		maxQueued = 4*nrThreads;
+
+		start();
+	}
+
+	~PupilTracker()
+	{
+		finish();
+		for (size_t i=0; i<queue.size(); i++) free(queue[i].data);
+	}
+
+	// takes ownership of data (malloc'ed), blocks while the queue is full
+	void push(uint8_t* data, unsigned int frameNr, double time)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		// a finished tracker is picked up again by the next capture
+		if (workers.empty()) start();
+		notFull.wait(lock, [this]{ return queue.size() < maxQueued; });
+
+		Job job = {data, frameNr, time};
+		queue.push_back(job);
+		notEmpty.notify_one();
+	}
+
+	// wait for all queued frames and stop the workers, samples are kept
+	void finish()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (workers.empty()) return;
+			stopping = true;
+		}
+		notEmpty.notify_all();
+		for (size_t i=0; i<workers.size(); i++) workers[i].join();
+		workers.clear();
+
+		std::sort(samples.begin(),samples.end());
+	}
+
+	std::vector<PupilSample> samples;
+
+private:
+	struct Job
+	{
+		uint8_t* data;
+		unsigned int frameNr;
+		double time;
+	};
+
+	// moments of one labelled blob
+	struct Blob
+	{
+		double n, sx, sy, sxx, syy, sxy;
+	};
+
+	// called with the mutex held or before any worker runs
+	void start()
+	{
+		stopping = false;
+		for (int i=0; i<nrThreads; i++) workers.push_back(std::thread(&PupilTracker::work,this));
+	}
+
+	void work()
+	{
+		std::vector<uint8_t> luma(roiWidth*roiHeight);
+		std::vector<int> labels(roiWidth*roiHeight);
+		std::vector<int> parent;
+		std::vector<Blob> blobs;
+
+		while (true)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				notEmpty.wait(lock, [this]{ return stopping || !queue.empty(); });
+				if (queue.empty()) return;
+				job = queue.front();
+				queue.pop_front();
+				notFull.notify_one();
+			}
+
+			PupilSample sample = analyse(job.data, luma, labels, parent, blobs);
+			sample.frameNr = job.frameNr;
+			sample.time = job.time;
+			free(job.data);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			samples.push_back(sample);
+		}
+	}
+
+	static int find(std::vector<int>& parent, int i)
+	{
+		while (parent[i] != i)
+		{
+			parent[i] = parent[parent[i]];
+			i = parent[i];
+		}
+		return i;
+	}
+
+	PupilSample analyse(const uint8_t* data, std::vector<uint8_t>& luma, std::vector<int>& labels, std::vector<int>& parent, std::vector<Blob>& blobs)
+	{
+		PupilSample sample;
+		sample.x = sample.y = sample.major = sample.minor = NAN;
+		sample.confidence = 0;
+
+		// 8 bit luminance of the ROI
+		int histogram[256] = {0};
+		for (int y=0; y<roiHeight; y++)
+		{
+			const uint8_t* row = data + ((roiY+y)*width + roiX)*bytesPerPixel;
+			uint8_t* out = &luma[y*roiWidth];
+			switch (bytesPerPixel)
+			{
+				case 1: memcpy(out,row,roiWidth); break;
+				case 2: for (int x=0; x<roiWidth; x++) out[x] = ((const uint16_t*)row)[x] >> 8; break;
+				default: for (int x=0; x<roiWidth; x++) out[x] = (row[3*x]*77 + row[3*x+1]*150 + row[3*x+2]*29) >> 8; break;
+			}
+			for (int x=0; x<roiWidth; x++) histogram[out[x]]++;
+		}
+
+		// without a fixed threshold, take halfway between the darkest pixel and the median
+		int threshold = settings.threshold;
+		if (threshold <= 0)
+		{
+			int darkest = 0, median = 0, count = 0;
+			while (darkest < 255 && histogram[darkest] == 0) darkest++;
+			while (median < 255 && (count += histogram[median]) < roiWidth*roiHeight/2) median++;
+			threshold = (darkest+median)/2 + 1;
+		}
+
+		// label the dark pixels, merging labels with union-find as we go
+		parent.clear();
+		for (int y=0; y<roiHeight; y++)
+		{
+			for (int x=0; x<roiWidth; x++)
+			{
+				int i = y*roiWidth + x;
+				if (luma[i] >= threshold)
+				{
+					labels[i] = -1;
+					continue;
+				}
+
+				int left = x > 0 ? labels[i-1] : -1;
+				int up = y > 0 ? labels[i-roiWidth] : -1;
+
+				if (left < 0 && up < 0)
+				{
+					labels[i] = parent.size();
+					parent.push_back(labels[i]);
+				} else if (left < 0 || up < 0) {
+					labels[i] = std::max(left,up);
+				} else {
+					int a = find(parent,left), b = find(parent,up);
+					if (a != b) parent[std::max(a,b)] = std::min(a,b);
+					labels[i] = std::min(a,b);
+				}
+			}
+		}
+
+		// accumulate moments per blob (relative to the ROI origin)
+		Blob empty = {0,0,0,0,0,0};
+		blobs.assign(parent.size(),empty);
+		for (int y=0; y<roiHeight; y++)
+		{
+			for (int x=0; x<roiWidth; x++)
+			{
+				int label = labels[y*roiWidth + x];
+				if (label < 0) continue;
+				Blob& b = blobs[find(parent,label)];
+				b.n++;
+				b.sx += x;
+				b.sy += y;
+				b.sxx += (double)x*x;
+				b.syy += (double)y*y;
+				b.sxy += (double)x*y;
+			}
+		}
+
+		int best = -1;
+		for (size_t i=0; i<blobs.size(); i++)
+		{
+			if (blobs[i].n < settings.minArea || blobs[i].n > settings.maxArea) continue;
+			if (best < 0 || blobs[i].n > blobs[best].n) best = i;
+		}
+		if (best < 0) return sample;
+
+		// ellipse with the same second order moments as the blob
+		const Blob& b = blobs[best];
+		double cx = b.sx/b.n, cy = b.sy/b.n;
+		double cxx = b.sxx/b.n - cx*cx, cyy = b.syy/b.n - cy*cy, cxy = b.sxy/b.n - cx*cy;
+		double root = sqrt((cxx-cyy)*(cxx-cyy)/4 + cxy*cxy);
+		double l1 = (cxx+cyy)/2 + root, l2 = std::max(0.0,(cxx+cyy)/2 - root);
+		double major = 4*sqrt(l1), minor = 4*sqrt(l2);
+
+		sample.x = offsetX + (roiX + cx + 0.5)*scale - 0.5;
+		sample.y = offsetY + (roiY + cy + 0.5)*scale - 0.5;
+		sample.major = major*scale;
+		sample.minor = minor*scale;
+
+		if (major > 0)
+		{
+			// M_PI is not defined by MSVC
+			const double pi = 3.14159265358979323846;
+			double fill = b.n/(pi/4*std::max(1.0,major)*std::max(1.0,minor));
+			sample.confidence = std::min(fill,1/fill)*minor/major;
+		}
+
+		return sample;
+	}
+
+	PupilSettings settings;
+	int width, height, bytesPerPixel;
+	int offsetX, offsetY, scale;
+	int roiX, roiY, roiWidth, roiHeight;
+
+	std::vector<std::thread> workers;
+	std::deque<Job> queue;
+	int nrThreads;
+	size_t maxQueued;
+	bool stopping;
+	std::mutex mutex;
+	std::condition_variable notEmpty, notFull;
+};
+
+#endif
@@ -0,0 +1,77 @@
+#!/bin/bash
+# Benchmark of the ffgrab command line tool on synthetic videos.
+#
+#   bench/ffgrab_bench.sh [path to ffgrab] [work directory]
+#
+# Makes 20 s test videos with ffmpeg for every combination of codec, GOP
+# length and resolution, then times ffgrab on each of them:
+#   full      decode every frame (gray8)
+#   sparse    20 frames spread over the file
+#   window    a 2 s time window in the middle
+#   seek      10 random 0.5 s windows, each from a freshly opened file
+# and prints one table row per video: frames per second of the three
+# capture modes, median/max seek latency and peak memory (MB).
+#
+# Codecs that the installed ffmpeg can't encode are skipped.
+
+FFGRAB=${1:-./ffgrab}
+WORK=${2:-/tmp/ffgrab_bench}
+DURATION=20
+RATE=30
+
+CODECS="mpeg4 libx264 mjpeg"
+GOPS="12 250"
+SIZES="320x240 1280x720"
+
+if ! command -v ffmpeg >/dev/null; then
+	echo "ffmpeg is needed to make the test videos" >&2
+	exit 1
+fi
+if [ ! -x "$FFGRAB" ]; then
+	echo "$FFGRAB not found, run make first" >&2
+	exit 1
+fi
+mkdir -p "$WORK" || exit 1
+
+# value of a "key value" line of ffgrab output
+value() {
+	awk -v key="$1" '$1 == key { print $2; exit }'
+}
+
+sparse_frames() {
+	local total=$((DURATION*RATE)) list="" i
+	for ((i=0; i<20; i++)); do
+		list="$list,$((1 + i*total/20))"
+	done
+	echo "${list#,}"
+}
+
+printf "%-8s %5s %10s %10s %10s %10s %10s %10s %8s\n" codec gop size full_fps sparse_fps window_fps seek_med seek_max peak_MB
+
+for codec in $CODECS; do
+	for gop in $GOPS; do
+		for size in $SIZES; do
+			video="$WORK/test_${codec}_g${gop}_${size}.avi"
+			if [ ! -f "$video" ]; then
+				if ! ffmpeg -v error -y -f lavfi -i "testsrc=duration=$DURATION:size=$size:rate=$RATE" \
+					-c:v "$codec" -g "$gop" -q:v 5 -pix_fmt yuvj420p "$video" 2>/dev/null &&
+				   ! ffmpeg -v error -y -f lavfi -i "testsrc=duration=$DURATION:size=$size:rate=$RATE" \
+					-c:v "$codec" -g "$gop" -pix_fmt yuv420p "$video" 2>/dev/null; then
+					rm -f "$video"
+					echo "skipping $codec: ffmpeg can't encode it" >&2
+					continue 3
+				fi
+			fi
+
+			full=$("$FFGRAB" --no-audio --pixel-format gray8 "$video")
+			sparse=$("$FFGRAB" --no-audio --pixel-format gray8 --frames "$(sparse_frames)" "$video")
+			window=$("$FFGRAB" --no-audio --pixel-format gray8 --time $((DURATION/2)) $((DURATION/2 + 2)) "$video")
+			seek=$("$FFGRAB" --pixel-format gray8 --seek-test 10 0.5 "$video")
+
+			peak=$(printf "%s\n" "$full" "$sparse" "$window" "$seek" | awk '$1 == "peakRSS" && $2 > m { m = $2 } END { printf "%.1f", m/1048576 }')
+			printf "%-8s %5s %10s %10s %10s %10s %10s %10s %8s\n" "$codec" "$gop" "$size" \
+				"$(echo "$full" | value fps)" "$(echo "$sparse" | value fps)" "$(echo "$window" | value fps)" \
+				"$(echo "$seek" | value seekMedian)" "$(echo "$seek" | value seekMax)" "$peak"
+		done
+	done
+done
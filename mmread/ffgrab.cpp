@@ -0,0 +1,270 @@
+/***************************************************
+Command line front end of FFGrab, for decoding and benchmarking videos
+without matlab.  Every result is printed as a "key value" line so the
+output can be collected by scripts (see bench/ffgrab_bench.sh).
+
+usage: ffgrab [options] file [file ...]
+  --frames a,b,c-d     capture these frame numbers (1 based)
+  --time start stop    capture the frames between start and stop (seconds)
+  --roi x y w h        crop to this region (0 based, in source pixels)
+  --pixel-format f     rgb24 (default), gray8 or gray16
+  --downscale n        keep every n-th pixel in both directions
+  --audio-rate r       resample the audio to r Hz while decoding
+  --mono               mix the audio down to one channel
+  --float32            deliver the audio as float32
+  --no-audio, --no-video
+  --no-seek            decode from the start instead of seeking
+  --threads n          threads for several files (default one per core)
+  --max-bytes n        memory limit for several files
+  --seek-test n len    time n random windows of len seconds (one file)
+
+Several files are decoded in parallel with BatchDecoder, one "file" block
+is printed per file in the order they finish.
+
+Build with the Makefile in this directory.
+
+This file is part of mmread.
+**************************************************/
+
+#include "FFGrab.h"
+
+#include <sys/resource.h>
+
+static void usage()
+{
+	fprintf(stderr,"usage: ffgrab [--frames list] [--time start stop] [--roi x y w h] [--pixel-format rgb24|gray8|gray16]\n"
+		"              [--downscale n] [--audio-rate r] [--mono] [--float32] [--no-audio] [--no-video] [--no-seek]\n"
+		"              [--threads n] [--max-bytes n]\n"
+		"              [--seek-test n len] file [file ...]\n");
+	exit(2);
+}
+
+// "1,5,10-20" to frame numbers
+static bool parseFrames(const char* list, vector<unsigned int>* frames)
+{
+	const char* p = list;
+	while (*p)
+	{
+		char* end;
+		unsigned long first = strtoul(p, &end, 10), last = first;
+		if (end == p) return false;
+		if (*end == '-')
+		{
+			p = end+1;
+			last = strtoul(p, &end, 10);
+			if (end == p || last < first) return false;
+		}
+		for (unsigned long i=first; i<=last; i++) frames->push_back(i);
+		if (*end == ',') end++;
+		else if (*end) return false;
+		p = end;
+	}
+	return !frames->empty();
+}
+
+static double peakRSS()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss;
+#else
+	return usage.ru_maxrss*1024.0;
+#endif
+}
+
+static void printStats(FFGrabber& FFG, double seconds)
+{
+	int nrVideo = 0, nrAudio = 0;
+	FFG.getCaptureInfo(&nrVideo, &nrAudio);
+	FFStats& stats = FFG.getStats();
+
+	int framesCaptured = 0;
+	if (nrVideo > 0)
+	{
+		int width, height, nrFramesTotal, pixelFormat;
+		double rate, totalDuration;
+		FFG.getVideoInfo(0, &width, &height, &rate, &framesCaptured, &nrFramesTotal, &totalDuration, &pixelFormat);
+		printf("width %d\nheight %d\nrate %g\nduration %g\n", width, height, rate, totalDuration);
+	}
+
+	printf("videoStreams %d\naudioStreams %d\n", nrVideo, nrAudio);
+	printf("frames %d\n", framesCaptured);
+	printf("seconds %.6f\n", seconds);
+	printf("fps %.2f\n", seconds > 0 ? framesCaptured/seconds : 0.0);
+	printf("framesDecoded %u\nframesSkipped %u\nframesDiscarded %u\nframesFailed %u\nnoPicture %u\naudioPacketsDecoded %u\n",
+		stats.framesDecoded, stats.framesSkipped, stats.framesDiscarded, stats.framesFailed, stats.noPicture, stats.audioPacketsDecoded);
+	printf("bytesAllocated %lu\npeakResidentBytes %lu\n", (unsigned long)stats.bytesAllocated, (unsigned long)stats.peakResidentBytes);
+	printf("readTime %.6f\ndecodeTime %.6f\nconvertTime %.6f\n", stats.readTime, stats.decodeTime, stats.convertTime);
+	printf("seeks %lu\n", (unsigned long)stats.seeks.size());
+
+	for (int i=0; i<nrAudio; i++)
+	{
+		int nrChannels, bits, nrPackets, nrPacketsTotal, subtype;
+		double rate, totalDuration;
+		uint8_t* data;
+		size_t nrBytes = 0;
+		bool mxOwned;
+		FFG.getAudioInfo(i, &nrChannels, &rate, &bits, &nrPackets, &nrPacketsTotal, &subtype, &totalDuration);
+		if (FFG.getAudio(i, &data, &nrBytes, &mxOwned) == 0) free(data);
+		printf("audio%d %d channels %g Hz %d bits %lu samples\n", i, nrChannels, rate, bits, (unsigned long)(nrBytes/max(1,nrChannels*bits/8)));
+	}
+}
+
+// opens the file again for every window so each capture starts cold, the
+// time of build and of doCapture are reported separately
+static int seekTest(char* filename, const BatchOptions& options, int nrWindows, double length)
+{
+	FFGrabber probe;
+	int err = probe.build(filename, NULL, false, true, true, options.videoOutput);
+	int width, height, nrFramesCaptured, nrFramesTotal;
+	double rate, duration = 0;
+	if (err >= 0) err = probe.getVideoInfo(0, &width, &height, &rate, &nrFramesCaptured, &nrFramesTotal, &duration);
+	probe.cleanUp();
+	if (err < 0 || duration <= length)
+	{
+		fprintf(stderr, "%s: can't seek in this file\n", filename);
+		return 1;
+	}
+
+	srand(1);
+	vector<double> latencies;
+	double openTime = 0;
+	for (int i=0; i<nrWindows; i++)
+	{
+		double start = (duration-length)*rand()/RAND_MAX;
+
+		FFGrabber FFG;
+		double t0 = FFnow();
+		FFG.build(filename, NULL, false, true, true, options.videoOutput);
+		double t1 = FFnow();
+		FFG.setTime(start, start+length);
+		FFG.doCapture();
+		double t2 = FFnow();
+		FFG.cleanUp();
+
+		openTime += t1-t0;
+		latencies.push_back(t2-t1);
+	}
+
+	sort(latencies.begin(), latencies.end());
+	double total = 0;
+	for (size_t i=0; i<latencies.size(); i++) total += latencies[i];
+	printf("file %s\n", filename);
+	printf("seekWindows %d\nseekLength %g\n", nrWindows, length);
+	printf("openTime %.6f\n", openTime/nrWindows);
+	printf("seekMean %.6f\nseekMedian %.6f\nseekMax %.6f\n", total/nrWindows, latencies[latencies.size()/2], latencies.back());
+	printf("peakRSS %.0f\n", peakRSS());
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	BatchOptions options;
+	vector<unsigned int> frames;
+	bool tryseeking = true;
+	int seekWindows = 0;
+	double seekLength = 0;
+	vector<string> filenames;
+
+	for (int i=1; i<argc; i++)
+	{
+		string arg = argv[i];
+		bool more = i+1 < argc;
+		if (arg == "--frames" && more)
+		{
+			if (!parseFrames(argv[++i], &frames)) usage();
+		}
+		else if (arg == "--time" && i+2 < argc)
+		{
+			options.startTime = atof(argv[++i]);
+			options.stopTime = atof(argv[++i]);
+		}
+		else if (arg == "--roi" && i+4 < argc)
+		{
+			options.videoOutput.x = atoi(argv[++i]);
+			options.videoOutput.y = atoi(argv[++i]);
+			options.videoOutput.width = atoi(argv[++i]);
+			options.videoOutput.height = atoi(argv[++i]);
+		}
+		else if (arg == "--pixel-format" && more)
+		{
+			string format = argv[++i];
+			if (format == "rgb24") options.videoOutput.pixelFormat = FF_RGB24;
+			else if (format == "gray8") options.videoOutput.pixelFormat = FF_GRAY8;
+			else if (format == "gray16") options.videoOutput.pixelFormat = FF_GRAY16;
+			else usage();
+		}
+		else if (arg == "--downscale" && more)
+		{
+			options.videoOutput.downscale = atoi(argv[++i]);
+			if (options.videoOutput.downscale < 1) usage();
+		}
+		else if (arg == "--audio-rate" && more)
+		{
+			options.audioOutput.rate = atoi(argv[++i]);
+			if (options.audioOutput.rate < 1) usage();
+		}
+		else if (arg == "--mono") options.audioOutput.mono = true;
+		else if (arg == "--float32") options.audioOutput.float32 = true;
+		else if (arg == "--no-audio") options.disableAudio = true;
+		else if (arg == "--no-video") options.disableVideo = true;
+		else if (arg == "--no-seek") tryseeking = false;
+		else if (arg == "--threads" && more) options.nrThreads = atoi(argv[++i]);
+		else if (arg == "--max-bytes" && more) options.maxBytes = strtoull(argv[++i], NULL, 10);
+		else if (arg == "--seek-test" && i+2 < argc)
+		{
+			seekWindows = atoi(argv[++i]);
+			seekLength = atof(argv[++i]);
+			if (seekWindows < 1 || seekLength <= 0) usage();
+		}
+		else if (arg.size() > 1 && arg[0] == '-') usage();
+		else filenames.push_back(arg);
+	}
+	if (filenames.empty()) usage();
+
+	if (seekWindows > 0)
+	{
+		if (filenames.size() != 1) usage();
+		return seekTest(&filenames[0][0], options, seekWindows, seekLength);
+	}
+
+	if (filenames.size() > 1)
+	{
+		if (!frames.empty()) usage();
+		double t0 = FFnow();
+		BatchDecoder batch(filenames, options);
+		BatchDecoder::Result result;
+		int failed = 0;
+		while (batch.next(&result))
+		{
+			printf("file %s\nerror %d\n", filenames[result.index].c_str(), result.err);
+			if (result.err < 0) failed++;
+			else printStats(*result.grabber, FFnow()-t0);
+			printf("truncated %d\n", (int)result.grabber->isTruncated());
+			batch.release(&result);
+		}
+		printf("totalSeconds %.6f\npeakRSS %.0f\n", FFnow()-t0, peakRSS());
+		return failed ? 1 : 0;
+	}
+
+	FFGrabber FFG;
+	printf("file %s\n", filenames[0].c_str());
+	double t0 = FFnow();
+	int err = FFG.build(&filenames[0][0], NULL, options.disableVideo, options.disableAudio, tryseeking, options.videoOutput, options.audioOutput);
+	if (err < 0)
+	{
+		printf("error %d\n", err);
+		return 1;
+	}
+	if (!frames.empty()) FFG.setFrames(&frames[0], frames.size());
+	else if (options.stopTime > 0) FFG.setTime(options.startTime, options.stopTime);
+	FFG.setContiguousAudio(true);
+	err = FFG.doCapture();
+	double seconds = FFnow()-t0;
+	printf("error %d\n", err);
+	printStats(FFG, seconds);
+	printf("peakRSS %.0f\n", peakRSS());
+	FFG.cleanUp();
+	return err < 0 ? 1 : 0;
+}
@@ -0,0 +1,69 @@
+function [frames, times] = mmepochs(filename, onsets, window, videoOptions)
+% [frames, times] = mmepochs(filename, onsets, window, videoOptions)
+% mmepochs reads short clips of video around a list of events in one pass.
+% The windows are sorted and overlapping ones merged, FFGrab then seeks
+% once per group of windows and decodes every needed GOP only once, which
+% is much faster than calling mmread with a time range per trial.
+%
+% INPUT
+% filename      input video file
+% onsets        event times in seconds (one per trial)
+% window        [start stop] in seconds relative to the onsets, for
+%               example [-0.2 2]
+% videoOptions  struct with the optional fields roi, pixelFormat and
+%               downscale, see mmread
+%
+% OUTPUT
+% frames        height x width x channels x trials x frames (uint8, or
+%               uint16 for gray16).  Frame j of a trial is the frame
+%               closest to onset+window(1)+(j-1)/rate; slots without a
+%               frame (e.g. past the end of the file) are 0.
+% times         trials x frames time stamps of the frames in seconds, NaN
+%               for slots without a frame
+%
+% EXAMPLE
+%   [frames, times] = mmepochs('eye.avi', stimOnsets, [-0.2 2], ...
+%       struct('pixelFormat','gray8'));
+%   imagesc(frames(:,:,1,1,10)); % trial 1, frame 10
+
+if nargin < 4
+    videoOptions = struct();
+end
+if numel(window) ~= 2
+    error('window must be a vector of length 2: [start stop]');
+end
+
+roi = [];
+if isfield(videoOptions,'roi') && ~isempty(videoOptions.roi)
+    roi = double(videoOptions.roi(:)') - [1 1 0 0];
+end
+pixelFormat = '';
+if isfield(videoOptions,'pixelFormat')
+    pixelFormat = videoOptions.pixelFormat;
+end
+downscale = [];
+if isfield(videoOptions,'downscale')
+    downscale = double(videoOptions.downscale);
+end
+
+currentdir = pwd;
+try
+    if ~ispc
+        cd(fileparts(mfilename('fullpath'))); % FFGrab searches for AVbin in the current directory
+    end
+
+    FFGrab('build',filename,'',0,1,1,roi,pixelFormat,downscale);
+    FFGrab('setEpochs',double(onsets(:)'),double(window(:)'));
+    FFGrab('doCapture');
+    [frames, times] = FFGrab('getEpochs');
+    FFGrab('cleanUp');
+catch
+    err = lasterror;
+    try
+        FFGrab('cleanUp');
+    catch
+    end
+    cd(currentdir);
+    rethrow(err);
+end
+cd(currentdir);
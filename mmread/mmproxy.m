@@ -0,0 +1,83 @@
+function [frames, times] = mmproxy(filename, level, range, videoOptions)
+% [frames, times] = mmproxy(filename, level, range, videoOptions)
+% mmproxy reads frames from a low resolution proxy of a video, for
+% scrubbing through long eye camera recordings.  The proxy is made in one
+% pass over the video the first time it is needed (or when the video has
+% changed) and is stored next to it:
+%   [filename '.q4.ffstore']   every frame at 1/4 size
+%   [filename '.q16.ffstore']  every frame at 1/16 size
+%   [filename '.key.ffstore']  only the keyframes, at 1/4 size
+% Reading from the proxy does not decode anything, so any frame comes back
+% at interactive speed.  Use mmread for full resolution frames (e.g. once
+% the viewer is paused).
+%
+% INPUT
+% filename      input video file
+% level         'q4', 'q16' or 'key' (default 'q16')
+% range         [first last] frame numbers (1 based) within the level,
+%               default [] for all
+% videoOptions  struct with the optional fields roi, pixelFormat and
+%               downscale (see mmread), applied before the proxy scaling.
+%               These only take effect when the proxy is made, delete the
+%               .ffstore files to make it again with other options.
+%
+% OUTPUT
+% frames        height x width x channels x nrFrames
+% times         time stamps of the frames (in seconds)
+%
+% EXAMPLE
+%   [thumbs, t] = mmproxy('eye.avi', 'key');  % keyframe strip
+%   frame = mmproxy('eye.avi', 'q4', [1200 1200]);
+
+if nargin < 4
+    videoOptions = struct();
+end
+if nargin < 3
+    range = [];
+end
+if nargin < 2 || isempty(level)
+    level = 'q16';
+end
+if ~any(strcmp(level,{'q4','q16','key'}))
+    error('level must be ''q4'', ''q16'' or ''key''');
+end
+
+roi = [];
+if isfield(videoOptions,'roi') && ~isempty(videoOptions.roi)
+    roi = double(videoOptions.roi(:)') - [1 1 0 0];
+end
+pixelFormat = '';
+if isfield(videoOptions,'pixelFormat')
+    pixelFormat = videoOptions.pixelFormat;
+end
+downscale = [];
+if isfield(videoOptions,'downscale')
+    downscale = double(videoOptions.downscale);
+end
+
+store = [filename '.' level '.ffstore'];
+currentdir = pwd;
+try
+    if ~ispc
+        cd(fileparts(mfilename('fullpath'))); % FFGrab searches for AVbin in the current directory
+    end
+
+    try
+        [frames, times] = FFGrab('readFrameStore',store,double(range),filename);
+    catch
+        % missing or out of date: make the whole proxy again
+        FFGrab('build',filename,'',0,1,1,roi,pixelFormat,downscale);
+        FFGrab('makeProxy',filename);
+        FFGrab('cleanUp');
+        [frames, times] = FFGrab('readFrameStore',store,double(range),filename);
+    end
+catch
+    err = lasterror;
+    try
+        FFGrab('cleanUp');
+    catch
+    end
+    cd(currentdir);
+    rethrow(err);
+end
+cd(currentdir);
@@ -0,0 +1,130 @@
+function pupil = mmpupil(filename, time, roi, threshold, minArea, maxArea, videoOptions)
+% pupil = mmpupil(filename, time, roi, threshold, minArea, maxArea,
+%                 videoOptions)
+% mmpupil tracks a dark pupil in eye camera video while it is decoded.
+% The frames are analysed by worker threads inside FFGrab and are never
+% returned to Matlab, only one sample per frame is.
+%
+% INPUT
+% filename      input video file
+% time          [startTime stopTime] in seconds, default [] for all
+% roi           [x y width height] in pixels of the video (x and y start
+%               at 1) in which the pupil is searched, default [] for the
+%               whole frame
+% threshold     gray level (0-255) below which pixels count as pupil,
+%               default 0 picks one per frame (halfway between the darkest
+%               pixel and the median of the roi)
+% minArea       smallest accepted pupil blob in pixels, default 10
+% maxArea       largest accepted pupil blob in pixels, default Inf
+% videoOptions  see mmread, default decodes the roi only as gray8.  Areas
+%               are in pixels after videoOptions.downscale.
+%
+% OUTPUT
+% pupil is a struct with the following column vectors:
+%   time        time stamps of the frames (in msec)
+%   frameNr     the frame # (counting starts at frame 1)
+%   x, y        pupil centre in pixels of the video
+%   major       major axis of the pupil ellipse in pixels
+%   minor       minor axis of the pupil ellipse in pixels
+%   confidence  0 when no pupil was found (blinks), otherwise the fill of
+%               the fitted ellipse times its roundness (0-1)
+%   diameter    major axis, NaN where no pupil was found
+%
+% pupil.time and pupil.diameter can go straight into rawDataFilter:
+%   valOut = rawDataFilter(pupil.time, pupil.diameter, settings);
+% with settings.PupilDiameter_Min/Max given in pixels.
+%
+% EXAMPLE
+%   pupil = mmpupil('eye.avi', [], [200 120 240 200]);
+%   plot(pupil.time, pupil.diameter);
+
+if nargin < 7
+    videoOptions = struct();
+end
+if nargin < 6 || isempty(maxArea)
+    maxArea = Inf;
+end
+if nargin < 5 || isempty(minArea)
+    minArea = 10;
+end
+if nargin < 4 || isempty(threshold)
+    threshold = 0;
+end
+if nargin < 3
+    roi = [];
+end
+if nargin < 2
+    time = [];
+end
+
+% by default only decode the roi, in gray
+if ~isfield(videoOptions,'pixelFormat')
+    videoOptions.pixelFormat = 'gray8';
+end
+if ~isfield(videoOptions,'roi') || isempty(videoOptions.roi)
+    videoOptions.roi = roi;
+    roi = [];
+end
+downscale = 1;
+if isfield(videoOptions,'downscale') && ~isempty(videoOptions.downscale)
+    downscale = double(videoOptions.downscale);
+end
+
+buildRoi = [];
+if ~isempty(videoOptions.roi)
+    buildRoi = double(videoOptions.roi(:)') - [1 1 0 0];
+end
+% a tracking roi on top of the decoded roi is given in decoded pixels
+trackRoi = [];
+if ~isempty(roi)
+    trackRoi = double(roi(:)') - [1 1 0 0];
+    if ~isempty(buildRoi)
+        trackRoi(1:2) = trackRoi(1:2) - buildRoi(1:2);
+    end
+    trackRoi = floor(trackRoi/downscale);
+end
+if isinf(maxArea)
+    maxArea = double(intmax('int32'));
+end
+
+currentdir = pwd;
+try
+    if ~ispc
+        cd(fileparts(mfilename('fullpath'))); % FFGrab searches for AVbin in the current directory
+    end
+
+    FFGrab('build',filename,'',0,1,1,buildRoi,videoOptions.pixelFormat,downscale);
+    if isempty(time)
+        FFGrab('setFrames',[]);
+    else
+        if (numel(time) ~= 2)
+            error('time must be a vector of length 2: [startTime stopTime]');
+        end
+        FFGrab('setTime',time(1),time(2));
+    end
+    FFGrab('setPupilTracking',trackRoi,threshold,minArea,maxArea);
+    FFGrab('doCapture');
+
+    [data, frameNr] = FFGrab('getPupilData',0);
+    FFGrab('cleanUp');
+catch
+    err = lasterror;
+    try
+        FFGrab('cleanUp');
+    catch
+    end
+    cd(currentdir);
+    rethrow(err);
+end
+cd(currentdir);
+
+pupil = struct();
+pupil.time = data(:,1)*1000;
+pupil.frameNr = frameNr;
+pupil.x = data(:,2)+1;
+pupil.y = data(:,3)+1;
+pupil.major = data(:,4);
+pupil.minor = data(:,5);
+pupil.confidence = data(:,6);
+pupil.diameter = pupil.major;
+pupil.diameter(pupil.confidence == 0) = NaN;
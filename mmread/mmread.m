@@ -1,6 +1,7 @@
-function [video, audio] = mmread(filename, frames, time, disableVideo, disableAudio, matlabCommand, trySeeking, useFFGRAB)
+function [video, audio] = mmread(filename, frames, time, disableVideo, disableAudio, matlabCommand, trySeeking, useFFGRAB, videoOptions, audioOptions)
 % [video, audio] = mmread(filename, frames, time, disableVideo, 
-%                       disableAudio, matlabCommand, trySeeking, useFFGRAB)
+%                       disableAudio, matlabCommand, trySeeking, useFFGRAB,
+%                       videoOptions, audioOptions)
 % mmread reads virtually any media file.  It now uses AVbin and FFmpeg to 
 % capture the data, this includes URLs.  The code supports all major OSs
 % and architectures that Matlab runs on.
@@ -22,6 +23,47 @@ function [video, audio] = mmread(filename, frames, time, disableVideo, disableAu
 % useFFGRAB     [true] Use the new version of mmread, which uses ffmpeg.
 %               However, if an audio or video stream can't be read AND you 
 %               are running Windows try setting this to false (old version).
+% videoOptions  [struct()] struct with any of the following fields, applied
+%               while decoding so the full size RGB frame is never kept
+%               (FFGrab only):
+%   roi         [x y width height] region of interest in pixels, x and y
+%               start at 1 (the same as imcrop).  The origin is rounded
+%               down to the chroma grid of the video (normally even pixels).
+%   pixelFormat 'rgb24' (default), 'gray8' or 'gray16'
+%   downscale   integer factor to shrink the ROI by (default 1)
+%   batchSize   call matlabCommand with this many frames at once (default
+%               1).  The function definition must then match that of
+%               processFrameBatch.m.  The next batch is decoded while
+%               matlabCommand works on the current one.
+%   frameStore  file to cache the decoded frames in, or true for
+%               [filename '.ffstore'].  If it holds the frames of this
+%               file with the same roi, pixelFormat and downscale they are
+%               read from it without decoding, otherwise it is written
+%               while reading a whole file (no frames or time given).  It
+%               goes out of date when the file's size or date changes.
+%               FFGrab('readFrameStore',store,[first last],filename)
+%               reads a range of frames straight from a store.
+%   clockAnchors    [n x 2] video time and eye tracker time (in seconds) of
+%                   the same sync events.  All times (video and audio) are
+%                   then returned in the tracker clock, mapped piecewise
+%                   linearly between the anchors so clock drift is
+%                   corrected (one anchor only corrects the offset).
+%   sampleRate      only keep the frame nearest to each tracker sample at
+%                   this rate (e.g. 60 for a 60 Hz analysis of a 250 Hz
+%                   eye camera).  Other frames are decoded but never
+%                   converted or kept.  Use with frames = [].
+%   sampleWindow    [start stop] of the tracker samples in the tracker
+%                   clock (seconds), only that part of the video is read.
+%                   Default the whole file.
+% audioOptions  [struct()] struct with any of the following fields, applied
+%               to every packet while decoding (FFGrab only):
+%   rate        resample to this rate, e.g. 1000 to match the eye tracker
+%               ([] keeps the rate of the file).  The resampler is a
+%               streaming polyphase windowed sinc, so no filtering is
+%               needed afterwards.
+%   mono        true mixes all channels down to one (their mean)
+%   float32     true delivers single precision samples (between -1.0 and
+%               1.0) instead of the sample format of the file
 %
 % OUTPUT
 % video is a struct with the following fields:
@@ -38,9 +80,13 @@ function [video, audio] = mmread(filename, frames, time, disableVideo, disableAu
 %                   is a possitive number then it should always be accurate.
 %   totalDuration   the total length of the video in seconds.
 %   frames          a struct array with the following fields:
-%       cdata       [height X width X 3] uint8 matricies
+%       cdata       [height X width X 3] uint8 matricies, or [height X width]
+%                   uint8/uint16 for the gray pixel formats
 %       colormap    always empty
 %   times           the corresponding time stamps for the frames (in msec)
+%   sampleFrames    with videoOptions.sampleRate: for every tracker sample
+%                   the index into frames of the frame nearest to it (0 if
+%                   there is none)
 %   skippedFrames   some codecs (not mmread) will skip duplicate frames
 %                   (i.e. identical to the previous) in fixed frame rate
 %                   movies to save space and time.  These skipped frames
@@ -65,6 +111,8 @@ function [video, audio] = mmread(filename, frames, time, disableVideo, disableAu
 %                   sense.
 %   totalDuration   the total length of the audio in seconds.
 %   frames          cell array of uint8s.  Probably not of great use.
+%                   FFGrab decodes all audio into one buffer, so it leaves
+%                   this empty.
 %   times           the corresponding time stamps for the frames (in milliseconds)
 %
 % If there is no video or audio stream the corresponding structure will be
@@ -105,6 +153,12 @@ function [video, audio] = mmread(filename, frames, time, disableVideo, disableAu
 % 
 % This file is part of mmread.
 
+if nargin < 10
+    audioOptions = struct();
+end
+if nargin < 9
+    videoOptions = struct();
+end
 if nargin < 8
     useFFGRAB = true;
     if nargin < 7
@@ -143,7 +197,30 @@ if useFFGRAB
             filename = filename{1};
 	end
 
-        FFGrab('build',filename,fmt,double(disableVideo),double(disableAudio),double(trySeeking));
+        roi = [];
+        if isfield(videoOptions,'roi') && ~isempty(videoOptions.roi)
+            if numel(videoOptions.roi) ~= 4
+                error('videoOptions.roi must be [x y width height]');
+            end
+            roi = double(videoOptions.roi(:)') - [1 1 0 0];
+        end
+        pixelFormat = '';
+        if isfield(videoOptions,'pixelFormat')
+            pixelFormat = videoOptions.pixelFormat;
+        end
+        downscale = [];
+        if isfield(videoOptions,'downscale')
+            downscale = double(videoOptions.downscale);
+        end
+
+        audioRate = [];
+        if isfield(audioOptions,'rate')
+            audioRate = double(audioOptions.rate);
+        end
+        mono = isfield(audioOptions,'mono') && audioOptions.mono;
+        float32 = isfield(audioOptions,'float32') && audioOptions.float32;
+
+        FFGrab('build',filename,fmt,double(disableVideo),double(disableAudio),double(trySeeking),roi,pixelFormat,downscale,audioRate,double(mono),double(float32));
         
         if (isempty(time))
             FFGrab('setFrames',frames);
@@ -153,7 +230,34 @@ if useFFGRAB
             end
             FFGrab('setTime',time(1),time(2));
         end
-        FFGrab('setMatlabCommand',matlabCommand);
+        batchSize = [];
+        if isfield(videoOptions,'batchSize')
+            batchSize = double(videoOptions.batchSize);
+        end
+        FFGrab('setMatlabCommand',matlabCommand,batchSize);
+        if isfield(videoOptions,'clockAnchors') && ~isempty(videoOptions.clockAnchors)
+            anchors = double(videoOptions.clockAnchors);
+            if size(anchors,2) ~= 2
+                error('videoOptions.clockAnchors must be [videoTime trackerTime] pairs, one per row');
+            end
+            FFGrab('setClockAnchors',anchors(:,1)',anchors(:,2)');
+        end
+        sampleLocked = isfield(videoOptions,'sampleRate') && ~isempty(videoOptions.sampleRate);
+        if sampleLocked
+            sampleWindow = [];
+            if isfield(videoOptions,'sampleWindow')
+                sampleWindow = double(videoOptions.sampleWindow);
+            end
+            FFGrab('setSampleLock',double(videoOptions.sampleRate),sampleWindow);
+        end
+        if isfield(videoOptions,'frameStore') && ~isempty(videoOptions.frameStore) && ~isequal(videoOptions.frameStore,false)
+            frameStore = videoOptions.frameStore;
+            if ~ischar(frameStore)
+                frameStore = [filename '.ffstore'];
+            end
+            FFGrab('setFrameStore',frameStore);
+        end
+        FFGrab('setContiguousAudio',true);
 
         try
             FFGrab('doCapture');
@@ -175,7 +279,7 @@ if useFFGRAB
         if strcmp(matlabCommand,'')
             % loop through getting all of the video data from each stream
             for i=1:nrVideoStreams
-                [width, height, rate, nrFramesCaptured, nrFramesTotal, totalDuration] = FFGrab('getVideoInfo',i-1);
+                [width, height, rate, nrFramesCaptured, nrFramesTotal, totalDuration, pixelFormat] = FFGrab('getVideoInfo',i-1);
                 video(i).width = width;
                 video(i).height = height;
                 video(i).rate = rate;
@@ -198,12 +302,20 @@ if useFFGRAB
                         warning('mmread:getVideoFrame',['Frame ' num2str(f) ' could not be decoded']);
                     else
                         % the data ordering is wrong for matlab images, so permute it
-                        data = permute(reshape(data, 3, width, height),[3 2 1]);
+                        if pixelFormat == 0
+                            data = permute(reshape(data, 3, width, height),[3 2 1]);
+                        else
+                            data = reshape(data, width, height)';
+                        end
                         video(i).frames(f).cdata = data;
                         video(i).times(f) = time;
                     end
                 end
 
+                if sampleLocked
+                    video(i).sampleFrames = FFGrab('getSampleFrames',i-1);
+                end
+
                 framerate = (max(video(i).times)-min(video(i).times))/nrFramesCaptured;
                 if framerate > 0
                     video(i).skippedFrames = any(diff(video(i).times)>framerate*1.8) & abs(mean(diff(video(i).times))-framerate)/framerate<0.05;
@@ -232,14 +344,11 @@ if useFFGRAB
             audio(i).bits = bits;
             audio(i).nrFramesTotal = nrFramesTotal;
             audio(i).totalDuration = totalDuration;
-            audio(i).frames = cell(1,nrFramesCaptured);
-            for f=1:nrFramesCaptured
-                [data, time] = FFGrab('getAudioFrame',i-1,f-1);
-                audio(i).frames{f} = data;
-                audio(i).times(f) = time;
-            end
-            % combine the data across frames
-            d = double(cat(1,audio(i).frames{:}));
+            audio(i).frames = {};
+            % the whole stream comes back at once, already Samples x nrChannels
+            [data, audio(i).times] = FFGrab('getAudio',i-1,true);
+            d = double(data);
+            clear data;
 
             % rescale the data so that it is between -1.0 and 1.0
             if (subtype==0)
@@ -253,7 +362,8 @@ if useFFGRAB
             elseif (subtype==1)
                 if (bits == 32)
                     %IEEE FLOAT formated data...
-                    if (max(d) > 1 | min(d) < -1)
+                    % converted audio is already -1 to 1 (up to filter overshoot)
+                    if ~float32 && (max(d) > 1 | min(d) < -1)
                         % there are two float formats one that is already -1 to 1
                         % and the there is between -2^15 to 2^15
                         d = d / 2^15;
@@ -265,8 +375,8 @@ if useFFGRAB
                 warning('Audio data format not recognized/supported, it probably is going to be useless.');
             end
 
-            % reshape the data so that it is nrChannels x Samples.  This should be the same output as wavread.
-            audio(i).data = reshape(d,nrChannels,length(d)/nrChannels)';
+            % the data is Samples x nrChannels.  This should be the same output as wavread.
+            audio(i).data = d;
         end
 
         FFGrab('cleanUp');
@@ -0,0 +1,140 @@
+function results = mmreadbatch(filenames, time, videoOptions, batchOptions, callback)
+% results = mmreadbatch(filenames, time, videoOptions, batchOptions, callback)
+% mmreadbatch decodes a list of files at the same time, one file per
+% thread inside FFGrab.  Each file is returned as soon as it has been
+% decoded, so it can be processed while the others are still decoding.
+%
+% INPUT
+% filenames     cell array of input files
+% time          [startTime stopTime] in seconds for every file, default []
+%               for the whole files
+% videoOptions  struct with the optional fields roi, pixelFormat and
+%               downscale, see mmread
+% batchOptions  struct with the optional fields:
+%   nrThreads       number of files decoded at once, default one per core
+%   maxBytesPerFile stop decoding a file once this many bytes of frames
+%                   and audio are decoded, default no limit
+%   maxBytes        limit on the decoded data held by all files together.
+%                   A file that would go over it waits until results have
+%                   been handed out, otherwise it is cut short.  Default no
+%                   limit.
+%   disableVideo    default false
+%   disableAudio    default false
+%   audioRate, mono, float32
+%                   convert the audio while decoding, as the rate, mono
+%                   and float32 fields of mmread's audioOptions
+% callback      function handle called as callback(result) for every file
+%               as soon as it is finished.  When given, results are not
+%               kept and the output is empty.
+%
+% OUTPUT
+% results is a cell array (in the order of filenames) of structs with:
+%   index       position of the file in filenames
+%   filename    the file
+%   video       cell array with a struct per video stream: width, height,
+%               rate, nrFramesTotal, totalDuration, frames (height x width
+%               x channels x nrFrames) and times (in seconds)
+%   audio       cell array with a struct per audio stream: nrChannels,
+%               rate, bits, totalDuration, data (Samples x nrChannels,
+%               between -1.0 and 1.0 like mmread) and times (in seconds)
+%   truncated   true if a memory limit stopped decoding early
+%   error       error message, '' if the file was decoded
+%
+% EXAMPLE
+%   files = {'s01_eye.avi','s02_eye.avi','s03_eye.avi'};
+%   mmreadbatch(files, [], struct('pixelFormat','gray8'), ...
+%       struct('maxBytes',2^31), @(r) save([r.filename '.mat'],'r'));
+
+if nargin < 5
+    callback = [];
+end
+if nargin < 4 || isempty(batchOptions)
+    batchOptions = struct();
+end
+if nargin < 3 || isempty(videoOptions)
+    videoOptions = struct();
+end
+if nargin < 2
+    time = [];
+end
+if ischar(filenames)
+    filenames = {filenames};
+end
+
+options = batchOptions;
+if ~isempty(time)
+    if (numel(time) ~= 2)
+        error('time must be a vector of length 2: [startTime stopTime]');
+    end
+    options.time = double(time(:)');
+end
+if isfield(videoOptions,'roi') && ~isempty(videoOptions.roi)
+    if numel(videoOptions.roi) ~= 4
+        error('videoOptions.roi must be [x y width height]');
+    end
+    options.roi = double(videoOptions.roi(:)') - [1 1 0 0];
+end
+if isfield(videoOptions,'pixelFormat')
+    options.pixelFormat = videoOptions.pixelFormat;
+end
+if isfield(videoOptions,'downscale')
+    options.downscale = double(videoOptions.downscale);
+end
+
+results = cell(size(filenames));
+currentdir = pwd;
+try
+    if ~ispc
+        cd(fileparts(mfilename('fullpath'))); % FFGrab searches for AVbin in the current directory
+    end
+
+    FFGrab('batchStart',filenames,options);
+    cd(currentdir);
+
+    result = FFGrab('batchNext');
+    while ~isempty(result)
+        for i=1:length(result.audio)
+            result.audio{i} = scaleAudio(result.audio{i}, isfield(options,'float32') && options.float32);
+        end
+
+        if isempty(callback)
+            results{result.index} = result;
+        else
+            callback(result);
+        end
+        result = FFGrab('batchNext');
+    end
+catch
+    err = lasterror;
+    try
+        FFGrab('batchStop');
+    catch
+    end
+    cd(currentdir);
+    rethrow(err);
+end
+
+if ~isempty(callback)
+    results = {};
+end
+
+
+function audio = scaleAudio(audio, converted)
+% rescale the data so that it is between -1.0 and 1.0, the same as mmread
+% (converted float32 audio already is)
+d = double(audio.data);
+if (audio.subtype==0)
+    %PCM formated data...
+    switch (audio.bits)
+        case {4, 8}
+            d = (d-2^(audio.bits-1))/2^(audio.bits-1);
+        case {16, 24, 32}
+            d = d/2^(audio.bits-1);
+    end
+elseif (audio.bits == 32)
+    %IEEE FLOAT formated data...
+    if ~converted && (max(d(:)) > 1 | min(d(:)) < -1)
+        d = d / 2^15;
+    end
+end
+audio.data = d;
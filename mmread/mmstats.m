@@ -0,0 +1,68 @@
+function stats = mmstats(handle)
+% stats = mmstats(handle)
+% mmstats reports where the time of the last FFGrab capture went: reading
+% (disk and demuxing), decoding, colour conversion, the matlab command and
+% copying the data out to matlab.  Call it after doCapture (and the
+% getVideoFrame/getAudio calls), before cleanUp.
+%
+% INPUT
+% handle        FFGrab handle returned by build, default [] for the
+%               grabber used by mmread
+%
+% OUTPUT
+% stats is the struct returned by FFGrab('getStats'), with the fields:
+%   packetsRead         [stream index, packets] per stream
+%   framesDecoded       video pictures decoded
+%   framesSkipped       video packets not decoded (seeking)
+%   framesDiscarded     pictures decoded only to keep the decoder going
+%   framesFailed        decoder errors
+%   noPicture           packets that did not complete a picture (yet)
+%   audioPacketsDecoded
+%   bytesAllocated, residentBytes, peakResidentBytes
+%   readTime, decodeTime, convertTime, commandTime, copyOutTime (seconds)
+%   seeks               struct array (reason, time, packetNr) of every
+%                       seek decision
+% Without an output argument a report is printed.
+%
+% EXAMPLE
+%   FFGrab('build','eye.avi','',0,1,1);
+%   FFGrab('setFrames',[]);
+%   FFGrab('doCapture');
+%   mmstats;
+
+if nargin < 1 || isempty(handle)
+    s = FFGrab('getStats');
+else
+    s = FFGrab(handle,'getStats');
+end
+
+if nargout > 0
+    stats = s;
+    return;
+end
+
+stages = {'read', s.readTime; 'decode', s.decodeTime; 'convert', s.convertTime; ...
+    'matlab command', s.commandTime; 'copy out', s.copyOutTime};
+total = sum([stages{:,2}]);
+
+fprintf('packets read:');
+fprintf(' stream %d: %d', s.packetsRead');
+fprintf('\n');
+fprintf('frames: %d decoded, %d skipped, %d discarded, %d failed, %d packets without picture\n', ...
+    s.framesDecoded, s.framesSkipped, s.framesDiscarded, s.framesFailed, s.noPicture);
+fprintf('audio packets decoded: %d\n', s.audioPacketsDecoded);
+fprintf('memory: %.1f MB allocated, %.1f MB peak, %.1f MB still held\n', ...
+    s.bytesAllocated/2^20, s.peakResidentBytes/2^20, s.residentBytes/2^20);
+for i=1:size(stages,1)
+    fprintf('%-15s %8.3f s  %5.1f%%\n', stages{i,1}, stages{i,2}, 100*stages{i,2}/max(total,eps));
+end
+if total > 0
+    fprintf('throughput: %.1f frames/s, %.1f MB/s delivered\n', s.framesDecoded/total, s.bytesAllocated/2^20/total);
+end
+for i=1:length(s.seeks)
+    if strcmp(s.seeks(i).reason,'startDecodingAt')
+        fprintf('seek: startDecodingAt packet %d (keyframe at %.3f s)\n', s.seeks(i).packetNr, s.seeks(i).time);
+    else
+        fprintf('seek: %s to %.3f s\n', s.seeks(i).reason, s.seeks(i).time);
+    end
+end
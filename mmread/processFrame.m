@@ -42,6 +42,16 @@ function processFrame(data,width,height,frameNr,time)
 persistent warned;
 
 try
+    % gray frames (see the videoOptions of mmread) are just width x height
+    if (numel(data) == width*height)
+        data = reshape(data, width, height)';
+        imagesc(data);
+        colormap(gray);
+        title(['frame ' num2str(frameNr) ' ' num2str(time) 's ']);
+        drawnow;
+        return;
+    end
+
     scanline = ceil(width*3/4)*4; % the scanline size must be a multiple of 4.
 
     % some times the amount of data doesn't match exactly what we expect...
@@ -0,0 +1,35 @@
+function processFrameBatch(frames,width,height,frameNrs,times)
+% processFrameBatch(frames,width,height,frameNrs,times)
+%
+% This is the function prototype to be used by the matlabCommand option of
+% mmread when videoOptions.batchSize is larger than 1.
+% INPUT
+%   frames      [height X width X channels X K] uint8 (uint16 for gray16)
+%               array with K frames, ready to use as images.  channels is 3
+%               for rgb24 and 1 for the gray pixel formats.  The last batch
+%               may hold fewer frames.
+%   width       the width of the images
+%   height      the height of the images
+%   frameNrs    [K X 1] frame #s (counting starts at frame 1)
+%   times       [K X 1] time stamps of the frames (in seconds)
+%
+% The next batch is decoded while this function runs, so only two batches
+% of frames are held in memory at any time.
+%
+% EXAMPLES
+%   Process all frames in a movie, 50 at a time, using this function:
+%   mmread('mymovie.mpg',[],[],false,true,'processFrameBatch',true,true,struct('batchSize',50));
+%
+% This file is part of mmread.
+
+% now do something with the data...
+for k=1:size(frames,4)
+    image(frames(:,:,:,k));
+    title(['frame ' num2str(frameNrs(k)) ' ' num2str(times(k)) 's ']);
+    drawnow;
+end
+
+% stop early
+%     if (any(frameNrs >= 100))
+%         error('processFrame:STOP','STOP!!!');
+%     end
@@ -4,6 +4,18 @@ numTrial = length(Data);
 nData    = cell(numTrial,1);
 rmFlag = false(numTrial,1);
 
+% native engine (mex/detectSacMex.cc), same parameters as getMsac below
+if exist('detectSacMex','file') == 3
+    nSamples = cellfun(@(x) size(x,1), Data(:));
+    D = zeros(sum(nSamples),5);
+    offsets = [0; cumsum(nSamples)]';
+    for nTrial = 1:numTrial
+        D(offsets(nTrial)+1:offsets(nTrial+1),:) = double(Data{nTrial}(:,[1 2 3 7 8]));
+    end
+    [nData, rmFlag] = detectSacMex(D, offsets, double(evtList(:)), 6, 6, 1000);
+    return
+end
+
 for nTrial = 1:numTrial
     subData = Data{nTrial};
 
@@ -19,8 +19,7 @@ for nSubj = 1:numSubj
     subFile = dir([subjDir '\*rmFlag.mat']);
     load([subFile.folder '\\' subFile.name])
 
-    subFile = dir([subjDir '\*RateMatx.mat']);
-    load([subFile.folder '\\' subFile.name])
+    RateMatx = getDV(subjDir,'Rate',[]);
 
     ACC = logical(behData.ACC);
     rmFlag.ACC = ~ACC;
@@ -0,0 +1,31 @@
+function SacEvents = getSacEvents(rmSacData,tw)
+% Compact store of the microsaccades of a subject, one element per saccade
+% in each field instead of the dense time x trial matrices of getSacMTX.m.
+%   trial  trial number
+%   onset  onset in ms relative to the event
+%   amp, vel, ang  as in getSacMTX.m
+% A saccade whose onset another saccade of the same trial also has replaces
+% it, as it overwrites it in the getSacMTX.m matrices.  sacEventMatrix.m
+% rebuilds those matrices and sacQueryMex averages over trials from the
+% events directly.
+
+numTrial = length(rmSacData);
+nSac = cellfun(@(x) size(x,1), rmSacData(:));
+sac  = vertcat(rmSacData{:});
+if isempty(sac)
+    sac = zeros(0,14);
+end
+
+trial = repelem((1:numTrial)', nSac);
+onset = sac(:,1);
+
+% keep the last saccade per trial and onset
+[~, keep] = unique([trial onset], 'rows', 'last');
+
+SacEvents.numTrial = numTrial;
+SacEvents.tw    = tw;
+SacEvents.trial = uint32(trial(keep));
+SacEvents.onset = int32(onset(keep));
+SacEvents.amp   = sqrt(sac(keep,6).^2 + sac(keep,7).^2);
+SacEvents.vel   = sac(keep,3);
+SacEvents.ang   = cart2pol(sac(keep,6),sac(keep,7));
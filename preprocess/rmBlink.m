@@ -16,6 +16,35 @@ nData = Data;
 rmFlag = false(length(Data),1);
 
 numTrial = length(Data);
+
+% native filter chain and interpolation (mex/rawDataFilterMex.cc and
+% mex/resampleEyeMex.cc), all trials in one call
+if exist('rawDataFilterMex','file') == 3 && exist('resampleEyeMex','file') == 3
+    offsets = [0; cumsum(cellfun(@(x) size(x,1), Data(:)))]';
+    D = double(vertcat(Data{:}));
+    [~, ~, timeAll] = resampleEyeMex(D, offsets, [], [], false);
+    valAll = rawDataFilterMex(timeAll, D(:,eyeIdx), offsets, rawDataFilter());
+    % the first and last sample of every non-empty trial stay valid
+    nz = diff(offsets) > 0;
+    valAll(offsets([nz false])+1) = true;
+    valAll(offsets([false nz])) = true;
+    if strcmp(type,"interp")
+        D = resampleEyeMex(D, offsets, valAll, eyeIdx, false);
+    end
+
+    for nTrial = 1:numTrial
+        rows = offsets(nTrial)+1:offsets(nTrial+1);
+        valOut = valAll(rows);
+        if strcmp(type,"interp")
+            nData{nTrial}(:,eyeIdx) = D(rows,eyeIdx);
+        elseif strcmp(type, "nan")
+            nData{nTrial}(~valOut,clmIdx) = NaN;
+        end
+        rmFlag(nTrial) = mean(valOut) < 0.3;
+    end
+    return
+end
+
 for nTrial = 1:numTrial
     subData = Data{nTrial};
 
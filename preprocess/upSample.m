@@ -3,6 +3,17 @@ function nData = upSample(Data)
 nData = Data;
 
 numTrial = length(Data);
+
+% native kernel (mex/resampleEyeMex.cc), all trials in one call
+if exist('resampleEyeMex','file') == 3
+    offsets = [0; cumsum(cellfun(@(x) size(x,1), Data(:)))]';
+    [D, newOffsets] = resampleEyeMex(double(vertcat(Data{:})), offsets, [], [], true);
+    for nTrial = 1:numTrial
+        nData{nTrial} = D(newOffsets(nTrial)+1:newOffsets(nTrial+1),:);
+    end
+    return
+end
+
 for nTrial = 1:numTrial
     subData = Data{nTrial};
     tp = subData(:,1);
@@ -40,7 +40,17 @@ else
     return;
 end
 
-if A == 1
+if exist('filtfiltMex','file') == 3 && ~isempty(X)
+    % native engine (mex/filtfiltMex.cc): FIR by overlap-save FFT with the
+    % extrapolation below, IIR as filtfilt on second order sections
+    if A == 1
+        X = filtfiltMex(X, 1, [], [], [], double(B), false);
+    elseif isvector(X)
+        X = reshape(filtfiltMex(X(:), 1, [], [], tf2sos(B,A), [], false), size(X));
+    else
+        X = filtfiltMex(X, 1, [], [], tf2sos(B,A), [], false);
+    end
+elseif A == 1
     was_single = strcmp(class(X),'single');
     w = length(B); t = size(X,1);    
     % extrapolate
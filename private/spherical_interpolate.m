@@ -34,6 +34,16 @@ if ( nargin < 4 || isempty(order) ) order = 4; end; %#ok<SEPEX>
 if ( nargin < 5 || isempty(type)) type = 'spline'; end; %#ok<SEPEX>
 if ( nargin < 6 || isempty(tol) ) tol = eps; end; %#ok<SEPEX>
 
+% The operator only depends on the montages and parameters, which repeat
+% across calls (e.g., the random subsets of findNoisyChannels)
+[W, Gss, Gds, Hds] = hlp_microcache('spherical', @interpolationMatrix, ...
+    src, dest, lambda, order, type, tol);
+return;
+%--------------------------------------------------------------------------
+function [W, Gss, Gds, Hds] = ...
+     interpolationMatrix(src, dest, lambda, order, type, tol)
+% Uncached body of spherical_interpolate
+
 % Map the positions onto the sphere (not using repop, by JMH)
 src  = src./repmat(sqrt(sum(src.^2)), size(src, 1), 1);  
 dest = dest./repmat(sqrt(sum(dest.^2)), size(dest, 1), 1); 
@@ -72,6 +82,10 @@ function [G, H]=interpMx(cosEE, order, tol)
 if ( nargin < 3 || isempty(tol) ) 
     tol = 1e-10; 
 end
+if exist('legendreSplineMex', 'file') == 3
+    [G, H] = legendreSplineMex(cosEE, order, tol);
+    return;
+end
 G = zeros(size(cosEE)); H = zeros(size(cosEE));
 for i = 1:numel(cosEE);
    x = cosEE(i);
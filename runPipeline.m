@@ -0,0 +1,316 @@
+function report = runPipeline(projectDir,nCores,params)
+% report = runPipeline(projectDir, nCores, params)
+% doPreprocess.m followed by excludeOutliers.m, as a chain of stages per
+% subject that only reruns what changed.
+%
+% Every stage records in derivatives\prec\pipeline\sub-XX\manifest.mat a key
+% made of its parameters, the code of the functions it calls and the output
+% hashes of the stages it reads, and the hash of its own output (kept in
+% <stage>.mat next to it).  A stage whose key is unchanged is skipped and not
+% even loaded unless a later stage has to run.  A stage that is rerun but gives
+% the same output leaves the stages after it skipped.  Subjects are run in
+% parallel on nCores workers (parfor) when the Parallel Computing Toolbox is
+% there; excludeOutliers.m runs once all subjects are done, if any changed.
+%
+% INPUT
+% projectDir    as for doPreprocess.m
+% nCores        workers, default 1 (no pool)
+% params        struct overriding the defaults of doPreprocess.m:
+%   epoch       [-1000 4000]   pupil epoch (doEpoch.m, subInfo.epoch)
+%   baseline    [-200 0]       baseline window
+%   sacWindow   [-1000 3999]   rmSac.m tw
+%   sacAmp      [0.1 2]        rmSac.m thr
+%   sacVel      [0 200]        rmSac.m vthr
+%   sacDur      false          rmSac.m dur
+%   sacIntv     false          rmSac.m intv
+%   sacEpoch    [-1000 4000]   getSacEvents.m tw
+%
+% OUTPUT
+% report is a table with a row per subject and stage: Subj, Stage, Seconds
+% and Skipped.  A summary per stage is printed.
+
+if nargin < 2 || isempty(nCores)
+    nCores = 1;
+end
+if nargin < 3
+    params = struct();
+end
+params = defaultParams(params);
+
+rawDir = dir([projectDir '\derivatives\raw\']);
+rawDir = rawDir(3:end);
+precDir = [projectDir '\derivatives\prec\'];
+numSubj = length(rawDir);
+
+timing = cell(numSubj,1);
+if nCores > 1 && license('test','Distrib_Computing_Toolbox')
+    pool = gcp('nocreate');
+    if isempty(pool) || pool.NumWorkers ~= nCores
+        delete(pool);
+        parpool(nCores);
+    end
+    parfor nSubj = 1:numSubj
+        timing{nSubj} = runSubject(rawDir, precDir, nSubj, params);
+    end
+else
+    for nSubj = 1:numSubj
+        fprintf('\rProgress: %d / %d (%.1f%%)', nSubj, numSubj, nSubj/numSubj*100);
+        timing{nSubj} = runSubject(rawDir, precDir, nSubj, params);
+    end
+    fprintf('\n');
+end
+report = vertcat(timing{:});
+
+if ~exist([precDir 'VarName.mat'], "file")
+    subFile = dir([precDir 'sub-01\\*beh.mat']);
+    load([subFile.folder '\\' subFile.name], "behData")
+    VarName = [behData.Properties.VariableNames, ...
+        'Pupil_l', 'Pupil_r', 'tonicPupil_l', 'tonicPupil_r', ...
+        'Rate', 'Amp', 'Vel'];
+    save([precDir 'VarName.mat'],     "VarName")
+end
+
+% outlier exclusion is over all subjects
+if any(~report.Skipped) || ~exist([precDir 'olFlag.mat'], "file")
+    t0 = tic;
+    excludeOutliers(projectDir);
+    report = [report; table(0, "excludeOutliers", toc(t0), false, ...
+        'VariableNames', {'Subj','Stage','Seconds','Skipped'})];
+end
+
+% timing report
+stageNames = unique(report.Stage, 'stable');
+fprintf('%-16s %6s %8s %10s %10s\n', 'stage', 'runs', 'skipped', 'total s', 'mean s');
+for i = 1:length(stageNames)
+    rows = report.Stage == stageNames(i);
+    ran = rows & ~report.Skipped;
+    fprintf('%-16s %6d %8d %10.2f %10.2f\n', stageNames(i), sum(ran), sum(rows & report.Skipped), ...
+        sum(report.Seconds(ran)), mean(report.Seconds(ran)));
+end
+end
+
+
+function params = defaultParams(params)
+defaults = struct('epoch', [-1000 4000], 'baseline', [-200 0], ...
+    'sacWindow', [-1000 3999], 'sacAmp', [0.1 2], 'sacVel', [0 200], ...
+    'sacDur', false, 'sacIntv', false, 'sacEpoch', [-1000 4000]);
+names = fieldnames(defaults);
+for i = 1:length(names)
+    if ~isfield(params, names{i})
+        params.(names{i}) = defaults.(names{i});
+    end
+end
+end
+
+
+function stages = pipelineStages()
+% name, stages read, parameters used, functions whose code goes into the key
+% (the MEX kernels they dispatch to as well, so a rebuild invalidates the stage).
+% The stage subfunction below goes into the key too.
+stages = struct('name', {}, 'inputs', {}, 'params', {}, 'code', {}, 'fun', {});
+stages(end+1) = struct('name', 'load',          'inputs', {{}},                      'params', {{}}, 'code', {{}},                                       'fun', @stageLoad);
+stages(end+1) = struct('name', 'upSample',      'inputs', {{'load'}},                'params', {{}}, 'code', {{'upSample','rmDupes','resampleEyeMex'}}, 'fun', @stageUpSample);
+stages(end+1) = struct('name', 'cvtDia',        'inputs', {{'upSample'}},            'params', {{}}, 'code', {{'cvtDia'}},                               'fun', @stageCvtDia);
+stages(end+1) = struct('name', 'rmBlinkInterp', 'inputs', {{'cvtDia'}},              'params', {{}}, 'code', {{'rmBlink','rawDataFilter','rmDupes','rawDataFilterMex','resampleEyeMex'}}, 'fun', @stageRmBlinkInterp);
+stages(end+1) = struct('name', 'doEpoch',       'inputs', {{'rmBlinkInterp','load'}},'params', {{'epoch','baseline'}}, 'code', {{'doEpoch'}},            'fun', @stageDoEpoch);
+stages(end+1) = struct('name', 'rmBlinkNan',    'inputs', {{'cvtDia'}},              'params', {{}}, 'code', {{'rmBlink','rawDataFilter','rmDupes','rawDataFilterMex','resampleEyeMex'}}, 'fun', @stageRmBlinkNan);
+stages(end+1) = struct('name', 'detectSac',     'inputs', {{'rmBlinkNan','load'}},   'params', {{}}, 'code', {{'detectSac','microsacc','binsacc','detectSacMex'}}, 'fun', @stageDetectSac);
+stages(end+1) = struct('name', 'rmSac',         'inputs', {{'detectSac'}},           'params', {{'sacWindow','sacAmp','sacVel','sacDur','sacIntv'}}, 'code', {{'rmSac'}}, 'fun', @stageRmSac);
+stages(end+1) = struct('name', 'getSacEvents',  'inputs', {{'rmSac'}},               'params', {{'sacEpoch'}}, 'code', {{'getSacEvents'}},               'fun', @stageGetSacEvents);
+stages(end+1) = struct('name', 'save',          'inputs', {{'load','rmBlinkInterp','doEpoch','detectSac','rmSac','getSacEvents'}}, 'params', {{'epoch'}}, 'code', {{}}, 'fun', @stageSave);
+end
+
+
+function timing = runSubject(rawDir, precDir, nSubj, params)
+subIdx = sprintf('\\sub-%02d',nSubj);
+subjDir = [precDir subIdx '\\'];
+stageDir = [precDir 'pipeline' subIdx '\\'];
+if ~exist(stageDir, "dir")
+    mkdir(stageDir)
+end
+
+manifest = struct();
+if exist([stageDir 'manifest.mat'], "file")
+    load([stageDir 'manifest.mat'], "manifest")
+end
+% the subject files are written again if they were deleted
+if isempty(dir([subjDir '*info.mat'])) && isfield(manifest, 'save')
+    manifest = rmfield(manifest, 'save');
+end
+
+% the raw files go into the key of the load stage by name, size and date
+rawFiles = dir([rawDir(nSubj).folder subIdx '\*.mat']);
+rawKey = {rawFiles.name; rawFiles.bytes; rawFiles.datenum};
+
+stages = pipelineStages();
+data = struct();
+outHash = struct();
+nStages = length(stages);
+Stage = strings(nStages,1);
+Seconds = zeros(nStages,1);
+Skipped = false(nStages,1);
+for s = 1:nStages
+    st = stages(s);
+    Stage(s) = st.name;
+
+    keyParts = {st.name, codeHash(st.code), stageSource(st.fun)};
+    for i = 1:length(st.params)
+        keyParts{end+1} = params.(st.params{i}); %#ok<AGROW>
+    end
+    for i = 1:length(st.inputs)
+        keyParts{end+1} = outHash.(st.inputs{i}); %#ok<AGROW>
+    end
+    if strcmp(st.name, 'load')
+        keyParts{end+1} = rawKey; %#ok<AGROW>
+    end
+    key = hashData(keyParts);
+
+    stageFile = [stageDir st.name '.mat'];
+    if isfield(manifest, st.name) && strcmp(manifest.(st.name).key, key) && exist(stageFile, "file")
+        outHash.(st.name) = manifest.(st.name).outHash;
+        Skipped(s) = true;
+        continue
+    end
+
+    % inputs of skipped stages are read back from their stage files
+    ins = cell(1, length(st.inputs));
+    for i = 1:length(st.inputs)
+        name = st.inputs{i};
+        if ~isfield(data, name)
+            stored = load([stageDir name '.mat'], "out");
+            data.(name) = stored.out;
+        end
+        ins{i} = data.(name);
+    end
+
+    t0 = tic;
+    if strcmp(st.name, 'load')
+        out = st.fun(rawFiles);
+    elseif strcmp(st.name, 'save')
+        out = st.fun(params, subjDir, nSubj, ins{:});
+    else
+        out = st.fun(params, ins{:});
+    end
+    Seconds(s) = toc(t0);
+
+    save(stageFile, "out", '-v7.3');
+    data.(st.name) = out;
+    outHash.(st.name) = hashData(out);
+    manifest.(st.name) = struct('key', key, 'outHash', outHash.(st.name), ...
+        'seconds', Seconds(s), 'time', now);
+    % kept after every stage, so an interrupted run resumes where it stopped
+    save([stageDir 'manifest.mat'], "manifest")
+end
+
+Subj = repmat(nSubj, nStages, 1);
+timing = table(Subj, Stage, Seconds, Skipped);
+end
+
+
+function h = hashData(x)
+md = java.security.MessageDigest.getInstance('MD5');
+md.update(getByteStreamFromArray(x));
+h = sprintf('%02x', typecast(md.digest(), 'uint8'));
+end
+
+
+function h = codeHash(funcs)
+code = cell(size(funcs));
+for i = 1:length(funcs)
+    f = which(funcs{i});
+    if ~isempty(f)
+        code{i} = fileread(f);
+    end
+end
+h = hashData(code);
+end
+
+
+function src = stageSource(fun)
+% the text of a stage subfunction of this file, up to the next function
+text = fileread([mfilename('fullpath') '.m']);
+first = regexp(text, ['\nfunction [^\n]*\<' func2str(fun) '\('], 'once');
+next = regexp(text(first+1:end), '\nfunction ', 'once');
+if isempty(next)
+    src = text(first:end);
+else
+    src = text(first:first+next-1);
+end
+end
+
+
+%% Stages, as in doPreprocess.m
+
+function out = stageLoad(rawFiles)
+for i = 1:length(rawFiles)
+    load([rawFiles(i).folder '\\' rawFiles(i).name])
+end
+out.rawData = pupData.trials;
+out.evtList = pupData.targeton;
+out.behData = behData;
+out.subInfo = subInfo;
+end
+
+function out = stageUpSample(~, in)
+out = upSample(in.rawData);
+end
+
+function out = stageCvtDia(~, in)
+out = cvtDia(in);
+end
+
+function out = stageRmBlinkInterp(~, in)
+[out.rbkData, out.pup_l] = rmBlink(in,'interp','left');
+[out.rbkData, out.pup_r] = rmBlink(out.rbkData,'interp','right');
+end
+
+function out = stageDoEpoch(params, rbk, raw)
+[out.l_epData, out.r_epData, out.ep] = doEpoch(rbk.rbkData,raw.evtList,params.epoch);
+
+tw = params.baseline - params.epoch(1);
+out.l_epbcData = out.l_epData - mean(out.l_epData(tw(1):tw(2),:));
+out.r_epbcData = out.r_epData - mean(out.r_epData(tw(1):tw(2),:));
+end
+
+function out = stageRmBlinkNan(~, in)
+[out, ~] = rmBlink(in,'nan','left');
+[out, ~] = rmBlink(out,'nan','right');
+end
+
+function out = stageDetectSac(~, nanData, raw)
+[out.sacData, out.sac] = detectSac(nanData,raw.evtList);
+end
+
+function out = stageRmSac(params, sac)
+out = rmSac(sac.sacData, params.sacWindow, params.sacAmp, params.sacVel, params.sacDur, params.sacIntv);
+end
+
+function out = stageGetSacEvents(params, Sac)
+out = getSacEvents(Sac,params.sacEpoch);
+end
+
+function out = stageSave(params, subjDir, nSubj, raw, rbk, ep, sac, Sac, SacEvents)
+if ~exist(subjDir, "dir")
+    mkdir(subjDir)
+end
+behData = raw.behData;
+subInfo = raw.subInfo;
+subInfo.epoch = params.epoch;
+rmFlag = struct('pup_l', rbk.pup_l, 'pup_r', rbk.pup_r, 'ep', ep.ep, 'sac', sac.sac);
+l_epData = ep.l_epData;
+r_epData = ep.r_epData;
+l_epbcData = ep.l_epbcData;
+r_epbcData = ep.r_epbcData;
+
+subjFileName = sprintf('sub-%02d_task-%s_',nSubj,subInfo.task);
+save([subjDir subjFileName 'beh.mat'],        "behData")
+save([subjDir subjFileName 'info.mat'],       "subInfo")
+save([subjDir subjFileName 'l_epData.mat'],   "l_epData")
+save([subjDir subjFileName 'r_epData.mat'],   "r_epData")
+save([subjDir subjFileName 'l_epbcData.mat'], "l_epbcData")
+save([subjDir subjFileName 'r_epbcData.mat'], "r_epbcData")
+save([subjDir subjFileName 'Sac.mat'],        "Sac")
+save([subjDir subjFileName 'SacEvents.mat'],  "SacEvents")
+save([subjDir subjFileName 'rmFlag.mat'],     "rmFlag")
+out = true;
+end
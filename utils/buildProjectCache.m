@@ -0,0 +1,78 @@
+function buildProjectCache(projectDir,dvList)
+% buildProjectCache(projectDir, dvList)
+% Writes the project cache read by getValues.m to derivatives\prec\cache\:
+%   <dv>.bin   the samples x trials matrix of the dv (getDV.m with tw = [])
+%              of every subject side by side, as doubles, read through
+%              memmapfile so a window of samples only reads those rows
+%   meta.mat   per subject its first column in the .bin files, number of
+%              trials, olFlag, epoch, behData and rmFlag, the samples per dv
+%              and the time the cache was built
+% The cache is used until a file in derivatives\prec\sub* is newer than it,
+% run this again after preprocessing.  The default dvList holds the time
+% series dvs; 'Cos' and 'Sin' are served from 'Ang'.
+
+if nargin < 2 || isempty(dvList)
+    dvList = {'Pupil_l','Pupil_r','tonicPupil_l','tonicPupil_r','Rate','Amp','Vel','Ang'};
+end
+
+precDir  = dir([projectDir '\derivatives\prec\sub*']);
+numSubj  = length(precDir);
+cacheDir = [projectDir '\derivatives\prec\cache\'];
+if ~exist(cacheDir, "dir")
+    mkdir(cacheDir)
+end
+
+% subject metadata
+cacheMeta = struct();
+cacheMeta.subjects = struct('firstTrial',cell(numSubj,1),'numTrial',[],'olFlag',[],'epoch',[],'behData',[],'rmFlag',[]);
+firstTrial = 1;
+for nSubj = 1:numSubj
+    subIdx = sprintf('\\sub-%02d',nSubj);
+    subjDir = [precDir(nSubj).folder subIdx '\\'];
+
+    f = dir(fullfile(subjDir,'*beh.mat'));
+    load(fullfile(f.folder,'\',f.name))
+    f = dir(fullfile(subjDir,'*info.mat'));
+    load(fullfile(f.folder,'\',f.name))
+    f = dir(fullfile(subjDir,'*rmFlag.mat'));
+    load(fullfile(f.folder,'\',f.name))
+
+    cacheMeta.subjects(nSubj).firstTrial = firstTrial;
+    cacheMeta.subjects(nSubj).numTrial   = height(behData);
+    cacheMeta.subjects(nSubj).olFlag     = subInfo.olFlag;
+    cacheMeta.subjects(nSubj).epoch      = subInfo.epoch;
+    cacheMeta.subjects(nSubj).behData    = behData;
+    cacheMeta.subjects(nSubj).rmFlag     = rmFlag;
+    firstTrial = firstTrial + height(behData);
+end
+cacheMeta.totalTrials = firstTrial - 1;
+
+% one file per dv, written a subject at a time
+cacheMeta.nSamples = struct();
+for i = 1:length(dvList)
+    dv  = dvList{i};
+    fid = fopen([cacheDir dv '.bin'], 'w');
+    if fid < 0
+        error('Cannot write %s', [cacheDir dv '.bin']);
+    end
+    nSamples = [];
+    for nSubj = 1:numSubj
+        subIdx = sprintf('\\sub-%02d',nSubj);
+        subjDir = [precDir(nSubj).folder subIdx '\\'];
+        dVar = getDV(subjDir, dv, []);
+        if isempty(nSamples)
+            nSamples = size(dVar,1);
+        end
+        if size(dVar,1) ~= nSamples || size(dVar,2) ~= cacheMeta.subjects(nSubj).numTrial
+            fclose(fid);
+            error('%s of subject %d is %d x %d, expected %d x %d', dv, nSubj, ...
+                size(dVar,1), size(dVar,2), nSamples, cacheMeta.subjects(nSubj).numTrial);
+        end
+        fwrite(fid, double(dVar), 'double');
+    end
+    fclose(fid);
+    cacheMeta.nSamples.(dv) = nSamples;
+end
+
+cacheMeta.built = now;
+save([cacheDir 'meta.mat'], "cacheMeta")
@@ -1,4 +1,20 @@
-function dVar = getDV(subDir,dv,tw)
+function dVar = getDV(subDir,dv,tw,cache,nSubj)
+
+% slices of the project cache (openProjectCache.m), only the rows of tw are read
+if nargin > 3 && ~isempty(cache)
+    s = cache.meta.subjects(nSubj);
+    cols = s.firstTrial:s.firstTrial+s.numTrial-1;
+    if isempty(tw)
+        dVar = cache.map.Data.x(:,cols);
+    else
+        rows = (tw(1):tw(2)) - s.epoch(1);
+        dVar = mean(cache.map.Data.x(rows,cols),'omitnan');
+        if strcmp(dv, 'Rate')
+            dVar = dVar * (tw(2)-tw(1));
+        end
+    end
+    return
+end
 
 f = dir(fullfile(subDir,'*beh.mat'));
 load(fullfile(f.folder,'\',f.name))
@@ -32,6 +48,15 @@ elseif strcmp(dv, 'tonicPupil_r')
     load(fullfile(f.folder,'\',f.name))
     dVar = r_epData;
 
+elseif ismember(dv, {'Rate','Amp','Vel','Ang','Cos','Sin'}) && ~isempty(dir(fullfile(subDir,'*SacEvents.mat')))
+    % subjects preprocessed with the event store (getSacEvents.m)
+    f = dir(fullfile(subDir,'*SacEvents.mat'));
+    load(fullfile(f.folder,'\',f.name))
+    dVar = sacEventMatrix(SacEvents, dv);
+    if strcmp(dv, 'Rate') && ~isempty(tw)
+        dVar = dVar * (tw(2)-tw(1));
+    end
+
 elseif strcmp(dv, 'Rate')
     f = dir(fullfile(subDir,'*RateMatx.mat'));
     load(fullfile(f.folder,'\',f.name))
@@ -1,18 +1,18 @@
-function [labels,rmIdx] = getIV(subjDir,iv,ivVal)
+function [labels,rmIdx] = getIV(subjDir,iv,ivVal,behData,rmFlag)
 %%
 % subFile = dir(fullfile(subDir,'*.mat'));
 % for i = 1:length(subFile)
 %     load(fullfile(subFile(i).folder,'\',subFile(i).name))
 % end
 
-f = dir(fullfile(subjDir,'*beh.mat'));
-load(fullfile(f.folder,'\',f.name))
+% behData and rmFlag come from the project cache when given
+if nargin < 5
+    f = dir(fullfile(subjDir,'*beh.mat'));
+    load(fullfile(f.folder,'\',f.name))
 
-f = dir(fullfile(subjDir,'*info.mat'));
-load(fullfile(f.folder,'\',f.name))
-
-f = dir(fullfile(subjDir,'*rmFlag.mat'));
-load(fullfile(f.folder,'\',f.name))
+    f = dir(fullfile(subjDir,'*rmFlag.mat'));
+    load(fullfile(f.folder,'\',f.name))
+end
 
 numTrial = height(behData);
 
@@ -1,14 +1,57 @@
-function op = getValues_sj(subjDir,dv,tw,iv,ivVal)
+function op = getValues_sj(subjDir,dv,tw,iv,ivVal,cache,nSubj)
 %%
+% cache and nSubj: read the dv and the trial metadata of subject nSubj from
+% the project cache (openProjectCache.m) instead of the subject files
+useCache = nargin > 5 && ~isempty(cache);
+
+% ----------------------------
+% Saccade time courses straight from the event store
+% ----------------------------
+sacDV = {'Rate','Amp','Vel','Ang','Cos','Sin'};
+f = dir(fullfile(subjDir,'*SacEvents.mat'));
+if ~useCache && isempty(tw) && ismember(dv, sacDV) && ~isempty(f) && exist('sacQueryMex','file') == 3
+    load(fullfile(f.folder,'\',f.name))
+    [labels,rmIdx] = getIV(subjDir,iv,ivVal);
+    num = cellfun(@sum, rmIdx(:));
+
+    idx = double(SacEvents.onset)-SacEvents.tw(1)+1;
+    T   = SacEvents.tw(2)-SacEvents.tw(1);
+    switch dv
+        case 'Rate'
+            meanVal = sacQueryMex(double(SacEvents.trial), idx, [], T, [rmIdx{:}], 'rate', 100);
+        case 'Amp'
+            meanVal = sacQueryMex(double(SacEvents.trial), idx, SacEvents.amp, T, [rmIdx{:}], 'mean', 500);
+        case 'Vel'
+            meanVal = sacQueryMex(double(SacEvents.trial), idx, SacEvents.vel, T, [rmIdx{:}], 'mean', 500);
+        otherwise
+            kind = lower(dv);
+            if strcmp(dv, 'Ang'), kind = 'mean'; end
+            meanVal = sacQueryMex(double(SacEvents.trial), idx, SacEvents.ang, T, [rmIdx{:}], kind, 500);
+    end
+
+    op = [table(num, 'VariableNames', {'n'}), ...
+        labels, table(meanVal, 'VariableNames', {dv})];
+    return
+end
+
 % ----------------------------
 % Get dependent variable matrix
 % ----------------------------
-dVar = getDV(subjDir, dv, tw);
+if useCache
+    dVar = getDV(subjDir, dv, tw, cache, nSubj);
+else
+    dVar = getDV(subjDir, dv, tw);
+end
 
 % ----------------------------
 % Multi-factor IV filtering
 % ----------------------------
-[labels,rmIdx] = getIV(subjDir,iv,ivVal);
+if useCache
+    [labels,rmIdx] = getIV(subjDir,iv,ivVal, ...
+        cache.meta.subjects(nSubj).behData,cache.meta.subjects(nSubj).rmFlag);
+else
+    [labels,rmIdx] = getIV(subjDir,iv,ivVal);
+end
 
 % ----------------------------
 % Compute mean value per condition
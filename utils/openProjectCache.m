@@ -0,0 +1,31 @@
+function cache = openProjectCache(projectDir,dv)
+% cache = openProjectCache(projectDir, dv)
+% The project cache of buildProjectCache.m for dv, or [] when there is none
+% for dv or a subject file is newer than the cache.
+%   cache.meta  the cacheMeta struct of meta.mat
+%   cache.map   memmapfile of <dv>.bin, cache.map.Data.x is samples x trials
+
+cache = [];
+cacheDir = [projectDir '\derivatives\prec\cache\'];
+if ismember(dv, {'Cos','Sin'})
+    dv = 'Ang';
+end
+if ~exist([cacheDir 'meta.mat'], "file") || ~exist([cacheDir dv '.bin'], "file")
+    return
+end
+
+load([cacheDir 'meta.mat'], "cacheMeta")
+if ~isfield(cacheMeta.nSamples, dv)
+    return
+end
+
+% stale once preprocessing has written anything after the cache was built
+subjFiles = dir([projectDir '\derivatives\prec\sub*\*.mat']);
+if length(dir([projectDir '\derivatives\prec\sub*'])) ~= length(cacheMeta.subjects) || ...
+        (~isempty(subjFiles) && max([subjFiles.datenum]) > cacheMeta.built)
+    return
+end
+
+cache.meta = cacheMeta;
+cache.map  = memmapfile([cacheDir dv '.bin'], ...
+    'Format', {'double', [cacheMeta.nSamples.(dv) cacheMeta.totalTrials], 'x'});
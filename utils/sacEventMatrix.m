@@ -0,0 +1,28 @@
+function dVar = sacEventMatrix(SacEvents,dv)
+% The time x trial matrix of getSacMTX.m for dv ('Rate', 'Amp', 'Vel' or
+% 'Ang', 'Cos' and 'Sin' give the angles) from the events of getSacEvents.m.
+
+T   = SacEvents.tw(2)-SacEvents.tw(1);
+idx = double(SacEvents.onset)-SacEvents.tw(1)+1;
+col = double(SacEvents.trial);
+ok  = idx >= 1 & idx <= T;
+pos = sub2ind([T SacEvents.numTrial], idx(ok), col(ok));
+
+if strcmp(dv, 'Rate')
+    dVar = zeros(T, SacEvents.numTrial);
+    dVar(pos) = 1;
+    return
+end
+
+dVar = nan(T, SacEvents.numTrial);
+switch dv
+    case 'Amp'
+        val = SacEvents.amp;
+    case 'Vel'
+        val = SacEvents.vel;
+    case {'Ang','Cos','Sin'}
+        val = SacEvents.ang;
+    otherwise
+        error('Unsupported DV: %s', dv);
+end
+dVar(pos) = val(ok);